@@ -317,6 +317,31 @@ static void mp_media_next_audio(mp_media_t *m)
 	m->a_cb(m->opaque, &audio);
 }
 
+static void mp_media_release_frame(void *param)
+{
+	AVFrame *f = param;
+	av_frame_free(&f);
+}
+
+/* hands the decoder's frame over without copying it, the frame's buffers are
+ * reference counted so the decoder allocates new ones for the next frame */
+static bool mp_media_output_external(mp_media_t *m, AVFrame *f,
+				     struct obs_source_frame *frame)
+{
+	AVFrame *ref;
+
+	if (!m->v_external_cb || m->swscale || !f->buf[0])
+		return false;
+
+	ref = av_frame_alloc();
+	if (!ref)
+		return false;
+
+	av_frame_move_ref(ref, f);
+	m->v_external_cb(m->opaque, frame, mp_media_release_frame, ref);
+	return true;
+}
+
 static void mp_media_next_video(mp_media_t *m, bool preload)
 {
 	struct mp_decode *d = &m->v;
@@ -411,7 +436,7 @@ static void mp_media_next_video(mp_media_t *m, bool preload)
 
 	if (preload)
 		m->v_preload_cb(m->opaque, frame);
-	else
+	else if (!mp_media_output_external(m, f, frame))
 		m->v_cb(m->opaque, frame);
 }
 
@@ -752,6 +777,7 @@ bool mp_media_init(mp_media_t *media, const struct mp_media_info *info)
 	pthread_mutex_init_value(&media->mutex);
 	media->opaque = info->opaque;
 	media->v_cb = info->v_cb;
+	media->v_external_cb = info->v_external_cb;
 	media->a_cb = info->a_cb;
 	media->stop_cb = info->stop_cb;
 	media->v_preload_cb = info->v_preload_cb;
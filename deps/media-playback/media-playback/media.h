@@ -39,6 +39,10 @@ extern "C" {
 #endif
 
 typedef void (*mp_video_cb)(void *opaque, struct obs_source_frame *frame);
+typedef void (*mp_video_external_cb)(void *opaque,
+				     struct obs_source_frame *frame,
+				     void (*release)(void *param),
+				     void *param);
 typedef void (*mp_audio_cb)(void *opaque, struct obs_source_audio *audio);
 typedef void (*mp_stop_cb)(void *opaque);
 
@@ -48,6 +52,7 @@ struct mp_media {
 	mp_video_cb v_preload_cb;
 	mp_stop_cb stop_cb;
 	mp_video_cb v_cb;
+	mp_video_external_cb v_external_cb;
 	mp_audio_cb a_cb;
 	void *opaque;
 
@@ -107,6 +112,10 @@ struct mp_media_info {
 
 	mp_video_cb v_cb;
 	mp_video_cb v_preload_cb;
+	/* optional, receives decoded frames that need no conversion without
+	 * copying them.  The planes stay valid until release(param) is
+	 * called. */
+	mp_video_external_cb v_external_cb;
 	mp_audio_cb a_cb;
 	mp_stop_cb stop_cb;
 
@@ -25,6 +25,7 @@
 #include "../util/profiler.h"
 
 #include "audio-io.h"
+#include "audio-mix.h"
 #include "audio-resampler.h"
 
 extern profiler_name_store_t *obs_get_profiler_name_store(void);
@@ -69,6 +70,9 @@ struct audio_output {
 	void *input_param;
 	pthread_mutex_t input_mutex;
 	struct audio_mix mixes[MAX_AUDIO_MIXES];
+
+	/* only touched by the audio thread */
+	size_t extra_ticks;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -166,7 +170,8 @@ static inline void do_audio_output(struct audio_output *audio, size_t mix_idx,
 	pthread_mutex_unlock(&audio->input_mutex);
 }
 
-static inline void clamp_audio_output(struct audio_output *audio, size_t bytes)
+static inline void clamp_audio_output(struct audio_output *audio, size_t bytes,
+				      uint32_t active_mixes)
 {
 	size_t float_size = bytes / sizeof(float);
 
@@ -174,20 +179,11 @@ static inline void clamp_audio_output(struct audio_output *audio, size_t bytes)
 		struct audio_mix *mix = &audio->mixes[mix_idx];
 
 		/* do not process mixing if a specific mix is inactive */
-		if (!mix->inputs.num)
+		if ((active_mixes & (1 << mix_idx)) == 0)
 			continue;
 
-		for (size_t plane = 0; plane < audio->planes; plane++) {
-			float *mix_data = mix->buffer[plane];
-			float *mix_end = &mix_data[float_size];
-
-			while (mix_data < mix_end) {
-				float val = *mix_data;
-				val = (val > 1.0f) ? 1.0f : val;
-				val = (val < -1.0f) ? -1.0f : val;
-				*(mix_data++) = val;
-			}
-		}
+		for (size_t plane = 0; plane < audio->planes; plane++)
+			audio_mix_clamp(mix->buffer[plane], float_size);
 	}
 }
 
@@ -215,13 +211,14 @@ static void input_and_output(struct audio_output *audio, uint64_t audio_time,
 	}
 	pthread_mutex_unlock(&audio->input_mutex);
 
-	/* clear mix buffers */
+	/* clear mix buffers, inactive mixes are neither mixed nor output */
 	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
 		struct audio_mix *mix = &audio->mixes[mix_idx];
 
-		memset(mix->buffer[0], 0,
-		       AUDIO_OUTPUT_FRAMES * MAX_AUDIO_CHANNELS *
-			       sizeof(float));
+		if ((active_mixes & (1 << mix_idx)) != 0)
+			memset(mix->buffer[0], 0,
+			       AUDIO_OUTPUT_FRAMES * audio->planes *
+				       sizeof(float));
 
 		for (size_t i = 0; i < audio->planes; i++)
 			data[mix_idx].data[i] = mix->buffer[i];
@@ -234,11 +231,13 @@ static void input_and_output(struct audio_output *audio, uint64_t audio_time,
 		return;
 
 	/* clamps audio data to -1.0..1.0 */
-	clamp_audio_output(audio, bytes);
+	clamp_audio_output(audio, bytes, active_mixes);
 
 	/* output */
-	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++)
-		do_audio_output(audio, i, new_ts, AUDIO_OUTPUT_FRAMES);
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++) {
+		if ((active_mixes & (1 << i)) != 0)
+			do_audio_output(audio, i, new_ts, AUDIO_OUTPUT_FRAMES);
+	}
 }
 
 static void *audio_thread(void *param)
@@ -273,6 +272,12 @@ static void *audio_thread(void *param)
 
 			input_and_output(audio, audio_time, prev_time);
 			prev_time = audio_time;
+
+			/* buffered ticks the input wants to output early */
+			while (audio->extra_ticks) {
+				audio->extra_ticks--;
+				input_and_output(audio, audio_time, audio_time);
+			}
 		}
 
 		profile_end(audio_thread_name);
@@ -468,6 +473,12 @@ const struct audio_output_info *audio_output_get_info(const audio_t *audio)
 	return audio ? &audio->info : NULL;
 }
 
+void audio_output_add_extra_ticks(audio_t *audio, size_t ticks)
+{
+	if (audio)
+		audio->extra_ticks += ticks;
+}
+
 bool audio_output_active(const audio_t *audio)
 {
 	if (!audio)
@@ -228,6 +228,11 @@ EXPORT void audio_output_disconnect(audio_t *video, size_t mix_idx,
 
 EXPORT bool audio_output_active(const audio_t *audio);
 
+/* Only for use from the input callback: has it called again ticks times
+ * right after it returns, with an empty time range (start_ts == end_ts),
+ * so buffered audio can be output early. */
+EXPORT void audio_output_add_extra_ticks(audio_t *audio, size_t ticks);
+
 EXPORT size_t audio_output_get_block_size(const audio_t *audio);
 EXPORT size_t audio_output_get_planes(const audio_t *audio);
 EXPORT size_t audio_output_get_channels(const audio_t *audio);
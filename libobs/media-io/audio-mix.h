@@ -0,0 +1,101 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "../util/c99defs.h"
+#include "../util/sse-intrin.h"
+#include "audio-io.h"
+
+/* Float mixing kernels used by the audio thread.  Buffers do not need to be
+ * aligned, mixing starts at arbitrary frame offsets. */
+
+/* dst[i] += src[i] */
+static inline void audio_mix_add(float *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m128 a0 = _mm_loadu_ps(dst + i);
+		__m128 a1 = _mm_loadu_ps(dst + i + 4);
+		__m128 a2 = _mm_loadu_ps(dst + i + 8);
+		__m128 a3 = _mm_loadu_ps(dst + i + 12);
+
+		a0 = _mm_add_ps(a0, _mm_loadu_ps(src + i));
+		a1 = _mm_add_ps(a1, _mm_loadu_ps(src + i + 4));
+		a2 = _mm_add_ps(a2, _mm_loadu_ps(src + i + 8));
+		a3 = _mm_add_ps(a3, _mm_loadu_ps(src + i + 12));
+
+		_mm_storeu_ps(dst + i, a0);
+		_mm_storeu_ps(dst + i + 4, a1);
+		_mm_storeu_ps(dst + i + 8, a2);
+		_mm_storeu_ps(dst + i + 12, a3);
+	}
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 a = _mm_loadu_ps(dst + i);
+		_mm_storeu_ps(dst + i, _mm_add_ps(a, _mm_loadu_ps(src + i)));
+	}
+
+	for (; i < count; i++)
+		dst[i] += src[i];
+}
+
+/* clamps to -1.0..1.0 */
+static inline void audio_mix_clamp(float *data, size_t count)
+{
+	const __m128 min_val = _mm_set1_ps(-1.0f);
+	const __m128 max_val = _mm_set1_ps(1.0f);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 v0 = _mm_loadu_ps(data + i);
+		__m128 v1 = _mm_loadu_ps(data + i + 4);
+
+		v0 = _mm_max_ps(_mm_min_ps(v0, max_val), min_val);
+		v1 = _mm_max_ps(_mm_min_ps(v1, max_val), min_val);
+
+		_mm_storeu_ps(data + i, v0);
+		_mm_storeu_ps(data + i + 4, v1);
+	}
+
+	for (; i < count; i++) {
+		float val = data[i];
+		val = (val > 1.0f) ? 1.0f : val;
+		val = (val < -1.0f) ? -1.0f : val;
+		data[i] = val;
+	}
+}
+
+/* Adds count frames of each mix set in mixers to the matching output mix,
+ * starting at frame start_point of the output.  Mixes left out of mixers are
+ * skipped, so they must be known to be silent in src. */
+static inline void
+audio_mix_add_mixes(struct audio_output_data *mixes,
+		    float *src[MAX_AUDIO_MIXES][MAX_AUDIO_CHANNELS],
+		    uint32_t mixers, size_t channels, size_t start_point,
+		    size_t count)
+{
+	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
+		if ((mixers & (1 << mix_idx)) == 0)
+			continue;
+
+		for (size_t ch = 0; ch < channels; ch++)
+			audio_mix_add(mixes[mix_idx].data[ch] + start_point,
+				      src[mix_idx][ch], count);
+	}
+}
@@ -17,8 +17,31 @@
 
 #include "format-conversion.h"
 
+#include "../util/base.h"
+#include "../util/threading.h"
 #include "../util/sse-intrin.h"
 
+/*
+ * Every kernel has an SSE2 version, which simde translates to NEON on ARM.
+ * On x86 the RGB to YUV kernels, which do the most arithmetic per byte, also
+ * have AVX2 versions.  The kernel set is picked once, on first use, from the
+ * features of the CPU we run on rather than the one we were built for.
+ */
+
+#if !NEEDS_SIMDE && (defined(__x86_64__) || defined(_M_X64) || \
+		     defined(__i386__) || defined(_M_IX86))
+#define HAVE_AVX2_KERNELS 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#else
+#define HAVE_AVX2_KERNELS 0
+#endif
+
 /* ...surprisingly, if I don't use a macro to force inlining, it causes the
  * CPU usage to boost by a tremendous amount in debug builds. */
 
@@ -90,9 +113,10 @@ static FORCE_INLINE uint32_t min_uint32(uint32_t a, uint32_t b)
 	return a < b ? a : b;
 }
 
-void compress_uyvx_to_i420(const uint8_t *input, uint32_t in_linesize,
-			   uint32_t start_y, uint32_t end_y, uint8_t *output[],
-			   const uint32_t out_linesize[])
+static void compress_uyvx_to_i420_sse2(const uint8_t *input,
+				       uint32_t in_linesize, uint32_t start_y,
+				       uint32_t end_y, uint8_t *output[],
+				       const uint32_t out_linesize[])
 {
 	uint8_t *lum_plane = output[0];
 	uint8_t *u_plane = output[1];
@@ -127,9 +151,10 @@ void compress_uyvx_to_i420(const uint8_t *input, uint32_t in_linesize,
 	}
 }
 
-void compress_uyvx_to_nv12(const uint8_t *input, uint32_t in_linesize,
-			   uint32_t start_y, uint32_t end_y, uint8_t *output[],
-			   const uint32_t out_linesize[])
+static void compress_uyvx_to_nv12_sse2(const uint8_t *input,
+				       uint32_t in_linesize, uint32_t start_y,
+				       uint32_t end_y, uint8_t *output[],
+				       const uint32_t out_linesize[])
 {
 	uint8_t *lum_plane = output[0];
 	uint8_t *chroma_plane = output[1];
@@ -162,9 +187,10 @@ void compress_uyvx_to_nv12(const uint8_t *input, uint32_t in_linesize,
 	}
 }
 
-void convert_uyvx_to_i444(const uint8_t *input, uint32_t in_linesize,
-			  uint32_t start_y, uint32_t end_y, uint8_t *output[],
-			  const uint32_t out_linesize[])
+static void convert_uyvx_to_i444_sse2(const uint8_t *input,
+				      uint32_t in_linesize, uint32_t start_y,
+				      uint32_t end_y, uint8_t *output[],
+				      const uint32_t out_linesize[])
 {
 	uint8_t *lum_plane = output[0];
 	uint8_t *u_plane = output[1];
@@ -200,119 +226,1078 @@ void convert_uyvx_to_i444(const uint8_t *input, uint32_t in_linesize,
 	}
 }
 
-void decompress_420(const uint8_t *const input[], const uint32_t in_linesize[],
-		    uint32_t start_y, uint32_t end_y, uint8_t *output,
-		    uint32_t out_linesize)
+/* ------------------------------------------------------------------------- */
+/* packed 444 decompression                                                   */
+
+static FORCE_INLINE void decompress_420_pixels(const uint8_t *lum0,
+					       const uint8_t *lum1,
+					       const uint8_t *chroma0,
+					       const uint8_t *chroma1,
+					       uint32_t *output0,
+					       uint32_t *output1, uint32_t x,
+					       uint32_t width_d2)
+{
+	for (; x < width_d2; x++) {
+		uint32_t out = (chroma0[x] << 8) | chroma1[x];
+
+		output0[x * 2] = (lum0[x * 2] << 16) | out;
+		output0[x * 2 + 1] = (lum0[x * 2 + 1] << 16) | out;
+
+		output1[x * 2] = (lum1[x * 2] << 16) | out;
+		output1[x * 2 + 1] = (lum1[x * 2 + 1] << 16) | out;
+	}
+}
+
+static FORCE_INLINE void decompress_nv12_pixels(const uint8_t *lum0,
+						const uint8_t *lum1,
+						const uint16_t *chroma,
+						uint32_t *output0,
+						uint32_t *output1, uint32_t x,
+						uint32_t width_d2)
+{
+	for (; x < width_d2; x++) {
+		uint32_t out = chroma[x] << 8;
+
+		output0[x * 2] = lum0[x * 2] | out;
+		output0[x * 2 + 1] = lum0[x * 2 + 1] | out;
+
+		output1[x * 2] = lum1[x * 2] | out;
+		output1[x * 2 + 1] = lum1[x * 2 + 1] | out;
+	}
+}
+
+static FORCE_INLINE void decompress_422_pixels(const uint32_t *input32,
+					       uint32_t *output32, uint32_t x,
+					       uint32_t width_d2,
+					       bool leading_lum)
+{
+	for (; x < width_d2; x++) {
+		uint32_t dw = input32[x];
+
+		output32[x * 2] = dw;
+		if (leading_lum) {
+			dw &= 0xFFFFFF00;
+			dw |= (uint8_t)(dw >> 16);
+		} else {
+			dw &= 0xFFFF00FF;
+			dw |= (dw >> 16) & 0xFF00;
+		}
+		output32[x * 2 + 1] = dw;
+	}
+}
+
+/* 16 pixels of two rows sharing one chroma row, [V, U, Y, X] per pixel */
+static FORCE_INLINE void decompress_420_16px(const uint8_t *lum,
+					     __m128i vu_lo, __m128i vu_hi,
+					     uint8_t *output)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i y = _mm_loadu_si128((const __m128i *)lum);
+	__m128i y_lo = _mm_unpacklo_epi8(y, zero);
+	__m128i y_hi = _mm_unpackhi_epi8(y, zero);
+
+	_mm_storeu_si128((__m128i *)output, _mm_unpacklo_epi16(vu_lo, y_lo));
+	_mm_storeu_si128((__m128i *)(output + 16),
+			 _mm_unpackhi_epi16(vu_lo, y_lo));
+	_mm_storeu_si128((__m128i *)(output + 32),
+			 _mm_unpacklo_epi16(vu_hi, y_hi));
+	_mm_storeu_si128((__m128i *)(output + 48),
+			 _mm_unpackhi_epi16(vu_hi, y_hi));
+}
+
+static void decompress_420_sse2(const uint8_t *const input[],
+				const uint32_t in_linesize[], uint32_t start_y,
+				uint32_t end_y, uint8_t *output,
+				uint32_t out_linesize)
 {
-	uint32_t start_y_d2 = start_y / 2;
 	uint32_t width_d2 = in_linesize[0] / 2;
-	uint32_t height_d2 = end_y / 2;
-	uint32_t y;
 
-	for (y = start_y_d2; y < height_d2; y++) {
+	for (uint32_t y = start_y / 2; y < end_y / 2; y++) {
 		const uint8_t *chroma0 = input[1] + y * in_linesize[1];
 		const uint8_t *chroma1 = input[2] + y * in_linesize[2];
-		register const uint8_t *lum0, *lum1;
-		register uint32_t *output0, *output1;
-		uint32_t x;
+		const uint8_t *lum0 = input[0] + y * 2 * in_linesize[0];
+		const uint8_t *lum1 = lum0 + in_linesize[0];
+		uint8_t *output0 = output + y * 2 * out_linesize;
+		uint8_t *output1 = output0 + out_linesize;
+		uint32_t x = 0;
 
-		lum0 = input[0] + y * 2 * in_linesize[0];
-		lum1 = lum0 + in_linesize[0];
-		output0 = (uint32_t *)(output + y * 2 * out_linesize);
-		output1 = (uint32_t *)((uint8_t *)output0 + out_linesize);
+		for (; x + 8 <= width_d2; x += 8) {
+			__m128i u = _mm_loadl_epi64(
+				(const __m128i *)(chroma0 + x));
+			__m128i v = _mm_loadl_epi64(
+				(const __m128i *)(chroma1 + x));
+			__m128i vu = _mm_unpacklo_epi8(v, u);
+			__m128i vu_lo = _mm_unpacklo_epi16(vu, vu);
+			__m128i vu_hi = _mm_unpackhi_epi16(vu, vu);
+
+			decompress_420_16px(lum0 + x * 2, vu_lo, vu_hi,
+					    output0 + x * 8);
+			decompress_420_16px(lum1 + x * 2, vu_lo, vu_hi,
+					    output1 + x * 8);
+		}
+
+		decompress_420_pixels(lum0, lum1, chroma0, chroma1,
+				      (uint32_t *)output0, (uint32_t *)output1,
+				      x, width_d2);
+	}
+}
+
+/* 16 pixels of two rows sharing one chroma row, [Y, U, V, X] per pixel */
+static FORCE_INLINE void decompress_nv12_16px(const uint8_t *lum,
+					      __m128i uv_lo, __m128i uv_hi,
+					      uint8_t *output)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i mask = _mm_set1_epi16(0x00FF);
+	__m128i y = _mm_loadu_si128((const __m128i *)lum);
+	__m128i yu_lo = _mm_or_si128(
+		_mm_unpacklo_epi8(y, zero),
+		_mm_slli_epi16(_mm_and_si128(uv_lo, mask), 8));
+	__m128i yu_hi = _mm_or_si128(
+		_mm_unpackhi_epi8(y, zero),
+		_mm_slli_epi16(_mm_and_si128(uv_hi, mask), 8));
+	__m128i v_lo = _mm_srli_epi16(uv_lo, 8);
+	__m128i v_hi = _mm_srli_epi16(uv_hi, 8);
+
+	_mm_storeu_si128((__m128i *)output, _mm_unpacklo_epi16(yu_lo, v_lo));
+	_mm_storeu_si128((__m128i *)(output + 16),
+			 _mm_unpackhi_epi16(yu_lo, v_lo));
+	_mm_storeu_si128((__m128i *)(output + 32),
+			 _mm_unpacklo_epi16(yu_hi, v_hi));
+	_mm_storeu_si128((__m128i *)(output + 48),
+			 _mm_unpackhi_epi16(yu_hi, v_hi));
+}
+
+static void decompress_nv12_sse2(const uint8_t *const input[],
+				 const uint32_t in_linesize[], uint32_t start_y,
+				 uint32_t end_y, uint8_t *output,
+				 uint32_t out_linesize)
+{
+	uint32_t width_d2 = min_uint32(in_linesize[0], out_linesize) / 2;
 
-		for (x = 0; x < width_d2; x++) {
-			uint32_t out;
-			out = (*(chroma0++) << 8) | *(chroma1++);
+	for (uint32_t y = start_y / 2; y < end_y / 2; y++) {
+		const uint8_t *chroma = input[1] + y * in_linesize[1];
+		const uint8_t *lum0 = input[0] + y * 2 * in_linesize[0];
+		const uint8_t *lum1 = lum0 + in_linesize[0];
+		uint8_t *output0 = output + y * 2 * out_linesize;
+		uint8_t *output1 = output0 + out_linesize;
+		uint32_t x = 0;
 
-			*(output0++) = (*(lum0++) << 16) | out;
-			*(output0++) = (*(lum0++) << 16) | out;
+		for (; x + 8 <= width_d2; x += 8) {
+			__m128i uv = _mm_loadu_si128(
+				(const __m128i *)(chroma + x * 2));
+			__m128i uv_lo = _mm_unpacklo_epi16(uv, uv);
+			__m128i uv_hi = _mm_unpackhi_epi16(uv, uv);
 
-			*(output1++) = (*(lum1++) << 16) | out;
-			*(output1++) = (*(lum1++) << 16) | out;
+			decompress_nv12_16px(lum0 + x * 2, uv_lo, uv_hi,
+					     output0 + x * 8);
+			decompress_nv12_16px(lum1 + x * 2, uv_lo, uv_hi,
+					     output1 + x * 8);
 		}
+
+		decompress_nv12_pixels(lum0, lum1, (const uint16_t *)chroma,
+				       (uint32_t *)output0, (uint32_t *)output1,
+				       x, width_d2);
 	}
 }
 
-void decompress_nv12(const uint8_t *const input[], const uint32_t in_linesize[],
-		     uint32_t start_y, uint32_t end_y, uint8_t *output,
-		     uint32_t out_linesize)
+static void decompress_422_sse2(const uint8_t *input, uint32_t in_linesize,
+				uint32_t start_y, uint32_t end_y,
+				uint8_t *output, uint32_t out_linesize,
+				bool leading_lum)
 {
-	uint32_t start_y_d2 = start_y / 2;
-	uint32_t width_d2 = min_uint32(in_linesize[0], out_linesize) / 2;
-	uint32_t height_d2 = end_y / 2;
-	uint32_t y;
+	uint32_t width_d2 = min_uint32(in_linesize, out_linesize) / 2;
+	__m128i keep = _mm_set1_epi32(leading_lum ? 0xFFFFFF00 : 0xFFFF00FF);
+	__m128i take = _mm_set1_epi32(leading_lum ? 0x000000FF : 0x0000FF00);
 
-	for (y = start_y_d2; y < height_d2; y++) {
-		const uint16_t *chroma;
-		register const uint8_t *lum0, *lum1;
-		register uint32_t *output0, *output1;
-		uint32_t x;
+	for (uint32_t y = start_y; y < end_y; y++) {
+		const uint32_t *input32 =
+			(const uint32_t *)(input + y * in_linesize);
+		uint32_t *output32 = (uint32_t *)(output + y * out_linesize);
+		uint32_t x = 0;
+
+		for (; x + 4 <= width_d2; x += 4) {
+			__m128i dw = _mm_loadu_si128(
+				(const __m128i *)(input32 + x));
+			__m128i dw2 = _mm_or_si128(
+				_mm_and_si128(dw, keep),
+				_mm_and_si128(_mm_srli_epi32(dw, 16), take));
+
+			_mm_storeu_si128((__m128i *)(output32 + x * 2),
+					 _mm_unpacklo_epi32(dw, dw2));
+			_mm_storeu_si128((__m128i *)(output32 + x * 2 + 4),
+					 _mm_unpackhi_epi32(dw, dw2));
+		}
+
+		decompress_422_pixels(input32, output32, x, width_d2,
+				      leading_lum);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* RGB <-> YUV                                                                */
+
+/* 14 bit fixed point, in the byte order of the RGB format */
+struct rgb_to_yuv {
+	int16_t y[4];
+	int16_t u[4];
+	int16_t v[4];
+	int32_t y_offset;
+};
+
+/* 13 bit fixed point */
+struct yuv_to_rgb {
+	int16_t y;
+	int16_t r_v;
+	int16_t g_u;
+	int16_t g_v;
+	int16_t b_u;
+	int32_t y_offset;
+	bool bgr;
+};
 
-		chroma = (const uint16_t *)(input[1] + y * in_linesize[1]);
-		lum0 = input[0] + y * 2 * in_linesize[0];
-		lum1 = lum0 + in_linesize[0];
-		output0 = (uint32_t *)(output + y * 2 * out_linesize);
-		output1 = (uint32_t *)((uint8_t *)output0 + out_linesize);
+static inline void get_kr_kb(enum video_colorspace cs, double *kr, double *kb)
+{
+	if (cs == VIDEO_CS_709 || cs == VIDEO_CS_SRGB) {
+		*kr = 0.2126;
+		*kb = 0.0722;
+	} else {
+		*kr = 0.299;
+		*kb = 0.114;
+	}
+}
+
+static inline int16_t fixed(double val, int bits)
+{
+	double scaled = val * (double)(1 << bits);
+	return (int16_t)(scaled < 0.0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+static void get_rgb_to_yuv(struct rgb_to_yuv *c, enum video_format format,
+			   enum video_colorspace cs,
+			   enum video_range_type range)
+{
+	bool full = range == VIDEO_RANGE_FULL;
+	bool bgr = format == VIDEO_FORMAT_BGRA || format == VIDEO_FORMAT_BGRX;
+	double y_scale = full ? 1.0 : 219.0 / 255.0;
+	double c_scale = full ? 1.0 : 224.0 / 255.0;
+	double kr, kb, kg;
+	double yc[3], uc[3], vc[3];
+
+	get_kr_kb(cs, &kr, &kb);
+	kg = 1.0 - kr - kb;
+
+	yc[0] = kr * y_scale;
+	yc[1] = kg * y_scale;
+	yc[2] = kb * y_scale;
+	uc[0] = -kr / (2.0 * (1.0 - kb)) * c_scale;
+	uc[1] = -kg / (2.0 * (1.0 - kb)) * c_scale;
+	uc[2] = 0.5 * c_scale;
+	vc[0] = 0.5 * c_scale;
+	vc[1] = -kg / (2.0 * (1.0 - kr)) * c_scale;
+	vc[2] = -kb / (2.0 * (1.0 - kr)) * c_scale;
+
+	for (int i = 0; i < 3; i++) {
+		int idx = bgr ? 2 - i : i;
+		c->y[idx] = fixed(yc[i], 14);
+		c->u[idx] = fixed(uc[i], 14);
+		c->v[idx] = fixed(vc[i], 14);
+	}
+
+	c->y[3] = c->u[3] = c->v[3] = 0;
+	c->y_offset = full ? 0 : 16;
+}
+
+static void get_yuv_to_rgb(struct yuv_to_rgb *c, enum video_format format,
+			   enum video_colorspace cs,
+			   enum video_range_type range)
+{
+	bool full = range == VIDEO_RANGE_FULL;
+	double y_scale = full ? 1.0 : 255.0 / 219.0;
+	double c_scale = full ? 1.0 : 255.0 / 224.0;
+	double kr, kb, kg;
 
-		for (x = 0; x < width_d2; x++) {
-			uint32_t out = *(chroma++) << 8;
+	get_kr_kb(cs, &kr, &kb);
+	kg = 1.0 - kr - kb;
 
-			*(output0++) = *(lum0++) | out;
-			*(output0++) = *(lum0++) | out;
+	c->y = fixed(y_scale, 13);
+	c->r_v = fixed(2.0 * (1.0 - kr) * c_scale, 13);
+	c->g_u = fixed(-2.0 * kb * (1.0 - kb) / kg * c_scale, 13);
+	c->g_v = fixed(-2.0 * kr * (1.0 - kr) / kg * c_scale, 13);
+	c->b_u = fixed(2.0 * (1.0 - kb) * c_scale, 13);
+	c->y_offset = full ? 0 : 16;
+	c->bgr = format == VIDEO_FORMAT_BGRA || format == VIDEO_FORMAT_BGRX;
+}
+
+static FORCE_INLINE uint8_t clamp_u8(int32_t val)
+{
+	return (uint8_t)(val < 0 ? 0 : (val > 255 ? 255 : val));
+}
+
+static FORCE_INLINE int32_t dot_rgb(const int16_t *c, const uint8_t *px)
+{
+	return c[0] * px[0] + c[1] * px[1] + c[2] * px[2];
+}
+
+/* Chroma for 4:2:0 is taken from the average of each 2x2 block.  u_step is
+ * 2 for NV12, where u and v point into the same interleaved plane. */
+static FORCE_INLINE void rgbx_to_420_pixels(const uint8_t *row0,
+					    const uint8_t *row1, uint8_t *lum0,
+					    uint8_t *lum1, uint8_t *u,
+					    uint8_t *v, uint32_t u_step,
+					    uint32_t x, uint32_t width,
+					    const struct rgb_to_yuv *c)
+{
+	for (; x + 1 < width; x += 2) {
+		const uint8_t *p00 = row0 + x * 4, *p01 = p00 + 4;
+		const uint8_t *p10 = row1 + x * 4, *p11 = p10 + 4;
+		int32_t u_val = 0, v_val = 0;
 
-			*(output1++) = *(lum1++) | out;
-			*(output1++) = *(lum1++) | out;
+		lum0[x] = clamp_u8(((dot_rgb(c->y, p00) + 8192) >> 14) +
+				   c->y_offset);
+		lum0[x + 1] = clamp_u8(((dot_rgb(c->y, p01) + 8192) >> 14) +
+				       c->y_offset);
+		lum1[x] = clamp_u8(((dot_rgb(c->y, p10) + 8192) >> 14) +
+				   c->y_offset);
+		lum1[x + 1] = clamp_u8(((dot_rgb(c->y, p11) + 8192) >> 14) +
+				       c->y_offset);
+
+		for (int i = 0; i < 3; i++) {
+			int32_t total = p00[i] + p01[i] + p10[i] + p11[i];
+			u_val += c->u[i] * total;
+			v_val += c->v[i] * total;
 		}
+
+		u[(x / 2) * u_step] = clamp_u8(((u_val + 32768) >> 16) + 128);
+		v[(x / 2) * u_step] = clamp_u8(((v_val + 32768) >> 16) + 128);
 	}
 }
 
-void decompress_422(const uint8_t *input, uint32_t in_linesize,
-		    uint32_t start_y, uint32_t end_y, uint8_t *output,
-		    uint32_t out_linesize, bool leading_lum)
+static FORCE_INLINE void rgbx_to_444_pixels(const uint8_t *row, uint8_t *lum,
+					    uint8_t *u, uint8_t *v, uint32_t x,
+					    uint32_t width,
+					    const struct rgb_to_yuv *c)
 {
-	uint32_t width_d2 = min_uint32(in_linesize, out_linesize) / 2;
-	uint32_t y;
+	for (; x < width; x++) {
+		const uint8_t *px = row + x * 4;
+
+		lum[x] = clamp_u8(((dot_rgb(c->y, px) + 8192) >> 14) +
+				  c->y_offset);
+		u[x] = clamp_u8(((dot_rgb(c->u, px) + 8192) >> 14) + 128);
+		v[x] = clamp_u8(((dot_rgb(c->v, px) + 8192) >> 14) + 128);
+	}
+}
+
+static FORCE_INLINE void nv12_to_rgbx_pixels(const uint8_t *lum,
+					     const uint8_t *chroma,
+					     uint8_t *output, uint32_t x,
+					     uint32_t width,
+					     const struct yuv_to_rgb *c)
+{
+	for (; x < width; x++) {
+		int32_t y_val = (lum[x] - c->y_offset) * c->y + 4096;
+		int32_t u_val = chroma[(x / 2) * 2] - 128;
+		int32_t v_val = chroma[(x / 2) * 2 + 1] - 128;
+		uint8_t r = clamp_u8((y_val + c->r_v * v_val) >> 13);
+		uint8_t g = clamp_u8(
+			(y_val + c->g_u * u_val + c->g_v * v_val) >> 13);
+		uint8_t b = clamp_u8((y_val + c->b_u * u_val) >> 13);
+		uint8_t *px = output + x * 4;
+
+		px[0] = c->bgr ? b : r;
+		px[1] = g;
+		px[2] = c->bgr ? r : b;
+		px[3] = 255;
+	}
+}
+
+static FORCE_INLINE __m128i rgb_coeffs_sse2(const int16_t *c)
+{
+	return _mm_setr_epi16(c[0], c[1], c[2], c[3], c[0], c[1], c[2], c[3]);
+}
+
+/* [a0, b0, a1, b1], [a2, b2, a3, b3] -> [a0+b0, a1+b1, a2+b2, a3+b3] */
+static FORCE_INLINE __m128i add_pairs_sse2(__m128i lo, __m128i hi)
+{
+	__m128i t0 = _mm_unpacklo_epi32(lo, hi);
+	__m128i t1 = _mm_unpackhi_epi32(lo, hi);
+	__m128i sum = _mm_add_epi32(_mm_unpacklo_epi64(t0, t1),
+				    _mm_unpackhi_epi64(t0, t1));
+	return _mm_shuffle_epi32(sum, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+/* dot products of 4 pixels with the coefficients */
+static FORCE_INLINE __m128i dot_4px_sse2(__m128i px, __m128i coeffs)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coeffs);
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coeffs);
+	return add_pairs_sse2(lo, hi);
+}
+
+/* one output byte per pixel for 8 pixels, in the low 8 bytes */
+static FORCE_INLINE __m128i to_plane_8px_sse2(__m128i px0, __m128i px1,
+					      __m128i coeffs, __m128i offset)
+{
+	__m128i round = _mm_set1_epi32(8192);
+	__m128i val0 = _mm_add_epi32(
+		_mm_srai_epi32(_mm_add_epi32(dot_4px_sse2(px0, coeffs), round),
+			       14),
+		offset);
+	__m128i val1 = _mm_add_epi32(
+		_mm_srai_epi32(_mm_add_epi32(dot_4px_sse2(px1, coeffs), round),
+			       14),
+		offset);
+	__m128i val = _mm_packs_epi32(val0, val1);
+	return _mm_packus_epi16(val, val);
+}
+
+/* sums of the two 2x2 blocks in 4 pixels of two rows, 16 bit per channel */
+static FORCE_INLINE __m128i sum_2x2_sse2(__m128i row0, __m128i row1)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(row0, zero),
+				   _mm_unpacklo_epi8(row1, zero));
+	__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(row0, zero),
+				   _mm_unpackhi_epi8(row1, zero));
+	lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+	hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+	return _mm_unpacklo_epi64(lo, hi);
+}
 
-	register const uint32_t *input32;
-	register const uint32_t *input32_end;
-	register uint32_t *output32;
+static FORCE_INLINE __m128i chroma_4_sse2(__m128i sum0, __m128i sum1,
+					  __m128i coeffs)
+{
+	__m128i val = add_pairs_sse2(_mm_madd_epi16(sum0, coeffs),
+				     _mm_madd_epi16(sum1, coeffs));
+	val = _mm_srai_epi32(_mm_add_epi32(val, _mm_set1_epi32(32768)), 16);
+	return _mm_add_epi32(val, _mm_set1_epi32(128));
+}
+
+static void rgbx_to_420_sse2(const uint8_t *input, uint32_t in_linesize,
+			     uint32_t width, uint32_t start_y, uint32_t end_y,
+			     uint8_t *output[], const uint32_t out_linesize[],
+			     bool nv12, const struct rgb_to_yuv *c)
+{
+	__m128i y_coeffs = rgb_coeffs_sse2(c->y);
+	__m128i u_coeffs = rgb_coeffs_sse2(c->u);
+	__m128i v_coeffs = rgb_coeffs_sse2(c->v);
+	__m128i y_offset = _mm_set1_epi32(c->y_offset);
 
-	if (leading_lum) {
-		for (y = start_y; y < end_y; y++) {
-			input32 = (const uint32_t *)(input + y * in_linesize);
-			input32_end = input32 + width_d2;
-			output32 = (uint32_t *)(output + y * out_linesize);
+	for (uint32_t y = start_y; y + 1 < end_y; y += 2) {
+		const uint8_t *row0 = input + y * in_linesize;
+		const uint8_t *row1 = row0 + in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = lum0 + out_linesize[0];
+		uint8_t *u = output[1] + (y / 2) * out_linesize[1];
+		uint8_t *v = nv12 ? u + 1
+				  : output[2] + (y / 2) * out_linesize[2];
+		uint32_t x = 0;
 
-			while (input32 < input32_end) {
-				register uint32_t dw = *input32;
+		for (; x + 8 <= width; x += 8) {
+			__m128i a0 = _mm_loadu_si128(
+				(const __m128i *)(row0 + x * 4));
+			__m128i a1 = _mm_loadu_si128(
+				(const __m128i *)(row0 + x * 4 + 16));
+			__m128i b0 = _mm_loadu_si128(
+				(const __m128i *)(row1 + x * 4));
+			__m128i b1 = _mm_loadu_si128(
+				(const __m128i *)(row1 + x * 4 + 16));
 
-				output32[0] = dw;
-				dw &= 0xFFFFFF00;
-				dw |= (uint8_t)(dw >> 16);
-				output32[1] = dw;
+			_mm_storel_epi64((__m128i *)(lum0 + x),
+					 to_plane_8px_sse2(a0, a1, y_coeffs,
+							   y_offset));
+			_mm_storel_epi64((__m128i *)(lum1 + x),
+					 to_plane_8px_sse2(b0, b1, y_coeffs,
+							   y_offset));
 
-				output32 += 2;
-				input32++;
+			__m128i sum0 = sum_2x2_sse2(a0, b0);
+			__m128i sum1 = sum_2x2_sse2(a1, b1);
+			__m128i u_val = chroma_4_sse2(sum0, sum1, u_coeffs);
+			__m128i v_val = chroma_4_sse2(sum0, sum1, v_coeffs);
+
+			if (nv12) {
+				__m128i uv = _mm_packs_epi32(
+					_mm_unpacklo_epi32(u_val, v_val),
+					_mm_unpackhi_epi32(u_val, v_val));
+				uv = _mm_packus_epi16(uv, uv);
+				_mm_storel_epi64((__m128i *)(u + x), uv);
+			} else {
+				__m128i uv = _mm_packs_epi32(u_val, v_val);
+				uv = _mm_packus_epi16(uv, uv);
+				*(uint32_t *)(u + x / 2) =
+					(uint32_t)_mm_cvtsi128_si32(uv);
+				*(uint32_t *)(v + x / 2) =
+					(uint32_t)_mm_cvtsi128_si32(
+						_mm_srli_si128(uv, 4));
 			}
 		}
-	} else {
-		for (y = start_y; y < end_y; y++) {
-			input32 = (const uint32_t *)(input + y * in_linesize);
-			input32_end = input32 + width_d2;
-			output32 = (uint32_t *)(output + y * out_linesize);
 
-			while (input32 < input32_end) {
-				register uint32_t dw = *input32;
+		rgbx_to_420_pixels(row0, row1, lum0, lum1, u, v, nv12 ? 2 : 1,
+				   x, width, c);
+	}
+}
+
+static void rgbx_to_444_sse2(const uint8_t *input, uint32_t in_linesize,
+			     uint32_t width, uint32_t start_y, uint32_t end_y,
+			     uint8_t *output[], const uint32_t out_linesize[],
+			     const struct rgb_to_yuv *c)
+{
+	__m128i y_coeffs = rgb_coeffs_sse2(c->y);
+	__m128i u_coeffs = rgb_coeffs_sse2(c->u);
+	__m128i v_coeffs = rgb_coeffs_sse2(c->v);
+	__m128i y_offset = _mm_set1_epi32(c->y_offset);
+	__m128i c_offset = _mm_set1_epi32(128);
+
+	for (uint32_t y = start_y; y < end_y; y++) {
+		const uint8_t *row = input + y * in_linesize;
+		uint8_t *lum = output[0] + y * out_linesize[0];
+		uint8_t *u = output[1] + y * out_linesize[1];
+		uint8_t *v = output[2] + y * out_linesize[2];
+		uint32_t x = 0;
+
+		for (; x + 8 <= width; x += 8) {
+			__m128i px0 = _mm_loadu_si128(
+				(const __m128i *)(row + x * 4));
+			__m128i px1 = _mm_loadu_si128(
+				(const __m128i *)(row + x * 4 + 16));
 
-				output32[0] = dw;
-				dw &= 0xFFFF00FF;
-				dw |= (dw >> 16) & 0xFF00;
-				output32[1] = dw;
+			_mm_storel_epi64((__m128i *)(lum + x),
+					 to_plane_8px_sse2(px0, px1, y_coeffs,
+							   y_offset));
+			_mm_storel_epi64((__m128i *)(u + x),
+					 to_plane_8px_sse2(px0, px1, u_coeffs,
+							   c_offset));
+			_mm_storel_epi64((__m128i *)(v + x),
+					 to_plane_8px_sse2(px0, px1, v_coeffs,
+							   c_offset));
+		}
+
+		rgbx_to_444_pixels(row, lum, u, v, x, width, c);
+	}
+}
+
+/* rgb for 4 pixels from 16 bit [y, u] and [y, v] pairs */
+static FORCE_INLINE void yuv_to_rgb_4px_sse2(__m128i yu, __m128i yv,
+					     const struct yuv_to_rgb *c,
+					     __m128i *r, __m128i *g, __m128i *b)
+{
+	__m128i round = _mm_set1_epi32(4096);
+
+	*r = _mm_madd_epi16(yv, _mm_setr_epi16(c->y, c->r_v, c->y, c->r_v,
+					       c->y, c->r_v, c->y, c->r_v));
+	*g = _mm_add_epi32(
+		_mm_madd_epi16(yu, _mm_setr_epi16(c->y, c->g_u, c->y, c->g_u,
+						  c->y, c->g_u, c->y, c->g_u)),
+		_mm_madd_epi16(yv, _mm_setr_epi16(0, c->g_v, 0, c->g_v, 0,
+						  c->g_v, 0, c->g_v)));
+	*b = _mm_madd_epi16(yu, _mm_setr_epi16(c->y, c->b_u, c->y, c->b_u,
+					       c->y, c->b_u, c->y, c->b_u));
+
+	*r = _mm_srai_epi32(_mm_add_epi32(*r, round), 13);
+	*g = _mm_srai_epi32(_mm_add_epi32(*g, round), 13);
+	*b = _mm_srai_epi32(_mm_add_epi32(*b, round), 13);
+}
+
+/* 16 bit channels of 8 pixels to 32 bytes of rgbx */
+static FORCE_INLINE void store_rgbx_8px_sse2(uint8_t *output, __m128i c0,
+					     __m128i c1, __m128i c2)
+{
+	__m128i alpha = _mm_set1_epi16(255);
+	__m128i c01 = _mm_unpacklo_epi16(c0, c1);
+	__m128i c23 = _mm_unpacklo_epi16(c2, alpha);
+
+	_mm_storeu_si128((__m128i *)output,
+			 _mm_packus_epi16(_mm_unpacklo_epi32(c01, c23),
+					  _mm_unpackhi_epi32(c01, c23)));
+
+	c01 = _mm_unpackhi_epi16(c0, c1);
+	c23 = _mm_unpackhi_epi16(c2, alpha);
+
+	_mm_storeu_si128((__m128i *)(output + 16),
+			 _mm_packus_epi16(_mm_unpacklo_epi32(c01, c23),
+					  _mm_unpackhi_epi32(c01, c23)));
+}
+
+static void nv12_to_rgbx_sse2(const uint8_t *const input[],
+			      const uint32_t in_linesize[], uint32_t width,
+			      uint32_t start_y, uint32_t end_y, uint8_t *output,
+			      uint32_t out_linesize,
+			      const struct yuv_to_rgb *c)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i y_offset = _mm_set1_epi16((int16_t)c->y_offset);
+	__m128i c_offset = _mm_set1_epi16(128);
+
+	for (uint32_t y = start_y; y < end_y; y++) {
+		const uint8_t *lum = input[0] + y * in_linesize[0];
+		const uint8_t *chroma = input[1] + (y / 2) * in_linesize[1];
+		uint8_t *out = output + y * out_linesize;
+		uint32_t x = 0;
+
+		for (; x + 8 <= width; x += 8) {
+			__m128i y16 = _mm_sub_epi16(
+				_mm_unpacklo_epi8(
+					_mm_loadl_epi64(
+						(const __m128i *)(lum + x)),
+					zero),
+				y_offset);
+			__m128i uv16 = _mm_sub_epi16(
+				_mm_unpacklo_epi8(
+					_mm_loadl_epi64(
+						(const __m128i *)(chroma + x)),
+					zero),
+				c_offset);
+
+			/* one u and v per pixel */
+			__m128i u32 =
+				_mm_srai_epi32(_mm_slli_epi32(uv16, 16), 16);
+			__m128i v32 = _mm_srai_epi32(uv16, 16);
+			__m128i u16 =
+				_mm_packs_epi32(_mm_unpacklo_epi32(u32, u32),
+						_mm_unpackhi_epi32(u32, u32));
+			__m128i v16 =
+				_mm_packs_epi32(_mm_unpacklo_epi32(v32, v32),
+						_mm_unpackhi_epi32(v32, v32));
+
+			__m128i r0, g0, b0, r1, g1, b1;
+			yuv_to_rgb_4px_sse2(_mm_unpacklo_epi16(y16, u16),
+					    _mm_unpacklo_epi16(y16, v16), c,
+					    &r0, &g0, &b0);
+			yuv_to_rgb_4px_sse2(_mm_unpackhi_epi16(y16, u16),
+					    _mm_unpackhi_epi16(y16, v16), c,
+					    &r1, &g1, &b1);
+
+			__m128i r = _mm_packs_epi32(r0, r1);
+			__m128i g = _mm_packs_epi32(g0, g1);
+			__m128i b = _mm_packs_epi32(b0, b1);
+
+			if (c->bgr)
+				store_rgbx_8px_sse2(out + x * 4, b, g, r);
+			else
+				store_rgbx_8px_sse2(out + x * 4, r, g, b);
+		}
+
+		nv12_to_rgbx_pixels(lum, chroma, out, x, width, c);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* AVX2                                                                       */
+
+#if HAVE_AVX2_KERNELS
+
+static AVX2_TARGET inline __m256i rgb_coeffs_avx2(const int16_t *c)
+{
+	return _mm256_setr_epi16(c[0], c[1], c[2], c[3], c[0], c[1], c[2],
+				 c[3], c[0], c[1], c[2], c[3], c[0], c[1],
+				 c[2], c[3]);
+}
+
+/* per 128 bit lane, same as add_pairs_sse2 */
+static AVX2_TARGET inline __m256i add_pairs_avx2(__m256i lo, __m256i hi)
+{
+	__m256i t0 = _mm256_unpacklo_epi32(lo, hi);
+	__m256i t1 = _mm256_unpackhi_epi32(lo, hi);
+	__m256i sum = _mm256_add_epi32(_mm256_unpacklo_epi64(t0, t1),
+				       _mm256_unpackhi_epi64(t0, t1));
+	return _mm256_shuffle_epi32(sum, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+/* dot products of 8 pixels with the coefficients, in pixel order */
+static AVX2_TARGET inline __m256i dot_8px_avx2(__m256i px, __m256i coeffs)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i lo =
+		_mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coeffs);
+	__m256i hi =
+		_mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coeffs);
+	return add_pairs_avx2(lo, hi);
+}
+
+/* one output byte per pixel for 16 pixels */
+static AVX2_TARGET inline __m128i to_plane_16px_avx2(__m256i px0, __m256i px1,
+						    __m256i coeffs,
+						    __m256i offset)
+{
+	__m256i round = _mm256_set1_epi32(8192);
+	__m256i val0 = _mm256_add_epi32(
+		_mm256_srai_epi32(
+			_mm256_add_epi32(dot_8px_avx2(px0, coeffs), round), 14),
+		offset);
+	__m256i val1 = _mm256_add_epi32(
+		_mm256_srai_epi32(
+			_mm256_add_epi32(dot_8px_avx2(px1, coeffs), round), 14),
+		offset);
+	__m256i val = _mm256_packs_epi32(val0, val1);
+	val = _mm256_packus_epi16(val, val);
+	val = _mm256_permutevar8x32_epi32(
+		val, _mm256_setr_epi32(0, 4, 1, 5, 0, 0, 0, 0));
+	return _mm256_castsi256_si128(val);
+}
+
+/* sums of the 2x2 blocks of 8 pixels of two rows, in pixel order */
+static AVX2_TARGET inline __m256i sum_2x2_avx2(__m256i row0, __m256i row1)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(row0, zero),
+				      _mm256_unpacklo_epi8(row1, zero));
+	__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(row0, zero),
+				      _mm256_unpackhi_epi8(row1, zero));
+	lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+	hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+	return _mm256_unpacklo_epi64(lo, hi);
+}
+
+static AVX2_TARGET inline __m256i chroma_8_avx2(__m256i sum0, __m256i sum1,
+					       __m256i coeffs)
+{
+	__m256i val = add_pairs_avx2(_mm256_madd_epi16(sum0, coeffs),
+				     _mm256_madd_epi16(sum1, coeffs));
+	val = _mm256_permutevar8x32_epi32(
+		val, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+	val = _mm256_srai_epi32(
+		_mm256_add_epi32(val, _mm256_set1_epi32(32768)), 16);
+	return _mm256_add_epi32(val, _mm256_set1_epi32(128));
+}
+
+static AVX2_TARGET void
+rgbx_to_420_avx2(const uint8_t *input, uint32_t in_linesize, uint32_t width,
+		 uint32_t start_y, uint32_t end_y, uint8_t *output[],
+		 const uint32_t out_linesize[], bool nv12,
+		 const struct rgb_to_yuv *c)
+{
+	__m256i y_coeffs = rgb_coeffs_avx2(c->y);
+	__m256i u_coeffs = rgb_coeffs_avx2(c->u);
+	__m256i v_coeffs = rgb_coeffs_avx2(c->v);
+	__m256i y_offset = _mm256_set1_epi32(c->y_offset);
+
+	for (uint32_t y = start_y; y + 1 < end_y; y += 2) {
+		const uint8_t *row0 = input + y * in_linesize;
+		const uint8_t *row1 = row0 + in_linesize;
+		uint8_t *lum0 = output[0] + y * out_linesize[0];
+		uint8_t *lum1 = lum0 + out_linesize[0];
+		uint8_t *u = output[1] + (y / 2) * out_linesize[1];
+		uint8_t *v = nv12 ? u + 1
+				  : output[2] + (y / 2) * out_linesize[2];
+		uint32_t x = 0;
+
+		for (; x + 16 <= width; x += 16) {
+			__m256i a0 = _mm256_loadu_si256(
+				(const __m256i *)(row0 + x * 4));
+			__m256i a1 = _mm256_loadu_si256(
+				(const __m256i *)(row0 + x * 4 + 32));
+			__m256i b0 = _mm256_loadu_si256(
+				(const __m256i *)(row1 + x * 4));
+			__m256i b1 = _mm256_loadu_si256(
+				(const __m256i *)(row1 + x * 4 + 32));
 
-				output32 += 2;
-				input32++;
+			_mm_storeu_si128((__m128i *)(lum0 + x),
+					 to_plane_16px_avx2(a0, a1, y_coeffs,
+							    y_offset));
+			_mm_storeu_si128((__m128i *)(lum1 + x),
+					 to_plane_16px_avx2(b0, b1, y_coeffs,
+							    y_offset));
+
+			__m256i sum0 = sum_2x2_avx2(a0, b0);
+			__m256i sum1 = sum_2x2_avx2(a1, b1);
+			__m256i u_val = chroma_8_avx2(sum0, sum1, u_coeffs);
+			__m256i v_val = chroma_8_avx2(sum0, sum1, v_coeffs);
+
+			if (nv12) {
+				__m256i uv = _mm256_packs_epi32(
+					_mm256_unpacklo_epi32(u_val, v_val),
+					_mm256_unpackhi_epi32(u_val, v_val));
+				uv = _mm256_packus_epi16(uv, uv);
+				uv = _mm256_permute4x64_epi64(
+					uv, _MM_SHUFFLE(3, 1, 2, 0));
+				_mm_storeu_si128((__m128i *)(u + x),
+						 _mm256_castsi256_si128(uv));
+			} else {
+				__m256i uv = _mm256_packs_epi32(u_val, v_val);
+				uv = _mm256_packus_epi16(uv, uv);
+				uv = _mm256_permutevar8x32_epi32(
+					uv,
+					_mm256_setr_epi32(0, 4, 1, 5, 0, 0, 0,
+							  0));
+				__m128i uv128 = _mm256_castsi256_si128(uv);
+				_mm_storel_epi64((__m128i *)(u + x / 2),
+						 uv128);
+				_mm_storel_epi64((__m128i *)(v + x / 2),
+						 _mm_srli_si128(uv128, 8));
 			}
 		}
+
+		rgbx_to_420_pixels(row0, row1, lum0, lum1, u, v, nv12 ? 2 : 1,
+				   x, width, c);
 	}
 }
+
+static AVX2_TARGET void
+rgbx_to_444_avx2(const uint8_t *input, uint32_t in_linesize, uint32_t width,
+		 uint32_t start_y, uint32_t end_y, uint8_t *output[],
+		 const uint32_t out_linesize[], const struct rgb_to_yuv *c)
+{
+	__m256i y_coeffs = rgb_coeffs_avx2(c->y);
+	__m256i u_coeffs = rgb_coeffs_avx2(c->u);
+	__m256i v_coeffs = rgb_coeffs_avx2(c->v);
+	__m256i y_offset = _mm256_set1_epi32(c->y_offset);
+	__m256i c_offset = _mm256_set1_epi32(128);
+
+	for (uint32_t y = start_y; y < end_y; y++) {
+		const uint8_t *row = input + y * in_linesize;
+		uint8_t *lum = output[0] + y * out_linesize[0];
+		uint8_t *u = output[1] + y * out_linesize[1];
+		uint8_t *v = output[2] + y * out_linesize[2];
+		uint32_t x = 0;
+
+		for (; x + 16 <= width; x += 16) {
+			__m256i px0 = _mm256_loadu_si256(
+				(const __m256i *)(row + x * 4));
+			__m256i px1 = _mm256_loadu_si256(
+				(const __m256i *)(row + x * 4 + 32));
+
+			_mm_storeu_si128((__m128i *)(lum + x),
+					 to_plane_16px_avx2(px0, px1, y_coeffs,
+							    y_offset));
+			_mm_storeu_si128((__m128i *)(u + x),
+					 to_plane_16px_avx2(px0, px1, u_coeffs,
+							    c_offset));
+			_mm_storeu_si128((__m128i *)(v + x),
+					 to_plane_16px_avx2(px0, px1, v_coeffs,
+							    c_offset));
+		}
+
+		rgbx_to_444_pixels(row, lum, u, v, x, width, c);
+	}
+}
+
+static bool cpu_has_avx2(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	/* the OS also has to save the ymm registers */
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+		return false;
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* kernel selection                                                           */
+
+struct format_kernels {
+	const char *name;
+
+	void (*compress_uyvx_to_i420)(const uint8_t *input,
+				      uint32_t in_linesize, uint32_t start_y,
+				      uint32_t end_y, uint8_t *output[],
+				      const uint32_t out_linesize[]);
+	void (*compress_uyvx_to_nv12)(const uint8_t *input,
+				      uint32_t in_linesize, uint32_t start_y,
+				      uint32_t end_y, uint8_t *output[],
+				      const uint32_t out_linesize[]);
+	void (*convert_uyvx_to_i444)(const uint8_t *input,
+				     uint32_t in_linesize, uint32_t start_y,
+				     uint32_t end_y, uint8_t *output[],
+				     const uint32_t out_linesize[]);
+
+	void (*decompress_420)(const uint8_t *const input[],
+			       const uint32_t in_linesize[], uint32_t start_y,
+			       uint32_t end_y, uint8_t *output,
+			       uint32_t out_linesize);
+	void (*decompress_nv12)(const uint8_t *const input[],
+				const uint32_t in_linesize[], uint32_t start_y,
+				uint32_t end_y, uint8_t *output,
+				uint32_t out_linesize);
+	void (*decompress_422)(const uint8_t *input, uint32_t in_linesize,
+			       uint32_t start_y, uint32_t end_y,
+			       uint8_t *output, uint32_t out_linesize,
+			       bool leading_lum);
+
+	void (*rgbx_to_420)(const uint8_t *input, uint32_t in_linesize,
+			    uint32_t width, uint32_t start_y, uint32_t end_y,
+			    uint8_t *output[], const uint32_t out_linesize[],
+			    bool nv12, const struct rgb_to_yuv *c);
+	void (*rgbx_to_444)(const uint8_t *input, uint32_t in_linesize,
+			    uint32_t width, uint32_t start_y, uint32_t end_y,
+			    uint8_t *output[], const uint32_t out_linesize[],
+			    const struct rgb_to_yuv *c);
+	void (*nv12_to_rgbx)(const uint8_t *const input[],
+			     const uint32_t in_linesize[], uint32_t width,
+			     uint32_t start_y, uint32_t end_y, uint8_t *output,
+			     uint32_t out_linesize,
+			     const struct yuv_to_rgb *c);
+};
+
+/* on ARM the SSE2 kernels are translated to NEON by simde */
+static const struct format_kernels sse2_kernels = {
+#if NEEDS_SIMDE && (defined(__ARM_NEON) || defined(__aarch64__))
+	.name = "NEON (simde)",
+#elif NEEDS_SIMDE
+	.name = "simde",
+#else
+	.name = "SSE2",
+#endif
+	.compress_uyvx_to_i420 = compress_uyvx_to_i420_sse2,
+	.compress_uyvx_to_nv12 = compress_uyvx_to_nv12_sse2,
+	.convert_uyvx_to_i444 = convert_uyvx_to_i444_sse2,
+	.decompress_420 = decompress_420_sse2,
+	.decompress_nv12 = decompress_nv12_sse2,
+	.decompress_422 = decompress_422_sse2,
+	.rgbx_to_420 = rgbx_to_420_sse2,
+	.rgbx_to_444 = rgbx_to_444_sse2,
+	.nv12_to_rgbx = nv12_to_rgbx_sse2,
+};
+
+#if HAVE_AVX2_KERNELS
+/* the packed 444 kernels are memory bound, they keep the SSE2 versions */
+static const struct format_kernels avx2_kernels = {
+	.name = "AVX2",
+	.compress_uyvx_to_i420 = compress_uyvx_to_i420_sse2,
+	.compress_uyvx_to_nv12 = compress_uyvx_to_nv12_sse2,
+	.convert_uyvx_to_i444 = convert_uyvx_to_i444_sse2,
+	.decompress_420 = decompress_420_sse2,
+	.decompress_nv12 = decompress_nv12_sse2,
+	.decompress_422 = decompress_422_sse2,
+	.rgbx_to_420 = rgbx_to_420_avx2,
+	.rgbx_to_444 = rgbx_to_444_avx2,
+	.nv12_to_rgbx = nv12_to_rgbx_sse2,
+};
+#endif
+
+static const struct format_kernels *kernels = &sse2_kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels(void)
+{
+#if HAVE_AVX2_KERNELS
+	if (cpu_has_avx2())
+		kernels = &avx2_kernels;
+#endif
+
+	blog(LOG_INFO, "format-conversion: using %s kernels", kernels->name);
+}
+
+static inline const struct format_kernels *get_kernels(void)
+{
+	pthread_once(&kernels_once, select_kernels);
+	return kernels;
+}
+
+const char *format_conversion_get_kernels(void)
+{
+	return get_kernels()->name;
+}
+
+void compress_uyvx_to_i420(const uint8_t *input, uint32_t in_linesize,
+			   uint32_t start_y, uint32_t end_y, uint8_t *output[],
+			   const uint32_t out_linesize[])
+{
+	get_kernels()->compress_uyvx_to_i420(input, in_linesize, start_y,
+					     end_y, output, out_linesize);
+}
+
+void compress_uyvx_to_nv12(const uint8_t *input, uint32_t in_linesize,
+			   uint32_t start_y, uint32_t end_y, uint8_t *output[],
+			   const uint32_t out_linesize[])
+{
+	get_kernels()->compress_uyvx_to_nv12(input, in_linesize, start_y,
+					     end_y, output, out_linesize);
+}
+
+void convert_uyvx_to_i444(const uint8_t *input, uint32_t in_linesize,
+			  uint32_t start_y, uint32_t end_y, uint8_t *output[],
+			  const uint32_t out_linesize[])
+{
+	get_kernels()->convert_uyvx_to_i444(input, in_linesize, start_y,
+					    end_y, output, out_linesize);
+}
+
+void decompress_420(const uint8_t *const input[], const uint32_t in_linesize[],
+		    uint32_t start_y, uint32_t end_y, uint8_t *output,
+		    uint32_t out_linesize)
+{
+	get_kernels()->decompress_420(input, in_linesize, start_y, end_y,
+				      output, out_linesize);
+}
+
+void decompress_nv12(const uint8_t *const input[], const uint32_t in_linesize[],
+		     uint32_t start_y, uint32_t end_y, uint8_t *output,
+		     uint32_t out_linesize)
+{
+	get_kernels()->decompress_nv12(input, in_linesize, start_y, end_y,
+				       output, out_linesize);
+}
+
+void decompress_422(const uint8_t *input, uint32_t in_linesize,
+		    uint32_t start_y, uint32_t end_y, uint8_t *output,
+		    uint32_t out_linesize, bool leading_lum)
+{
+	get_kernels()->decompress_422(input, in_linesize, start_y, end_y,
+				      output, out_linesize, leading_lum);
+}
+
+void compress_rgbx_to_nv12(const uint8_t *input, uint32_t in_linesize,
+			   uint32_t width, uint32_t start_y, uint32_t end_y,
+			   uint8_t *output[], const uint32_t out_linesize[],
+			   enum video_format format, enum video_colorspace cs,
+			   enum video_range_type range)
+{
+	struct rgb_to_yuv c;
+	get_rgb_to_yuv(&c, format, cs, range);
+	get_kernels()->rgbx_to_420(input, in_linesize, width, start_y, end_y,
+				   output, out_linesize, true, &c);
+}
+
+void compress_rgbx_to_i420(const uint8_t *input, uint32_t in_linesize,
+			   uint32_t width, uint32_t start_y, uint32_t end_y,
+			   uint8_t *output[], const uint32_t out_linesize[],
+			   enum video_format format, enum video_colorspace cs,
+			   enum video_range_type range)
+{
+	struct rgb_to_yuv c;
+	get_rgb_to_yuv(&c, format, cs, range);
+	get_kernels()->rgbx_to_420(input, in_linesize, width, start_y, end_y,
+				   output, out_linesize, false, &c);
+}
+
+void convert_rgbx_to_i444(const uint8_t *input, uint32_t in_linesize,
+			  uint32_t width, uint32_t start_y, uint32_t end_y,
+			  uint8_t *output[], const uint32_t out_linesize[],
+			  enum video_format format, enum video_colorspace cs,
+			  enum video_range_type range)
+{
+	struct rgb_to_yuv c;
+	get_rgb_to_yuv(&c, format, cs, range);
+	get_kernels()->rgbx_to_444(input, in_linesize, width, start_y, end_y,
+				   output, out_linesize, &c);
+}
+
+void decompress_nv12_to_rgbx(const uint8_t *const input[],
+			     const uint32_t in_linesize[], uint32_t width,
+			     uint32_t start_y, uint32_t end_y, uint8_t *output,
+			     uint32_t out_linesize, enum video_format format,
+			     enum video_colorspace cs,
+			     enum video_range_type range)
+{
+	struct yuv_to_rgb c;
+	get_yuv_to_rgb(&c, format, cs, range);
+	get_kernels()->nv12_to_rgbx(input, in_linesize, width, start_y, end_y,
+				    output, out_linesize, &c);
+}
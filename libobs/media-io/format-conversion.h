@@ -18,6 +18,7 @@
 #pragma once
 
 #include "../util/c99defs.h"
+#include "video-io.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -56,6 +57,48 @@ EXPORT void decompress_422(const uint8_t *input, uint32_t in_linesize,
 			   uint32_t start_y, uint32_t end_y, uint8_t *output,
 			   uint32_t out_linesize, bool leading_lum);
 
+/*
+ * Functions for converting between RGBA/BGRA/BGRX and YUV, format selects
+ * the byte order of the RGB side.  4:2:0 output takes rows in pairs, so
+ * start_y, end_y and width should be even.
+ */
+
+EXPORT void compress_rgbx_to_nv12(const uint8_t *input, uint32_t in_linesize,
+				  uint32_t width, uint32_t start_y,
+				  uint32_t end_y, uint8_t *output[],
+				  const uint32_t out_linesize[],
+				  enum video_format format,
+				  enum video_colorspace cs,
+				  enum video_range_type range);
+
+EXPORT void compress_rgbx_to_i420(const uint8_t *input, uint32_t in_linesize,
+				  uint32_t width, uint32_t start_y,
+				  uint32_t end_y, uint8_t *output[],
+				  const uint32_t out_linesize[],
+				  enum video_format format,
+				  enum video_colorspace cs,
+				  enum video_range_type range);
+
+EXPORT void convert_rgbx_to_i444(const uint8_t *input, uint32_t in_linesize,
+				 uint32_t width, uint32_t start_y,
+				 uint32_t end_y, uint8_t *output[],
+				 const uint32_t out_linesize[],
+				 enum video_format format,
+				 enum video_colorspace cs,
+				 enum video_range_type range);
+
+EXPORT void decompress_nv12_to_rgbx(const uint8_t *const input[],
+				    const uint32_t in_linesize[],
+				    uint32_t width, uint32_t start_y,
+				    uint32_t end_y, uint8_t *output,
+				    uint32_t out_linesize,
+				    enum video_format format,
+				    enum video_colorspace cs,
+				    enum video_range_type range);
+
+/* Name of the kernel set picked for this CPU ("SSE2", "AVX2", ...) */
+EXPORT const char *format_conversion_get_kernels(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -30,40 +30,109 @@
 
 extern profiler_name_store_t *obs_get_profiler_name_store(void);
 
-#define MAX_CONVERT_BUFFERS 3
 #define MAX_CACHE_SIZE 16
-
+#define MIN_CACHE_SIZE 2
+
+/*
+ * The cache is a ring written by a single producer (the graphics thread
+ * through video_output_lock_frame/unlock_frame) and read by every input on
+ * its own thread, each with its own cursor, so a slow input does not hold
+ * up the others.
+ *
+ * A slot is published by setting seq to the slot's sequence number and is
+ * invalidated (seq = -1) while it is rewritten.  Readers pin a slot by
+ * incrementing readers and then re-checking seq, the producer invalidates
+ * and then checks readers, so one of them always backs off.  The producer
+ * never waits: if the oldest slot is pinned it repeats the newest frame
+ * instead, as the old cache did when it was full.
+ *
+ * Frame numbers count deliveries, a slot delivers count consecutive frames
+ * starting at first_frame.  An input whose frames were overwritten before it
+ * read them repeats the next available frame in their place, so encoders
+ * still see one frame per frame interval, unless its overflow policy is
+ * VIDEO_INPUT_OVERFLOW_DROP, in which case they are skipped.  An input can
+ * also be limited to fall fewer frames behind than the cache holds.
+ */
 struct cached_frame_info {
 	struct video_data frame;
-	int skipped;
-	int count;
+	volatile long seq;
+	volatile long count;
+	long first_frame;
+	volatile long readers;
 };
 
-struct video_input {
+/*
+ * Inputs that ask for the same conversion share one scale node, which scales
+ * each cached frame once, on whichever input thread reads it first, into a
+ * frame that belongs to the same cache slot.  The scaled frame is only
+ * rewritten when its cache slot is, which cannot happen while any input has
+ * that slot pinned, so the inputs can read it without copying.
+ *
+ * A node that only changes the size can cascade from a larger node with the
+ * same format (1440p -> 720p -> 360p), which is cheaper than scaling every
+ * rung from the base frame.  Only exact integer downscales by a parent that
+ * scales at least as well cascade, anything else would filter the frame
+ * twice and come out softer than scaling from the base frame.
+ */
+struct video_scale_node {
+	uint32_t id;
 	struct video_scale_info conversion;
+	enum video_scale_type scale_type;
+	struct video_scale_node *parent;
 	video_scaler_t *scaler;
-	struct video_frame frame[MAX_CONVERT_BUFFERS];
-	int cur_frame;
+
+	/* protected by the output's input_mutex */
+	size_t inputs;
+	size_t children;
+
+	pthread_mutex_t mutex;
+	struct video_frame frame[MAX_CACHE_SIZE];
+	long frame_seq[MAX_CACHE_SIZE];
+	uint64_t scaled_frames;
+	uint64_t scale_time_ns;
+};
+
+struct video_input {
+	struct video_output *video;
+	struct video_scale_info conversion;
+	struct video_scale_node *node;
 
 	void (*callback)(void *param, struct video_data *frame);
 	void *param;
-};
 
-static inline void video_input_free(struct video_input *input)
-{
-	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-		video_frame_free(&input->frame[i]);
-	video_scaler_destroy(input->scaler);
-}
+	pthread_t thread;
+	os_sem_t *sem;
+	os_event_t *exited;
+	volatile bool stop;
+	bool detached;
+
+	/* protected by the output's input_mutex: claimed while
+	 * video_output_stop joins the thread, disconnected when the input was
+	 * disconnected meanwhile and video_output_stop has to free it */
+	bool claimed;
+	bool joined;
+	bool disconnected;
+
+	/* read state, only touched by the input thread */
+	long cursor;
+	long next_frame;
+	bool synced;
+
+	/* queue settings, 0 max_lag means the cache size */
+	volatile long max_lag;
+	volatile long overflow;
+
+	volatile long delivered_frames;
+	volatile long lagged_frames;
+	volatile long dropped_frames;
+};
 
 struct video_output {
 	struct video_output_info info;
 
-	pthread_t thread;
 	pthread_mutex_t data_mutex;
 	bool stop;
 
-	os_sem_t *update_semaphore;
 	uint64_t frame_time;
 	volatile long skipped_frames;
 	volatile long total_frames;
@@ -71,132 +140,231 @@ struct video_output {
 	bool initialized;
 
 	pthread_mutex_t input_mutex;
-	DARRAY(struct video_input) inputs;
-
-	size_t available_frames;
-	size_t first_added;
-	size_t last_added;
+	DARRAY(struct video_input *) inputs;
+	DARRAY(struct video_scale_node *) scale_nodes;
+	uint32_t next_node_id;
+
+	/* producer state, only touched by the thread locking frames */
+	volatile long write_seq;
+	long next_frame;
+	struct cached_frame_info *locked;
 	struct cached_frame_info cache[MAX_CACHE_SIZE];
 
 	volatile bool raw_active;
 	volatile long gpu_refs;
 };
 
+static inline void atomic_add_long(volatile long *val, long add)
+{
+	long old;
+	do {
+		old = os_atomic_load_long(val);
+	} while (!os_atomic_compare_swap_long(val, old, old + add));
+}
+
 /* ------------------------------------------------------------------------- */
 
-static inline bool scale_video_output(struct video_input *input,
-				      struct video_data *data)
+static void scale_node_release(struct video_output *video,
+			       struct video_scale_node *node);
+
+static inline void video_input_free(struct video_input *input)
+{
+	if (input->node) {
+		pthread_mutex_lock(&input->video->input_mutex);
+		input->node->inputs--;
+		scale_node_release(input->video, input->node);
+		pthread_mutex_unlock(&input->video->input_mutex);
+	}
+
+	os_sem_destroy(input->sem);
+	os_event_destroy(input->exited);
+	bfree(input);
+}
+
+/* scales the frame in cache slot idx (sequence seq) unless another input
+ * already has, called with the slot pinned */
+static bool scale_node_get(struct video_scale_node *node,
+			   const struct video_data *src, size_t idx, long seq,
+			   struct video_data *out)
 {
+	struct video_frame *frame = &node->frame[idx];
 	bool success = true;
 
-	if (input->scaler) {
-		struct video_frame *frame;
+	pthread_mutex_lock(&node->mutex);
 
-		if (++input->cur_frame == MAX_CONVERT_BUFFERS)
-			input->cur_frame = 0;
+	if (node->frame_seq[idx] != seq) {
+		struct video_data parent_data;
+		uint64_t start = os_gettime_ns();
 
-		frame = &input->frame[input->cur_frame];
+		if (node->parent) {
+			success = scale_node_get(node->parent, src, idx, seq,
+						 &parent_data);
+			src = &parent_data;
+		}
 
-		success = video_scaler_scale(input->scaler, frame->data,
-					     frame->linesize,
-					     (const uint8_t *const *)data->data,
-					     data->linesize);
+		if (success)
+			success = video_scaler_scale(
+				node->scaler, frame->data, frame->linesize,
+				(const uint8_t *const *)src->data,
+				src->linesize);
 
-		if (success) {
-			for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-				data->data[i] = frame->data[i];
-				data->linesize[i] = frame->linesize[i];
-			}
-		} else {
+		node->frame_seq[idx] = success ? seq : -1;
+		node->scaled_frames++;
+		node->scale_time_ns += os_gettime_ns() - start;
+
+		if (!success)
 			blog(LOG_WARNING, "video-io: Could not scale frame!");
-		}
 	}
 
+	pthread_mutex_unlock(&node->mutex);
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		out->data[i] = frame->data[i];
+		out->linesize[i] = frame->linesize[i];
+	}
+	out->timestamp = src->timestamp;
 	return success;
 }
 
-static inline bool video_output_cur_frame(struct video_output *video)
+static inline bool pin_slot(struct cached_frame_info *cfi, long seq)
 {
-	struct cached_frame_info *frame_info;
-	bool complete;
-	bool skipped;
+	os_atomic_inc_long(&cfi->readers);
+	if (os_atomic_load_long(&cfi->seq) == seq)
+		return true;
 
-	/* -------------------------------- */
+	os_atomic_dec_long(&cfi->readers);
+	return false;
+}
 
-	pthread_mutex_lock(&video->data_mutex);
+static inline void unpin_slot(struct cached_frame_info *cfi)
+{
+	os_atomic_dec_long(&cfi->readers);
+}
 
-	frame_info = &video->cache[video->first_added];
+/* delivers the frames of a pinned slot the input has not received yet */
+static void deliver_slot(struct video_input *input,
+			 struct cached_frame_info *cfi, long seq)
+{
+	struct video_output *video = input->video;
+	struct video_data data = cfi->frame;
+	long first = cfi->first_frame;
+	long end = first + os_atomic_load_long(&cfi->count);
+
+	if (!input->synced) {
+		input->next_frame = first;
+		input->synced = true;
+	}
 
-	pthread_mutex_unlock(&video->data_mutex);
+	if (first - input->next_frame > 0) {
+		long missed = first - input->next_frame;
 
-	/* -------------------------------- */
+		if (os_atomic_load_long(&input->overflow) ==
+		    VIDEO_INPUT_OVERFLOW_DROP) {
+			atomic_add_long(&input->dropped_frames, missed);
+			input->next_frame = first;
+		} else {
+			atomic_add_long(&input->lagged_frames, missed);
+		}
+	}
 
-	pthread_mutex_lock(&video->input_mutex);
+	if (end - input->next_frame <= 0)
+		return;
 
-	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array + i;
-		struct video_data frame = frame_info->frame;
+	if (input->node) {
+		size_t idx = (size_t)(cfi - video->cache);
+		if (!scale_node_get(input->node, &cfi->frame, idx, seq, &data))
+			return;
+	}
+
+	while (!input->stop && end - input->next_frame > 0) {
+		struct video_data frame = data;
+		frame.timestamp += (int64_t)(input->next_frame - first) *
+				   (int64_t)video->frame_time;
+
+		input->callback(input->param, &frame);
 
-		if (scale_video_output(input, &frame))
-			input->callback(input->param, &frame);
+		input->next_frame++;
+		os_atomic_inc_long(&input->delivered_frames);
 	}
+}
 
-	pthread_mutex_unlock(&video->input_mutex);
+static void video_input_read(struct video_input *input)
+{
+	struct video_output *video = input->video;
+	long cache_size = (long)video->info.cache_size;
+	long max_lag = os_atomic_load_long(&input->max_lag);
 
-	/* -------------------------------- */
+	if (!max_lag || max_lag > cache_size)
+		max_lag = cache_size;
 
-	pthread_mutex_lock(&video->data_mutex);
+	while (!input->stop) {
+		long latest = os_atomic_load_long(&video->write_seq);
+		if (input->cursor == latest)
+			break;
 
-	frame_info->frame.timestamp += video->frame_time;
-	complete = --frame_info->count == 0;
-	skipped = frame_info->skipped > 0;
+		/* anything older has been overwritten, or is further behind
+		 * than the input wants to be */
+		if (latest - input->cursor > max_lag)
+			input->cursor = latest - max_lag;
 
-	if (complete) {
-		if (++video->first_added == video->info.cache_size)
-			video->first_added = 0;
+		struct cached_frame_info *cfi =
+			&video->cache[(unsigned long)input->cursor %
+				      (unsigned long)cache_size];
 
-		if (++video->available_frames == video->info.cache_size)
-			video->last_added = video->first_added;
-	} else if (skipped) {
-		--frame_info->skipped;
-		os_atomic_inc_long(&video->skipped_frames);
-	}
+		if (!pin_slot(cfi, input->cursor)) {
+			input->cursor++;
+			continue;
+		}
 
-	pthread_mutex_unlock(&video->data_mutex);
+		deliver_slot(input, cfi, input->cursor);
+		unpin_slot(cfi);
 
-	/* -------------------------------- */
+		/* the newest slot can still get repeats added to it */
+		if (latest - input->cursor == 1)
+			break;
 
-	return complete;
+		input->cursor++;
+	}
 }
 
-static void *video_thread(void *param)
+static void *video_input_thread(void *param)
 {
-	struct video_output *video = param;
+	struct video_input *input = param;
 
-	os_set_thread_name("video-io: video thread");
+	os_set_thread_name("video-io: video input thread");
 
 	const char *video_thread_name =
 		profile_store_name(obs_get_profiler_name_store(),
-				   "video_thread(%s)", video->info.name);
+				   "video_thread(%s)", input->video->info.name);
 
-	while (os_sem_wait(video->update_semaphore) == 0) {
-		if (video->stop)
+	while (os_sem_wait(input->sem) == 0) {
+		if (input->stop)
 			break;
 
 		profile_start(video_thread_name);
-		while (!video->stop && !video_output_cur_frame(video)) {
-			os_atomic_inc_long(&video->total_frames);
-		}
-
-		os_atomic_inc_long(&video->total_frames);
+		video_input_read(input);
 		profile_end(video_thread_name);
 
 		profile_reenable_thread();
 	}
 
+	os_event_signal(input->exited);
+
+	/* disconnected from inside its own callback, nobody will join us */
+	if (input->detached)
+		video_input_free(input);
+
 	return NULL;
 }
 
+static inline void signal_inputs(struct video_output *video)
+{
+	pthread_mutex_lock(&video->input_mutex);
+	for (size_t i = 0; i < video->inputs.num; i++)
+		os_sem_post(video->inputs.array[i]->sem);
+	pthread_mutex_unlock(&video->input_mutex);
+}
+
 /* ------------------------------------------------------------------------- */
 
 static inline bool valid_video_params(const struct video_output_info *info)
@@ -209,6 +377,8 @@ static inline void init_cache(struct video_output *video)
 {
 	if (video->info.cache_size > MAX_CACHE_SIZE)
 		video->info.cache_size = MAX_CACHE_SIZE;
+	if (video->info.cache_size < MIN_CACHE_SIZE)
+		video->info.cache_size = MIN_CACHE_SIZE;
 
 	for (size_t i = 0; i < video->info.cache_size; i++) {
 		struct video_frame *frame;
@@ -216,9 +386,8 @@ static inline void init_cache(struct video_output *video)
 
 		video_frame_init(frame, video->info.format, video->info.width,
 				 video->info.height);
+		video->cache[i].seq = -1;
 	}
-
-	video->available_frames = video->info.cache_size;
 }
 
 int video_output_open(video_t **video, struct video_output_info *info)
@@ -246,10 +415,6 @@ int video_output_open(video_t **video, struct video_output_info *info)
 		goto fail;
 	if (pthread_mutex_init(&out->input_mutex, &attr) != 0)
 		goto fail;
-	if (os_sem_init(&out->update_semaphore, 0) != 0)
-		goto fail;
-	if (pthread_create(&out->thread, NULL, video_thread, out) != 0)
-		goto fail;
 
 	init_cache(out);
 
@@ -270,13 +435,13 @@ void video_output_close(video_t *video)
 	video_output_stop(video);
 
 	for (size_t i = 0; i < video->inputs.num; i++)
-		video_input_free(&video->inputs.array[i]);
+		video_input_free(video->inputs.array[i]);
 	da_free(video->inputs);
+	da_free(video->scale_nodes);
 
 	for (size_t i = 0; i < video->info.cache_size; i++)
 		video_frame_free((struct video_frame *)&video->cache[i]);
 
-	os_sem_destroy(video->update_semaphore);
 	pthread_mutex_destroy(&video->data_mutex);
 	pthread_mutex_destroy(&video->input_mutex);
 	bfree(video);
@@ -288,7 +453,7 @@ static size_t video_get_input_idx(const video_t *video,
 				  void *param)
 {
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array + i;
+		struct video_input *input = video->inputs.array[i];
 		if (input->callback == callback && input->param == param)
 			return i;
 	}
@@ -296,38 +461,163 @@ static size_t video_get_input_idx(const video_t *video,
 	return DARRAY_INVALID;
 }
 
+static inline bool same_conversion(const struct video_scale_info *a,
+				   const struct video_scale_info *b)
+{
+	return a->format == b->format && a->width == b->width &&
+	       a->height == b->height && a->range == b->range &&
+	       a->colorspace == b->colorspace;
+}
+
+static inline int scale_quality(enum video_scale_type type)
+{
+	return type == VIDEO_SCALE_DEFAULT ? VIDEO_SCALE_FAST_BILINEAR
+					   : (int)type;
+}
+
+/* the same integer factor on both axes */
+static inline bool exact_downscale(const struct video_scale_info *from,
+				   const struct video_scale_info *to)
+{
+	if (!to->width || !to->height || from->width % to->width ||
+	    from->height % to->height)
+		return false;
+
+	return from->width / to->width == from->height / to->height;
+}
+
+/* the smallest existing node this conversion can be an exact downscale of */
+static struct video_scale_node *
+find_cascade_parent(struct video_output *video,
+		    const struct video_scale_info *conv,
+		    enum video_scale_type type)
+{
+	struct video_scale_node *best = NULL;
+
+	for (size_t i = 0; i < video->scale_nodes.num; i++) {
+		struct video_scale_node *node = video->scale_nodes.array[i];
+		const struct video_scale_info *from = &node->conversion;
+
+		if (from->format != conv->format ||
+		    from->range != conv->range ||
+		    from->colorspace != conv->colorspace)
+			continue;
+		if (scale_quality(node->scale_type) < scale_quality(type) ||
+		    !exact_downscale(from, conv))
+			continue;
+		if (best && (uint64_t)from->width * from->height >=
+				    (uint64_t)best->conversion.width *
+					    best->conversion.height)
+			continue;
+
+		best = node;
+	}
+
+	return best;
+}
+
+static void scale_node_destroy(struct video_output *video,
+			       struct video_scale_node *node)
+{
+	for (size_t i = 0; i < video->info.cache_size; i++)
+		video_frame_free(&node->frame[i]);
+	video_scaler_destroy(node->scaler);
+	pthread_mutex_destroy(&node->mutex);
+	bfree(node);
+}
+
+/* called with input_mutex held */
+static void scale_node_release(struct video_output *video,
+			       struct video_scale_node *node)
+{
+	while (node && !node->inputs && !node->children) {
+		struct video_scale_node *parent = node->parent;
+
+		da_erase_item(video->scale_nodes, &node);
+		scale_node_destroy(video, node);
+
+		if (parent)
+			parent->children--;
+		node = parent;
+	}
+}
+
+static struct video_scale_node *
+scale_node_create(struct video_output *video,
+		  const struct video_scale_info *conv)
+{
+	struct video_scale_node *node = bzalloc(sizeof(*node));
+	enum video_scale_type type = VIDEO_SCALE_FAST_BILINEAR;
+	struct video_scale_info from = {.format = video->info.format,
+					.width = video->info.width,
+					.height = video->info.height,
+					.range = video->info.range,
+					.colorspace = video->info.colorspace};
+
+	node->conversion = *conv;
+	node->scale_type = type;
+	node->parent = find_cascade_parent(video, conv, type);
+	if (node->parent)
+		from = node->parent->conversion;
+
+	if (pthread_mutex_init(&node->mutex, NULL) != 0) {
+		bfree(node);
+		return NULL;
+	}
+
+	int ret = video_scaler_create(&node->scaler, conv, &from, type);
+	if (ret != VIDEO_SCALER_SUCCESS) {
+		if (ret == VIDEO_SCALER_BAD_CONVERSION)
+			blog(LOG_ERROR, "video_input_init: Bad "
+					"scale conversion type");
+		else
+			blog(LOG_ERROR, "video_input_init: Failed to "
+					"create scaler");
+
+		node->parent = NULL;
+		scale_node_destroy(video, node);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < video->info.cache_size; i++) {
+		video_frame_init(&node->frame[i], conv->format, conv->width,
+				 conv->height);
+		node->frame_seq[i] = -1;
+	}
+
+	node->id = ++video->next_node_id;
+	if (node->parent)
+		node->parent->children++;
+
+	da_push_back(video->scale_nodes, &node);
+	return node;
+}
+
+/* called with input_mutex held */
 static inline bool video_input_init(struct video_input *input,
 				    struct video_output *video)
 {
 	if (input->conversion.width != video->info.width ||
 	    input->conversion.height != video->info.height ||
 	    input->conversion.format != video->info.format) {
-		struct video_scale_info from = {.format = video->info.format,
-						.width = video->info.width,
-						.height = video->info.height,
-						.range = video->info.range,
-						.colorspace =
-							video->info.colorspace};
-
-		int ret = video_scaler_create(&input->scaler,
-					      &input->conversion, &from,
-					      VIDEO_SCALE_FAST_BILINEAR);
-		if (ret != VIDEO_SCALER_SUCCESS) {
-			if (ret == VIDEO_SCALER_BAD_CONVERSION)
-				blog(LOG_ERROR, "video_input_init: Bad "
-						"scale conversion type");
-			else
-				blog(LOG_ERROR, "video_input_init: Failed to "
-						"create scaler");
+		struct video_scale_node *node = NULL;
+
+		for (size_t i = 0; i < video->scale_nodes.num; i++) {
+			if (same_conversion(
+				    &video->scale_nodes.array[i]->conversion,
+				    &input->conversion)) {
+				node = video->scale_nodes.array[i];
+				break;
+			}
+		}
 
+		if (!node)
+			node = scale_node_create(video, &input->conversion);
+		if (!node)
 			return false;
-		}
 
-		for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-			video_frame_init(&input->frame[i],
-					 input->conversion.format,
-					 input->conversion.width,
-					 input->conversion.height);
+		node->inputs++;
+		input->node = node;
 	}
 
 	return true;
@@ -339,6 +629,48 @@ static inline void reset_frames(video_t *video)
 	os_atomic_set_long(&video->total_frames, 0);
 }
 
+/* called once the input has been removed from the output's inputs */
+static void video_input_stop(struct video_input *input)
+{
+	struct video_output *video = input->video;
+	bool self = pthread_equal(pthread_self(), input->thread);
+	bool claimed;
+
+	os_atomic_set_bool(&input->stop, true);
+	os_sem_post(input->sem);
+
+	pthread_mutex_lock(&video->input_mutex);
+	claimed = input->claimed;
+	pthread_mutex_unlock(&video->input_mutex);
+
+	/* video_output_stop is joining the thread, wait for its last callback
+	 * (unless this is it) and leave the join and free to whichever of us
+	 * is still holding the input */
+	if (claimed) {
+		if (!self)
+			os_event_wait(input->exited);
+
+		pthread_mutex_lock(&video->input_mutex);
+		claimed = input->claimed;
+		if (claimed)
+			input->disconnected = true;
+		pthread_mutex_unlock(&video->input_mutex);
+
+		if (claimed)
+			return;
+	}
+
+	if (input->joined) {
+		video_input_free(input);
+	} else if (self) {
+		input->detached = true;
+		pthread_detach(input->thread);
+	} else {
+		pthread_join(input->thread, NULL);
+		video_input_free(input);
+	}
+}
+
 bool video_output_connect(
 	video_t *video, const struct video_scale_info *conversion,
 	void (*callback)(void *param, struct video_data *frame), void *param)
@@ -351,26 +683,36 @@ bool video_output_connect(
 	pthread_mutex_lock(&video->input_mutex);
 
 	if (video_get_input_idx(video, callback, param) == DARRAY_INVALID) {
-		struct video_input input;
-		memset(&input, 0, sizeof(input));
+		struct video_input *input = bzalloc(sizeof(*input));
 
-		input.callback = callback;
-		input.param = param;
+		input->video = video;
+		input->callback = callback;
+		input->param = param;
 
 		if (conversion) {
-			input.conversion = *conversion;
+			input->conversion = *conversion;
 		} else {
-			input.conversion.format = video->info.format;
-			input.conversion.width = video->info.width;
-			input.conversion.height = video->info.height;
+			input->conversion.format = video->info.format;
+			input->conversion.width = video->info.width;
+			input->conversion.height = video->info.height;
+			input->conversion.range = video->info.range;
+			input->conversion.colorspace = video->info.colorspace;
 		}
 
-		if (input.conversion.width == 0)
-			input.conversion.width = video->info.width;
-		if (input.conversion.height == 0)
-			input.conversion.height = video->info.height;
+		if (input->conversion.width == 0)
+			input->conversion.width = video->info.width;
+		if (input->conversion.height == 0)
+			input->conversion.height = video->info.height;
 
-		success = video_input_init(&input, video);
+		/* start at the next frame published */
+		input->cursor = os_atomic_load_long(&video->write_seq);
+
+		success = video_input_init(input, video) &&
+			  os_sem_init(&input->sem, 0) == 0 &&
+			  os_event_init(&input->exited,
+					OS_EVENT_TYPE_MANUAL) == 0 &&
+			  pthread_create(&input->thread, NULL,
+					 video_input_thread, input) == 0;
 		if (success) {
 			if (video->inputs.num == 0) {
 				if (!os_atomic_load_long(&video->gpu_refs)) {
@@ -379,6 +721,8 @@ bool video_output_connect(
 				os_atomic_set_bool(&video->raw_active, true);
 			}
 			da_push_back(video->inputs, &input);
+		} else {
+			video_input_free(input);
 		}
 	}
 
@@ -409,6 +753,8 @@ void video_output_disconnect(video_t *video,
 					      struct video_data *frame),
 			     void *param)
 {
+	struct video_input *input = NULL;
+
 	if (!video || !callback)
 		return;
 
@@ -416,7 +762,7 @@ void video_output_disconnect(video_t *video,
 
 	size_t idx = video_get_input_idx(video, callback, param);
 	if (idx != DARRAY_INVALID) {
-		video_input_free(video->inputs.array + idx);
+		input = video->inputs.array[idx];
 		da_erase(video->inputs, idx);
 
 		if (video->inputs.num == 0) {
@@ -428,6 +774,11 @@ void video_output_disconnect(video_t *video,
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
+
+	/* joined outside of the lock so frame delivery to other inputs and
+	 * other connects do not wait for this input's last callback */
+	if (input)
+		video_input_stop(input);
 }
 
 bool video_output_active(const video_t *video)
@@ -446,50 +797,71 @@ bool video_output_lock_frame(video_t *video, struct video_frame *frame,
 			     int count, uint64_t timestamp)
 {
 	struct cached_frame_info *cfi;
-	bool locked;
+	long seq;
 
 	if (!video)
 		return false;
 
 	pthread_mutex_lock(&video->data_mutex);
 
-	if (video->available_frames == 0) {
-		video->cache[video->last_added].count += count;
-		video->cache[video->last_added].skipped += count;
-		locked = false;
+	seq = video->write_seq;
+	cfi = &video->cache[(unsigned long)seq %
+			    (unsigned long)video->info.cache_size];
 
-	} else {
-		if (video->available_frames != video->info.cache_size) {
-			if (++video->last_added == video->info.cache_size)
-				video->last_added = 0;
-		}
+	atomic_add_long(&video->total_frames, count);
 
-		cfi = &video->cache[video->last_added];
-		cfi->frame.timestamp = timestamp;
-		cfi->count = count;
-		cfi->skipped = 0;
+	/* invalidate the oldest slot, unless an input is still reading it */
+	long old_seq = cfi->seq;
+	os_atomic_compare_swap_long(&cfi->seq, old_seq, -1);
 
-		memcpy(frame, &cfi->frame, sizeof(*frame));
+	if (os_atomic_load_long(&cfi->readers) != 0) {
+		os_atomic_compare_swap_long(&cfi->seq, -1, old_seq);
 
-		locked = true;
+		/* repeat the newest frame instead */
+		if (seq > 0) {
+			struct cached_frame_info *last =
+				&video->cache[(unsigned long)(seq - 1) %
+					      (unsigned long)video->info
+						      .cache_size];
+			atomic_add_long(&last->count, count);
+			video->next_frame += count;
+		}
+
+		atomic_add_long(&video->skipped_frames, count);
+		pthread_mutex_unlock(&video->data_mutex);
+
+		signal_inputs(video);
+		return false;
 	}
 
-	pthread_mutex_unlock(&video->data_mutex);
+	cfi->frame.timestamp = timestamp;
+	cfi->count = count;
+	cfi->first_frame = video->next_frame;
+	video->locked = cfi;
+
+	memcpy(frame, &cfi->frame, sizeof(*frame));
 
-	return locked;
+	/* data_mutex stays locked until the frame is published */
+	return true;
 }
 
 void video_output_unlock_frame(video_t *video)
 {
+	struct cached_frame_info *cfi;
+
 	if (!video)
 		return;
 
-	pthread_mutex_lock(&video->data_mutex);
+	cfi = video->locked;
+	video->locked = NULL;
+	video->next_frame += cfi->count;
 
-	video->available_frames--;
-	os_sem_post(video->update_semaphore);
+	os_atomic_compare_swap_long(&cfi->seq, -1, video->write_seq);
+	os_atomic_inc_long(&video->write_seq);
 
 	pthread_mutex_unlock(&video->data_mutex);
+
+	signal_inputs(video);
 }
 
 uint64_t video_output_get_frame_time(const video_t *video)
@@ -499,16 +871,49 @@ uint64_t video_output_get_frame_time(const video_t *video)
 
 void video_output_stop(video_t *video)
 {
-	void *thread_ret;
-
 	if (!video)
 		return;
 
 	if (video->initialized) {
 		video->initialized = false;
 		video->stop = true;
-		os_sem_post(video->update_semaphore);
-		pthread_join(video->thread, &thread_ret);
+
+		DARRAY(struct video_input *) inputs;
+		da_init(inputs);
+
+		/* claimed inputs are not joined or freed by a concurrent
+		 * disconnect, detached ones are never joined */
+		pthread_mutex_lock(&video->input_mutex);
+		for (size_t i = 0; i < video->inputs.num; i++) {
+			struct video_input *input = video->inputs.array[i];
+			if (input->detached || input->joined)
+				continue;
+
+			os_atomic_set_bool(&input->stop, true);
+			os_sem_post(input->sem);
+			input->claimed = true;
+			da_push_back(inputs, &input);
+		}
+		pthread_mutex_unlock(&video->input_mutex);
+
+		/* no callbacks run once stopped, the inputs stay connected
+		 * until their outputs disconnect or the video is closed */
+		for (size_t i = 0; i < inputs.num; i++)
+			pthread_join(inputs.array[i]->thread, NULL);
+
+		pthread_mutex_lock(&video->input_mutex);
+		for (size_t i = inputs.num; i > 0; i--) {
+			struct video_input *input = inputs.array[i - 1];
+			input->claimed = false;
+			input->joined = true;
+			if (!input->disconnected)
+				da_erase(inputs, i - 1);
+		}
+		pthread_mutex_unlock(&video->input_mutex);
+
+		for (size_t i = 0; i < inputs.num; i++)
+			video_input_free(inputs.array[i]);
+		da_free(inputs);
 	}
 }
 
@@ -553,6 +958,132 @@ uint32_t video_output_get_total_frames(const video_t *video)
 	return (uint32_t)os_atomic_load_long(&video->total_frames);
 }
 
+bool video_output_set_input_queue(
+	video_t *video, void (*callback)(void *param, struct video_data *frame),
+	void *param, size_t max_frames, enum video_input_overflow overflow)
+{
+	bool found = false;
+
+	if (!video || !callback)
+		return false;
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	size_t idx = video_get_input_idx(video, callback, param);
+	if (idx != DARRAY_INVALID) {
+		struct video_input *input = video->inputs.array[idx];
+
+		if (max_frames > MAX_CACHE_SIZE)
+			max_frames = MAX_CACHE_SIZE;
+		os_atomic_set_long(&input->max_lag, (long)max_frames);
+		os_atomic_set_long(&input->overflow, (long)overflow);
+		found = true;
+	}
+
+	pthread_mutex_unlock(&video->input_mutex);
+
+	return found;
+}
+
+/* called with input_mutex held */
+static void get_input_stats(struct video_output *video,
+			    struct video_input *input,
+			    struct video_input_stats *stat)
+{
+	long latest = os_atomic_load_long(&video->write_seq);
+
+	stat->callback = input->callback;
+	stat->param = input->param;
+	stat->scale_node = input->node ? input->node->id : 0;
+	stat->delivered_frames =
+		(uint32_t)os_atomic_load_long(&input->delivered_frames);
+	stat->lagged_frames =
+		(uint32_t)os_atomic_load_long(&input->lagged_frames);
+	stat->dropped_frames =
+		(uint32_t)os_atomic_load_long(&input->dropped_frames);
+
+	/* cursor is owned by the input thread, this is a snapshot */
+	long lag = latest - input->cursor - 1;
+	stat->lag = lag > 0 ? (uint32_t)lag : 0;
+}
+
+size_t video_output_get_input_stats(video_t *video,
+				    struct video_input_stats *stats,
+				    size_t max_stats)
+{
+	size_t num;
+
+	if (!video)
+		return 0;
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	num = video->inputs.num < max_stats ? video->inputs.num : max_stats;
+	for (size_t i = 0; i < num; i++)
+		get_input_stats(video, video->inputs.array[i], &stats[i]);
+
+	pthread_mutex_unlock(&video->input_mutex);
+
+	return num;
+}
+
+bool video_output_get_input_stat(
+	video_t *video, void (*callback)(void *param, struct video_data *frame),
+	void *param, struct video_input_stats *stats)
+{
+	bool found = false;
+
+	if (!video || !callback || !stats)
+		return false;
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	size_t idx = video_get_input_idx(video, callback, param);
+	if (idx != DARRAY_INVALID) {
+		get_input_stats(video, video->inputs.array[idx], stats);
+		found = true;
+	}
+
+	pthread_mutex_unlock(&video->input_mutex);
+
+	return found;
+}
+
+size_t video_output_get_scale_graph(video_t *video,
+				    struct video_scale_node_info *nodes,
+				    size_t max_nodes)
+{
+	size_t num;
+
+	if (!video)
+		return 0;
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	num = video->scale_nodes.num < max_nodes ? video->scale_nodes.num
+						 : max_nodes;
+
+	for (size_t i = 0; i < num; i++) {
+		struct video_scale_node *node = video->scale_nodes.array[i];
+		struct video_scale_node_info *info = &nodes[i];
+
+		info->id = node->id;
+		info->parent_id = node->parent ? node->parent->id : 0;
+		info->conversion = node->conversion;
+		info->inputs = node->inputs;
+		info->children = node->children;
+
+		pthread_mutex_lock(&node->mutex);
+		info->scaled_frames = node->scaled_frames;
+		info->scale_time_ns = node->scale_time_ns;
+		pthread_mutex_unlock(&node->mutex);
+	}
+
+	pthread_mutex_unlock(&video->input_mutex);
+
+	return num;
+}
+
 /* Note: These four functions below are a very slight bit of a hack.  If the
  * texture encoder thread is active while the raw encoder thread is active, the
  * total frame count will just be doubled while they're both active.  Which is
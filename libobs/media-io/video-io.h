@@ -260,6 +260,62 @@ EXPORT double video_output_get_frame_rate(const video_t *video);
 EXPORT uint32_t video_output_get_skipped_frames(const video_t *video);
 EXPORT uint32_t video_output_get_total_frames(const video_t *video);
 
+/* What happens to frames an input falls too far behind to read */
+enum video_input_overflow {
+	/* the next available frame is delivered in their place, so the input
+	 * still gets one frame per frame interval (the default) */
+	VIDEO_INPUT_OVERFLOW_REPEAT,
+	/* they are skipped, the input sees a gap in the timestamps */
+	VIDEO_INPUT_OVERFLOW_DROP,
+};
+
+/* Limits how many frames an input can fall behind before overflow applies.
+ * 0 (the default) uses the whole cache.  Returns false if the input is not
+ * connected. */
+EXPORT bool video_output_set_input_queue(
+	video_t *video, void (*callback)(void *param, struct video_data *frame),
+	void *param, size_t max_frames, enum video_input_overflow overflow);
+
+/* Per-input delivery state.  Each connected input is fed from its own thread,
+ * lagged_frames counts frames that were overwritten before the input read
+ * them (a previous frame was repeated in their place), dropped_frames the
+ * ones skipped with VIDEO_INPUT_OVERFLOW_DROP, and lag is how many cached
+ * frames the input is currently behind. */
+struct video_input_stats {
+	void (*callback)(void *param, struct video_data *frame);
+	void *param;
+	uint32_t delivered_frames;
+	uint32_t lagged_frames;
+	uint32_t dropped_frames;
+	uint32_t lag;
+	uint32_t scale_node;
+};
+
+EXPORT size_t video_output_get_input_stats(video_t *video,
+					   struct video_input_stats *stats,
+					   size_t max_stats);
+EXPORT bool video_output_get_input_stat(
+	video_t *video, void (*callback)(void *param, struct video_data *frame),
+	void *param, struct video_input_stats *stats);
+
+/* Inputs with the same conversion share a scale node (the scale_node id in
+ * video_input_stats, 0 when the input takes the output frames as they are).
+ * A node with a parent_id scales from that node's frames instead of the
+ * output frames. */
+struct video_scale_node_info {
+	uint32_t id;
+	uint32_t parent_id;
+	struct video_scale_info conversion;
+	size_t inputs;
+	size_t children;
+	uint64_t scaled_frames;
+	uint64_t scale_time_ns;
+};
+
+EXPORT size_t video_output_get_scale_graph(video_t *video,
+					   struct video_scale_node_info *nodes,
+					   size_t max_nodes);
+
 extern void video_output_inc_texture_encoders(video_t *video);
 extern void video_output_dec_texture_encoders(video_t *video);
 extern void video_output_inc_texture_frames(video_t *video);
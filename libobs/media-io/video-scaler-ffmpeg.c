@@ -16,15 +16,64 @@
 ******************************************************************************/
 
 #include "../util/bmem.h"
+#include "../util/platform.h"
+#include "../util/threading.h"
 #include "video-scaler.h"
 
+#include <libavutil/pixdesc.h>
 #include <libswscale/swscale.h>
 
+/* frames with fewer source pixels than this are scaled in one call, the
+ * thread hand-off costs more than it saves */
+#define MIN_SLICED_PIXELS (1920 * 1080 + 1)
+#define MAX_SLICES 8
+
+/* band heights are a multiple of this, which covers chroma subsampling and
+ * keeps swscale's 8 row dither pattern in phase across bands */
+#define SLICE_ROW_ALIGN 8
+
+/*
+ * Large frames are split into horizontal bands, each with its own swscale
+ * context.  Only conversions that do not scale vertically are split: with
+ * the same height and the same vertical chroma subsampling on both sides,
+ * swscale's vertical filters take a single source row for each output row,
+ * so a band needs no rows from its neighbours and there are no seams.  Any
+ * vertical scaling filters across band edges, those frames are scaled in one
+ * call.  The first band is scaled on the calling thread, the others on
+ * worker threads that live as long as the scaler.
+ */
+struct scale_slice {
+	struct video_scaler *scaler;
+	struct SwsContext *swscale;
+	int y;
+	int height;
+
+	pthread_t thread;
+	bool thread_created;
+	os_sem_t *start;
+	bool success;
+};
+
 struct video_scaler {
 	struct SwsContext *swscale;
 	int src_height;
+
+	const AVPixFmtDescriptor *src_desc;
+	const AVPixFmtDescriptor *dst_desc;
+	struct scale_slice *slices;
+	size_t num_slices;
+	os_sem_t *done;
+	volatile bool stop;
+
+	/* the frame being scaled, set before the workers are started */
+	const uint8_t *const *input;
+	const uint32_t *in_linesize;
+	uint8_t **output;
+	const uint32_t *out_linesize;
 };
 
+static volatile long scaler_threads = 0;
+
 static inline enum AVPixelFormat
 get_ffmpeg_video_format(enum video_format format)
 {
@@ -115,6 +164,202 @@ static inline int get_ffmpeg_range_type(enum video_range_type type)
 
 #define FIXED_1_0 (1 << 16)
 
+void video_scaler_set_threads(int threads)
+{
+	os_atomic_set_long(&scaler_threads, threads < 0 ? 0 : threads);
+}
+
+static size_t get_thread_count(void)
+{
+	long threads = os_atomic_load_long(&scaler_threads);
+
+	if (threads == 0) {
+		threads = os_get_logical_cores() / 2;
+		if (threads > 4)
+			threads = 4;
+	}
+
+	return threads < 1 ? 1 : (threads > MAX_SLICES ? MAX_SLICES : threads);
+}
+
+static inline int row_offset(const AVPixFmtDescriptor *desc, size_t plane,
+			     int y)
+{
+	/* planes 1 and 2 hold chroma for every format we map */
+	return (plane == 1 || plane == 2) ? y >> desc->log2_chroma_h : y;
+}
+
+static bool scale_slice(struct scale_slice *slice)
+{
+	struct video_scaler *scaler = slice->scaler;
+	const uint8_t *input[MAX_AV_PLANES];
+	uint8_t *output[MAX_AV_PLANES];
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		size_t in_y = (size_t)row_offset(scaler->src_desc, i, slice->y);
+		size_t out_y = (size_t)row_offset(scaler->dst_desc, i, slice->y);
+
+		input[i] = scaler->input[i]
+				   ? scaler->input[i] +
+					     in_y * scaler->in_linesize[i]
+				   : NULL;
+		output[i] = scaler->output[i]
+				    ? scaler->output[i] +
+					      out_y * scaler->out_linesize[i]
+				    : NULL;
+	}
+
+	return sws_scale(slice->swscale, input,
+			 (const int *)scaler->in_linesize, 0, slice->height,
+			 output, (const int *)scaler->out_linesize) > 0;
+}
+
+static void *scale_thread(void *data)
+{
+	struct scale_slice *slice = data;
+	struct video_scaler *scaler = slice->scaler;
+
+	os_set_thread_name("video-scaler: slice thread");
+
+	while (os_sem_wait(slice->start) == 0) {
+		if (scaler->stop)
+			break;
+
+		slice->success = scale_slice(slice);
+		os_sem_post(scaler->done);
+	}
+
+	return NULL;
+}
+
+static struct SwsContext *create_context(int src_w, int src_h,
+					 enum AVPixelFormat format_src,
+					 int dst_w, int dst_h,
+					 enum AVPixelFormat format_dst,
+					 int scale_type, const int *coeff_src,
+					 int range_src, const int *coeff_dst,
+					 int range_dst)
+{
+	struct SwsContext *swscale = sws_getCachedContext(
+		NULL, src_w, src_h, format_src, dst_w, dst_h, format_dst,
+		scale_type, NULL, NULL, NULL);
+	if (!swscale) {
+		blog(LOG_ERROR, "video_scaler_create: Could not create "
+				"swscale");
+		return NULL;
+	}
+
+	int ret = sws_setColorspaceDetails(swscale, coeff_src, range_src,
+					   coeff_dst, range_dst, 0, FIXED_1_0,
+					   FIXED_1_0);
+	if (ret < 0) {
+		blog(LOG_DEBUG, "video_scaler_create: "
+				"sws_setColorspaceDetails failed, ignoring");
+	}
+
+	return swscale;
+}
+
+/* number of SLICE_ROW_ALIGN row units the frame can be split into, 0 if
+ * the conversion scales vertically and cannot be split */
+static size_t get_slice_units(const struct video_scaler *scaler,
+			      const struct video_scale_info *dst,
+			      const struct video_scale_info *src)
+{
+	if (src->height != dst->height ||
+	    scaler->src_desc->log2_chroma_h != scaler->dst_desc->log2_chroma_h)
+		return 0;
+
+	return src->height / SLICE_ROW_ALIGN;
+}
+
+static bool create_slices(struct video_scaler *scaler,
+			  const struct video_scale_info *dst,
+			  const struct video_scale_info *src,
+			  enum AVPixelFormat format_src,
+			  enum AVPixelFormat format_dst, int scale_type,
+			  const int *coeff_src, int range_src,
+			  const int *coeff_dst, int range_dst)
+{
+	size_t count = get_thread_count();
+
+	if (count < 2 || (uint64_t)src->width * src->height < MIN_SLICED_PIXELS)
+		return false;
+
+	size_t units = get_slice_units(scaler, dst, src);
+	if (units < count)
+		count = units;
+	if (count < 2)
+		return false;
+
+	if (os_sem_init(&scaler->done, 0) != 0)
+		return false;
+
+	scaler->slices = bzalloc(sizeof(struct scale_slice) * count);
+	scaler->num_slices = count;
+
+	size_t first_unit = 0;
+	for (size_t i = 0; i < count; i++) {
+		struct scale_slice *slice = &scaler->slices[i];
+		size_t end_unit = units * (i + 1) / count;
+		int end_y = i == count - 1 ? (int)src->height
+					   : (int)end_unit * SLICE_ROW_ALIGN;
+
+		slice->scaler = scaler;
+		slice->y = (int)first_unit * SLICE_ROW_ALIGN;
+		slice->height = end_y - slice->y;
+		first_unit = end_unit;
+
+		slice->swscale = create_context(
+			src->width, slice->height, format_src, dst->width,
+			slice->height, format_dst, scale_type, coeff_src,
+			range_src, coeff_dst, range_dst);
+		if (!slice->swscale)
+			return false;
+
+		/* the first band runs on the calling thread */
+		if (i == 0)
+			continue;
+
+		if (os_sem_init(&slice->start, 0) != 0)
+			return false;
+		if (pthread_create(&slice->thread, NULL, scale_thread, slice) !=
+		    0)
+			return false;
+		slice->thread_created = true;
+	}
+
+	return true;
+}
+
+static void destroy_slices(struct video_scaler *scaler)
+{
+	if (!scaler->slices)
+		goto done;
+
+	scaler->stop = true;
+
+	for (size_t i = 0; i < scaler->num_slices; i++) {
+		struct scale_slice *slice = &scaler->slices[i];
+
+		if (slice->thread_created) {
+			os_sem_post(slice->start);
+			pthread_join(slice->thread, NULL);
+		}
+
+		os_sem_destroy(slice->start);
+		sws_freeContext(slice->swscale);
+	}
+
+	bfree(scaler->slices);
+	scaler->slices = NULL;
+	scaler->num_slices = 0;
+
+done:
+	os_sem_destroy(scaler->done);
+	scaler->done = NULL;
+}
+
 int video_scaler_create(video_scaler_t **scaler_out,
 			const struct video_scale_info *dst,
 			const struct video_scale_info *src,
@@ -128,7 +373,6 @@ int video_scaler_create(video_scaler_t **scaler_out,
 	int range_src = get_ffmpeg_range_type(src->range);
 	int range_dst = get_ffmpeg_range_type(dst->range);
 	struct video_scaler *scaler;
-	int ret;
 
 	if (!scaler_out)
 		return VIDEO_SCALER_FAILED;
@@ -138,23 +382,21 @@ int video_scaler_create(video_scaler_t **scaler_out,
 
 	scaler = bzalloc(sizeof(struct video_scaler));
 	scaler->src_height = src->height;
+	scaler->src_desc = av_pix_fmt_desc_get(format_src);
+	scaler->dst_desc = av_pix_fmt_desc_get(format_dst);
 
-	scaler->swscale = sws_getCachedContext(NULL, src->width, src->height,
-					       format_src, dst->width,
-					       dst->height, format_dst,
-					       scale_type, NULL, NULL, NULL);
-	if (!scaler->swscale) {
-		blog(LOG_ERROR, "video_scaler_create: Could not create "
-				"swscale");
-		goto fail;
-	}
+	if (!create_slices(scaler, dst, src, format_src, format_dst,
+			   scale_type, coeff_src, range_src, coeff_dst,
+			   range_dst)) {
+		/* fall back to scaling the whole frame in one call */
+		destroy_slices(scaler);
 
-	ret = sws_setColorspaceDetails(scaler->swscale, coeff_src, range_src,
-				       coeff_dst, range_dst, 0, FIXED_1_0,
-				       FIXED_1_0);
-	if (ret < 0) {
-		blog(LOG_DEBUG, "video_scaler_create: "
-				"sws_setColorspaceDetails failed, ignoring");
+		scaler->swscale = create_context(
+			src->width, src->height, format_src, dst->width,
+			dst->height, format_dst, scale_type, coeff_src,
+			range_src, coeff_dst, range_dst);
+		if (!scaler->swscale)
+			goto fail;
 	}
 
 	*scaler_out = scaler;
@@ -168,6 +410,7 @@ fail:
 void video_scaler_destroy(video_scaler_t *scaler)
 {
 	if (scaler) {
+		destroy_slices(scaler);
 		sws_freeContext(scaler->swscale);
 		bfree(scaler);
 	}
@@ -181,6 +424,30 @@ bool video_scaler_scale(video_scaler_t *scaler, uint8_t *output[],
 	if (!scaler)
 		return false;
 
+	if (scaler->slices) {
+		bool success = true;
+
+		scaler->input = input;
+		scaler->in_linesize = in_linesize;
+		scaler->output = output;
+		scaler->out_linesize = out_linesize;
+
+		for (size_t i = 1; i < scaler->num_slices; i++)
+			os_sem_post(scaler->slices[i].start);
+
+		success = scale_slice(&scaler->slices[0]);
+
+		for (size_t i = 1; i < scaler->num_slices; i++)
+			os_sem_wait(scaler->done);
+		for (size_t i = 1; i < scaler->num_slices; i++)
+			success = success && scaler->slices[i].success;
+
+		if (!success)
+			blog(LOG_ERROR, "video_scaler_scale: sws_scale failed "
+					"on a slice");
+		return success;
+	}
+
 	int ret = sws_scale(scaler->swscale, input, (const int *)in_linesize, 0,
 			    scaler->src_height, output,
 			    (const int *)out_linesize);
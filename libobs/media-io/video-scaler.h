@@ -37,6 +37,13 @@ EXPORT int video_scaler_create(video_scaler_t **scaler,
 			       enum video_scale_type type);
 EXPORT void video_scaler_destroy(video_scaler_t *scaler);
 
+/* Number of threads large frames (above 1080p) are scaled with, split into
+ * horizontal bands.  Only conversions that keep the frame height are split,
+ * vertical scaling is always done in one call.  0 picks a count from the
+ * number of cores, 1 always scales in one call.  Applies to scalers created
+ * afterwards. */
+EXPORT void video_scaler_set_threads(int threads);
+
 EXPORT bool video_scaler_scale(video_scaler_t *scaler, uint8_t *output[],
 			       const uint32_t out_linesize[],
 			       const uint8_t *const input[],
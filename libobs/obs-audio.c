@@ -17,6 +17,7 @@
 
 #include <inttypes.h>
 #include "obs-internal.h"
+#include "media-io/audio-mix.h"
 
 struct ts_info {
 	uint64_t start;
@@ -26,6 +27,10 @@ struct ts_info {
 #define DEBUG_AUDIO 0
 #define MAX_BUFFERING_TICKS 45
 
+struct audio_render_pool;
+static void add_render_edge(struct audio_render_pool *pool,
+			    obs_source_t *parent, obs_source_t *child);
+
 static void push_audio_tree(obs_source_t *parent, obs_source_t *source, void *p)
 {
 	struct obs_core_audio *audio = p;
@@ -36,7 +41,348 @@ static void push_audio_tree(obs_source_t *parent, obs_source_t *source, void *p)
 			da_push_back(audio->render_order, &s);
 	}
 
-	UNUSED_PARAMETER(parent);
+	if (parent && audio->render_pool)
+		add_render_edge(audio->render_pool, parent, source);
+}
+
+/* ------------------------------------------------------------------------- */
+/* obs_source_audio_render of the sources in render_order runs on a small pool
+ * of render threads, with the audio thread taking part.  That covers taking
+ * each source's audio out of its input buffer, copying it to its mixes and
+ * applying volume, the audio_render callbacks of scenes and transitions, and
+ * the audio_mix callbacks of submix sources (including the filters their
+ * output goes through).  A source only becomes ready once all of its active
+ * children have been rendered, so nested scenes and transitions see the same
+ * input they would with serial rendering.
+ *
+ * Everything else in the tick stays on the audio thread: building the render
+ * order, buffering and discarding, mixing the root sources into the output
+ * mixes, and the outputs and encoders.  Filters of sources that push audio
+ * with obs_source_output_audio run on that source's own thread and are not
+ * affected.
+ *
+ * A plain source render takes about 2.3us per tick (stereo, 1024 frames, six
+ * mixes), while waking a render thread costs about 2us on a single core and
+ * more when a core has to leave idle.  Below MIN_PARALLEL_SOURCES sources
+ * that actually render audio the wakeups cost as much as they save, so those
+ * ticks stay serial. */
+
+#define MAX_RENDER_THREADS 4
+#define MIN_PARALLEL_SOURCES 8
+
+struct render_edge {
+	obs_source_t *parent;
+	obs_source_t *child;
+};
+
+struct render_task {
+	obs_source_t *source;
+	volatile long deps;
+	size_t first_dependent;
+	size_t num_dependents;
+};
+
+struct audio_render_pool {
+	pthread_t threads[MAX_RENDER_THREADS];
+	size_t num_threads;
+
+	pthread_mutex_t mutex;
+	os_sem_t *work_sem;
+	os_event_t *done_event;
+	volatile bool stop;
+
+	/* parent/child pairs seen while building render_order */
+	DARRAY(struct render_edge) edges;
+
+	DARRAY(struct render_task) tasks;
+	DARRAY(size_t) dependents;
+	DARRAY(size_t) ready;
+	volatile long remaining;
+
+	uint32_t mixers;
+	size_t channels;
+	size_t sample_rate;
+	size_t size;
+};
+
+static void add_render_edge(struct audio_render_pool *pool,
+			    obs_source_t *parent, obs_source_t *child)
+{
+	struct render_edge edge = {parent, child};
+	da_push_back(pool->edges, &edge);
+}
+
+static void render_audio_source(obs_source_t *source, uint32_t mixers,
+				size_t channels, size_t sample_rate,
+				size_t size)
+{
+	/* renamed names are kept until the source is destroyed, so comparing
+	 * the pointer is enough to notice a rename */
+	if (source->profile_audio_render_src_name != source->context.name) {
+		source->profile_audio_render_src_name = source->context.name;
+		source->profile_audio_render_name = profile_store_name(
+			obs_get_profiler_name_store(), "audio_render(%s)",
+			source->context.name);
+	}
+
+	profile_start(source->profile_audio_render_name);
+	obs_source_audio_render(source, mixers, channels, sample_rate, size);
+	profile_end(source->profile_audio_render_name);
+}
+
+static void push_ready_task(struct audio_render_pool *pool, size_t idx)
+{
+	pthread_mutex_lock(&pool->mutex);
+	da_push_back(pool->ready, &idx);
+	pthread_mutex_unlock(&pool->mutex);
+
+	os_sem_post(pool->work_sem);
+}
+
+static bool run_render_task(struct audio_render_pool *pool)
+{
+	struct render_task *task;
+	size_t idx;
+
+	pthread_mutex_lock(&pool->mutex);
+	if (!pool->ready.num) {
+		pthread_mutex_unlock(&pool->mutex);
+		return false;
+	}
+
+	idx = pool->ready.array[pool->ready.num - 1];
+	da_pop_back(pool->ready);
+	pthread_mutex_unlock(&pool->mutex);
+
+	task = &pool->tasks.array[idx];
+	render_audio_source(task->source, pool->mixers, pool->channels,
+			    pool->sample_rate, pool->size);
+
+	for (size_t i = 0; i < task->num_dependents; i++) {
+		size_t dep = pool->dependents.array[task->first_dependent + i];
+
+		if (os_atomic_dec_long(&pool->tasks.array[dep].deps) == 0)
+			push_ready_task(pool, dep);
+	}
+
+	if (os_atomic_dec_long(&pool->remaining) == 0)
+		os_event_signal(pool->done_event);
+
+	return true;
+}
+
+static void *render_thread(void *param)
+{
+	struct audio_render_pool *pool = param;
+
+	os_set_thread_name("obs-audio: render thread");
+
+	const char *render_thread_name = profile_store_name(
+		obs_get_profiler_name_store(), "audio_render_thread");
+
+	while (os_sem_wait(pool->work_sem) == 0) {
+		if (os_atomic_load_bool(&pool->stop))
+			break;
+
+		profile_start(render_thread_name);
+		while (run_render_task(pool))
+			;
+		profile_end(render_thread_name);
+
+		profile_reenable_thread();
+	}
+
+	return NULL;
+}
+
+static inline bool find_task(struct audio_render_pool *pool,
+			     obs_source_t *source, size_t *idx)
+{
+	*idx = source->audio_render_idx;
+	return *idx < pool->tasks.num &&
+	       pool->tasks.array[*idx].source == source;
+}
+
+/* render_order lists children before their parents, so edges pointing the
+ * other way can only come from a cycle and are ignored rather than allowed
+ * to stall the tick */
+static void build_render_tasks(struct obs_core_audio *audio,
+			       struct audio_render_pool *pool)
+{
+	size_t num = audio->render_order.num;
+	size_t total = 0;
+
+	da_resize(pool->tasks, num);
+	memset(pool->tasks.array, 0, num * sizeof(struct render_task));
+
+	for (size_t i = 0; i < num; i++) {
+		obs_source_t *source = audio->render_order.array[i];
+		pool->tasks.array[i].source = source;
+		source->audio_render_idx = i;
+	}
+
+	for (size_t i = 0; i < pool->edges.num; i++) {
+		struct render_edge *edge = &pool->edges.array[i];
+		size_t parent, child;
+
+		if (!find_task(pool, edge->parent, &parent) ||
+		    !find_task(pool, edge->child, &child) || child >= parent)
+			continue;
+
+		pool->tasks.array[parent].deps++;
+		pool->tasks.array[child].num_dependents++;
+	}
+
+	for (size_t i = 0; i < num; i++) {
+		struct render_task *task = &pool->tasks.array[i];
+		task->first_dependent = total;
+		total += task->num_dependents;
+		task->num_dependents = 0;
+	}
+
+	da_resize(pool->dependents, total);
+
+	for (size_t i = 0; i < pool->edges.num; i++) {
+		struct render_edge *edge = &pool->edges.array[i];
+		struct render_task *task;
+		size_t parent, child;
+
+		if (!find_task(pool, edge->parent, &parent) ||
+		    !find_task(pool, edge->child, &child) || child >= parent)
+			continue;
+
+		task = &pool->tasks.array[child];
+		pool->dependents.array[task->first_dependent +
+				       task->num_dependents++] = parent;
+	}
+}
+
+/* video-only sources return from obs_source_audio_render right away */
+static inline bool renders_audio(const obs_source_t *source)
+{
+	return source->audio_output_buf[0][0] &&
+	       (source->info.audio_render || source->info.audio_mix ||
+		source->audio_ts);
+}
+
+static bool should_render_parallel(struct obs_core_audio *audio)
+{
+	size_t count = 0;
+
+	if (!audio->render_pool)
+		return false;
+
+	for (size_t i = 0; i < audio->render_order.num; i++) {
+		if (renders_audio(audio->render_order.array[i]) &&
+		    ++count == MIN_PARALLEL_SOURCES)
+			return true;
+	}
+
+	return false;
+}
+
+static void render_audio_sources(struct obs_core_audio *audio,
+				 uint32_t mixers, size_t channels,
+				 size_t sample_rate, size_t size)
+{
+	struct audio_render_pool *pool = audio->render_pool;
+
+	if (!should_render_parallel(audio)) {
+		for (size_t i = 0; i < audio->render_order.num; i++)
+			render_audio_source(audio->render_order.array[i],
+					    mixers, channels, sample_rate,
+					    size);
+		return;
+	}
+
+	build_render_tasks(audio, pool);
+
+	pool->mixers = mixers;
+	pool->channels = channels;
+	pool->sample_rate = sample_rate;
+	pool->size = size;
+	os_atomic_set_long(&pool->remaining, (long)pool->tasks.num);
+
+	for (size_t i = 0; i < pool->tasks.num; i++) {
+		if (!pool->tasks.array[i].deps)
+			push_ready_task(pool, i);
+	}
+
+	while (os_atomic_load_long(&pool->remaining) > 0) {
+		if (!run_render_task(pool))
+			os_event_wait(pool->done_event);
+	}
+}
+
+void obs_audio_render_pool_init(struct obs_core_audio *audio)
+{
+	struct audio_render_pool *pool;
+	int threads = os_get_logical_cores() - 1;
+
+	if (threads > MAX_RENDER_THREADS)
+		threads = MAX_RENDER_THREADS;
+	if (threads < 1)
+		return;
+
+	pool = bzalloc(sizeof(*pool));
+	pthread_mutex_init_value(&pool->mutex);
+
+	if (pthread_mutex_init(&pool->mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&pool->work_sem, 0) != 0)
+		goto fail;
+	if (os_event_init(&pool->done_event, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+
+	for (int i = 0; i < threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, render_thread,
+				   pool) != 0)
+			break;
+		pool->num_threads++;
+	}
+
+	if (!pool->num_threads)
+		goto fail;
+
+	blog(LOG_INFO, "Audio sources are rendered on %d render threads",
+	     (int)pool->num_threads);
+
+	audio->render_pool = pool;
+	return;
+
+fail:
+	blog(LOG_WARNING, "Failed to create audio render threads, "
+			  "rendering audio sources serially");
+	os_event_destroy(pool->done_event);
+	os_sem_destroy(pool->work_sem);
+	pthread_mutex_destroy(&pool->mutex);
+	bfree(pool);
+}
+
+void obs_audio_render_pool_free(struct obs_core_audio *audio)
+{
+	struct audio_render_pool *pool = audio->render_pool;
+
+	if (!pool)
+		return;
+
+	os_atomic_set_bool(&pool->stop, true);
+	for (size_t i = 0; i < pool->num_threads; i++)
+		os_sem_post(pool->work_sem);
+	for (size_t i = 0; i < pool->num_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	da_free(pool->edges);
+	da_free(pool->tasks);
+	da_free(pool->dependents);
+	da_free(pool->ready);
+
+	os_event_destroy(pool->done_event);
+	os_sem_destroy(pool->work_sem);
+	pthread_mutex_destroy(&pool->mutex);
+	bfree(pool);
+
+	audio->render_pool = NULL;
 }
 
 static inline size_t convert_time_to_frames(size_t sample_rate, uint64_t t)
@@ -45,12 +391,19 @@ static inline size_t convert_time_to_frames(size_t sample_rate, uint64_t t)
 }
 
 static inline void mix_audio(struct audio_output_data *mixes,
-			     obs_source_t *source, size_t channels,
-			     size_t sample_rate, struct ts_info *ts)
+			     obs_source_t *source, uint32_t mixers,
+			     size_t channels, size_t sample_rate,
+			     struct ts_info *ts)
 {
 	size_t total_floats = AUDIO_OUTPUT_FRAMES;
 	size_t start_point = 0;
 
+	/* muted sources and mixes the source is not assigned to are silent,
+	 * and inactive mixes are never output */
+	mixers &= source->audio_output_mixes;
+	if (!mixers)
+		return;
+
 	if (source->audio_ts < ts->start || ts->end <= source->audio_ts)
 		return;
 
@@ -63,20 +416,8 @@ static inline void mix_audio(struct audio_output_data *mixes,
 		total_floats -= start_point;
 	}
 
-	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
-		for (size_t ch = 0; ch < channels; ch++) {
-			register float *mix = mixes[mix_idx].data[ch];
-			register float *aud =
-				source->audio_output_buf[mix_idx][ch];
-			register float *end;
-
-			mix += start_point;
-			end = aud + total_floats;
-
-			while (aud < end)
-				*(mix++) += *(aud++);
-		}
-	}
+	audio_mix_add_mixes(mixes, source->audio_output_buf, mixers, channels,
+			    start_point, total_floats);
 }
 
 static void ignore_audio(obs_source_t *source, size_t channels,
@@ -229,6 +570,59 @@ static inline void discard_audio(struct obs_core_audio *audio,
 	source->audio_ts = ts->end;
 }
 
+static inline uint32_t buffering_ticks_to_ms(int ticks, size_t sample_rate)
+{
+	return (uint32_t)((uint64_t)ticks * AUDIO_OUTPUT_FRAMES * 1000 /
+			  sample_rate);
+}
+
+static void record_buffering_change(struct obs_core_audio *audio,
+				    size_t sample_rate, int prev_ticks)
+{
+	struct obs_audio_buffering_info *info = &audio->buffering_info;
+	struct obs_audio_buffering_change *change;
+	uint32_t ms = buffering_ticks_to_ms(audio->total_buffering_ticks,
+					    sample_rate);
+	uint32_t prev_ms = buffering_ticks_to_ms(prev_ticks, sample_rate);
+	struct calldata data;
+	uint8_t stack[128];
+
+	pthread_mutex_lock(&audio->buffering_mutex);
+
+	info->ms = ms;
+	if (ms > info->max_ms)
+		info->max_ms = ms;
+	if (ms > prev_ms)
+		info->increases++;
+	else
+		info->decreases++;
+
+	change = &audio->buffering_history[audio->buffering_history_pos];
+	change->timestamp = os_gettime_ns();
+	change->ms = ms;
+	change->prev_ms = prev_ms;
+
+	audio->buffering_history_pos =
+		(audio->buffering_history_pos + 1) % AUDIO_BUFFERING_HISTORY;
+	if (audio->buffering_history_num < AUDIO_BUFFERING_HISTORY)
+		audio->buffering_history_num++;
+
+	pthread_mutex_unlock(&audio->buffering_mutex);
+
+	calldata_init_fixed(&data, stack, sizeof(stack));
+	calldata_set_int(&data, "ms", ms);
+	calldata_set_int(&data, "prev_ms", prev_ms);
+	signal_handler_signal(obs->signals, "audio_buffering_changed", &data);
+}
+
+static inline void reset_headroom_window(struct obs_core_audio *audio)
+{
+	audio->headroom_bucket = 0;
+	audio->headroom_bucket_ticks = 0;
+	audio->headroom_buckets = 0;
+	audio->shrink_ticks = 0;
+}
+
 static void add_audio_buffering(struct obs_core_audio *audio,
 				size_t sample_rate, struct ts_info *ts,
 				uint64_t min_ts, const char *buffering_name)
@@ -238,6 +632,7 @@ static void add_audio_buffering(struct obs_core_audio *audio,
 	uint64_t frames;
 	size_t total_ms;
 	size_t ms;
+	int prev_ticks = audio->total_buffering_ticks;
 	int ticks;
 
 	if (audio->total_buffering_ticks == MAX_BUFFERING_TICKS)
@@ -300,6 +695,112 @@ static void add_audio_buffering(struct obs_core_audio *audio,
 	}
 
 	*ts = new_ts;
+
+	reset_headroom_window(audio);
+	record_buffering_change(audio, sample_rate, prev_ticks);
+}
+
+/* Headroom is how much audio a source has buffered past the end of the
+ * current tick.  While every source keeps more than a tick of headroom for
+ * the whole window, the extra ticks of buffering are not needed.
+ *
+ * Sources that have output audio and not stopped count even when they have
+ * nothing buffered or are waiting for audio, with no headroom, so a source
+ * that is late keeps buffering from being reduced. */
+static inline bool has_headroom(const struct obs_source *source)
+{
+	return !source->info.audio_render && source->audio_ts;
+}
+
+static inline uint64_t get_headroom(const struct obs_source *source,
+				    size_t sample_rate, const struct ts_info *ts)
+{
+	size_t frames = source->audio_input_buf[0].size / sizeof(float);
+	uint64_t end;
+
+	if (source->audio_pending || !frames)
+		return 0;
+
+	end = source->audio_ts + audio_frames_to_ns(sample_rate, frames);
+
+	return end > ts->end ? end - ts->end : 0;
+}
+
+static void update_headroom_window(struct obs_core_audio *audio,
+				   size_t sample_rate, uint64_t headroom)
+{
+	size_t bucket_ticks = sample_rate / AUDIO_OUTPUT_FRAMES;
+	uint64_t tick_ns = audio_frames_to_ns(sample_rate, AUDIO_OUTPUT_FRAMES);
+	uint64_t min_headroom = UINT64_MAX;
+	uint64_t *bucket;
+	int ticks;
+
+	if (!audio->total_buffering_ticks)
+		return;
+
+	bucket = &audio->headroom[audio->headroom_bucket];
+	if (!audio->headroom_bucket_ticks || headroom < *bucket)
+		*bucket = headroom;
+	if (++audio->headroom_bucket_ticks < bucket_ticks)
+		return;
+
+	audio->headroom_bucket_ticks = 0;
+	audio->headroom_bucket =
+		(audio->headroom_bucket + 1) % HEADROOM_WINDOW_BUCKETS;
+	if (audio->headroom_buckets < HEADROOM_WINDOW_BUCKETS)
+		audio->headroom_buckets++;
+	if (audio->headroom_buckets < HEADROOM_WINDOW_BUCKETS)
+		return;
+
+	for (size_t i = 0; i < HEADROOM_WINDOW_BUCKETS; i++) {
+		if (audio->headroom[i] < min_headroom)
+			min_headroom = audio->headroom[i];
+	}
+
+	/* no source had any audio buffered during the window */
+	if (min_headroom == UINT64_MAX)
+		return;
+
+	/* always keep a tick of headroom */
+	ticks = (int)(min_headroom / tick_ns) - 1;
+	if (ticks > audio->total_buffering_ticks)
+		ticks = audio->total_buffering_ticks;
+	if (ticks > 0)
+		audio->shrink_ticks = ticks;
+}
+
+/* Reduces buffering by outputting the oldest buffered ticks right away: the
+ * audio thread calls back once more for each of them, with an empty time
+ * range, and those calls do not queue a new tick.  Nothing is dropped, so
+ * encoders and raw outputs keep getting contiguous audio and timestamps
+ * while they are connected, the audio is just output early, which the
+ * sources' headroom covers. */
+static void drain_audio_buffering(struct obs_core_audio *audio,
+				  size_t sample_rate)
+{
+	size_t buffered = audio->buffered_timestamps.size /
+			  sizeof(struct ts_info);
+	int prev_ticks = audio->total_buffering_ticks;
+	int ticks = audio->shrink_ticks;
+
+	if ((size_t)ticks > buffered)
+		ticks = (int)buffered;
+
+	reset_headroom_window(audio);
+	if (ticks <= 0)
+		return;
+
+	audio_output_add_extra_ticks(audio->audio, ticks);
+	audio->total_buffering_ticks -= ticks;
+
+	blog(LOG_INFO,
+	     "removed %d milliseconds of audio buffering, total "
+	     "audio buffering is now %d milliseconds",
+	     (int)buffering_ticks_to_ms(ticks, sample_rate),
+	     (int)buffering_ticks_to_ms(audio->total_buffering_ticks,
+					sample_rate));
+
+	record_buffering_change(audio, sample_rate, prev_ticks);
 }
 
 static bool audio_buffer_insuffient(struct obs_source *source,
@@ -389,13 +890,26 @@ bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 	size_t sample_rate = audio_output_get_sample_rate(audio->audio);
 	size_t channels = audio_output_get_channels(audio->audio);
 	struct ts_info ts = {start_ts_in, end_ts_in};
+	bool adaptive = !os_atomic_load_bool(&audio->fixed_buffering);
+	uint64_t headroom = UINT64_MAX;
+	bool measure_headroom;
 	size_t audio_size;
 	uint64_t min_ts;
 
 	da_resize(audio->render_order, 0);
 	da_resize(audio->root_nodes, 0);
+	if (audio->render_pool)
+		da_resize(audio->render_pool->edges, 0);
+
+	/* the extra ticks of drain_audio_buffering output the next buffered
+	 * tick without queuing a new one */
+	if (start_ts_in != end_ts_in)
+		circlebuf_push_back(&audio->buffered_timestamps, &ts,
+				    sizeof(ts));
+
+	if (!adaptive)
+		reset_headroom_window(audio);
 
-	circlebuf_push_back(&audio->buffered_timestamps, &ts, sizeof(ts));
 	circlebuf_peek_front(&audio->buffered_timestamps, &ts, sizeof(ts));
 	min_ts = ts.start;
 
@@ -431,11 +945,7 @@ bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 
 	/* ------------------------------------------------ */
 	/* render audio data */
-	for (size_t i = 0; i < audio->render_order.num; i++) {
-		obs_source_t *source = audio->render_order.array[i];
-		obs_source_audio_render(source, mixers, channels, sample_rate,
-					audio_size);
-	}
+	render_audio_sources(audio, mixers, channels, sample_rate, audio_size);
 
 	/* ------------------------------------------------ */
 	/* get minimum audio timestamp */
@@ -461,8 +971,8 @@ bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 			pthread_mutex_lock(&source->audio_buf_mutex);
 
 			if (source->audio_output_buf[0][0] && source->audio_ts)
-				mix_audio(mixes, source, channels, sample_rate,
-					  &ts);
+				mix_audio(mixes, source, mixers, channels,
+					  sample_rate, &ts);
 
 			pthread_mutex_unlock(&source->audio_buf_mutex);
 		}
@@ -470,12 +980,22 @@ bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 
 	/* ------------------------------------------------ */
 	/* discard audio */
+	measure_headroom = adaptive && !audio->buffering_wait_ticks;
+
 	pthread_mutex_lock(&data->audio_sources_mutex);
 
 	source = data->first_audio_source;
 	while (source) {
 		pthread_mutex_lock(&source->audio_buf_mutex);
 		discard_audio(audio, source, channels, sample_rate, &ts);
+
+		if (measure_headroom && has_headroom(source)) {
+			uint64_t source_headroom =
+				get_headroom(source, sample_rate, &ts);
+			if (source_headroom < headroom)
+				headroom = source_headroom;
+		}
+
 		pthread_mutex_unlock(&source->audio_buf_mutex);
 
 		source = (struct obs_source *)source->next_audio_source;
@@ -483,12 +1003,18 @@ bool audio_callback(void *param, uint64_t start_ts_in, uint64_t end_ts_in,
 
 	pthread_mutex_unlock(&data->audio_sources_mutex);
 
+	if (measure_headroom)
+		update_headroom_window(audio, sample_rate, headroom);
+
 	/* ------------------------------------------------ */
 	/* release audio sources */
 	release_audio_sources(audio);
 
 	circlebuf_pop_front(&audio->buffered_timestamps, NULL, sizeof(ts));
 
+	if (audio->shrink_ticks)
+		drain_audio_buffering(audio, sample_rate);
+
 	*out_ts = ts.start;
 
 	if (audio->buffering_wait_ticks) {
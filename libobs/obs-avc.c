@@ -15,7 +15,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
-#include "obs.h"
+#include "obs-internal.h"
 #include "obs-avc.h"
 #include "util/array-serializer.h"
 
@@ -130,22 +130,39 @@ static void serialize_avc_data(struct serializer *s, const uint8_t *data,
 	}
 }
 
+/* writes to a preallocated buffer, or only counts bytes if there is none */
+struct packet_output {
+	uint8_t *data;
+	size_t size;
+};
+
+static size_t packet_output_write(void *param, const void *data, size_t size)
+{
+	struct packet_output *out = param;
+
+	if (out->data)
+		memcpy(out->data + out->size, data, size);
+	out->size += size;
+	return size;
+}
+
 void obs_parse_avc_packet(struct encoder_packet *avc_packet,
 			  const struct encoder_packet *src)
 {
-	struct array_output_data output;
-	struct serializer s;
-	long ref = 1;
+	struct packet_output out = {0};
+	struct serializer s = {.data = &out, .write = packet_output_write};
+	bool keyframe;
+	int priority;
 
-	array_output_serializer_init(&s, &output);
-	*avc_packet = *src;
+	/* size it first so the packet can go straight into pooled storage */
+	serialize_avc_data(&s, src->data, src->size, &keyframe, &priority);
+
+	out.data = obs_encoder_packet_alloc(avc_packet, src, out.size);
+	out.size = 0;
 
-	serialize(&s, &ref, sizeof(ref));
 	serialize_avc_data(&s, src->data, src->size, &avc_packet->keyframe,
 			   &avc_packet->priority);
 
-	avc_packet->data = output.bytes.array + sizeof(ref);
-	avc_packet->size = output.bytes.num - sizeof(ref);
 	avc_packet->drop_priority = get_drop_priority(avc_packet->priority);
 }
 
@@ -210,14 +210,33 @@ static void add_connection(struct obs_encoder *encoder)
 		if (gpu_encode_available(encoder)) {
 			start_gpu_encode(encoder);
 		} else {
+			encoder->last_video_ts = 0;
+			encoder->dropped_frames = 0;
+			encoder->lagged_frames = 0;
 			start_raw_video(encoder->media, &info, receive_video,
 					encoder);
+			video_output_set_input_queue(
+				encoder->media, receive_video, encoder,
+				encoder->video_queue_frames,
+				encoder->video_overflow);
 		}
 	}
 
 	set_encoder_active(encoder, true);
 }
 
+/* keeps the input's counters around after it disconnects */
+static void update_video_queue_stats(struct obs_encoder *encoder)
+{
+	struct video_input_stats stats;
+
+	if (video_output_get_input_stat(encoder->media, receive_video, encoder,
+					&stats)) {
+		encoder->dropped_frames = stats.dropped_frames;
+		encoder->lagged_frames = stats.lagged_frames;
+	}
+}
+
 static void remove_connection(struct obs_encoder *encoder, bool shutdown)
 {
 	if (encoder->info.type == OBS_ENCODER_AUDIO) {
@@ -227,7 +246,17 @@ static void remove_connection(struct obs_encoder *encoder, bool shutdown)
 		if (gpu_encode_available(encoder)) {
 			stop_gpu_encode(encoder);
 		} else {
+			update_video_queue_stats(encoder);
 			stop_raw_video(encoder->media, receive_video, encoder);
+
+			if (encoder->dropped_frames || encoder->lagged_frames)
+				blog(LOG_INFO,
+				     "encoder '%s': %u frames dropped, "
+				     "%u frames repeated due to encoding "
+				     "lag",
+				     obs_encoder_get_name(encoder),
+				     encoder->dropped_frames,
+				     encoder->lagged_frames);
 		}
 	}
 
@@ -697,6 +726,45 @@ void obs_encoder_set_scaled_size(obs_encoder_t *encoder, uint32_t width,
 	encoder->scaled_height = height;
 }
 
+void obs_encoder_set_video_queue(obs_encoder_t *encoder, size_t max_frames,
+				 enum video_input_overflow overflow)
+{
+	if (!obs_encoder_valid(encoder, "obs_encoder_set_video_queue"))
+		return;
+	if (encoder->info.type != OBS_ENCODER_VIDEO) {
+		blog(LOG_WARNING,
+		     "obs_encoder_set_video_queue: "
+		     "encoder '%s' is not a video encoder",
+		     obs_encoder_get_name(encoder));
+		return;
+	}
+
+	encoder->video_queue_frames = max_frames;
+	encoder->video_overflow = overflow;
+
+	/* applies right away if the encoder is receiving raw frames */
+	if (encoder->media)
+		video_output_set_input_queue(encoder->media, receive_video,
+					     encoder, max_frames, overflow);
+}
+
+uint32_t obs_encoder_get_dropped_frames(const obs_encoder_t *encoder)
+{
+	struct video_input_stats stats;
+
+	if (!obs_encoder_valid(encoder, "obs_encoder_get_dropped_frames"))
+		return 0;
+	if (encoder->info.type != OBS_ENCODER_VIDEO)
+		return 0;
+
+	if (encoder->media &&
+	    video_output_get_input_stat(encoder->media, receive_video,
+					(void *)encoder, &stats))
+		return stats.dropped_frames + stats.lagged_frames;
+
+	return encoder->dropped_frames + encoder->lagged_frames;
+}
+
 bool obs_encoder_scaling_enabled(const obs_encoder_t *encoder)
 {
 	if (!obs_encoder_valid(encoder, "obs_encoder_scaling_enabled"))
@@ -855,7 +923,7 @@ static void send_first_video_packet(struct obs_encoder *encoder,
 				    struct encoder_packet *packet)
 {
 	struct encoder_packet first_packet;
-	DARRAY(uint8_t) data;
+	uint8_t *data;
 	uint8_t *sei;
 	size_t size;
 
@@ -863,25 +931,21 @@ static void send_first_video_packet(struct obs_encoder *encoder,
 	if (!packet->keyframe)
 		return;
 
-	da_init(data);
-
 	if (!get_sei(encoder, &sei, &size) || !sei || !size) {
 		cb->new_packet(cb->param, packet);
 		cb->sent_first_packet = true;
 		return;
 	}
 
-	da_push_back_array(data, sei, size);
-	da_push_back_array(data, packet->data, packet->size);
-
-	first_packet = *packet;
-	first_packet.data = data.array;
-	first_packet.size = data.num;
+	data = obs_encoder_packet_alloc(&first_packet, packet,
+					size + packet->size);
+	memcpy(data, sei, size);
+	memcpy(data + size, packet->data, packet->size);
 
 	cb->new_packet(cb->param, &first_packet);
 	cb->sent_first_packet = true;
 
-	da_free(data);
+	obs_encoder_packet_release(&first_packet);
 }
 
 static inline void send_packet(struct obs_encoder *encoder,
@@ -944,15 +1008,21 @@ void send_off_encoder_packet(obs_encoder_t *encoder, bool success,
 		pkt->sys_dts_usec += encoder->pause.ts_offset / 1000;
 		pthread_mutex_unlock(&encoder->pause.mutex);
 
+		/* copied once, every callback references the same data */
+		struct encoder_packet out;
+		obs_encoder_packet_create_instance(&out, pkt);
+
 		pthread_mutex_lock(&encoder->callbacks_mutex);
 
 		for (size_t i = encoder->callbacks.num; i > 0; i--) {
 			struct encoder_callback *cb;
 			cb = encoder->callbacks.array + (i - 1);
-			send_packet(encoder, cb, pkt);
+			send_packet(encoder, cb, &out);
 		}
 
 		pthread_mutex_unlock(&encoder->callbacks_mutex);
+
+		obs_encoder_packet_release(&out);
 	}
 }
 
@@ -1014,6 +1084,19 @@ bool video_pause_check(struct pause_data *pause, uint64_t timestamp)
 	return ignore_frame;
 }
 
+/* frames skipped by the video queue's overflow policy leave a gap in the
+ * timestamps, keep the pts in step with it */
+static inline int64_t dropped_video_frames(const struct obs_encoder *encoder,
+					   uint64_t last_ts, uint64_t ts)
+{
+	uint64_t interval = video_output_get_frame_time(encoder->media);
+
+	if (!last_ts || ts <= last_ts || !interval)
+		return 0;
+
+	return (int64_t)((ts - last_ts + interval / 2) / interval) - 1;
+}
+
 static const char *receive_video_name = "receive_video";
 static void receive_video(void *param, struct video_data *frame)
 {
@@ -1022,6 +1105,9 @@ static void receive_video(void *param, struct video_data *frame)
 	struct obs_encoder *encoder = param;
 	struct obs_encoder *pair = encoder->paired_encoder;
 	struct encoder_frame enc_frame;
+	uint64_t last_ts = encoder->last_video_ts;
+
+	encoder->last_video_ts = frame->timestamp;
 
 	if (!encoder->first_received && pair) {
 		if (!pair->first_received ||
@@ -1042,6 +1128,10 @@ static void receive_video(void *param, struct video_data *frame)
 
 	if (!encoder->start_ts)
 		encoder->start_ts = frame->timestamp;
+	else
+		encoder->cur_pts += dropped_video_frames(encoder, last_ts,
+							 frame->timestamp) *
+				    encoder->timebase_num;
 
 	enc_frame.frames = 1;
 	enc_frame.pts = encoder->cur_pts;
@@ -1311,13 +1401,8 @@ void obs_encoder_remove_output(struct obs_encoder *encoder,
 void obs_encoder_packet_create_instance(struct encoder_packet *dst,
 					const struct encoder_packet *src)
 {
-	long *p_refs;
-
-	*dst = *src;
-	p_refs = bmalloc(src->size + sizeof(long));
-	dst->data = (void *)(p_refs + 1);
-	*p_refs = 1;
-	memcpy(dst->data, src->data, src->size);
+	uint8_t *data = obs_encoder_packet_alloc(dst, src, src->size);
+	memcpy(data, src->data, src->size);
 }
 
 /* OBS_DEPRECATED */
@@ -1339,10 +1424,8 @@ void obs_encoder_packet_ref(struct encoder_packet *dst,
 	if (!src)
 		return;
 
-	if (src->data) {
-		long *p_refs = ((long *)src->data) - 1;
-		os_atomic_inc_long(p_refs);
-	}
+	if (src->data)
+		obs_encoder_packet_data_addref(src->data);
 
 	*dst = *src;
 }
@@ -1352,11 +1435,8 @@ void obs_encoder_packet_release(struct encoder_packet *pkt)
 	if (!pkt)
 		return;
 
-	if (pkt->data) {
-		long *p_refs = ((long *)pkt->data) - 1;
-		if (os_atomic_dec_long(p_refs) == 0)
-			bfree(p_refs);
-	}
+	if (pkt->data)
+		obs_encoder_packet_data_release(pkt->data);
 
 	memset(pkt, 0, sizeof(struct encoder_packet));
 }
@@ -42,7 +42,17 @@ enum obs_encoder_type {
 
 /** Encoder output packet */
 struct encoder_packet {
-	uint8_t *data; /**< Packet data */
+	/**
+	 * Packet data
+	 *
+	 * Packets handed to outputs keep their data in a reference counted
+	 * block owned by libobs.  The block layout is private: only use
+	 * obs_encoder_packet_ref and obs_encoder_packet_release on packets
+	 * received from libobs, and never on data allocated elsewhere.  Up to
+	 * libobs 25.0 a long reference count directly preceded the data;
+	 * code that relied on that no longer works.
+	 */
+	uint8_t *data;
 	size_t size;   /**< Packet size */
 
 	int64_t pts; /**< Presentation timestamp */
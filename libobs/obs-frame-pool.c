@@ -0,0 +1,523 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "obs-internal.h"
+
+/* Process-wide pool for the frames sources cache their async video in.
+ * Frames are kept in classes keyed by (format, width, height) so a source
+ * that renegotiates its resolution, or a new source with the same format as
+ * an old one, reuses allocations instead of going back to the allocator.
+ *
+ * Each thread keeps a few frames of its own so the common case (a capture
+ * thread releasing and getting frames of the same size) does not touch the
+ * pool mutex.  Frames idle for longer than MAX_IDLE_NS are freed, and the
+ * pool and the thread caches together never hold more than max_idle_bytes
+ * of idle frames.
+ *
+ * Only frames allocated here have frame.pooled set.  Frames made with
+ * obs_source_frame_create (filters can hand those back to a source) are
+ * destroyed when released instead of being pooled. */
+
+#define THREAD_CACHE_FRAMES 4
+#define MAX_IDLE_NS 5000000000ULL
+#define EXPIRE_INTERVAL_NS 1000000000ULL
+#define DEFAULT_MAX_IDLE_BYTES (256 * 1024 * 1024)
+
+struct pooled_frame {
+	/* must be first, frames are freed with obs_source_frame_destroy when
+	 * they leave the pool, and frame.pooled tells the rest of this
+	 * structure exists */
+	struct obs_source_frame frame;
+
+	enum video_format format;
+	uint32_t width;
+	uint32_t height;
+	size_t size;
+	uint64_t idle_since;
+
+	/* set for frames wrapping caller-owned planes, which are handed back
+	 * to their owner instead of being pooled */
+	void (*release)(void *param);
+	void *release_param;
+};
+
+struct frame_class {
+	enum video_format format;
+	uint32_t width;
+	uint32_t height;
+
+	/* oldest first */
+	DARRAY(struct pooled_frame *) frames;
+};
+
+struct thread_cache {
+	struct pooled_frame *frames[THREAD_CACHE_FRAMES];
+	size_t num;
+};
+
+static struct {
+	pthread_once_t init_token;
+	pthread_key_t thread_key;
+	pthread_mutex_t mutex;
+
+	DARRAY(struct frame_class) classes;
+	size_t frames_held;
+	size_t bytes_held;
+	size_t max_idle_bytes;
+	uint64_t last_expire;
+
+	volatile long hits;
+	volatile long misses;
+	volatile long trimmed;
+	volatile long thread_cached;
+
+	/* in KiB so the count fits a 32-bit long */
+	volatile long thread_cached_kib;
+	volatile long max_idle_kib;
+} pool = {
+	.init_token = PTHREAD_ONCE_INIT,
+	.max_idle_bytes = DEFAULT_MAX_IDLE_BYTES,
+	.max_idle_kib = DEFAULT_MAX_IDLE_BYTES / 1024,
+};
+
+static inline long size_kib(size_t size)
+{
+	return (long)((size + 1023) / 1024);
+}
+
+static inline void add_thread_cached_kib(long kib)
+{
+	long val;
+
+	do {
+		val = os_atomic_load_long(&pool.thread_cached_kib);
+	} while (!os_atomic_compare_swap_long(&pool.thread_cached_kib, val,
+					      val + kib));
+}
+
+static inline uint32_t plane_height(enum video_format format, size_t plane,
+				    uint32_t height)
+{
+	switch (format) {
+	case VIDEO_FORMAT_I420:
+	case VIDEO_FORMAT_NV12:
+	case VIDEO_FORMAT_I40A:
+		return (plane == 1 || plane == 2) ? height / 2 : height;
+	default:
+		return height;
+	}
+}
+
+static size_t frame_size(const struct obs_source_frame *frame)
+{
+	size_t size = 0;
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		if (!frame->data[i])
+			break;
+		size += (size_t)frame->linesize[i] *
+			plane_height(frame->format, i, frame->height);
+	}
+
+	return size;
+}
+
+static inline void free_pooled_frame(struct pooled_frame *pf)
+{
+	obs_source_frame_destroy(&pf->frame);
+}
+
+static inline bool class_matches(const struct frame_class *fc,
+				 enum video_format format, uint32_t width,
+				 uint32_t height)
+{
+	return fc->format == format && fc->width == width &&
+	       fc->height == height;
+}
+
+static struct frame_class *find_class(enum video_format format,
+				      uint32_t width, uint32_t height)
+{
+	for (size_t i = 0; i < pool.classes.num; i++) {
+		struct frame_class *fc = &pool.classes.array[i];
+		if (class_matches(fc, format, width, height))
+			return fc;
+	}
+
+	return NULL;
+}
+
+static inline void remove_held(struct frame_class *fc, size_t idx)
+{
+	struct pooled_frame *pf = fc->frames.array[idx];
+
+	da_erase(fc->frames, idx);
+	pool.frames_held--;
+	pool.bytes_held -= pf->size;
+}
+
+/* pool.mutex must be held */
+static void remove_empty_classes(void)
+{
+	for (size_t i = pool.classes.num; i > 0; i--) {
+		struct frame_class *fc = &pool.classes.array[i - 1];
+		if (!fc->frames.num) {
+			da_free(fc->frames);
+			da_erase(pool.classes, i - 1);
+		}
+	}
+}
+
+/* pool.mutex must be held, max_bytes includes what the thread caches hold */
+static void trim_to(size_t max_bytes, uint64_t expire_before)
+{
+	size_t thread_bytes =
+		(size_t)os_atomic_load_long(&pool.thread_cached_kib) * 1024;
+	bool removed = false;
+
+	max_bytes = max_bytes > thread_bytes ? max_bytes - thread_bytes : 0;
+
+	if (expire_before) {
+		for (size_t i = 0; i < pool.classes.num; i++) {
+			struct frame_class *fc = &pool.classes.array[i];
+
+			while (fc->frames.num &&
+			       fc->frames.array[0]->idle_since < expire_before) {
+				struct pooled_frame *pf = fc->frames.array[0];
+				remove_held(fc, 0);
+				free_pooled_frame(pf);
+				os_atomic_inc_long(&pool.trimmed);
+				removed = true;
+			}
+		}
+	}
+
+	while (pool.bytes_held > max_bytes) {
+		struct frame_class *oldest = NULL;
+
+		for (size_t i = 0; i < pool.classes.num; i++) {
+			struct frame_class *fc = &pool.classes.array[i];
+			if (!fc->frames.num)
+				continue;
+			if (!oldest || fc->frames.array[0]->idle_since <
+					       oldest->frames.array[0]->idle_since)
+				oldest = fc;
+		}
+
+		if (!oldest)
+			break;
+
+		struct pooled_frame *pf = oldest->frames.array[0];
+		remove_held(oldest, 0);
+		free_pooled_frame(pf);
+		os_atomic_inc_long(&pool.trimmed);
+		removed = true;
+	}
+
+	if (removed)
+		remove_empty_classes();
+}
+
+/* pool.mutex must be held */
+static inline void expire_idle(uint64_t now)
+{
+	if (now - pool.last_expire < EXPIRE_INTERVAL_NS)
+		return;
+
+	pool.last_expire = now;
+	if (now > MAX_IDLE_NS)
+		trim_to(pool.max_idle_bytes, now - MAX_IDLE_NS);
+}
+
+static void release_to_pool(struct pooled_frame *pf)
+{
+	struct frame_class *fc;
+
+	pthread_mutex_lock(&pool.mutex);
+
+	fc = find_class(pf->format, pf->width, pf->height);
+	if (!fc) {
+		fc = da_push_back_new(pool.classes);
+		fc->format = pf->format;
+		fc->width = pf->width;
+		fc->height = pf->height;
+	}
+
+	da_push_back(fc->frames, &pf);
+	pool.frames_held++;
+	pool.bytes_held += pf->size;
+
+	trim_to(pool.max_idle_bytes, 0);
+	expire_idle(pf->idle_since);
+
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+static struct pooled_frame *get_from_pool(enum video_format format,
+					  uint32_t width, uint32_t height)
+{
+	struct pooled_frame *pf = NULL;
+	struct frame_class *fc;
+
+	pthread_mutex_lock(&pool.mutex);
+
+	fc = find_class(format, width, height);
+	if (fc && fc->frames.num) {
+		/* newest first, it is the most likely to still be in cache */
+		pf = fc->frames.array[fc->frames.num - 1];
+		remove_held(fc, fc->frames.num - 1);
+	}
+
+	expire_idle(os_gettime_ns());
+
+	pthread_mutex_unlock(&pool.mutex);
+	return pf;
+}
+
+static inline void thread_cache_remove(struct thread_cache *cache, size_t idx)
+{
+	add_thread_cached_kib(-size_kib(cache->frames[idx]->size));
+
+	cache->num--;
+	memmove(cache->frames + idx, cache->frames + idx + 1,
+		(cache->num - idx) * sizeof(cache->frames[0]));
+	os_atomic_dec_long(&pool.thread_cached);
+}
+
+static void thread_cache_flush(struct thread_cache *cache)
+{
+	while (cache->num) {
+		struct pooled_frame *pf = cache->frames[0];
+		thread_cache_remove(cache, 0);
+		release_to_pool(pf);
+	}
+}
+
+static void thread_cache_destroy(void *data)
+{
+	struct thread_cache *cache = data;
+
+	thread_cache_flush(cache);
+	bfree(cache);
+}
+
+static void init_pool(void)
+{
+	pthread_mutex_init_value(&pool.mutex);
+	if (pthread_mutex_init(&pool.mutex, NULL) != 0)
+		blog(LOG_ERROR, "Failed to create frame pool mutex");
+	if (pthread_key_create(&pool.thread_key, thread_cache_destroy) != 0)
+		blog(LOG_ERROR, "Failed to create frame pool thread key");
+}
+
+static inline void init_pool_once(void)
+{
+	pthread_once(&pool.init_token, init_pool);
+}
+
+static struct thread_cache *get_thread_cache(void)
+{
+	struct thread_cache *cache = pthread_getspecific(pool.thread_key);
+	if (!cache) {
+		cache = bzalloc(sizeof(*cache));
+		pthread_setspecific(pool.thread_key, cache);
+	}
+
+	return cache;
+}
+
+/* hands frames this thread has not reused for a while to the shared pool so
+ * other threads can have them */
+static void thread_cache_flush_idle(struct thread_cache *cache, uint64_t now)
+{
+	while (cache->num && now - cache->frames[0]->idle_since > MAX_IDLE_NS) {
+		struct pooled_frame *pf = cache->frames[0];
+		thread_cache_remove(cache, 0);
+		release_to_pool(pf);
+	}
+}
+
+struct obs_source_frame *obs_frame_pool_get(enum video_format format,
+					    uint32_t width, uint32_t height)
+{
+	struct thread_cache *cache;
+	struct pooled_frame *pf = NULL;
+
+	init_pool_once();
+	cache = get_thread_cache();
+
+	for (size_t i = cache->num; i > 0; i--) {
+		struct pooled_frame *cur = cache->frames[i - 1];
+		if (cur->format == format && cur->width == width &&
+		    cur->height == height) {
+			pf = cur;
+			thread_cache_remove(cache, i - 1);
+			break;
+		}
+	}
+
+	if (!pf)
+		pf = get_from_pool(format, width, height);
+
+	if (pf) {
+		uint8_t *data[MAX_AV_PLANES];
+		uint32_t linesize[MAX_AV_PLANES];
+
+		memcpy(data, pf->frame.data, sizeof(data));
+		memcpy(linesize, pf->frame.linesize, sizeof(linesize));
+		memset(&pf->frame, 0, sizeof(pf->frame));
+		memcpy(pf->frame.data, data, sizeof(data));
+		memcpy(pf->frame.linesize, linesize, sizeof(linesize));
+
+		pf->frame.format = format;
+		pf->frame.width = width;
+		pf->frame.height = height;
+		pf->frame.pooled = true;
+
+		os_atomic_inc_long(&pool.hits);
+		return &pf->frame;
+	}
+
+	pf = bzalloc(sizeof(*pf));
+	obs_source_frame_init(&pf->frame, format, width, height);
+	pf->frame.pooled = true;
+	pf->format = format;
+	pf->width = width;
+	pf->height = height;
+	pf->size = frame_size(&pf->frame);
+
+	os_atomic_inc_long(&pool.misses);
+	return &pf->frame;
+}
+
+struct obs_source_frame *obs_frame_pool_wrap(const struct obs_source_frame *src,
+					     void (*release)(void *param),
+					     void *param)
+{
+	struct pooled_frame *pf = bzalloc(sizeof(*pf));
+
+	pf->frame = *src;
+	pf->frame.refs = 0;
+	pf->frame.prev_frame = false;
+	pf->frame.pooled = true;
+	pf->format = src->format;
+	pf->width = src->width;
+	pf->height = src->height;
+	pf->release = release;
+	pf->release_param = param;
+	return &pf->frame;
+}
+
+void obs_frame_pool_release(struct obs_source_frame *frame)
+{
+	struct pooled_frame *pf = (struct pooled_frame *)frame;
+	struct thread_cache *cache;
+	uint64_t now;
+
+	if (!frame)
+		return;
+
+	if (!frame->pooled) {
+		obs_source_frame_destroy(frame);
+		return;
+	}
+
+	if (pf->release) {
+		pf->release(pf->release_param);
+		bfree(pf);
+		return;
+	}
+
+	init_pool_once();
+	cache = get_thread_cache();
+	now = os_gettime_ns();
+	pf->idle_since = now;
+
+	thread_cache_flush_idle(cache, now);
+
+	if (cache->num == THREAD_CACHE_FRAMES) {
+		struct pooled_frame *oldest = cache->frames[0];
+		thread_cache_remove(cache, 0);
+		release_to_pool(oldest);
+	}
+
+	/* past the idle limit the frame goes to the pool, which trims */
+	if (os_atomic_load_long(&pool.thread_cached_kib) + size_kib(pf->size) >
+	    os_atomic_load_long(&pool.max_idle_kib)) {
+		release_to_pool(pf);
+		return;
+	}
+
+	add_thread_cached_kib(size_kib(pf->size));
+	cache->frames[cache->num++] = pf;
+	os_atomic_inc_long(&pool.thread_cached);
+}
+
+void obs_frame_pool_get_stats(struct obs_frame_pool_stats *stats)
+{
+	if (!obs_ptr_valid(stats, "obs_frame_pool_get_stats"))
+		return;
+
+	init_pool_once();
+
+	pthread_mutex_lock(&pool.mutex);
+	stats->classes = pool.classes.num;
+	stats->frames_held = pool.frames_held;
+	stats->bytes_held = pool.bytes_held;
+	stats->max_idle_bytes = pool.max_idle_bytes;
+	pthread_mutex_unlock(&pool.mutex);
+
+	stats->thread_cached_frames = (size_t)os_atomic_load_long(
+		&pool.thread_cached);
+	stats->hits = (uint32_t)os_atomic_load_long(&pool.hits);
+	stats->misses = (uint32_t)os_atomic_load_long(&pool.misses);
+	stats->trimmed = (uint32_t)os_atomic_load_long(&pool.trimmed);
+}
+
+void obs_frame_pool_set_max_idle_bytes(size_t max_bytes)
+{
+	init_pool_once();
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.max_idle_bytes = max_bytes;
+	os_atomic_set_long(&pool.max_idle_kib, (long)(max_bytes / 1024));
+	trim_to(max_bytes, 0);
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+void obs_frame_pool_trim(size_t max_bytes)
+{
+	struct thread_cache *cache;
+
+	init_pool_once();
+
+	/* the calling thread's own cache is returned and freed too (the main
+	 * thread's cache would otherwise outlive obs_shutdown), other threads'
+	 * caches are flushed as those threads use the pool or exit */
+	cache = pthread_getspecific(pool.thread_key);
+	if (cache) {
+		thread_cache_flush(cache);
+		pthread_setspecific(pool.thread_key, NULL);
+		bfree(cache);
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	trim_to(max_bytes, 0);
+	blog(LOG_DEBUG, "Frame pool trimmed to %zu bytes (%zu frames held)",
+	     pool.bytes_held, pool.frames_held);
+	pthread_mutex_unlock(&pool.mutex);
+}
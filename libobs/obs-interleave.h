@@ -0,0 +1,136 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "util/darray.h"
+#include "obs.h"
+
+/* Packets waiting to be interleaved are queued per track (video and each
+ * audio mix) in dts order, seq records arrival order for timestamp ties.
+ * Kept apart from obs-output.c so test/test-output-interleave can run the
+ * same code. */
+
+struct interleaved_packet {
+	struct encoder_packet packet;
+	uint64_t seq;
+};
+
+struct interleave_queue {
+	DARRAY(struct interleaved_packet) packets;
+	size_t head;
+};
+
+static inline size_t interleave_queue_size(const struct interleave_queue *queue)
+{
+	return queue->packets.num - queue->head;
+}
+
+static inline struct interleaved_packet *
+interleave_queue_get(struct interleave_queue *queue, size_t idx)
+{
+	return queue->packets.array + queue->head + idx;
+}
+
+static inline struct interleaved_packet *
+interleave_queue_first(struct interleave_queue *queue)
+{
+	return interleave_queue_size(queue) ? interleave_queue_get(queue, 0)
+					    : NULL;
+}
+
+static inline struct interleaved_packet *
+interleave_queue_last(struct interleave_queue *queue)
+{
+	size_t size = interleave_queue_size(queue);
+	return size ? interleave_queue_get(queue, size - 1) : NULL;
+}
+
+/* popped packets are only compacted away once they make up half of the
+ * array, which keeps popping amortized O(1) */
+static inline void interleave_queue_pop(struct interleave_queue *queue)
+{
+	if (++queue->head == queue->packets.num) {
+		da_resize(queue->packets, 0);
+		queue->head = 0;
+
+	} else if (queue->head >= 32 && queue->head * 2 >= queue->packets.num) {
+		da_erase_range(queue->packets, 0, queue->head);
+		queue->head = 0;
+	}
+}
+
+static inline void interleave_queue_free(struct interleave_queue *queue)
+{
+	for (size_t i = 0; i < interleave_queue_size(queue); i++)
+		obs_encoder_packet_release(
+			&interleave_queue_get(queue, i)->packet);
+	da_free(queue->packets);
+	queue->head = 0;
+}
+
+/* packets are sent in dts order.  on equal timestamps video goes first, then
+ * whatever arrived first */
+static inline bool interleave_packet_before(const struct interleaved_packet *a,
+					    const struct interleaved_packet *b)
+{
+	if (a->packet.dts_usec != b->packet.dts_usec)
+		return a->packet.dts_usec < b->packet.dts_usec;
+	if (a->packet.type != b->packet.type)
+		return a->packet.type == OBS_ENCODER_VIDEO;
+	return a->seq < b->seq;
+}
+
+static inline void
+interleave_queue_insert(struct interleave_queue *queue,
+			const struct interleaved_packet *packet)
+{
+	size_t idx = queue->packets.num;
+
+	/* packets of a track nearly always arrive in order, so this normally
+	 * appends */
+	while (idx > queue->head &&
+	       interleave_packet_before(packet, &queue->packets.array[idx - 1]))
+		idx--;
+
+	da_insert(queue->packets, idx, packet);
+}
+
+/* each track is already in order, so the next packet is the earliest of the
+ * track heads */
+static inline struct interleave_queue *
+interleave_next_queue(struct interleave_queue *video,
+		      struct interleave_queue *audio)
+{
+	struct interleave_queue *next = NULL;
+
+	if (interleave_queue_size(video))
+		next = video;
+
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++) {
+		struct interleave_queue *queue = &audio[i];
+
+		if (!interleave_queue_size(queue))
+			continue;
+		if (!next || interleave_packet_before(
+				     interleave_queue_first(queue),
+				     interleave_queue_first(next)))
+			next = queue;
+	}
+
+	return next;
+}
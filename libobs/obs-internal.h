@@ -35,9 +35,11 @@
 #include "media-io/audio-io.h"
 
 #include "obs.h"
+#include "obs-interleave.h"
 
 #define NUM_TEXTURES 2
 #define NUM_CHANNELS 3
+#define MAX_CONVERT_BANDS 4
 #define MICROSECOND_DEN 1000000
 #define NUM_ENCODE_TEXTURES 3
 #define NUM_ENCODE_TEXTURE_FRAMES_TO_WAIT 1
@@ -239,6 +241,14 @@ struct obs_task_info {
 	void *param;
 };
 
+struct obs_convert_band {
+	pthread_t thread;
+	bool thread_created;
+	os_sem_t *start;
+	uint32_t start_y;
+	uint32_t end_y;
+};
+
 struct obs_core_video {
 	graphics_t *graphics;
 	gs_stagesurf_t *copy_surfaces[NUM_TEXTURES][NUM_CHANNELS];
@@ -292,6 +302,16 @@ struct obs_core_video {
 	bool conversion_needed;
 	float conversion_width_i;
 
+	/* RGBA -> YUV on the CPU when GPU conversion is off, split into row
+	 * bands, band 0 runs on the graphics thread */
+	bool cpu_conversion;
+	struct obs_convert_band convert_bands[MAX_CONVERT_BANDS];
+	size_t num_convert_bands;
+	os_sem_t *convert_done;
+	volatile bool convert_stop;
+	const struct video_data *convert_input;
+	struct video_frame *convert_output;
+
 	uint32_t output_width;
 	uint32_t output_height;
 	uint32_t base_width;
@@ -318,17 +338,37 @@ struct obs_core_video {
 
 struct audio_monitor;
 
+/* adaptive buffering keeps the lowest source headroom of each ~1 second
+ * bucket over a sliding window of this many buckets */
+#define HEADROOM_WINDOW_BUCKETS 10
+#define AUDIO_BUFFERING_HISTORY 32
+
 struct obs_core_audio {
 	audio_t *audio;
 
 	DARRAY(struct obs_source *) render_order;
 	DARRAY(struct obs_source *) root_nodes;
+	struct audio_render_pool *render_pool;
 
 	uint64_t buffered_ts;
 	struct circlebuf buffered_timestamps;
 	int buffering_wait_ticks;
 	int total_buffering_ticks;
 
+	volatile bool fixed_buffering;
+	uint64_t headroom[HEADROOM_WINDOW_BUCKETS];
+	size_t headroom_bucket;
+	size_t headroom_bucket_ticks;
+	size_t headroom_buckets;
+	int shrink_ticks;
+
+	pthread_mutex_t buffering_mutex;
+	struct obs_audio_buffering_info buffering_info;
+	struct obs_audio_buffering_change
+		buffering_history[AUDIO_BUFFERING_HISTORY];
+	size_t buffering_history_pos;
+	size_t buffering_history_num;
+
 	float user_volume;
 
 	pthread_mutex_t monitoring_mutex;
@@ -435,12 +475,16 @@ struct obs_core {
 extern struct obs_core *obs;
 
 extern void *obs_graphics_thread(void *param);
+extern bool obs_init_cpu_conversion(void);
+extern void obs_free_cpu_conversion(void);
 
 extern gs_effect_t *obs_load_effect(gs_effect_t **effect, const char *file);
 
 extern bool audio_callback(void *param, uint64_t start_ts_in,
 			   uint64_t end_ts_in, uint64_t *out_ts,
 			   uint32_t mixers, struct audio_output_data *mixes);
+extern void obs_audio_render_pool_init(struct obs_core_audio *audio);
+extern void obs_audio_render_pool_free(struct obs_core_audio *audio);
 
 extern void
 start_raw_video(video_t *video, const struct video_scale_info *conversion,
@@ -537,8 +581,22 @@ struct async_frame {
 	struct obs_source_frame *frame;
 	long unused_count;
 	bool used;
+	bool external;
 };
 
+/* Frames from the pool are obs_source_frames like any other, but must go
+ * back through obs_frame_pool_release instead of obs_source_frame_destroy */
+extern struct obs_source_frame *obs_frame_pool_get(enum video_format format,
+						   uint32_t width,
+						   uint32_t height);
+extern void obs_frame_pool_release(struct obs_source_frame *frame);
+
+/* Wraps caller-owned planes without copying them, release(param) is called
+ * instead of pooling the frame once obs_frame_pool_release is called on it */
+extern struct obs_source_frame *
+obs_frame_pool_wrap(const struct obs_source_frame *frame,
+		    void (*release)(void *param), void *param);
+
 enum audio_action_type {
 	AUDIO_ACTION_VOL,
 	AUDIO_ACTION_MUTE,
@@ -634,6 +692,12 @@ struct obs_source {
 	struct obs_audio_data audio_data;
 	size_t audio_storage_size;
 	uint32_t audio_mixers;
+	/* mixes of audio_output_buf that may hold sound this tick, the others
+	 * are known to be silent */
+	uint32_t audio_output_mixes;
+	size_t audio_render_idx;
+	const char *profile_audio_render_name;
+	const char *profile_audio_render_src_name;
 	float user_volume;
 	float volume;
 	int64_t sync_offset;
@@ -905,7 +969,9 @@ struct obs_output {
 	pthread_t end_data_capture_thread;
 	os_event_t *stopping_event;
 	pthread_mutex_t interleaved_mutex;
-	DARRAY(struct encoder_packet) interleaved_packets;
+	struct interleave_queue interleaved_video;
+	struct interleave_queue interleaved_audio[MAX_AUDIO_MIXES];
+	uint64_t interleaved_seq;
 	int stop_code;
 
 	int reconnect_retry_sec;
@@ -998,6 +1064,17 @@ extern void obs_output_remove_encoder(struct obs_output *output,
 extern void
 obs_encoder_packet_create_instance(struct encoder_packet *dst,
 				   const struct encoder_packet *src);
+
+/* Packet payloads live in pooled, reference counted blocks.  Packets given to
+ * encoder callbacks are always backed by one, so callbacks take references
+ * with obs_encoder_packet_ref instead of copying.  alloc copies src's fields
+ * into dst and gives it an uninitialized payload of size bytes. */
+extern uint8_t *obs_encoder_packet_alloc(struct encoder_packet *dst,
+					 const struct encoder_packet *src,
+					 size_t size);
+extern void obs_encoder_packet_data_addref(uint8_t *data);
+extern void obs_encoder_packet_data_release(uint8_t *data);
+extern void obs_encoder_packet_pool_free(void);
 void obs_output_destroy(obs_output_t *output);
 
 /* ------------------------------------------------------------------------- */
@@ -1036,6 +1113,13 @@ struct obs_encoder {
 	uint32_t scaled_height;
 	enum video_format preferred_format;
 
+	/* raw video queue, see video_output_set_input_queue */
+	size_t video_queue_frames;
+	enum video_input_overflow video_overflow;
+	uint64_t last_video_ts;
+	uint32_t dropped_frames;
+	uint32_t lagged_frames;
+
 	volatile bool active;
 	volatile bool paused;
 	bool initialized;
@@ -168,10 +168,9 @@ fail:
 
 static inline void free_packets(struct obs_output *output)
 {
-	for (size_t i = 0; i < output->interleaved_packets.num; i++)
-		obs_encoder_packet_release(output->interleaved_packets.array +
-					   i);
-	da_free(output->interleaved_packets);
+	interleave_queue_free(&output->interleaved_video);
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++)
+		interleave_queue_free(&output->interleaved_audio[i]);
 }
 
 static inline void clear_audio_buffers(obs_output_t *output)
@@ -1208,24 +1207,18 @@ static const uint8_t nal_start[4] = {0, 0, 0, 1};
 
 static bool add_caption(struct obs_output *output, struct encoder_packet *out)
 {
-	struct encoder_packet backup = *out;
+	struct encoder_packet captioned;
 	caption_frame_t cf;
 	sei_t sei;
 	uint8_t *data;
+	uint8_t *dst;
 	size_t size;
-	long ref = 1;
-
-	DARRAY(uint8_t) out_data;
 
 	if (out->priority > 1)
 		return false;
 
 	sei_init(&sei, 0.0);
 
-	da_init(out_data);
-	da_push_back_array(out_data, &ref, sizeof(ref));
-	da_push_back_array(out_data, out->data, out->size);
-
 	caption_frame_init(&cf);
 	caption_frame_from_text(&cf, &output->caption_head->text[0]);
 
@@ -1233,16 +1226,18 @@ static bool add_caption(struct obs_output *output, struct encoder_packet *out)
 
 	data = malloc(sei_render_size(&sei));
 	size = sei_render(&sei, data);
+
 	/* TODO SEI should come after AUD/SPS/PPS, but before any VCL */
-	da_push_back_array(out_data, nal_start, 4);
-	da_push_back_array(out_data, data, size);
+	dst = obs_encoder_packet_alloc(&captioned, out,
+				       out->size + sizeof(nal_start) + size);
+	memcpy(dst, out->data, out->size);
+	dst += out->size;
+	memcpy(dst, nal_start, sizeof(nal_start));
+	memcpy(dst + sizeof(nal_start), data, size);
 	free(data);
 
 	obs_encoder_packet_release(out);
-
-	*out = backup;
-	out->data = (uint8_t *)out_data.array + sizeof(ref);
-	out->size = out_data.num - sizeof(ref);
+	*out = captioned;
 
 	sei_free(&sei);
 
@@ -1253,9 +1248,25 @@ static bool add_caption(struct obs_output *output, struct encoder_packet *out)
 }
 #endif
 
+static inline struct interleave_queue *
+get_packet_queue(struct obs_output *output, enum obs_encoder_type type,
+		 size_t track_idx)
+{
+	return (type == OBS_ENCODER_VIDEO)
+		       ? &output->interleaved_video
+		       : &output->interleaved_audio[track_idx];
+}
+
 static inline void send_interleaved(struct obs_output *output)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
+	struct interleave_queue *queue = interleave_next_queue(
+		&output->interleaved_video, output->interleaved_audio);
+	struct encoder_packet out;
+
+	if (!queue)
+		return;
+
+	out = interleave_queue_first(queue)->packet;
 
 	/* do not send an interleaved packet if there's no packet of the
 	 * opposing type of a higher timestamp in the interleave buffer.
@@ -1263,7 +1274,7 @@ static inline void send_interleaved(struct obs_output *output)
 	if (!has_higher_opposing_ts(output, &out))
 		return;
 
-	da_erase(output->interleaved_packets, 0);
+	interleave_queue_pop(queue);
 
 	if (out.type == OBS_ENCODER_VIDEO) {
 		output->total_frames++;
@@ -1308,186 +1319,171 @@ static inline void set_higher_ts(struct obs_output *output,
 	}
 }
 
-static inline struct encoder_packet *
-find_first_packet_type(struct obs_output *output, enum obs_encoder_type type,
-		       size_t audio_idx);
-static int find_first_packet_type_idx(struct obs_output *output,
-				      enum obs_encoder_type type,
-				      size_t audio_idx);
-
-/* gets the point where audio and video are closest together */
-static size_t get_interleaved_start_idx(struct obs_output *output)
+/* gets the point where audio and video are closest together, NULL if there
+ * is nothing to discard */
+static struct interleaved_packet *
+get_interleaved_start(struct obs_output *output)
 {
 	int64_t closest_diff = 0x7FFFFFFFFFFFFFFFLL;
-	struct encoder_packet *first_video =
-		find_first_packet_type(output, OBS_ENCODER_VIDEO, 0);
-	size_t video_idx = DARRAY_INVALID;
-	size_t idx = 0;
-
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		int64_t diff;
-
-		if (packet->type != OBS_ENCODER_AUDIO) {
-			if (packet == first_video)
-				video_idx = i;
-			continue;
-		}
+	struct interleaved_packet *first_video =
+		interleave_queue_first(&output->interleaved_video);
+	struct interleaved_packet *closest = NULL;
 
-		diff = llabs(packet->dts_usec - first_video->dts_usec);
-		if (diff < closest_diff) {
-			closest_diff = diff;
-			idx = i;
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++) {
+		struct interleave_queue *queue = &output->interleaved_audio[i];
+
+		for (size_t j = 0; j < interleave_queue_size(queue); j++) {
+			struct interleaved_packet *packet =
+				interleave_queue_get(queue, j);
+			int64_t diff = llabs(packet->packet.dts_usec -
+					     first_video->packet.dts_usec);
+
+			if (diff < closest_diff ||
+			    (diff == closest_diff &&
+			     interleave_packet_before(packet, closest))) {
+				closest_diff = diff;
+				closest = packet;
+			}
 		}
 	}
 
-	return video_idx < idx ? video_idx : idx;
+	if (!closest)
+		return NULL;
+
+	return interleave_packet_before(first_video, closest) ? first_video
+							      : closest;
 }
 
-static int prune_premature_packets(struct obs_output *output)
+/* returns -1 if a track has no packets yet, 1 if the first packets are too
+ * far apart (*last is then the last packet to discard), 0 otherwise */
+static int prune_premature_packets(struct obs_output *output,
+				   struct interleaved_packet **last)
 {
 	size_t audio_mixes = num_audio_mixes(output);
-	struct encoder_packet *video;
-	int video_idx;
-	int max_idx;
+	struct interleaved_packet *video;
 	int64_t duration_usec;
 	int64_t max_diff = 0;
 	int64_t diff = 0;
 
-	video_idx = find_first_packet_type_idx(output, OBS_ENCODER_VIDEO, 0);
-	if (video_idx == -1) {
+	video = interleave_queue_first(&output->interleaved_video);
+	if (!video) {
 		output->received_video = false;
 		return -1;
 	}
 
-	max_idx = video_idx;
-	video = &output->interleaved_packets.array[video_idx];
-	duration_usec = video->timebase_num * 1000000LL / video->timebase_den;
+	*last = video;
+	duration_usec = video->packet.timebase_num * 1000000LL /
+			video->packet.timebase_den;
 
 	for (size_t i = 0; i < audio_mixes; i++) {
-		struct encoder_packet *audio;
-		int audio_idx;
+		struct interleaved_packet *audio;
 
-		audio_idx = find_first_packet_type_idx(output,
-						       OBS_ENCODER_AUDIO, i);
-		if (audio_idx == -1) {
+		audio = interleave_queue_first(&output->interleaved_audio[i]);
+		if (!audio) {
 			output->received_audio = false;
 			return -1;
 		}
 
-		audio = &output->interleaved_packets.array[audio_idx];
-		if (audio_idx > max_idx)
-			max_idx = audio_idx;
+		if (interleave_packet_before(*last, audio))
+			*last = audio;
 
-		diff = audio->dts_usec - video->dts_usec;
+		diff = audio->packet.dts_usec - video->packet.dts_usec;
 		if (diff > max_diff)
 			max_diff = diff;
 	}
 
-	return diff > duration_usec ? max_idx + 1 : 0;
+	return diff > duration_usec ? 1 : 0;
 }
 
-static void discard_to_idx(struct obs_output *output, size_t idx)
+/* releases every packet that would be sent before end, and end itself if
+ * inclusive */
+static void discard_to(struct obs_output *output,
+		       const struct interleaved_packet *end, bool inclusive)
 {
-	for (size_t i = 0; i < idx; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		obs_encoder_packet_release(packet);
-	}
+	struct interleaved_packet key = *end;
+
+	for (size_t i = 0; i <= MAX_AUDIO_MIXES; i++) {
+		struct interleave_queue *queue =
+			i ? &output->interleaved_audio[i - 1]
+			  : &output->interleaved_video;
+
+		while (interleave_queue_size(queue)) {
+			struct interleaved_packet *packet =
+				interleave_queue_first(queue);
+
+			if (!interleave_packet_before(packet, &key) &&
+			    !(inclusive && packet->seq == key.seq))
+				break;
 
-	da_erase_range(output->interleaved_packets, 0, idx);
+			obs_encoder_packet_release(&packet->packet);
+			interleave_queue_pop(queue);
+		}
+	}
 }
 
 #define DEBUG_STARTING_PACKETS 0
 
 static bool prune_interleaved_packets(struct obs_output *output)
 {
-	size_t start_idx = 0;
-	int prune_start = prune_premature_packets(output);
+	struct interleaved_packet *start;
+	struct interleaved_packet *last = NULL;
+	int prune = prune_premature_packets(output, &last);
 
 #if DEBUG_STARTING_PACKETS == 1
-	blog(LOG_DEBUG, "--------- Pruning! %d ---------", prune_start);
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		blog(LOG_DEBUG, "packet: %s %d, ts: %lld, pruned = %s",
-		     packet->type == OBS_ENCODER_AUDIO ? "audio" : "video",
-		     (int)packet->track_idx, packet->dts_usec,
-		     (int)i < prune_start ? "true" : "false");
+	blog(LOG_DEBUG, "--------- Pruning! %d ---------", prune);
+	for (size_t i = 0; i <= MAX_AUDIO_MIXES; i++) {
+		struct interleave_queue *queue =
+			i ? &output->interleaved_audio[i - 1]
+			  : &output->interleaved_video;
+
+		for (size_t j = 0; j < interleave_queue_size(queue); j++) {
+			struct interleaved_packet *packet =
+				interleave_queue_get(queue, j);
+			blog(LOG_DEBUG, "packet: %s %d, ts: %lld, pruned = %s",
+			     packet->packet.type == OBS_ENCODER_AUDIO ? "audio"
+								      : "video",
+			     (int)packet->packet.track_idx,
+			     packet->packet.dts_usec,
+			     prune == 1 && !interleave_packet_before(
+						   last, packet)
+				     ? "true"
+				     : "false");
+		}
 	}
 #endif
 
 	/* prunes the first video packet if it's too far away from audio */
-	if (prune_start == -1)
+	if (prune == -1)
 		return false;
-	else if (prune_start != 0)
-		start_idx = (size_t)prune_start;
-	else
-		start_idx = get_interleaved_start_idx(output);
-
-	if (start_idx)
-		discard_to_idx(output, start_idx);
-
-	return true;
-}
-
-static int find_first_packet_type_idx(struct obs_output *output,
-				      enum obs_encoder_type type,
-				      size_t audio_idx)
-{
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-
-		if (packet->type == type) {
-			if (type == OBS_ENCODER_AUDIO &&
-			    packet->track_idx != audio_idx) {
-				continue;
-			}
-
-			return (int)i;
-		}
-	}
-
-	return -1;
-}
 
-static int find_last_packet_type_idx(struct obs_output *output,
-				     enum obs_encoder_type type,
-				     size_t audio_idx)
-{
-	for (size_t i = output->interleaved_packets.num; i > 0; i--) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i - 1];
-
-		if (packet->type == type) {
-			if (type == OBS_ENCODER_AUDIO &&
-			    packet->track_idx != audio_idx) {
-				continue;
-			}
-
-			return (int)(i - 1);
-		}
+	if (prune == 1) {
+		discard_to(output, last, true);
+	} else {
+		start = get_interleaved_start(output);
+		if (start)
+			discard_to(output, start, false);
 	}
 
-	return -1;
+	return true;
 }
 
 static inline struct encoder_packet *
 find_first_packet_type(struct obs_output *output, enum obs_encoder_type type,
 		       size_t audio_idx)
 {
-	int idx = find_first_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
+	struct interleave_queue *queue =
+		get_packet_queue(output, type, audio_idx);
+	struct interleaved_packet *packet = interleave_queue_first(queue);
+	return packet ? &packet->packet : NULL;
 }
 
 static inline struct encoder_packet *
 find_last_packet_type(struct obs_output *output, enum obs_encoder_type type,
 		      size_t audio_idx)
 {
-	int idx = find_last_packet_type_idx(output, type, audio_idx);
-	return (idx != -1) ? &output->interleaved_packets.array[idx] : NULL;
+	struct interleaved_packet *packet =
+		interleave_queue_last(get_packet_queue(output, type, audio_idx));
+	return packet ? &packet->packet : NULL;
 }
 
 static bool get_audio_and_video_packets(struct obs_output *output,
@@ -1514,13 +1510,23 @@ static bool get_audio_and_video_packets(struct obs_output *output,
 	return true;
 }
 
+static void apply_queue_offset(struct obs_output *output,
+			       struct interleave_queue *queue)
+{
+	for (size_t i = 0; i < interleave_queue_size(queue); i++) {
+		struct interleaved_packet *packet =
+			interleave_queue_get(queue, i);
+		apply_interleaved_packet_offset(output, &packet->packet);
+	}
+}
+
 static bool initialize_interleaved_packets(struct obs_output *output)
 {
 	struct encoder_packet *video;
 	struct encoder_packet *audio[MAX_AUDIO_MIXES];
 	struct encoder_packet *last_audio[MAX_AUDIO_MIXES];
+	struct interleaved_packet *start;
 	size_t audio_mixes = num_audio_mixes(output);
-	size_t start_idx;
 
 	if (!get_audio_and_video_packets(output, &video, audio, audio_mixes))
 		return false;
@@ -1538,9 +1544,9 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 	}
 
 	/* clear out excess starting audio if it hasn't been already */
-	start_idx = get_interleaved_start_idx(output);
-	if (start_idx) {
-		discard_to_idx(output, start_idx);
+	start = get_interleaved_start(output);
+	if (start) {
+		discard_to(output, start, false);
 		if (!get_audio_and_video_packets(output, &video, audio,
 						 audio_mixes))
 			return false;
@@ -1566,12 +1572,12 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 	output->highest_audio_ts -= audio[0]->dts_usec;
 	output->highest_video_ts -= video->dts_usec;
 
-	/* apply new offsets to all existing packet DTS/PTS values */
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		apply_interleaved_packet_offset(output, packet);
-	}
+	/* apply new offsets to all existing packet DTS/PTS values.  the offset
+	 * is the same for every packet of a track, so the tracks stay in
+	 * order and nothing has to be resorted */
+	apply_queue_offset(output, &output->interleaved_video);
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++)
+		apply_queue_offset(output, &output->interleaved_audio[i]);
 
 	return true;
 }
@@ -1579,51 +1585,32 @@ static bool initialize_interleaved_packets(struct obs_output *output)
 static inline void insert_interleaved_packet(struct obs_output *output,
 					     struct encoder_packet *out)
 {
-	size_t idx;
-	for (idx = 0; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *cur_packet;
-		cur_packet = output->interleaved_packets.array + idx;
-
-		if (out->dts_usec == cur_packet->dts_usec &&
-		    out->type == OBS_ENCODER_VIDEO) {
-			break;
-		} else if (out->dts_usec < cur_packet->dts_usec) {
-			break;
-		}
-	}
-
-	da_insert(output->interleaved_packets, idx, out);
-}
-
-static void resort_interleaved_packets(struct obs_output *output)
-{
-	DARRAY(struct encoder_packet) old_array;
-
-	old_array.da = output->interleaved_packets.da;
-	memset(&output->interleaved_packets, 0,
-	       sizeof(output->interleaved_packets));
-
-	for (size_t i = 0; i < old_array.num; i++)
-		insert_interleaved_packet(output, &old_array.array[i]);
+	struct interleave_queue *queue =
+		get_packet_queue(output, out->type, out->track_idx);
+	struct interleaved_packet packet = {*out, output->interleaved_seq++};
 
-	da_free(old_array);
+	interleave_queue_insert(queue, &packet);
 }
 
 static void discard_unused_audio_packets(struct obs_output *output,
 					 int64_t dts_usec)
 {
-	size_t idx = 0;
+	for (size_t i = 0; i <= MAX_AUDIO_MIXES; i++) {
+		struct interleave_queue *queue =
+			i ? &output->interleaved_audio[i - 1]
+			  : &output->interleaved_video;
 
-	for (; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *p =
-			&output->interleaved_packets.array[idx];
+		while (interleave_queue_size(queue)) {
+			struct interleaved_packet *packet =
+				interleave_queue_first(queue);
 
-		if (p->dts_usec >= dts_usec)
-			break;
-	}
+			if (packet->packet.dts_usec >= dts_usec)
+				break;
 
-	if (idx)
-		discard_to_idx(output, idx);
+			obs_encoder_packet_release(&packet->packet);
+			interleave_queue_pop(queue);
+		}
+	}
 }
 
 static void interleave_packets(void *data, struct encoder_packet *packet)
@@ -1656,7 +1643,7 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	if (output->active_delay_ns)
 		out = *packet;
 	else
-		obs_encoder_packet_create_instance(&out, packet);
+		obs_encoder_packet_ref(&out, packet);
 
 	if (was_started)
 		apply_interleaved_packet_offset(output, &out);
@@ -1671,10 +1658,8 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 	if (output->received_audio && output->received_video) {
 		if (!was_started) {
 			if (prune_interleaved_packets(output)) {
-				if (initialize_interleaved_packets(output)) {
-					resort_interleaved_packets(output);
+				if (initialize_interleaved_packets(output))
 					send_interleaved(output);
-				}
 			}
 		} else {
 			send_interleaved(output);
@@ -0,0 +1,232 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "obs-internal.h"
+
+/* Storage for encoded packet payloads.  An encoder's packet is copied into a
+ * block once, and every output it goes to takes a reference to that block
+ * instead of a copy of its own.
+ *
+ * Blocks come in power of two size classes and are kept on a free list per
+ * class when released, so steady streams of similarly sized packets stop
+ * going to the allocator.  Payloads larger than the biggest class are
+ * allocated and freed directly. */
+
+#define MIN_CLASS_SHIFT 8
+#define NUM_CLASSES 15
+#define UNPOOLED_CLASS ((uint32_t)-1)
+#define MAX_POOLED_CLASS_BYTES (8 * 1024 * 1024)
+#define MIN_POOLED_CLASS_BLOCKS 4
+
+/* the payload follows the block header */
+struct packet_block {
+	struct packet_block *next;
+	size_t capacity;
+	uint32_t size_class;
+	volatile long refs;
+};
+
+static struct {
+	pthread_once_t init_token;
+	pthread_mutex_t mutex;
+
+	struct packet_block *free_blocks[NUM_CLASSES];
+	size_t free_counts[NUM_CLASSES];
+
+	size_t live_packets;
+	size_t live_bytes;
+	size_t peak_live_bytes;
+	size_t pooled_packets;
+	size_t pooled_bytes;
+	uint64_t hits;
+	uint64_t misses;
+} pool = {
+	.init_token = PTHREAD_ONCE_INIT,
+};
+
+static void init_pool(void)
+{
+	pthread_mutex_init_value(&pool.mutex);
+	if (pthread_mutex_init(&pool.mutex, NULL) != 0)
+		blog(LOG_ERROR, "Failed to create packet pool mutex");
+}
+
+static inline void init_pool_once(void)
+{
+	pthread_once(&pool.init_token, init_pool);
+}
+
+static inline uint32_t get_size_class(size_t size)
+{
+	size_t class_size = (size_t)1 << MIN_CLASS_SHIFT;
+
+	for (uint32_t i = 0; i < NUM_CLASSES; i++) {
+		if (size <= class_size)
+			return i;
+		class_size <<= 1;
+	}
+
+	return UNPOOLED_CLASS;
+}
+
+static inline size_t class_capacity(uint32_t size_class)
+{
+	return (size_t)1 << (MIN_CLASS_SHIFT + size_class);
+}
+
+static inline size_t max_pooled_blocks(uint32_t size_class)
+{
+	size_t blocks = MAX_POOLED_CLASS_BYTES / class_capacity(size_class);
+	return blocks > MIN_POOLED_CLASS_BLOCKS ? blocks
+						: MIN_POOLED_CLASS_BLOCKS;
+}
+
+static struct packet_block *get_block(size_t size)
+{
+	uint32_t size_class = get_size_class(size);
+	struct packet_block *block = NULL;
+	size_t capacity;
+
+	init_pool_once();
+
+	capacity = size_class == UNPOOLED_CLASS ? size
+						: class_capacity(size_class);
+
+	pthread_mutex_lock(&pool.mutex);
+
+	if (size_class != UNPOOLED_CLASS && pool.free_blocks[size_class]) {
+		block = pool.free_blocks[size_class];
+		pool.free_blocks[size_class] = block->next;
+		pool.free_counts[size_class]--;
+		pool.pooled_packets--;
+		pool.pooled_bytes -= capacity;
+		pool.hits++;
+	} else {
+		pool.misses++;
+	}
+
+	pool.live_packets++;
+	pool.live_bytes += capacity;
+	if (pool.live_bytes > pool.peak_live_bytes)
+		pool.peak_live_bytes = pool.live_bytes;
+
+	pthread_mutex_unlock(&pool.mutex);
+
+	if (!block) {
+		block = bmalloc(sizeof(*block) + capacity);
+		block->capacity = capacity;
+		block->size_class = size_class;
+	}
+
+	block->next = NULL;
+	block->refs = 1;
+	return block;
+}
+
+static void put_block(struct packet_block *block)
+{
+	uint32_t size_class = block->size_class;
+	bool keep = false;
+
+	pthread_mutex_lock(&pool.mutex);
+
+	pool.live_packets--;
+	pool.live_bytes -= block->capacity;
+
+	if (size_class != UNPOOLED_CLASS &&
+	    pool.free_counts[size_class] < max_pooled_blocks(size_class)) {
+		block->next = pool.free_blocks[size_class];
+		pool.free_blocks[size_class] = block;
+		pool.free_counts[size_class]++;
+		pool.pooled_packets++;
+		pool.pooled_bytes += block->capacity;
+		keep = true;
+	}
+
+	pthread_mutex_unlock(&pool.mutex);
+
+	if (!keep)
+		bfree(block);
+}
+
+uint8_t *obs_encoder_packet_alloc(struct encoder_packet *dst,
+				  const struct encoder_packet *src, size_t size)
+{
+	struct packet_block *block = get_block(size);
+
+	*dst = *src;
+	dst->data = (uint8_t *)(block + 1);
+	dst->size = size;
+	return dst->data;
+}
+
+void obs_encoder_packet_data_addref(uint8_t *data)
+{
+	struct packet_block *block = ((struct packet_block *)data) - 1;
+	os_atomic_inc_long(&block->refs);
+}
+
+void obs_encoder_packet_data_release(uint8_t *data)
+{
+	struct packet_block *block = ((struct packet_block *)data) - 1;
+	if (os_atomic_dec_long(&block->refs) == 0)
+		put_block(block);
+}
+
+void obs_encoder_packet_pool_free(void)
+{
+	init_pool_once();
+
+	pthread_mutex_lock(&pool.mutex);
+
+	for (size_t i = 0; i < NUM_CLASSES; i++) {
+		struct packet_block *block = pool.free_blocks[i];
+
+		while (block) {
+			struct packet_block *next = block->next;
+			bfree(block);
+			block = next;
+		}
+
+		pool.free_blocks[i] = NULL;
+		pool.free_counts[i] = 0;
+	}
+
+	pool.pooled_packets = 0;
+	pool.pooled_bytes = 0;
+
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+void obs_encoder_packet_pool_get_stats(
+	struct obs_encoder_packet_pool_stats *stats)
+{
+	if (!obs_ptr_valid(stats, "obs_encoder_packet_pool_get_stats"))
+		return;
+
+	init_pool_once();
+
+	pthread_mutex_lock(&pool.mutex);
+	stats->live_packets = pool.live_packets;
+	stats->live_bytes = pool.live_bytes;
+	stats->peak_live_bytes = pool.peak_live_bytes;
+	stats->pooled_packets = pool.pooled_packets;
+	stats->pooled_bytes = pool.pooled_bytes;
+	stats->hits = pool.hits;
+	stats->misses = pool.misses;
+	pthread_mutex_unlock(&pool.mutex);
+}
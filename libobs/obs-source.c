@@ -574,7 +574,7 @@ void obs_source_frame_init(struct obs_source_frame *frame,
 static inline void obs_source_frame_decref(struct obs_source_frame *frame)
 {
 	if (os_atomic_dec_long(&frame->refs) == 0)
-		obs_source_frame_destroy(frame);
+		obs_frame_pool_release(frame);
 }
 
 static bool obs_source_filter_remove_refless(obs_source_t *source,
@@ -2728,7 +2728,7 @@ static void clean_cache(obs_source_t *source)
 		struct async_frame *af = &source->async_cache.array[i - 1];
 		if (!af->used) {
 			if (++af->unused_count == MAX_UNUSED_FRAME_DURATION) {
-				obs_source_frame_destroy(af->frame);
+				obs_frame_pool_release(af->frame);
 				da_erase(source->async_cache, i - 1);
 			}
 		}
@@ -2736,9 +2736,10 @@ static void clean_cache(obs_source_t *source)
 }
 
 #define MAX_ASYNC_FRAMES 30
-//if return value is not null then do (os_atomic_dec_long(&output->refs) == 0) && obs_source_frame_destroy(output)
+//if return value is not null then do (os_atomic_dec_long(&output->refs) == 0) && obs_frame_pool_release(output)
 static inline struct obs_source_frame *
-cache_video(struct obs_source *source, const struct obs_source_frame *frame)
+cache_video(struct obs_source *source, const struct obs_source_frame *frame,
+	    void (*release)(void *param), void *param)
 {
 	struct obs_source_frame *new_frame = NULL;
 
@@ -2761,7 +2762,7 @@ cache_video(struct obs_source *source, const struct obs_source_frame *frame)
 	source->async_cache_format = format;
 	source->async_cache_full_range = frame->full_range;
 
-	for (size_t i = 0; i < source->async_cache.num; i++) {
+	for (size_t i = 0; !release && i < source->async_cache.num; i++) {
 		struct async_frame *af = &source->async_cache.array[i];
 		if (!af->used) {
 			new_frame = af->frame;
@@ -2777,10 +2778,12 @@ cache_video(struct obs_source *source, const struct obs_source_frame *frame)
 	if (!new_frame) {
 		struct async_frame new_af;
 
-		new_frame = obs_source_frame_create(format, frame->width,
-						    frame->height);
+		new_frame = release ? obs_frame_pool_wrap(frame, release, param)
+				    : obs_frame_pool_get(format, frame->width,
+							 frame->height);
 		new_af.frame = new_frame;
 		new_af.used = true;
+		new_af.external = !!release;
 		new_af.unused_count = 0;
 		new_frame->refs = 1;
 
@@ -2791,31 +2794,40 @@ cache_video(struct obs_source *source, const struct obs_source_frame *frame)
 
 	pthread_mutex_unlock(&source->async_mutex);
 
-	copy_frame_data(new_frame, frame);
+	if (!release)
+		copy_frame_data(new_frame, frame);
 
 	return new_frame;
 }
 
 static void
 obs_source_output_video_internal(obs_source_t *source,
-				 const struct obs_source_frame *frame)
+				 const struct obs_source_frame *frame,
+				 void (*release)(void *param), void *param)
 {
-	if (!obs_source_valid(source, "obs_source_output_video"))
+	if (!obs_source_valid(source, "obs_source_output_video")) {
+		if (release)
+			release(param);
 		return;
+	}
 
 	if (!frame) {
 		source->async_active = false;
 		return;
 	}
 
-	struct obs_source_frame *output = !!frame ? cache_video(source, frame)
-						  : NULL;
+	struct obs_source_frame *output =
+		!!frame ? cache_video(source, frame, release, param) : NULL;
+
+	/* dropped, the caller's planes were never referenced */
+	if (!output && release)
+		release(param);
 
 	/* ------------------------------------------- */
 	pthread_mutex_lock(&source->async_mutex);
 	if (output) {
 		if (os_atomic_dec_long(&output->refs) == 0) {
-			obs_source_frame_destroy(output);
+			obs_frame_pool_release(output);
 			output = NULL;
 		} else {
 			da_push_back(source->async_frames, &output);
@@ -2829,7 +2841,7 @@ void obs_source_output_video(obs_source_t *source,
 			     const struct obs_source_frame *frame)
 {
 	if (!frame) {
-		obs_source_output_video_internal(source, NULL);
+		obs_source_output_video_internal(source, NULL, NULL, NULL);
 		return;
 	}
 
@@ -2837,14 +2849,31 @@ void obs_source_output_video(obs_source_t *source,
 	new_frame.full_range =
 		format_is_yuv(frame->format) ? new_frame.full_range : true;
 
-	obs_source_output_video_internal(source, &new_frame);
+	obs_source_output_video_internal(source, &new_frame, NULL, NULL);
+}
+
+void obs_source_output_video_external(obs_source_t *source,
+				      const struct obs_source_frame *frame,
+				      void (*release)(void *param),
+				      void *param)
+{
+	if (!frame || !release) {
+		obs_source_output_video(source, frame);
+		return;
+	}
+
+	struct obs_source_frame new_frame = *frame;
+	new_frame.full_range =
+		format_is_yuv(frame->format) ? new_frame.full_range : true;
+
+	obs_source_output_video_internal(source, &new_frame, release, param);
 }
 
 void obs_source_output_video2(obs_source_t *source,
 			      const struct obs_source_frame2 *frame)
 {
 	if (!frame) {
-		obs_source_output_video_internal(source, NULL);
+		obs_source_output_video_internal(source, NULL, NULL, NULL);
 		return;
 	}
 
@@ -2871,7 +2900,7 @@ void obs_source_output_video2(obs_source_t *source,
 	memcpy(&new_frame.color_range_max, &frame->color_range_max,
 	       sizeof(frame->color_range_max));
 
-	obs_source_output_video_internal(source, &new_frame);
+	obs_source_output_video_internal(source, &new_frame, NULL, NULL);
 }
 
 void obs_source_set_async_rotation(obs_source_t *source, long rotation)
@@ -3202,7 +3231,14 @@ void remove_async_frame(obs_source_t *source, struct obs_source_frame *frame)
 		struct async_frame *f = &source->async_cache.array[i];
 
 		if (f->frame == frame) {
-			f->used = false;
+			/* external frames are never reused, hand the planes
+			 * back to their owner as soon as possible */
+			if (f->external) {
+				da_erase(source->async_cache, i);
+				obs_source_frame_decref(frame);
+			} else {
+				f->used = false;
+			}
 			break;
 		}
 	}
@@ -3353,12 +3389,12 @@ void obs_source_release_frame(obs_source_t *source,
 		return;
 
 	if (!source) {
-		obs_source_frame_destroy(frame);
+		obs_frame_pool_release(frame);
 	} else {
 		pthread_mutex_lock(&source->async_mutex);
 
 		if (os_atomic_dec_long(&frame->refs) == 0)
-			obs_source_frame_destroy(frame);
+			obs_frame_pool_release(frame);
 		else
 			remove_async_frame(source, frame);
 
@@ -4463,6 +4499,7 @@ static void apply_audio_volume(obs_source_t *source, uint32_t mixers,
 		memset(source->audio_output_buf[0][0], 0,
 		       AUDIO_OUTPUT_FRAMES * sizeof(float) *
 			       MAX_AUDIO_CHANNELS * MAX_AUDIO_MIXES);
+		source->audio_output_mixes = 0;
 		return;
 	}
 
@@ -4502,6 +4539,8 @@ static void custom_audio_render(obs_source_t *source, uint32_t mixers,
 	if (!success || !source->audio_ts || !mixers)
 		return;
 
+	source->audio_output_mixes = source->audio_mixers & mixers;
+
 	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
 		uint32_t mix_bit = 1 << mix;
 
@@ -4594,6 +4633,7 @@ static inline void process_audio_source_tick(obs_source_t *source,
 	}
 
 	if (audio_submix) {
+		source->audio_output_mixes = 0xFFFFFFFF;
 		source->audio_pending = false;
 		return;
 	}
@@ -4601,6 +4641,8 @@ static inline void process_audio_source_tick(obs_source_t *source,
 	if ((source->audio_mixers & 1) == 0 || (mixers & 1) == 0)
 		memset(source->audio_output_buf[0][0], 0, size * channels);
 
+	source->audio_output_mixes = source->audio_mixers & mixers;
+
 	apply_audio_volume(source, mixers, channels, sample_rate);
 	source->audio_pending = false;
 }
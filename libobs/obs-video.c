@@ -682,6 +682,166 @@ static inline void copy_rgbx_frame(struct video_frame *output,
 	}
 }
 
+static void convert_frame_band(struct obs_core_video *video, uint32_t start_y,
+			       uint32_t end_y)
+{
+	const struct video_output_info *info =
+		video_output_get_info(video->video);
+	const struct video_data *input = video->convert_input;
+	struct video_frame *output = video->convert_output;
+
+	switch (info->format) {
+	case VIDEO_FORMAT_NV12:
+		compress_rgbx_to_nv12(input->data[0], input->linesize[0],
+				      info->width, start_y, end_y, output->data,
+				      output->linesize, VIDEO_FORMAT_RGBA,
+				      info->colorspace, info->range);
+		break;
+	case VIDEO_FORMAT_I420:
+		compress_rgbx_to_i420(input->data[0], input->linesize[0],
+				      info->width, start_y, end_y, output->data,
+				      output->linesize, VIDEO_FORMAT_RGBA,
+				      info->colorspace, info->range);
+		break;
+	case VIDEO_FORMAT_I444:
+		convert_rgbx_to_i444(input->data[0], input->linesize[0],
+				     info->width, start_y, end_y, output->data,
+				     output->linesize, VIDEO_FORMAT_RGBA,
+				     info->colorspace, info->range);
+		break;
+	default:
+		break;
+	}
+}
+
+static void *convert_thread(void *param)
+{
+	struct obs_convert_band *band = param;
+	struct obs_core_video *video = &obs->video;
+
+	os_set_thread_name("libobs: cpu conversion thread");
+
+	while (os_sem_wait(band->start) == 0) {
+		if (video->convert_stop)
+			break;
+
+		convert_frame_band(video, band->start_y, band->end_y);
+		os_sem_post(video->convert_done);
+	}
+
+	return NULL;
+}
+
+static inline bool cpu_conversion_format(enum video_format format)
+{
+	return format == VIDEO_FORMAT_NV12 || format == VIDEO_FORMAT_I420 ||
+	       format == VIDEO_FORMAT_I444;
+}
+
+bool obs_init_cpu_conversion(void)
+{
+	struct obs_core_video *video = &obs->video;
+	const struct video_output_info *info =
+		video_output_get_info(video->video);
+	size_t bands = (size_t)os_get_logical_cores() / 2;
+	uint32_t band_height;
+
+	video->cpu_conversion = !video->gpu_conversion &&
+				cpu_conversion_format(info->format);
+	if (!video->cpu_conversion)
+		return true;
+
+	if (bands < 1)
+		bands = 1;
+	if (bands > MAX_CONVERT_BANDS)
+		bands = MAX_CONVERT_BANDS;
+
+	/* 4:2:0 formats convert rows in pairs */
+	band_height = ((info->height + (uint32_t)bands - 1) / (uint32_t)bands +
+		       1) & ~1;
+
+	video->convert_stop = false;
+	video->num_convert_bands = 0;
+
+	if (os_sem_init(&video->convert_done, 0) != 0)
+		return false;
+
+	for (size_t i = 0; i < bands; i++) {
+		struct obs_convert_band *band = &video->convert_bands[i];
+		uint32_t start_y = (uint32_t)i * band_height;
+
+		if (start_y >= info->height)
+			break;
+
+		band->start_y = start_y;
+		band->end_y = start_y + band_height;
+		if (band->end_y > info->height)
+			band->end_y = info->height;
+		video->num_convert_bands++;
+
+		if (i == 0)
+			continue;
+
+		if (os_sem_init(&band->start, 0) != 0)
+			goto fail;
+		if (pthread_create(&band->thread, NULL, convert_thread,
+				   band) != 0)
+			goto fail;
+		band->thread_created = true;
+	}
+
+	blog(LOG_INFO, "Converting RGBA to %s on the CPU in %d band(s)",
+	     get_video_format_name(info->format),
+	     (int)video->num_convert_bands);
+	return true;
+
+fail:
+	blog(LOG_ERROR, "Failed to create CPU conversion threads");
+	obs_free_cpu_conversion();
+	return false;
+}
+
+void obs_free_cpu_conversion(void)
+{
+	struct obs_core_video *video = &obs->video;
+
+	video->convert_stop = true;
+
+	for (size_t i = 0; i < MAX_CONVERT_BANDS; i++) {
+		struct obs_convert_band *band = &video->convert_bands[i];
+
+		if (band->thread_created) {
+			os_sem_post(band->start);
+			pthread_join(band->thread, NULL);
+		}
+
+		os_sem_destroy(band->start);
+		memset(band, 0, sizeof(*band));
+	}
+
+	os_sem_destroy(video->convert_done);
+	video->convert_done = NULL;
+	video->num_convert_bands = 0;
+	video->cpu_conversion = false;
+}
+
+static void cpu_convert_frame(struct obs_core_video *video,
+			      struct video_frame *output,
+			      const struct video_data *input)
+{
+	video->convert_input = input;
+	video->convert_output = output;
+
+	for (size_t i = 1; i < video->num_convert_bands; i++)
+		os_sem_post(video->convert_bands[i].start);
+
+	convert_frame_band(video, video->convert_bands[0].start_y,
+			   video->convert_bands[0].end_y);
+
+	for (size_t i = 1; i < video->num_convert_bands; i++)
+		os_sem_wait(video->convert_done);
+}
+
 static inline void output_video_data(struct obs_core_video *video,
 				     struct video_data *input_frame, int count)
 {
@@ -697,6 +857,8 @@ static inline void output_video_data(struct obs_core_video *video,
 		if (video->gpu_conversion) {
 			set_gpu_converted_data(video, &output_frame,
 					       input_frame, info);
+		} else if (video->cpu_conversion) {
+			cpu_convert_frame(video, &output_frame, input_frame);
 		} else {
 			copy_rgbx_frame(&output_frame, input_frame, info);
 		}
@@ -87,6 +87,16 @@ static inline void calc_gpu_conversion_sizes(const struct obs_video_info *ovi)
 	}
 }
 
+static void free_convert_textures(struct obs_core_video *video)
+{
+	for (size_t c = 0; c < NUM_CHANNELS; c++) {
+		if (video->convert_textures[c]) {
+			gs_texture_destroy(video->convert_textures[c]);
+			video->convert_textures[c] = NULL;
+		}
+	}
+}
+
 static bool obs_init_gpu_conversion(struct obs_video_info *ovi)
 {
 	struct obs_core_video *video = &obs->video;
@@ -425,13 +435,21 @@ static int obs_init_video(struct obs_video_info *ovi)
 
 	gs_enter_context(video->graphics);
 
-	if (ovi->gpu_conversion && !obs_init_gpu_conversion(ovi))
-		return OBS_VIDEO_FAIL;
+	if (ovi->gpu_conversion && !obs_init_gpu_conversion(ovi)) {
+		blog(LOG_WARNING, "GPU conversion could not be initialized, "
+				  "converting on the CPU instead");
+		free_convert_textures(video);
+		video->gpu_conversion = false;
+		video->using_nv12_tex = false;
+	}
 	if (!obs_init_textures(ovi))
 		return OBS_VIDEO_FAIL;
 
 	gs_leave_context();
 
+	if (!obs_init_cpu_conversion())
+		return OBS_VIDEO_FAIL;
+
 	if (pthread_mutexattr_init(&attr) != 0)
 		return OBS_VIDEO_FAIL;
 	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
@@ -473,6 +491,8 @@ static void obs_free_video(void)
 		video_output_close(video->video);
 		video->video = NULL;
 
+		obs_free_cpu_conversion();
+
 		if (!video->graphics)
 			return;
 
@@ -498,12 +518,7 @@ static void obs_free_video(void)
 
 		gs_texture_destroy(video->render_texture);
 
-		for (size_t c = 0; c < NUM_CHANNELS; c++) {
-			if (video->convert_textures[c]) {
-				gs_texture_destroy(video->convert_textures[c]);
-				video->convert_textures[c] = NULL;
-			}
-		}
+		free_convert_textures(video);
 
 		for (size_t i = 0; i < NUM_TEXTURES; i++) {
 			for (size_t c = 0; c < NUM_CHANNELS; c++) {
@@ -580,6 +595,7 @@ static bool obs_init_audio(struct audio_output_info *ai)
 	pthread_mutexattr_t attr;
 
 	pthread_mutex_init_value(&audio->monitoring_mutex);
+	pthread_mutex_init_value(&audio->buffering_mutex);
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		return false;
@@ -587,12 +603,16 @@ static bool obs_init_audio(struct audio_output_info *ai)
 		return false;
 	if (pthread_mutex_init(&audio->monitoring_mutex, &attr) != 0)
 		return false;
+	if (pthread_mutex_init(&audio->buffering_mutex, NULL) != 0)
+		return false;
 
 	audio->user_volume = 1.0f;
 
 	audio->monitoring_device_name = bstrdup("Default");
 	audio->monitoring_device_id = bstrdup("default");
 
+	obs_audio_render_pool_init(audio);
+
 	errorcode = audio_output_open(&audio->audio, ai);
 	if (errorcode == AUDIO_OUTPUT_SUCCESS)
 		return true;
@@ -607,9 +627,13 @@ static bool obs_init_audio(struct audio_output_info *ai)
 static void obs_free_audio(void)
 {
 	struct obs_core_audio *audio = &obs->audio;
+	bool fixed_buffering = audio->fixed_buffering;
+
 	if (audio->audio)
 		audio_output_close(audio->audio);
 
+	obs_audio_render_pool_free(audio);
+
 	circlebuf_free(&audio->buffered_timestamps);
 	da_free(audio->render_order);
 	da_free(audio->root_nodes);
@@ -618,8 +642,10 @@ static void obs_free_audio(void)
 	bfree(audio->monitoring_device_name);
 	bfree(audio->monitoring_device_id);
 	pthread_mutex_destroy(&audio->monitoring_mutex);
+	pthread_mutex_destroy(&audio->buffering_mutex);
 
 	memset(audio, 0, sizeof(struct obs_core_audio));
+	audio->fixed_buffering = fixed_buffering;
 }
 
 static bool obs_init_data(void)
@@ -735,6 +761,7 @@ static const char *obs_signals[] = {
 
 	"void channel_change(int channel, in out ptr source, ptr prev_source)",
 	"void master_volume(in out float volume)",
+	"void audio_buffering_changed(int ms, int prev_ms)",
 
 	"void hotkey_layout_change()",
 	"void hotkey_register(ptr hotkey)",
@@ -1044,6 +1071,8 @@ void obs_shutdown(void)
 	obs_free_video();
 	obs_free_hotkeys();
 	obs_free_graphics();
+	obs_frame_pool_trim(0);
+	obs_encoder_packet_pool_free();
 	proc_handler_destroy(obs->procs);
 	signal_handler_destroy(obs->signals);
 	obs->procs = NULL;
@@ -1828,6 +1857,61 @@ float obs_get_master_volume(void)
 	return obs ? obs->audio.user_volume : 0.0f;
 }
 
+void obs_set_adaptive_audio_buffering(bool adaptive)
+{
+	if (!obs)
+		return;
+
+	os_atomic_set_bool(&obs->audio.fixed_buffering, !adaptive);
+}
+
+bool obs_adaptive_audio_buffering(void)
+{
+	return obs ? !os_atomic_load_bool(&obs->audio.fixed_buffering) : false;
+}
+
+bool obs_get_audio_buffering_info(struct obs_audio_buffering_info *info)
+{
+	struct obs_core_audio *audio;
+
+	if (!obs || !info || !obs->audio.audio)
+		return false;
+
+	audio = &obs->audio;
+
+	pthread_mutex_lock(&audio->buffering_mutex);
+	*info = audio->buffering_info;
+	pthread_mutex_unlock(&audio->buffering_mutex);
+	return true;
+}
+
+size_t
+obs_get_audio_buffering_history(struct obs_audio_buffering_change *changes,
+				size_t max_changes)
+{
+	struct obs_core_audio *audio;
+	size_t num, start;
+
+	if (!obs || !changes || !obs->audio.audio)
+		return 0;
+
+	audio = &obs->audio;
+
+	pthread_mutex_lock(&audio->buffering_mutex);
+
+	num = audio->buffering_history_num;
+	if (num > max_changes)
+		num = max_changes;
+
+	start = audio->buffering_history_pos + AUDIO_BUFFERING_HISTORY - num;
+	for (size_t i = 0; i < num; i++)
+		changes[i] = audio->buffering_history[(start + i) %
+						      AUDIO_BUFFERING_HISTORY];
+
+	pthread_mutex_unlock(&audio->buffering_mutex);
+	return num;
+}
+
 static obs_source_t *obs_load_source_type(obs_data_t *source_data)
 {
 	obs_data_array_t *filters = obs_data_get_array(source_data, "filters");
@@ -245,6 +245,7 @@ struct obs_source_frame {
 	/* used internally by libobs */
 	volatile long refs;
 	bool prev_frame;
+	bool pooled;
 };
 
 struct obs_source_frame2 {
@@ -672,6 +673,38 @@ EXPORT void obs_set_master_volume(float volume);
 /** Gets the master user volume */
 EXPORT float obs_get_master_volume(void);
 
+/**
+ * Audio buffering is how far audio output is held back to wait for sources
+ * whose audio arrives late.  It grows whenever a source falls behind.  With
+ * adaptive buffering (the default) it is also reduced again once every
+ * source has been arriving early enough for a while.
+ */
+EXPORT void obs_set_adaptive_audio_buffering(bool adaptive);
+EXPORT bool obs_adaptive_audio_buffering(void);
+
+/** Current and peak audio buffering, and how often it changed */
+struct obs_audio_buffering_info {
+	uint32_t ms;
+	uint32_t max_ms;
+	uint32_t increases;
+	uint32_t decreases;
+};
+
+EXPORT bool obs_get_audio_buffering_info(struct obs_audio_buffering_info *info);
+
+/** A change of the audio buffering, timestamp is from os_gettime_ns */
+struct obs_audio_buffering_change {
+	uint64_t timestamp;
+	uint32_t ms;
+	uint32_t prev_ms;
+};
+
+/** Gets the most recent buffering changes, oldest first.  Returns how many
+ * changes were written to the array. */
+EXPORT size_t
+obs_get_audio_buffering_history(struct obs_audio_buffering_change *changes,
+				size_t max_changes);
+
 /** Saves a source to settings data */
 EXPORT obs_data_t *obs_save_source(obs_source_t *source);
 
@@ -1204,6 +1237,24 @@ EXPORT void obs_source_output_video(obs_source_t *source,
 EXPORT void obs_source_output_video2(obs_source_t *source,
 				     const struct obs_source_frame2 *frame);
 
+/**
+ * Outputs asynchronous video data without copying it.  The planes of the
+ * frame stay owned by the caller and must remain valid until libobs calls
+ * release(param), which happens once the frame has been uploaded and nothing
+ * in libobs uses it anymore, or right away if the frame is dropped.
+ *
+ * release can be called from any thread, including from within this call,
+ * and must not call back into the source.  Async filters that hold on to
+ * frames hold on to the caller's buffers too, so callers with a fixed number
+ * of buffers should fall back to obs_source_output_video when they run low.
+ *
+ * NOTE: Non-YUV formats will always be treated as full range with this
+ * function, as with obs_source_output_video.
+ */
+EXPORT void obs_source_output_video_external(
+	obs_source_t *source, const struct obs_source_frame *frame,
+	void (*release)(void *param), void *param);
+
 EXPORT void obs_source_set_async_rotation(obs_source_t *source, long rotation);
 
 /**
@@ -2017,6 +2068,22 @@ EXPORT void obs_encoder_set_scaled_size(obs_encoder_t *encoder, uint32_t width,
 /** For video encoders, returns true if pre-encode scaling is enabled */
 EXPORT bool obs_encoder_scaling_enabled(const obs_encoder_t *encoder);
 
+/**
+ * Sets how many raw frames a video encoder can fall behind (0 for the whole
+ * video cache) and whether the frames it misses beyond that are replaced by
+ * repeats (the default) or dropped.  Each video encoder receives frames on
+ * its own thread, so a slow encoder only affects itself.
+ */
+EXPORT void obs_encoder_set_video_queue(obs_encoder_t *encoder,
+					size_t max_frames,
+					enum video_input_overflow overflow);
+
+/**
+ * For video encoders, returns how many raw frames were dropped or repeated
+ * since the encoder last started because it could not keep up
+ */
+EXPORT uint32_t obs_encoder_get_dropped_frames(const obs_encoder_t *encoder);
+
 /** For video encoders, returns the width of the encoded image */
 EXPORT uint32_t obs_encoder_get_width(const obs_encoder_t *encoder);
 
@@ -2103,10 +2170,34 @@ OBS_DEPRECATED
 EXPORT void obs_free_encoder_packet(struct encoder_packet *packet);
 #endif
 
+/**
+ * Adds or releases a reference to the data of a packet received from libobs.
+ * The packet data is a pooled block whose layout is private to libobs (it is
+ * no longer preceded by a long reference count, see encoder_packet::data).
+ */
 EXPORT void obs_encoder_packet_ref(struct encoder_packet *dst,
 				   struct encoder_packet *src);
 EXPORT void obs_encoder_packet_release(struct encoder_packet *packet);
 
+/**
+ * Encoded packet payloads are stored once in pooled blocks that every output
+ * references.  live_* covers blocks still referenced (peak_live_bytes is the
+ * high-water mark), pooled_* released blocks kept for reuse, and hits and
+ * misses count allocations served from the pool and from the allocator.
+ */
+struct obs_encoder_packet_pool_stats {
+	size_t live_packets;
+	size_t live_bytes;
+	size_t peak_live_bytes;
+	size_t pooled_packets;
+	size_t pooled_bytes;
+	uint64_t hits;
+	uint64_t misses;
+};
+
+EXPORT void obs_encoder_packet_pool_get_stats(
+	struct obs_encoder_packet_pool_stats *stats);
+
 EXPORT void *obs_encoder_create_rerouted(obs_encoder_t *encoder,
 					 const char *reroute_id);
 
@@ -2237,6 +2328,30 @@ static inline void obs_source_frame_destroy(struct obs_source_frame *frame)
 EXPORT void obs_source_frame_copy(struct obs_source_frame *dst,
 				  const struct obs_source_frame *src);
 
+/* Async source frames are cached in a process-wide pool keyed by format and
+ * size.  frames_held/bytes_held cover the shared pool, thread_cached_frames
+ * the frames threads keep for themselves.  hits and misses count frame
+ * requests served from the pool and from new allocations. */
+struct obs_frame_pool_stats {
+	size_t classes;
+	size_t frames_held;
+	size_t bytes_held;
+	size_t max_idle_bytes;
+	size_t thread_cached_frames;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t trimmed;
+};
+
+EXPORT void obs_frame_pool_get_stats(struct obs_frame_pool_stats *stats);
+
+/** Limits how much memory idle pooled frames can hold (256MB by default) */
+EXPORT void obs_frame_pool_set_max_idle_bytes(size_t max_bytes);
+
+/** Frees idle pooled frames until at most max_bytes are held, for use when
+ * the system is low on memory */
+EXPORT void obs_frame_pool_trim(size_t max_bytes);
+
 /* ------------------------------------------------------------------------- */
 /* Get source icon type */
 EXPORT enum obs_icon_type obs_source_get_icon_type(const char *id);
@@ -14,7 +14,10 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <errno.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
 #include "bmem.h"
@@ -102,3 +105,63 @@ size_t os_process_pipe_write(os_process_pipe_t *pp, const uint8_t *data,
 	}
 	return written;
 }
+
+#define MAX_IOV 64
+
+size_t os_process_pipe_writev(os_process_pipe_t *pp,
+			      const struct os_process_pipe_vec *vecs,
+			      size_t count)
+{
+	struct iovec iov[MAX_IOV];
+	size_t written = 0;
+	size_t offset = 0;
+	size_t idx = 0;
+	int fd;
+
+	if (!pp) {
+		return 0;
+	}
+	if (pp->read_pipe) {
+		return 0;
+	}
+
+	/* anything still buffered by os_process_pipe_write goes first */
+	if (fflush(pp->file) != 0)
+		return 0;
+
+	fd = fileno(pp->file);
+
+	while (idx < count) {
+		int num = 0;
+		ssize_t ret;
+		size_t left;
+
+		for (size_t i = idx; i < count && num < MAX_IOV; i++) {
+			size_t skip = i == idx ? offset : 0;
+
+			iov[num].iov_base = (void *)(vecs[i].data + skip);
+			iov[num].iov_len = vecs[i].len - skip;
+			num++;
+		}
+
+		ret = writev(fd, iov, num);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		written += (size_t)ret;
+
+		/* skip past whatever was written, a partial write leaves an
+		 * offset into the current buffer */
+		left = (size_t)ret;
+		while (idx < count && left >= vecs[idx].len - offset) {
+			left -= vecs[idx].len - offset;
+			offset = 0;
+			idx++;
+		}
+		offset += left;
+	}
+
+	return written;
+}
@@ -26,6 +26,9 @@ struct os_process_pipe {
 	HANDLE handle;
 	HANDLE handle_err;
 	HANDLE process;
+
+	uint8_t *write_buf;
+	size_t write_buf_size;
 };
 
 static bool create_pipe(HANDLE *input, HANDLE *output)
@@ -125,6 +128,8 @@ os_process_pipe_t *os_process_pipe_create(const char *cmd_line,
 	pp->read_pipe = read_pipe;
 	pp->process = process;
 	pp->handle_err = err_input;
+	pp->write_buf = NULL;
+	pp->write_buf_size = 0;
 
 	CloseHandle(read_pipe ? output : input);
 	CloseHandle(err_output);
@@ -151,6 +156,7 @@ int os_process_pipe_destroy(os_process_pipe_t *pp)
 			ret = (int)code;
 
 		CloseHandle(pp->process);
+		bfree(pp->write_buf);
 		bfree(pp);
 	}
 
@@ -218,3 +224,50 @@ size_t os_process_pipe_write(os_process_pipe_t *pp, const uint8_t *data,
 
 	return 0;
 }
+
+/* pipes have no gather write, so the buffers are joined and written with a
+ * single WriteFile call */
+size_t os_process_pipe_writev(os_process_pipe_t *pp,
+			      const struct os_process_pipe_vec *vecs,
+			      size_t count)
+{
+	size_t written = 0;
+	size_t total = 0;
+	uint8_t *data;
+
+	if (!pp) {
+		return 0;
+	}
+	if (pp->read_pipe) {
+		return 0;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		total += vecs[i].len;
+
+	if (pp->write_buf_size < total) {
+		pp->write_buf = brealloc(pp->write_buf, total);
+		pp->write_buf_size = total;
+	}
+
+	data = pp->write_buf;
+	for (size_t i = 0; i < count; i++) {
+		memcpy(data, vecs[i].data, vecs[i].len);
+		data += vecs[i].len;
+	}
+
+	while (written < total) {
+		DWORD bytes_written;
+		bool success;
+
+		success = !!WriteFile(pp->handle, pp->write_buf + written,
+				      (DWORD)(total - written), &bytes_written,
+				      NULL);
+		if (!success || !bytes_written)
+			break;
+
+		written += bytes_written;
+	}
+
+	return written;
+}
@@ -31,3 +31,14 @@ EXPORT size_t os_process_pipe_read_err(os_process_pipe_t *pp, uint8_t *data,
 				       size_t len);
 EXPORT size_t os_process_pipe_write(os_process_pipe_t *pp, const uint8_t *data,
 				    size_t len);
+
+struct os_process_pipe_vec {
+	const uint8_t *data;
+	size_t len;
+};
+
+/* Writes several buffers with as few system calls as possible, returns the
+ * total number of bytes written */
+EXPORT size_t os_process_pipe_writev(os_process_pipe_t *pp,
+				     const struct os_process_pipe_vec *vecs,
+				     size_t count);
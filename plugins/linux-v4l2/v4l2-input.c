@@ -85,13 +85,128 @@ struct v4l2_data {
 	int width;
 	int height;
 	int linesize;
+	struct v4l2_buffer_set *buffers;
+};
+
+/* frames are only handed to obs without copying while at least this many
+ * buffers stay queued in the driver */
+#define MIN_QUEUED_BUFFERS 2
+
+/**
+ * Reference to one mapped buffer held by obs
+ */
+struct v4l2_frame_ref {
+	struct v4l2_buffer_set *set;
+	uint32_t index;
+};
+
+/**
+ * Mapped buffers shared with obs
+ *
+ * Frames are handed to obs without copying, so the mapped buffers must stay
+ * around until obs has released the last of them, which can be after the
+ * capture thread stopped and the device was closed.
+ */
+struct v4l2_buffer_set {
+	volatile long refs;
+	volatile long outstanding;
+	pthread_mutex_t mutex;
+	int_fast32_t dev;
+	bool streaming;
 	struct v4l2_buffer_data buffers;
+	struct v4l2_frame_ref *frames;
 };
 
 /* forward declarations */
 static void v4l2_init(struct v4l2_data *data);
 static void v4l2_terminate(struct v4l2_data *data);
 
+static struct v4l2_buffer_set *v4l2_buffer_set_create(int_fast32_t dev)
+{
+	struct v4l2_buffer_set *set = bzalloc(sizeof(struct v4l2_buffer_set));
+
+	set->refs = 1;
+	set->dev = dev;
+	pthread_mutex_init_value(&set->mutex);
+
+	if (pthread_mutex_init(&set->mutex, NULL) != 0) {
+		bfree(set);
+		return NULL;
+	}
+	if (v4l2_create_mmap(dev, &set->buffers) < 0) {
+		v4l2_destroy_mmap(&set->buffers);
+		pthread_mutex_destroy(&set->mutex);
+		bfree(set);
+		return NULL;
+	}
+
+	set->frames = bzalloc(set->buffers.count * sizeof(*set->frames));
+	for (uint_fast32_t i = 0; i < set->buffers.count; ++i) {
+		set->frames[i].set = set;
+		set->frames[i].index = i;
+	}
+
+	return set;
+}
+
+static void v4l2_buffer_set_release(struct v4l2_buffer_set *set)
+{
+	if (!set || os_atomic_dec_long(&set->refs) != 0)
+		return;
+
+	v4l2_destroy_mmap(&set->buffers);
+	pthread_mutex_destroy(&set->mutex);
+	bfree(set->frames);
+	bfree(set);
+}
+
+/**
+ * Release callback for frames handed to obs, requeues the buffer if the
+ * capture is still running
+ */
+static void v4l2_release_frame(void *param)
+{
+	struct v4l2_frame_ref *ref = param;
+	struct v4l2_buffer_set *set = ref->set;
+	struct v4l2_buffer buf;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = ref->index;
+
+	pthread_mutex_lock(&set->mutex);
+	if (set->streaming && v4l2_ioctl(set->dev, VIDIOC_QBUF, &buf) < 0)
+		blog(LOG_DEBUG, "failed to enqueue buffer");
+	pthread_mutex_unlock(&set->mutex);
+
+	os_atomic_dec_long(&set->outstanding);
+	v4l2_buffer_set_release(set);
+}
+
+/**
+ * Hand a dequeued buffer to obs without copying it
+ *
+ * @return false if too few buffers are left in the driver, the caller has to
+ *         copy the frame and requeue the buffer itself then
+ */
+static bool v4l2_output_buffer(struct v4l2_data *data,
+			       struct obs_source_frame *frame, uint32_t index)
+{
+	struct v4l2_buffer_set *set = data->buffers;
+	long max_outstanding = (long)set->buffers.count - MIN_QUEUED_BUFFERS;
+
+	if (os_atomic_load_long(&set->outstanding) >= max_outstanding)
+		return false;
+
+	os_atomic_inc_long(&set->outstanding);
+	os_atomic_inc_long(&set->refs);
+	obs_source_output_video_external(data->source, frame,
+					 v4l2_release_frame,
+					 &set->frames[index]);
+	return true;
+}
+
 /**
  * Prepare the output frame structure for obs and compute plane offsets
  *
@@ -159,8 +274,13 @@ static void *v4l2_thread(void *vptr)
 	struct obs_source_frame out;
 	size_t plane_offsets[MAX_AV_PLANES];
 
-	if (v4l2_start_capture(data->dev, &data->buffers) < 0)
+	pthread_mutex_lock(&data->buffers->mutex);
+	if (v4l2_start_capture(data->dev, &data->buffers->buffers) < 0) {
+		pthread_mutex_unlock(&data->buffers->mutex);
 		goto exit;
+	}
+	data->buffers->streaming = true;
+	pthread_mutex_unlock(&data->buffers->mutex);
 
 	frames = 0;
 	first_ts = 0;
@@ -198,23 +318,30 @@ static void *v4l2_thread(void *vptr)
 			first_ts = out.timestamp;
 		out.timestamp -= first_ts;
 
-		start = (uint8_t *)data->buffers.info[buf.index].start;
+		start = (uint8_t *)data->buffers->buffers.info[buf.index].start;
 		for (uint_fast32_t i = 0; i < MAX_AV_PLANES; ++i)
 			out.data[i] = start + plane_offsets[i];
+
+		frames++;
+		if (v4l2_output_buffer(data, &out, buf.index))
+			continue;
+
 		obs_source_output_video(data->source, &out);
 
 		if (v4l2_ioctl(data->dev, VIDIOC_QBUF, &buf) < 0) {
 			blog(LOG_DEBUG, "failed to enqueue buffer");
 			break;
 		}
-
-		frames++;
 	}
 
 	blog(LOG_INFO, "Stopped capture after %" PRIu64 " frames", frames);
 
 exit:
+	/* buffers still held by obs are not requeued after this */
+	pthread_mutex_lock(&data->buffers->mutex);
+	data->buffers->streaming = false;
 	v4l2_stop_capture(data->dev);
+	pthread_mutex_unlock(&data->buffers->mutex);
 	return NULL;
 }
 
@@ -807,7 +934,8 @@ static void v4l2_terminate(struct v4l2_data *data)
 		data->thread = 0;
 	}
 
-	v4l2_destroy_mmap(&data->buffers);
+	v4l2_buffer_set_release(data->buffers);
+	data->buffers = NULL;
 
 	if (data->dev != -1) {
 		v4l2_close(data->dev);
@@ -915,7 +1043,8 @@ static void v4l2_init(struct v4l2_data *data)
 	blog(LOG_INFO, "Framerate: %.2f fps", (float)fps_denom / fps_num);
 
 	/* map buffers */
-	if (v4l2_create_mmap(data->dev, &data->buffers) < 0) {
+	data->buffers = v4l2_buffer_set_create(data->dev);
+	if (!data->buffers) {
 		blog(LOG_ERROR, "Failed to map buffers");
 		goto fail;
 	}
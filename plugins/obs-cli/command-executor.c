@@ -0,0 +1,132 @@
+#include "util/bmem.h"
+#include "util/circlebuf.h"
+#include "util/threading.h"
+#include "command-executor.h"
+
+struct executor_task {
+	executor_task_t task;
+	void *param;
+};
+
+struct executor_lane {
+	const char *name;
+	pthread_t thread;
+	bool thread_created;
+
+	pthread_mutex_t mutex;
+	struct circlebuf tasks;
+	os_sem_t *sem;
+};
+
+struct executor {
+	struct executor_lane *lanes;
+	size_t num_lanes;
+
+	os_sem_t *idle_sem;
+};
+
+static void *lane_thread(void *data)
+{
+	struct executor_lane *lane = data;
+	struct executor_task task;
+
+	os_set_thread_name(lane->name);
+
+	while (os_sem_wait(lane->sem) == 0) {
+		pthread_mutex_lock(&lane->mutex);
+		circlebuf_pop_front(&lane->tasks, &task, sizeof(task));
+		pthread_mutex_unlock(&lane->mutex);
+
+		/* a NULL task is the stop marker queued by destroy */
+		if (!task.task)
+			break;
+
+		task.task(task.param);
+	}
+
+	return NULL;
+}
+
+struct executor *executor_create(size_t num_lanes,
+				 const char *const *lane_names)
+{
+	struct executor *executor = bzalloc(sizeof(struct executor));
+
+	executor->lanes = bzalloc(sizeof(struct executor_lane) * num_lanes);
+	executor->num_lanes = num_lanes;
+
+	if (os_sem_init(&executor->idle_sem, 0) != 0)
+		goto fail;
+
+	for (size_t i = 0; i < num_lanes; i++) {
+		struct executor_lane *lane = &executor->lanes[i];
+		lane->name = lane_names[i];
+
+		if (pthread_mutex_init(&lane->mutex, NULL) != 0)
+			goto fail;
+		if (os_sem_init(&lane->sem, 0) != 0)
+			goto fail;
+		if (pthread_create(&lane->thread, NULL, lane_thread, lane) != 0)
+			goto fail;
+
+		lane->thread_created = true;
+	}
+
+	return executor;
+
+fail:
+	executor_destroy(executor);
+	return NULL;
+}
+
+void executor_destroy(struct executor *executor)
+{
+	if (!executor)
+		return;
+
+	for (size_t i = 0; i < executor->num_lanes; i++) {
+		struct executor_lane *lane = &executor->lanes[i];
+
+		if (lane->thread_created) {
+			executor_submit(executor, i, NULL, NULL);
+			pthread_join(lane->thread, NULL);
+		}
+
+		if (lane->sem) {
+			pthread_mutex_destroy(&lane->mutex);
+			os_sem_destroy(lane->sem);
+		}
+		circlebuf_free(&lane->tasks);
+	}
+
+	os_sem_destroy(executor->idle_sem);
+	bfree(executor->lanes);
+	bfree(executor);
+}
+
+void executor_submit(struct executor *executor, size_t lane_idx,
+		     executor_task_t task, void *param)
+{
+	struct executor_lane *lane = &executor->lanes[lane_idx];
+	struct executor_task entry = {task, param};
+
+	pthread_mutex_lock(&lane->mutex);
+	circlebuf_push_back(&lane->tasks, &entry, sizeof(entry));
+	pthread_mutex_unlock(&lane->mutex);
+
+	os_sem_post(lane->sem);
+}
+
+static void post_idle(void *param)
+{
+	os_sem_post(param);
+}
+
+void executor_wait_idle(struct executor *executor)
+{
+	for (size_t i = 0; i < executor->num_lanes; i++)
+		executor_submit(executor, i, post_idle, executor->idle_sem);
+
+	for (size_t i = 0; i < executor->num_lanes; i++)
+		os_sem_wait(executor->idle_sem);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Runs commands on a fixed set of lanes, one worker thread per lane.  Tasks
+ * submitted to the same lane run one at a time in submission order; tasks on
+ * different lanes run concurrently.
+ */
+
+typedef void (*executor_task_t)(void *param);
+
+struct executor;
+
+extern struct executor *executor_create(size_t num_lanes,
+					const char *const *lane_names);
+
+/* Runs every queued task, then stops and joins the lane threads */
+extern void executor_destroy(struct executor *executor);
+
+extern void executor_submit(struct executor *executor, size_t lane,
+			    executor_task_t task, void *param);
+
+/* Blocks until every task submitted before the call has finished.  Used to
+ * run commands that touch state shared by all lanes. */
+extern void executor_wait_idle(struct executor *executor);
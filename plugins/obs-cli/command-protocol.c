@@ -0,0 +1,474 @@
+#include <string.h>
+
+#include "util/bmem.h"
+#include "util/dstr.h"
+#include "util/array-serializer.h"
+#include "util/circlebuf.h"
+#include "util/threading.h"
+#include "command-protocol.h"
+
+/* guards against allocating garbage lengths after a desync */
+#define MAX_MESSAGE_SIZE (256 * 1024 * 1024)
+#define MAX_BINARY_DEPTH 64
+
+enum binary_type {
+	BINARY_NULL,
+	BINARY_FALSE,
+	BINARY_TRUE,
+	BINARY_INTEGER,
+	BINARY_REAL,
+	BINARY_STRING,
+	BINARY_ARRAY,
+	BINARY_OBJECT,
+};
+
+/* ------------------------------------------------------------------------- */
+/* binary decoding                                                           */
+
+struct binary_reader {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+};
+
+static inline bool read_bytes(struct binary_reader *r, void *out, size_t size)
+{
+	if (r->size - r->pos < size)
+		return false;
+
+	memcpy(out, r->data + r->pos, size);
+	r->pos += size;
+	return true;
+}
+
+static inline bool read_u32(struct binary_reader *r, uint32_t *val)
+{
+	uint8_t b[4];
+	if (!read_bytes(r, b, sizeof(b)))
+		return false;
+
+	*val = (uint32_t)b[0] | ((uint32_t)b[1] << 8) |
+	       ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+	return true;
+}
+
+static inline bool read_u64(struct binary_reader *r, uint64_t *val)
+{
+	uint32_t lo, hi;
+	if (!read_u32(r, &lo) || !read_u32(r, &hi))
+		return false;
+
+	*val = (uint64_t)lo | ((uint64_t)hi << 32);
+	return true;
+}
+
+static json_t *decode_value(struct binary_reader *r, int depth);
+
+static json_t *decode_string(struct binary_reader *r)
+{
+	uint32_t len;
+	if (!read_u32(r, &len) || r->size - r->pos < len)
+		return NULL;
+
+	json_t *str = json_stringn((const char *)r->data + r->pos, len);
+	r->pos += len;
+	return str;
+}
+
+static json_t *decode_array(struct binary_reader *r, int depth)
+{
+	uint32_t count;
+	if (!read_u32(r, &count))
+		return NULL;
+
+	json_t *array = json_array();
+	for (uint32_t i = 0; i < count; i++) {
+		json_t *val = decode_value(r, depth + 1);
+		if (!val) {
+			json_decref(array);
+			return NULL;
+		}
+		json_array_append_new(array, val);
+	}
+
+	return array;
+}
+
+static json_t *decode_object(struct binary_reader *r, int depth)
+{
+	uint32_t count;
+	if (!read_u32(r, &count))
+		return NULL;
+
+	json_t *obj = json_object();
+	for (uint32_t i = 0; i < count; i++) {
+		json_t *key = decode_string(r);
+		json_t *val = key ? decode_value(r, depth + 1) : NULL;
+		if (!val) {
+			json_decref(key);
+			json_decref(obj);
+			return NULL;
+		}
+
+		json_object_set_new(obj, json_string_value(key), val);
+		json_decref(key);
+	}
+
+	return obj;
+}
+
+static json_t *decode_value(struct binary_reader *r, int depth)
+{
+	uint8_t type;
+	uint64_t u64;
+	double d;
+
+	if (depth > MAX_BINARY_DEPTH || !read_bytes(r, &type, 1))
+		return NULL;
+
+	switch (type) {
+	case BINARY_NULL:
+		return json_null();
+	case BINARY_FALSE:
+		return json_false();
+	case BINARY_TRUE:
+		return json_true();
+	case BINARY_INTEGER:
+		if (!read_u64(r, &u64))
+			return NULL;
+		return json_integer((json_int_t)(int64_t)u64);
+	case BINARY_REAL:
+		if (!read_u64(r, &u64))
+			return NULL;
+		memcpy(&d, &u64, sizeof(d));
+		return json_real(d);
+	case BINARY_STRING:
+		return decode_string(r);
+	case BINARY_ARRAY:
+		return decode_array(r, depth);
+	case BINARY_OBJECT:
+		return decode_object(r, depth);
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* binary encoding                                                           */
+
+static void encode_string(struct serializer *s, const char *str, size_t len)
+{
+	s_wl32(s, (uint32_t)len);
+	s_write(s, str, len);
+}
+
+static void encode_value(struct serializer *s, const json_t *val)
+{
+	const char *key;
+	json_t *item;
+	size_t idx;
+	double d;
+	uint64_t u64;
+
+	switch (json_typeof(val)) {
+	case JSON_NULL:
+		s_w8(s, BINARY_NULL);
+		break;
+	case JSON_FALSE:
+		s_w8(s, BINARY_FALSE);
+		break;
+	case JSON_TRUE:
+		s_w8(s, BINARY_TRUE);
+		break;
+	case JSON_INTEGER:
+		s_w8(s, BINARY_INTEGER);
+		s_wl64(s, (uint64_t)json_integer_value(val));
+		break;
+	case JSON_REAL:
+		d = json_real_value(val);
+		memcpy(&u64, &d, sizeof(d));
+		s_w8(s, BINARY_REAL);
+		s_wl64(s, u64);
+		break;
+	case JSON_STRING:
+		s_w8(s, BINARY_STRING);
+		encode_string(s, json_string_value(val),
+			      json_string_length(val));
+		break;
+	case JSON_ARRAY:
+		s_w8(s, BINARY_ARRAY);
+		s_wl32(s, (uint32_t)json_array_size(val));
+		json_array_foreach (val, idx, item)
+			encode_value(s, item);
+		break;
+	case JSON_OBJECT:
+		s_w8(s, BINARY_OBJECT);
+		s_wl32(s, (uint32_t)json_object_size(val));
+		json_object_foreach ((json_t *)val, key, item) {
+			encode_string(s, key, strlen(key));
+			encode_value(s, item);
+		}
+		break;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool read_line(FILE *in, struct dstr *line)
+{
+	char chunk[4096];
+
+	dstr_copy(line, "");
+
+	while (fgets(chunk, sizeof(chunk), in)) {
+		dstr_cat(line, chunk);
+		if (dstr_end(line) == '\n')
+			return true;
+	}
+
+	return !dstr_is_empty(line);
+}
+
+static json_t *read_line_command(FILE *in, bool *eof)
+{
+	struct dstr line = {0};
+	json_error_t error;
+	json_t *root = NULL;
+
+	if (!read_line(in, &line)) {
+		*eof = true;
+		goto exit;
+	}
+
+	dstr_depad(&line);
+	if (dstr_is_empty(&line))
+		goto exit;
+
+	root = json_loadb(line.array, line.len, 0, &error);
+	if (!root)
+		fprintf(stderr, "error: on line %d: %s\n", error.line,
+			error.text);
+
+exit:
+	dstr_free(&line);
+	return root;
+}
+
+static json_t *read_framed_command(FILE *in, enum command_encoding *encoding,
+				   bool *eof)
+{
+	uint8_t header[5];
+	json_error_t error;
+	json_t *root = NULL;
+
+	if (fread(header, 1, sizeof(header), in) != sizeof(header)) {
+		*eof = true;
+		return NULL;
+	}
+
+	uint32_t size = (uint32_t)header[0] | ((uint32_t)header[1] << 8) |
+			((uint32_t)header[2] << 16) |
+			((uint32_t)header[3] << 24);
+	if (size > MAX_MESSAGE_SIZE) {
+		fprintf(stderr, "error: message of %u bytes exceeds limit\n",
+			size);
+		*eof = true;
+		return NULL;
+	}
+
+	uint8_t *body = bmalloc(size ? size : 1);
+	if (fread(body, 1, size, in) != size) {
+		*eof = true;
+		goto exit;
+	}
+
+	*encoding = (enum command_encoding)header[4];
+
+	if (*encoding == COMMAND_ENCODING_JSON) {
+		root = json_loadb((const char *)body, size, 0, &error);
+		if (!root)
+			fprintf(stderr, "error: on line %d: %s\n", error.line,
+				error.text);
+
+	} else if (*encoding == COMMAND_ENCODING_BINARY) {
+		struct binary_reader reader = {body, size, 0};
+		root = decode_value(&reader, 0);
+		if (root && reader.pos != reader.size) {
+			fprintf(stderr, "error: %zu trailing bytes after "
+					"binary message\n",
+				reader.size - reader.pos);
+			json_decref(root);
+			root = NULL;
+		} else if (!root) {
+			fprintf(stderr, "error: malformed binary message\n");
+		}
+
+	} else {
+		fprintf(stderr, "error: unknown message encoding %d\n",
+			(int)header[4]);
+	}
+
+exit:
+	bfree(body);
+	return root;
+}
+
+json_t *command_read(FILE *in, enum command_protocol protocol,
+		     enum command_encoding *encoding, bool *eof)
+{
+	*eof = false;
+	*encoding = COMMAND_ENCODING_JSON;
+
+	if (protocol == COMMAND_PROTOCOL_FRAMED)
+		return read_framed_command(in, encoding, eof);
+
+	return read_line_command(in, eof);
+}
+
+static bool write_frame(FILE *out, enum command_encoding encoding,
+			const void *body, size_t size)
+{
+	uint8_t header[5] = {(uint8_t)size, (uint8_t)(size >> 8),
+			     (uint8_t)(size >> 16), (uint8_t)(size >> 24),
+			     (uint8_t)encoding};
+
+	return fwrite(header, 1, sizeof(header), out) == sizeof(header) &&
+	       fwrite(body, 1, size, out) == size;
+}
+
+bool command_write(FILE *out, enum command_protocol protocol,
+		   enum command_encoding encoding, const json_t *obj)
+{
+	bool success;
+
+	if (protocol == COMMAND_PROTOCOL_FRAMED &&
+	    encoding == COMMAND_ENCODING_BINARY) {
+		struct array_output_data data;
+		struct serializer s;
+
+		array_output_serializer_init(&s, &data);
+		encode_value(&s, obj);
+		success = write_frame(out, encoding, data.bytes.array,
+				      data.bytes.num);
+		array_output_serializer_free(&data);
+
+	} else {
+		char *str = json_dumps(obj, JSON_COMPACT);
+		if (!str)
+			return false;
+
+		if (protocol == COMMAND_PROTOCOL_FRAMED) {
+			success = write_frame(out, COMMAND_ENCODING_JSON, str,
+					      strlen(str));
+		} else {
+			// Newline first in case someone printed garbage to
+			// stdout
+			success = fprintf(out, "\n%s\n", str) > 0;
+		}
+
+		free(str);
+	}
+
+	fflush(out);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+/* writer thread                                                             */
+
+struct command_message {
+	enum command_encoding encoding;
+	json_t *obj;
+};
+
+struct command_writer {
+	FILE *out;
+	enum command_protocol protocol;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	struct circlebuf messages;
+	os_sem_t *sem;
+};
+
+static void *writer_thread(void *data)
+{
+	struct command_writer *writer = data;
+	struct command_message msg;
+
+	os_set_thread_name("obs-cli: command writer");
+
+	while (os_sem_wait(writer->sem) == 0) {
+		pthread_mutex_lock(&writer->mutex);
+		circlebuf_pop_front(&writer->messages, &msg, sizeof(msg));
+		pthread_mutex_unlock(&writer->mutex);
+
+		/* a NULL message is the stop marker queued by destroy */
+		if (!msg.obj)
+			break;
+
+		command_write(writer->out, writer->protocol, msg.encoding,
+			      msg.obj);
+		json_decref(msg.obj);
+	}
+
+	return NULL;
+}
+
+struct command_writer *command_writer_create(FILE *out,
+					     enum command_protocol protocol)
+{
+	struct command_writer *writer = bzalloc(sizeof(struct command_writer));
+	writer->out = out;
+	writer->protocol = protocol;
+
+	if (pthread_mutex_init(&writer->mutex, NULL) != 0)
+		goto fail_mutex;
+	if (os_sem_init(&writer->sem, 0) != 0)
+		goto fail_sem;
+	if (pthread_create(&writer->thread, NULL, writer_thread, writer) != 0)
+		goto fail_thread;
+
+	return writer;
+
+fail_thread:
+	os_sem_destroy(writer->sem);
+fail_sem:
+	pthread_mutex_destroy(&writer->mutex);
+fail_mutex:
+	bfree(writer);
+	return NULL;
+}
+
+static void queue_message(struct command_writer *writer,
+			  enum command_encoding encoding, json_t *obj)
+{
+	struct command_message msg = {encoding, obj};
+
+	pthread_mutex_lock(&writer->mutex);
+	circlebuf_push_back(&writer->messages, &msg, sizeof(msg));
+	pthread_mutex_unlock(&writer->mutex);
+
+	os_sem_post(writer->sem);
+}
+
+void command_writer_destroy(struct command_writer *writer)
+{
+	if (!writer)
+		return;
+
+	queue_message(writer, COMMAND_ENCODING_JSON, NULL);
+	pthread_join(writer->thread, NULL);
+
+	os_sem_destroy(writer->sem);
+	pthread_mutex_destroy(&writer->mutex);
+	circlebuf_free(&writer->messages);
+	bfree(writer);
+}
+
+void command_writer_send(struct command_writer *writer,
+			 enum command_encoding encoding, json_t *obj)
+{
+	if (obj)
+		queue_message(writer, encoding, json_incref(obj));
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <jansson.h>
+
+/*
+ * Command transport between the controller and obs-cli.
+ *
+ * COMMAND_PROTOCOL_LINES is the original protocol: one JSON object per line
+ * (lines may now be of any length).
+ *
+ * COMMAND_PROTOCOL_FRAMED prefixes every message with its body length as a
+ * little-endian uint32 followed by one encoding byte:
+ *
+ *   'J'  the body is UTF-8 JSON text
+ *   'B'  the body is a compact binary value:
+ *          0x00 null, 0x01 false, 0x02 true,
+ *          0x03 int64, 0x04 double (8 bytes each, little-endian),
+ *          0x05 string (uint32 length + bytes),
+ *          0x06 array (uint32 count + values),
+ *          0x07 object (uint32 count + (uint32 key length + key + value))
+ *        The body holds exactly one value, trailing bytes are an error.
+ */
+
+enum command_protocol {
+	COMMAND_PROTOCOL_LINES,
+	COMMAND_PROTOCOL_FRAMED,
+};
+
+enum command_encoding {
+	COMMAND_ENCODING_JSON = 'J',
+	COMMAND_ENCODING_BINARY = 'B',
+};
+
+/* Reads the next command, blocking.  Returns NULL with *eof set once the
+ * input is closed, or NULL without *eof for a malformed message. */
+extern json_t *command_read(FILE *in, enum command_protocol protocol,
+			    enum command_encoding *encoding, bool *eof);
+
+/* Writes a single message and flushes it.  Not thread safe. */
+extern bool command_write(FILE *out, enum command_protocol protocol,
+			  enum command_encoding encoding, const json_t *obj);
+
+/* Owns an output stream and writes queued messages to it from its own
+ * thread, so messages can be sent from any thread without blocking on the
+ * reader of the stream. */
+struct command_writer;
+
+extern struct command_writer *command_writer_create(FILE *out,
+						    enum command_protocol protocol);
+
+/* Writes every queued message, then stops the writer thread */
+extern void command_writer_destroy(struct command_writer *writer);
+
+/* Queues obj for writing, taking a reference to it */
+extern void command_writer_send(struct command_writer *writer,
+				enum command_encoding encoding, json_t *obj);
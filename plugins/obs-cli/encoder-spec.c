@@ -0,0 +1,285 @@
+#include <string.h>
+
+#include "encoder-spec.h"
+
+static const struct {
+	const char *name;
+	const char *setting;
+} video_fields[] = {
+	{"preset", "preset"},
+	{"tune", "tune"},
+	{"rateControl", "rate_control"},
+	{"profile", "profile"},
+	{"bitrate", "bitrate"},
+	{"keyint", "keyint_sec"},
+	{"crf", "crf"},
+};
+
+#define NUM_VIDEO_FIELDS (sizeof(video_fields) / sizeof(video_fields[0]))
+
+const char *encoder_spec_video_id(const json_t *spec)
+{
+	json_t *id = json_object_get(spec, "id");
+	return json_is_string(id) ? json_string_value(id)
+				  : DEFAULT_VIDEO_ENCODER;
+}
+
+bool encoder_spec_fallback(const json_t *spec)
+{
+	json_t *fallback = json_object_get(spec, "fallback");
+	return json_is_boolean(fallback) ? json_is_true(fallback) : true;
+}
+
+static bool find_list_item(obs_property_t *p, const json_t *val, size_t *idx)
+{
+	enum obs_combo_format format = obs_property_list_format(p);
+	size_t count = obs_property_list_item_count(p);
+
+	for (size_t i = 0; i < count; i++) {
+		bool match = false;
+
+		if (format == OBS_COMBO_FORMAT_STRING && json_is_string(val))
+			match = strcmp(obs_property_list_item_string(p, i),
+				       json_string_value(val)) == 0;
+		else if (format == OBS_COMBO_FORMAT_INT && json_is_integer(val))
+			match = obs_property_list_item_int(p, i) ==
+				json_integer_value(val);
+		else if (format == OBS_COMBO_FORMAT_FLOAT && json_is_number(val))
+			match = obs_property_list_item_float(p, i) ==
+				json_number_value(val);
+
+		if (match) {
+			*idx = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void list_items(obs_property_t *p, struct dstr *out)
+{
+	enum obs_combo_format format = obs_property_list_format(p);
+	size_t count = obs_property_list_item_count(p);
+
+	for (size_t i = 0; i < count; i++) {
+		if (i)
+			dstr_cat(out, ", ");
+		if (format == OBS_COMBO_FORMAT_STRING)
+			dstr_catf(out, "\"%s\"",
+				  obs_property_list_item_string(p, i));
+		else if (format == OBS_COMBO_FORMAT_INT)
+			dstr_catf(out, "%lld", obs_property_list_item_int(p, i));
+		else
+			dstr_catf(out, "%g", obs_property_list_item_float(p, i));
+	}
+}
+
+static bool set_value(obs_data_t *settings, obs_properties_t *props,
+		      const char *name, const char *setting, const json_t *val,
+		      struct dstr *error)
+{
+	obs_property_t *p = obs_properties_get(props, setting);
+	size_t idx;
+
+	if (!p) {
+		dstr_printf(error, "%s is not supported by this encoder", name);
+		return false;
+	}
+
+	switch (obs_property_get_type(p)) {
+	case OBS_PROPERTY_BOOL:
+		if (!json_is_boolean(val))
+			goto wrong_type;
+		obs_data_set_bool(settings, setting, json_is_true(val));
+		return true;
+
+	case OBS_PROPERTY_INT:
+		if (!json_is_integer(val))
+			goto wrong_type;
+		if (json_integer_value(val) < obs_property_int_min(p) ||
+		    json_integer_value(val) > obs_property_int_max(p)) {
+			dstr_printf(error, "%s must be between %d and %d", name,
+				    obs_property_int_min(p),
+				    obs_property_int_max(p));
+			return false;
+		}
+		obs_data_set_int(settings, setting, json_integer_value(val));
+		return true;
+
+	case OBS_PROPERTY_FLOAT:
+		if (!json_is_number(val))
+			goto wrong_type;
+		obs_data_set_double(settings, setting, json_number_value(val));
+		return true;
+
+	case OBS_PROPERTY_TEXT:
+	case OBS_PROPERTY_PATH:
+		if (!json_is_string(val))
+			goto wrong_type;
+		obs_data_set_string(settings, setting, json_string_value(val));
+		return true;
+
+	case OBS_PROPERTY_LIST:
+		if (!find_list_item(p, val, &idx)) {
+			dstr_printf(error, "%s must be one of: ", name);
+			list_items(p, error);
+			return false;
+		}
+		if (obs_property_list_format(p) == OBS_COMBO_FORMAT_STRING)
+			obs_data_set_string(settings, setting,
+					    obs_property_list_item_string(p, idx));
+		else if (obs_property_list_format(p) == OBS_COMBO_FORMAT_INT)
+			obs_data_set_int(settings, setting,
+					 obs_property_list_item_int(p, idx));
+		else
+			obs_data_set_double(settings, setting,
+					    obs_property_list_item_float(p, idx));
+		return true;
+
+	default:
+		dstr_printf(error, "%s cannot be set on this encoder", name);
+		return false;
+	}
+
+wrong_type:
+	dstr_printf(error, "%s has the wrong type", name);
+	return false;
+}
+
+static bool set_threads(obs_data_t *settings, obs_properties_t *props,
+			const json_t *val, struct dstr *error)
+{
+	if (!json_is_integer(val) || json_integer_value(val) < 0) {
+		dstr_copy(error, "threads must be 0 (auto) or more");
+		return false;
+	}
+
+	/* x264 only exposes its thread count through the option string */
+	if (!obs_properties_get(props, "x264opts")) {
+		dstr_copy(error, "threads is not supported by this encoder");
+		return false;
+	}
+
+	struct dstr opts = {0};
+	dstr_printf(&opts, "threads=%lld", (long long)json_integer_value(val));
+	obs_data_set_string(settings, "x264opts", opts.array);
+	dstr_free(&opts);
+	return true;
+}
+
+/* In lenient mode a rejected field is logged and skipped */
+static bool field_failed(const char *id, bool strict, struct dstr *field_error,
+			 struct dstr *error)
+{
+	if (strict) {
+		dstr_printf(error, "%s: %s", id, field_error->array);
+		return true;
+	}
+
+	blog(LOG_WARNING, "encoder spec: %s: %s, ignoring", id,
+	     field_error->array);
+	return false;
+}
+
+obs_data_t *encoder_spec_video_settings(const json_t *spec, const char *id,
+					bool strict, struct dstr *error)
+{
+	obs_properties_t *props = obs_get_encoder_properties(id);
+	struct dstr field_error = {0};
+	obs_data_t *settings;
+	json_t *val;
+
+	if (!props) {
+		dstr_printf(error, "encoder %s is not available", id);
+		return NULL;
+	}
+
+	settings = obs_data_create();
+
+	for (size_t i = 0; i < NUM_VIDEO_FIELDS; i++) {
+		val = json_object_get(spec, video_fields[i].name);
+		if (!val)
+			continue;
+
+		if (!set_value(settings, props, video_fields[i].name,
+			       video_fields[i].setting, val, &field_error) &&
+		    field_failed(id, strict, &field_error, error))
+			goto fail;
+	}
+
+	val = json_object_get(spec, "threads");
+	if (val && !set_threads(settings, props, val, &field_error) &&
+	    field_failed(id, strict, &field_error, error))
+		goto fail;
+
+	dstr_free(&field_error);
+	obs_properties_destroy(props);
+	return settings;
+
+fail:
+	dstr_free(&field_error);
+	obs_properties_destroy(props);
+	obs_data_release(settings);
+	return NULL;
+}
+
+obs_data_t *encoder_spec_audio_settings(const json_t *spec,
+					struct dstr *error)
+{
+	obs_properties_t *props =
+		obs_get_encoder_properties(DEFAULT_AUDIO_ENCODER);
+	obs_data_t *settings = obs_data_create();
+	json_t *val = json_object_get(spec, "audioBitrate");
+
+	if (val && !props) {
+		dstr_printf(error, "encoder %s is not available",
+			    DEFAULT_AUDIO_ENCODER);
+		obs_data_release(settings);
+		settings = NULL;
+
+	} else if (val && !set_value(settings, props, "audioBitrate", "bitrate",
+				     val, error)) {
+		obs_data_release(settings);
+		settings = NULL;
+	}
+
+	obs_properties_destroy(props);
+	return settings;
+}
+
+bool encoder_spec_validate(const json_t *spec, struct dstr *error)
+{
+	obs_data_t *settings;
+
+	if (!json_is_object(spec)) {
+		dstr_copy(error, "encoder must be an object");
+		return false;
+	}
+	if (json_object_get(spec, "id") &&
+	    !json_is_string(json_object_get(spec, "id"))) {
+		dstr_copy(error, "encoder id must be a string");
+		return false;
+	}
+
+	settings = encoder_spec_audio_settings(spec, error);
+	if (!settings)
+		return false;
+	obs_data_release(settings);
+
+	const char *id = encoder_spec_video_id(spec);
+	obs_properties_t *props = obs_get_encoder_properties(id);
+	bool known = props != NULL;
+	obs_properties_destroy(props);
+
+	/* a missing hardware encoder is fine if we are allowed to fall back */
+	if (!known && encoder_spec_fallback(spec))
+		return true;
+
+	settings = encoder_spec_video_settings(spec, id, true, error);
+	if (!settings)
+		return false;
+
+	obs_data_release(settings);
+	return true;
+}
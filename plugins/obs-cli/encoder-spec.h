@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <jansson.h>
+
+#include "util/dstr.h"
+#include "obs.h"
+
+/*
+ * Encoder spec accepted by the recording commands:
+ *
+ *   {
+ *     "id": "obs_x264" | "ffmpeg_nvenc" | "ffmpeg_vaapi" | ...,
+ *     "preset", "tune", "rateControl", "profile": strings,
+ *     "bitrate", "keyint", "crf", "threads", "audioBitrate": integers,
+ *     "fallback": bool, fall back to obs_x264 if the encoder is missing or
+ *                 fails to initialize (default true)
+ *   }
+ *
+ * Every field is checked against the properties the encoder reports, so a
+ * typo or an unsupported value fails the command instead of silently using
+ * the encoder defaults.
+ */
+
+#define DEFAULT_VIDEO_ENCODER "obs_x264"
+#define DEFAULT_AUDIO_ENCODER "ffmpeg_aac"
+
+extern const char *encoder_spec_video_id(const json_t *spec);
+extern bool encoder_spec_fallback(const json_t *spec);
+
+/* Returns false and fills error if the spec is malformed, or if the encoder
+ * is registered and rejects one of the fields */
+extern bool encoder_spec_validate(const json_t *spec, struct dstr *error);
+
+/* Builds settings for encoder id.  When strict is false, fields the encoder
+ * does not support are skipped with a warning, which is used for the
+ * fallback encoder.  Returns NULL and fills error on failure. */
+extern obs_data_t *encoder_spec_video_settings(const json_t *spec,
+					       const char *id, bool strict,
+					       struct dstr *error);
+
+extern obs_data_t *encoder_spec_audio_settings(const json_t *spec,
+					       struct dstr *error);
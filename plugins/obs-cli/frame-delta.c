@@ -0,0 +1,213 @@
+#include <string.h>
+
+#include "util/bmem.h"
+#include "util/threading.h"
+#include "util/sse-intrin.h"
+#include "frame-delta.h"
+
+struct frame_delta {
+	uint32_t tile_size;
+	uint32_t keyframe_interval;
+	uint32_t frames_since_keyframe;
+	volatile bool keyframe_requested;
+
+	/* previous frame as sent to the consumer, packed RGBA */
+	uint8_t *prev;
+	uint32_t width;
+	uint32_t height;
+
+	volatile long frames;
+	volatile long keyframes;
+	volatile long changed_tiles;
+	volatile long total_tiles;
+};
+
+static inline uint32_t div_ceil(uint32_t val, uint32_t div)
+{
+	return (val + div - 1) / div;
+}
+
+static inline size_t bitmap_size(uint32_t tiles)
+{
+	return (tiles + 7) / 8;
+}
+
+static bool rows_equal(const uint8_t *a, const uint8_t *b, size_t size)
+{
+	size_t i = 0;
+
+	for (; i + 64 <= size; i += 64) {
+		__m128i eq0 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(a + i)),
+			_mm_loadu_si128((const __m128i *)(b + i)));
+		__m128i eq1 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(a + i + 16)),
+			_mm_loadu_si128((const __m128i *)(b + i + 16)));
+		__m128i eq2 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(a + i + 32)),
+			_mm_loadu_si128((const __m128i *)(b + i + 32)));
+		__m128i eq3 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(a + i + 48)),
+			_mm_loadu_si128((const __m128i *)(b + i + 48)));
+
+		__m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1),
+					   _mm_and_si128(eq2, eq3));
+		if (_mm_movemask_epi8(eq) != 0xFFFF)
+			return false;
+	}
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i eq = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(a + i)),
+			_mm_loadu_si128((const __m128i *)(b + i)));
+		if (_mm_movemask_epi8(eq) != 0xFFFF)
+			return false;
+	}
+
+	return memcmp(a + i, b + i, size - i) == 0;
+}
+
+struct frame_delta *frame_delta_create(uint32_t tile_size,
+				       uint32_t keyframe_interval)
+{
+	struct frame_delta *delta;
+
+	if (!tile_size)
+		return NULL;
+
+	delta = bzalloc(sizeof(struct frame_delta));
+	delta->tile_size = tile_size;
+	delta->keyframe_interval = keyframe_interval;
+	return delta;
+}
+
+void frame_delta_destroy(struct frame_delta *delta)
+{
+	if (!delta)
+		return;
+
+	bfree(delta->prev);
+	bfree(delta);
+}
+
+size_t frame_delta_max_size(const struct frame_delta *delta, uint32_t width,
+			    uint32_t height)
+{
+	uint32_t tiles = div_ceil(width, delta->tile_size) *
+			 div_ceil(height, delta->tile_size);
+
+	return sizeof(struct frame_delta_header) + bitmap_size(tiles) +
+	       (size_t)width * height * 4;
+}
+
+void frame_delta_request_keyframe(struct frame_delta *delta)
+{
+	os_atomic_set_bool(&delta->keyframe_requested, true);
+}
+
+size_t frame_delta_encode(struct frame_delta *delta, uint8_t *dst,
+			  const uint8_t *src, uint32_t linesize,
+			  uint32_t width, uint32_t height, uint64_t timestamp)
+{
+	struct frame_delta_header *header = (void *)dst;
+	uint32_t tile_size = delta->tile_size;
+	uint32_t tiles_x = div_ceil(width, tile_size);
+	uint32_t tiles_y = div_ceil(height, tile_size);
+	uint8_t *bitmap = dst + sizeof(*header);
+	uint8_t *out = bitmap + bitmap_size(tiles_x * tiles_y);
+	uint32_t prev_linesize = width * 4;
+	uint32_t changed = 0;
+	bool keyframe;
+
+	if (delta->width != width || delta->height != height) {
+		bfree(delta->prev);
+		delta->prev = bmalloc((size_t)width * height * 4);
+		delta->width = width;
+		delta->height = height;
+		delta->frames_since_keyframe = 0;
+		keyframe = true;
+	} else {
+		keyframe = os_atomic_set_bool(&delta->keyframe_requested,
+					      false) ||
+			   (delta->keyframe_interval &&
+			    delta->frames_since_keyframe >=
+				    delta->keyframe_interval);
+	}
+
+	memset(bitmap, 0, bitmap_size(tiles_x * tiles_y));
+
+	for (uint32_t ty = 0; ty < tiles_y; ty++) {
+		uint32_t y = ty * tile_size;
+		uint32_t tile_h = height - y < tile_size ? height - y
+							 : tile_size;
+
+		for (uint32_t tx = 0; tx < tiles_x; tx++) {
+			uint32_t x = tx * tile_size;
+			uint32_t tile_w = width - x < tile_size ? width - x
+								: tile_size;
+			uint32_t row_size = tile_w * 4;
+			const uint8_t *cur_tile = src + y * linesize + x * 4;
+			uint8_t *prev_tile =
+				delta->prev + y * prev_linesize + x * 4;
+			bool dirty = keyframe;
+
+			for (uint32_t i = 0; !dirty && i < tile_h; i++)
+				dirty = !rows_equal(cur_tile + i * linesize,
+						    prev_tile + i * prev_linesize,
+						    row_size);
+			if (!dirty)
+				continue;
+
+			uint32_t tile_idx = ty * tiles_x + tx;
+			bitmap[tile_idx / 8] |= (uint8_t)(1 << (tile_idx % 8));
+
+			for (uint32_t i = 0; i < tile_h; i++) {
+				const uint8_t *row = cur_tile + i * linesize;
+				memcpy(out, row, row_size);
+				memcpy(prev_tile + i * prev_linesize, row,
+				       row_size);
+				out += row_size;
+			}
+
+			changed++;
+		}
+	}
+
+	delta->frames_since_keyframe =
+		keyframe ? 1 : delta->frames_since_keyframe + 1;
+
+	header->magic = FRAME_DELTA_MAGIC;
+	header->size = (uint32_t)(out - dst);
+	header->timestamp = timestamp;
+	header->flags = keyframe ? FRAME_DELTA_KEYFRAME : 0;
+	header->width = width;
+	header->height = height;
+	header->tile_size = tile_size;
+	header->tiles_x = tiles_x;
+	header->tiles_y = tiles_y;
+	header->changed_tiles = changed;
+	header->reserved = 0;
+
+	os_atomic_inc_long(&delta->frames);
+	if (keyframe)
+		os_atomic_inc_long(&delta->keyframes);
+	os_atomic_set_long(&delta->changed_tiles,
+			   delta->changed_tiles + (long)changed);
+	os_atomic_set_long(&delta->total_tiles,
+			   delta->total_tiles + (long)(tiles_x * tiles_y));
+
+	return header->size;
+}
+
+void frame_delta_get_stats(const struct frame_delta *delta,
+			   struct frame_delta_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (!delta)
+		return;
+
+	stats->frames = os_atomic_load_long(&delta->frames);
+	stats->keyframes = os_atomic_load_long(&delta->keyframes);
+	stats->changed_tiles = os_atomic_load_long(&delta->changed_tiles);
+	stats->total_tiles = os_atomic_load_long(&delta->total_tiles);
+}
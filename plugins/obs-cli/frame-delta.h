@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Delta (dirty tile) encoding for RGBA render frames.
+ *
+ * The previous frame is kept and each new frame is split into square tiles;
+ * only tiles that differ from the previous frame are sent.  A message is:
+ *
+ *   struct frame_delta_header
+ *   tile bitmap, (tiles_x * tiles_y + 7) / 8 bytes, bit i (LSB first) set if
+ *   tile i (row major) is included
+ *   the included tiles in bitmap order, each packed as tile_width * 4 bytes
+ *   per row (tiles on the right/bottom edges are clipped to the frame)
+ *
+ * Keyframes include every tile.  Because a delta is only valid on top of the
+ * previous message, a consumer that misses a message must wait for (or
+ * request) the next keyframe.
+ */
+
+#define FRAME_DELTA_MAGIC 0x544C4452 /* "RDLT" */
+#define FRAME_DELTA_KEYFRAME (1 << 0)
+
+struct frame_delta_header {
+	uint32_t magic;
+	uint32_t size;
+	uint64_t timestamp;
+	uint32_t flags;
+	uint32_t width;
+	uint32_t height;
+	uint32_t tile_size;
+	uint32_t tiles_x;
+	uint32_t tiles_y;
+	uint32_t changed_tiles;
+	uint32_t reserved;
+};
+
+struct frame_delta_stats {
+	long frames;
+	long keyframes;
+	long changed_tiles;
+	long total_tiles;
+};
+
+struct frame_delta;
+
+extern struct frame_delta *frame_delta_create(uint32_t tile_size,
+					      uint32_t keyframe_interval);
+extern void frame_delta_destroy(struct frame_delta *delta);
+
+/* Upper bound of the message size for a frame of the given size */
+extern size_t frame_delta_max_size(const struct frame_delta *delta,
+				   uint32_t width, uint32_t height);
+
+/* Makes the next encoded frame a keyframe, safe to call from any thread */
+extern void frame_delta_request_keyframe(struct frame_delta *delta);
+
+/* Encodes an RGBA frame into dst (frame_delta_max_size bytes) and returns the
+ * message size.  A change of frame size always produces a keyframe. */
+extern size_t frame_delta_encode(struct frame_delta *delta, uint8_t *dst,
+				 const uint8_t *src, uint32_t linesize,
+				 uint32_t width, uint32_t height,
+				 uint64_t timestamp);
+
+extern void frame_delta_get_stats(const struct frame_delta *delta,
+				  struct frame_delta_stats *stats);
@@ -0,0 +1,307 @@
+#include <string.h>
+
+#include "util/sse-intrin.h"
+#include "frame-regions.h"
+
+/* 8-bit fixed point luma coefficients, BT.601 */
+#define GRAY_R 77
+#define GRAY_G 150
+#define GRAY_B 29
+
+#define LUMA_R 66
+#define LUMA_G 129
+#define LUMA_B 25
+#define LUMA_OFFSET 16
+
+static const struct {
+	const char *name;
+	enum video_format format;
+} region_formats[] = {
+	{"RGBA", VIDEO_FORMAT_RGBA},
+	{"BGRA", VIDEO_FORMAT_BGRA},
+	{"GRAY8", VIDEO_FORMAT_Y800},
+	{"NV12", VIDEO_FORMAT_NV12},
+};
+
+#define NUM_REGION_FORMATS (sizeof(region_formats) / sizeof(region_formats[0]))
+
+bool frame_region_parse_format(const char *name, enum video_format *format)
+{
+	for (size_t i = 0; i < NUM_REGION_FORMATS; i++) {
+		if (strcmp(name, region_formats[i].name) == 0) {
+			*format = region_formats[i].format;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const char *frame_region_format_name(enum video_format format)
+{
+	for (size_t i = 0; i < NUM_REGION_FORMATS; i++) {
+		if (region_formats[i].format == format)
+			return region_formats[i].name;
+	}
+
+	return NULL;
+}
+
+size_t frame_regions_layout(struct frame_region *regions, size_t num,
+			    uint32_t frame_width, uint32_t frame_height)
+{
+	size_t offset = sizeof(struct frame_regions_header) +
+			num * sizeof(struct frame_region_info);
+
+	for (size_t i = 0; i < num; i++) {
+		struct frame_region *r = &regions[i];
+		uint32_t width = r->width;
+		uint32_t height = r->height;
+
+		if (r->x >= frame_width || r->y >= frame_height || !r->scale)
+			return 0;
+		if (width > frame_width - r->x)
+			width = frame_width - r->x;
+		if (height > frame_height - r->y)
+			height = frame_height - r->y;
+
+		r->out_width = width / r->scale;
+		r->out_height = height / r->scale;
+
+		switch (r->format) {
+		case VIDEO_FORMAT_RGBA:
+		case VIDEO_FORMAT_BGRA:
+			r->size = r->out_width * r->out_height * 4;
+			break;
+		case VIDEO_FORMAT_Y800:
+			r->size = r->out_width * r->out_height;
+			break;
+		case VIDEO_FORMAT_NV12:
+			r->out_width &= ~1;
+			r->out_height &= ~1;
+			r->size = r->out_width * r->out_height * 3 / 2;
+			break;
+		default:
+			return 0;
+		}
+
+		if (!r->size)
+			return 0;
+
+		r->offset = (uint32_t)offset;
+		offset += r->size;
+	}
+
+	return offset;
+}
+
+/* ------------------------------------------------------------------------- */
+/* row kernels, src is always RGBA                                           */
+
+static void swap_rb_row(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	const __m128i ag_mask = _mm_set1_epi32(0xFF00FF00);
+	const __m128i rb_mask = _mm_set1_epi32(0x00FF00FF);
+	uint32_t x = 0;
+
+	for (; x + 4 <= width; x += 4) {
+		__m128i px = _mm_loadu_si128((const __m128i *)(src + x * 4));
+		__m128i ag = _mm_and_si128(px, ag_mask);
+		__m128i rb = _mm_and_si128(px, rb_mask);
+
+		rb = _mm_or_si128(_mm_slli_epi32(rb, 16),
+				  _mm_srli_epi32(rb, 16));
+		_mm_storeu_si128((__m128i *)(dst + x * 4),
+				 _mm_or_si128(ag, rb));
+	}
+
+	for (; x < width; x++) {
+		dst[x * 4 + 0] = src[x * 4 + 2];
+		dst[x * 4 + 1] = src[x * 4 + 1];
+		dst[x * 4 + 2] = src[x * 4 + 0];
+		dst[x * 4 + 3] = src[x * 4 + 3];
+	}
+}
+
+static inline uint8_t luma_pixel(const uint8_t *px, int cr, int cg, int cb,
+				 int offset)
+{
+	return (uint8_t)(((px[0] * cr + px[1] * cg + px[2] * cb + 128) >> 8) +
+			 offset);
+}
+
+static void luma_row(uint8_t *dst, const uint8_t *src, uint32_t width,
+		     short cr, short cg, short cb, int offset)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i coeffs = _mm_set_epi16(0, cb, cg, cr, 0, cb, cg, cr);
+	const __m128i round = _mm_set1_epi32(128);
+	const __m128i bias = _mm_set1_epi32(offset);
+	uint32_t x = 0;
+
+	for (; x + 4 <= width; x += 4) {
+		__m128i px = _mm_loadu_si128((const __m128i *)(src + x * 4));
+
+		/* (r*cr + g*cg, b*cb) pairs per pixel */
+		__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero),
+					    coeffs);
+		__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero),
+					    coeffs);
+
+		lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+		hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+		lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+		hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+
+		__m128i y = _mm_unpacklo_epi64(lo, hi);
+		y = _mm_srli_epi32(_mm_add_epi32(y, round), 8);
+		y = _mm_add_epi32(y, bias);
+		y = _mm_packs_epi32(y, y);
+		y = _mm_packus_epi16(y, y);
+
+		uint32_t out = (uint32_t)_mm_cvtsi128_si32(y);
+		memcpy(dst + x, &out, sizeof(out));
+	}
+
+	for (; x < width; x++)
+		dst[x] = luma_pixel(src + x * 4, cr, cg, cb, offset);
+}
+
+static void sample_rgba_row(uint8_t *dst, const uint8_t *src, uint32_t width,
+			    uint32_t scale, bool swap_rb)
+{
+	const uint32_t *in = (const uint32_t *)src;
+	uint32_t *out = (uint32_t *)dst;
+
+	for (uint32_t x = 0; x < width; x++)
+		memcpy(out + x, in + x * scale, 4);
+
+	if (swap_rb)
+		swap_rb_row(dst, dst, width);
+}
+
+static void sample_luma_row(uint8_t *dst, const uint8_t *src, uint32_t width,
+			    uint32_t scale, int cr, int cg, int cb, int offset)
+{
+	for (uint32_t x = 0; x < width; x++)
+		dst[x] = luma_pixel(src + x * scale * 4, cr, cg, cb, offset);
+}
+
+static void chroma_row(uint8_t *dst, const uint8_t *src, uint32_t width,
+		       uint32_t scale)
+{
+	for (uint32_t x = 0; x < width; x += 2) {
+		const uint8_t *p0 = src + x * scale * 4;
+		const uint8_t *p1 = src + (x + 1) * scale * 4;
+		int r = (p0[0] + p1[0]) >> 1;
+		int g = (p0[1] + p1[1]) >> 1;
+		int b = (p0[2] + p1[2]) >> 1;
+
+		dst[x + 0] =
+			(uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) +
+				  128);
+		dst[x + 1] =
+			(uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) +
+				  128);
+	}
+}
+
+static void extract_region_row(uint8_t *dst, const struct frame_region *r,
+			       const uint8_t *src, uint32_t out_y)
+{
+	uint8_t *out = dst + r->offset;
+	uint32_t w = r->out_width;
+
+	switch (r->format) {
+	case VIDEO_FORMAT_RGBA:
+		if (r->scale == 1)
+			memcpy(out + out_y * w * 4, src, w * 4);
+		else
+			sample_rgba_row(out + out_y * w * 4, src, w, r->scale,
+					false);
+		break;
+
+	case VIDEO_FORMAT_BGRA:
+		if (r->scale == 1)
+			swap_rb_row(out + out_y * w * 4, src, w);
+		else
+			sample_rgba_row(out + out_y * w * 4, src, w, r->scale,
+					true);
+		break;
+
+	case VIDEO_FORMAT_Y800:
+		if (r->scale == 1)
+			luma_row(out + out_y * w, src, w, GRAY_R, GRAY_G,
+				 GRAY_B, 0);
+		else
+			sample_luma_row(out + out_y * w, src, w, r->scale,
+					GRAY_R, GRAY_G, GRAY_B, 0);
+		break;
+
+	case VIDEO_FORMAT_NV12:
+		if (r->scale == 1)
+			luma_row(out + out_y * w, src, w, LUMA_R, LUMA_G,
+				 LUMA_B, LUMA_OFFSET);
+		else
+			sample_luma_row(out + out_y * w, src, w, r->scale,
+					LUMA_R, LUMA_G, LUMA_B, LUMA_OFFSET);
+
+		if ((out_y & 1) == 0) {
+			uint8_t *uv = out + w * r->out_height;
+			chroma_row(uv + (out_y / 2) * w, src, w, r->scale);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+void frame_regions_extract(uint8_t *dst, const struct frame_region *regions,
+			   size_t num, size_t size,
+			   const struct video_data *frame)
+{
+	struct frame_regions_header *header = (void *)dst;
+	struct frame_region_info *info = (void *)(header + 1);
+	uint32_t start_y = UINT32_MAX;
+	uint32_t end_y = 0;
+
+	header->magic = FRAME_REGIONS_MAGIC;
+	header->size = (uint32_t)size;
+	header->timestamp = frame->timestamp;
+	header->region_count = (uint32_t)num;
+	header->reserved = 0;
+
+	for (size_t i = 0; i < num; i++) {
+		const struct frame_region *r = &regions[i];
+		uint32_t bottom = r->y + r->out_height * r->scale;
+
+		info[i].format = r->format;
+		info[i].width = r->out_width;
+		info[i].height = r->out_height;
+		info[i].size = r->size;
+
+		if (r->y < start_y)
+			start_y = r->y;
+		if (bottom > end_y)
+			end_y = bottom;
+	}
+
+	/* every source row is visited once and fanned out to the regions
+	 * that sample it, so overlapping regions stay cache friendly */
+	for (uint32_t y = start_y; y < end_y; y++) {
+		const uint8_t *row = frame->data[0] + y * frame->linesize[0];
+
+		for (size_t i = 0; i < num; i++) {
+			const struct frame_region *r = &regions[i];
+			uint32_t src_y = y - r->y;
+
+			if (y < r->y || src_y >= r->out_height * r->scale ||
+			    src_y % r->scale != 0)
+				continue;
+
+			extract_region_row(dst, r, row + r->x * 4,
+					   src_y / r->scale);
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util/c99defs.h"
+#include "media-io/video-io.h"
+
+/*
+ * Multi-region render output.
+ *
+ * Each frame is sent as a single message:
+ *
+ *   struct frame_regions_header
+ *   region_count * struct frame_region_info
+ *   region payloads, in the same order, packed back to back
+ *
+ * RGBA/BGRA payloads are width * 4 bytes per row, Y800 (GRAY8) is one byte
+ * per pixel and NV12 is a full resolution Y plane followed by the
+ * interleaved half resolution UV plane (BT.601 partial range).  Regions are
+ * downscaled by an integer factor by sampling every scale-th pixel.
+ */
+
+#define FRAME_REGIONS_MAGIC 0x4E475252 /* "RRGN" */
+
+struct frame_regions_header {
+	uint32_t magic;
+	uint32_t size;
+	uint64_t timestamp;
+	uint32_t region_count;
+	uint32_t reserved;
+};
+
+struct frame_region_info {
+	uint32_t format; /* enum video_format */
+	uint32_t width;
+	uint32_t height;
+	uint32_t size;
+};
+
+struct frame_region {
+	/* requested rectangle in output frame pixels */
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+	uint32_t scale;
+	enum video_format format;
+
+	/* filled in by frame_regions_layout */
+	uint32_t out_width;
+	uint32_t out_height;
+	uint32_t size;
+	uint32_t offset;
+};
+
+extern bool frame_region_parse_format(const char *name,
+				      enum video_format *format);
+extern const char *frame_region_format_name(enum video_format format);
+
+/* Clips the regions to the frame and computes their output layout.  Returns
+ * the total message size, or 0 if a region ends up empty. */
+extern size_t frame_regions_layout(struct frame_region *regions, size_t num,
+				   uint32_t frame_width, uint32_t frame_height);
+
+/* Writes the message for an RGBA frame in a single pass over its rows. */
+extern void frame_regions_extract(uint8_t *dst,
+				  const struct frame_region *regions,
+				  size_t num, size_t size,
+				  const struct video_data *frame);
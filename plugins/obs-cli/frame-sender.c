@@ -0,0 +1,359 @@
+#include <string.h>
+
+#include "util/bmem.h"
+#include "util/base.h"
+#include "util/platform.h"
+#include "util/threading.h"
+#include "frame-sender.h"
+
+#define STATS_WINDOW_NS 1000000000ULL
+
+struct frame_buffer {
+	uint8_t *data;
+	size_t capacity;
+	size_t size;
+};
+
+struct frame_sender {
+	enum frame_sender_policy policy;
+	frame_sender_write_cb write;
+	void *param;
+
+	/* queue_size + 1 buffers: one may be held by the sender thread while
+	 * the queue is full */
+	struct frame_buffer *buffers;
+	long num_buffers;
+
+	/* committed frames, pushed by the producer only, popped by the sender
+	 * thread (and by the producer when it replaces the oldest frame) */
+	long *queue;
+	long queue_size;
+	volatile long queue_head;
+	volatile long queue_tail;
+
+	/* buffers handed back by the sender thread, single producer/consumer */
+	long *free_list;
+	volatile long free_head;
+	volatile long free_tail;
+
+	long acquired;
+
+	os_sem_t *ready;
+	os_event_t *freed;
+	pthread_t thread;
+	bool thread_active;
+	volatile bool stopping;
+
+	volatile long dropped;
+	volatile long max_depth;
+
+	pthread_mutex_t stats_mutex;
+	uint64_t sent;
+	uint64_t bytes;
+	uint64_t write_errors;
+	uint64_t window_start;
+	uint64_t window_sent;
+	uint64_t window_bytes;
+	long window_dropped;
+	struct frame_sender_stats window;
+};
+
+static const char *policy_names[] = {
+	[FRAME_SENDER_DROP_OLDEST] = "dropOldest",
+	[FRAME_SENDER_DROP_NEWEST] = "dropNewest",
+	[FRAME_SENDER_BLOCK] = "block",
+};
+
+/* indices only ever grow, differences are taken modulo ULONG_MAX + 1 */
+static inline long queue_depth(long head, long tail)
+{
+	return (long)((unsigned long)head - (unsigned long)tail);
+}
+
+static inline long index_of(long pos, long size)
+{
+	return (long)((unsigned long)pos % (unsigned long)size);
+}
+
+static bool pop_frame(struct frame_sender *sender, long *idx)
+{
+	for (;;) {
+		long tail = os_atomic_load_long(&sender->queue_tail);
+		long head = os_atomic_load_long(&sender->queue_head);
+		if (tail == head)
+			return false;
+
+		long val = sender->queue[index_of(tail, sender->queue_size)];
+		long next = (long)((unsigned long)tail + 1);
+		if (os_atomic_compare_swap_long(&sender->queue_tail, tail,
+						next)) {
+			*idx = val;
+			return true;
+		}
+	}
+}
+
+static inline void push_frame(struct frame_sender *sender, long idx)
+{
+	long head = sender->queue_head;
+	sender->queue[index_of(head, sender->queue_size)] = idx;
+	os_atomic_inc_long(&sender->queue_head);
+}
+
+static inline bool pop_free(struct frame_sender *sender, long *idx)
+{
+	long tail = sender->free_tail;
+	if (tail == os_atomic_load_long(&sender->free_head))
+		return false;
+
+	*idx = sender->free_list[index_of(tail, sender->num_buffers)];
+	os_atomic_inc_long(&sender->free_tail);
+	return true;
+}
+
+static inline void push_free(struct frame_sender *sender, long idx)
+{
+	long head = sender->free_head;
+	sender->free_list[index_of(head, sender->num_buffers)] = idx;
+	os_atomic_inc_long(&sender->free_head);
+}
+
+/* stats_mutex must be held */
+static void update_window(struct frame_sender *sender, uint64_t now)
+{
+	uint64_t elapsed = now - sender->window_start;
+	if (elapsed < STATS_WINDOW_NS)
+		return;
+
+	long dropped = os_atomic_load_long(&sender->dropped);
+	uint64_t sent = sender->sent - sender->window_sent;
+	uint64_t bytes = sender->bytes - sender->window_bytes;
+
+	sender->window.sent_per_sec = sent * STATS_WINDOW_NS / elapsed;
+	sender->window.bytes_per_sec = bytes * STATS_WINDOW_NS / elapsed;
+	sender->window.dropped_per_sec =
+		(uint64_t)((unsigned long)dropped -
+			   (unsigned long)sender->window_dropped) *
+		STATS_WINDOW_NS / elapsed;
+	sender->window.max_queue_depth =
+		os_atomic_set_long(&sender->max_depth, 0);
+
+	sender->window_start = now;
+	sender->window_sent = sender->sent;
+	sender->window_bytes = sender->bytes;
+	sender->window_dropped = dropped;
+}
+
+static void *sender_thread(void *data)
+{
+	struct frame_sender *sender = data;
+
+	os_set_thread_name("obs-cli: frame sender");
+
+	while (os_sem_wait(sender->ready) == 0) {
+		if (os_atomic_load_bool(&sender->stopping))
+			break;
+
+		long idx;
+		while (pop_frame(sender, &idx)) {
+			struct frame_buffer *buf = &sender->buffers[idx];
+			size_t size = buf->size;
+			bool success =
+				sender->write(sender->param, buf->data, size);
+
+			push_free(sender, idx);
+			os_event_signal(sender->freed);
+
+			pthread_mutex_lock(&sender->stats_mutex);
+			if (success) {
+				sender->sent++;
+				sender->bytes += size;
+			} else {
+				sender->write_errors++;
+			}
+			update_window(sender, os_gettime_ns());
+			pthread_mutex_unlock(&sender->stats_mutex);
+		}
+	}
+
+	return NULL;
+}
+
+struct frame_sender *frame_sender_create(long queue_size,
+					 enum frame_sender_policy policy,
+					 frame_sender_write_cb write,
+					 void *param)
+{
+	struct frame_sender *sender;
+
+	if (queue_size < 1 || !write)
+		return NULL;
+
+	sender = bzalloc(sizeof(struct frame_sender));
+	sender->policy = policy;
+	sender->write = write;
+	sender->param = param;
+	sender->queue_size = queue_size;
+	sender->num_buffers = queue_size + 1;
+	sender->acquired = -1;
+	sender->window_start = os_gettime_ns();
+
+	sender->queue = bzalloc(sizeof(long) * sender->queue_size);
+	sender->free_list = bzalloc(sizeof(long) * sender->num_buffers);
+	sender->buffers =
+		bzalloc(sizeof(struct frame_buffer) * sender->num_buffers);
+
+	for (long i = 0; i < sender->num_buffers; i++)
+		sender->free_list[i] = i;
+	sender->free_head = sender->num_buffers;
+
+	pthread_mutex_init_value(&sender->stats_mutex);
+	if (pthread_mutex_init(&sender->stats_mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&sender->ready, 0) != 0)
+		goto fail;
+	if (os_event_init(&sender->freed, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+	if (pthread_create(&sender->thread, NULL, sender_thread, sender) != 0)
+		goto fail;
+
+	sender->thread_active = true;
+	return sender;
+
+fail:
+	blog(LOG_ERROR, "frame-sender: failed to create sender");
+	frame_sender_destroy(sender);
+	return NULL;
+}
+
+void frame_sender_destroy(struct frame_sender *sender)
+{
+	if (!sender)
+		return;
+
+	if (sender->thread_active) {
+		os_atomic_set_bool(&sender->stopping, true);
+		os_sem_post(sender->ready);
+		os_event_signal(sender->freed);
+		pthread_join(sender->thread, NULL);
+	}
+
+	for (long i = 0; i < sender->num_buffers; i++)
+		bfree(sender->buffers[i].data);
+
+	os_event_destroy(sender->freed);
+	os_sem_destroy(sender->ready);
+	pthread_mutex_destroy(&sender->stats_mutex);
+	bfree(sender->buffers);
+	bfree(sender->free_list);
+	bfree(sender->queue);
+	bfree(sender);
+}
+
+bool frame_sender_parse_policy(const char *name,
+			       enum frame_sender_policy *policy)
+{
+	for (size_t i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]);
+	     i++) {
+		if (strcmp(name, policy_names[i]) == 0) {
+			*policy = (enum frame_sender_policy)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const char *frame_sender_policy_name(enum frame_sender_policy policy)
+{
+	return policy_names[policy];
+}
+
+uint8_t *frame_sender_acquire(struct frame_sender *sender, size_t size)
+{
+	long idx = -1;
+	long depth = queue_depth(sender->queue_head,
+				 os_atomic_load_long(&sender->queue_tail));
+
+	if (depth >= sender->queue_size) {
+		switch (sender->policy) {
+		case FRAME_SENDER_DROP_NEWEST:
+			os_atomic_inc_long(&sender->dropped);
+			return NULL;
+
+		case FRAME_SENDER_DROP_OLDEST:
+			/* if the sender thread got there first a free buffer
+			 * is available anyway */
+			if (pop_frame(sender, &idx))
+				os_atomic_inc_long(&sender->dropped);
+			break;
+
+		case FRAME_SENDER_BLOCK:
+			while (queue_depth(sender->queue_head,
+					   os_atomic_load_long(
+						   &sender->queue_tail)) >=
+			       sender->queue_size) {
+				if (os_atomic_load_bool(&sender->stopping))
+					return NULL;
+				os_event_timedwait(sender->freed, 10);
+			}
+			break;
+		}
+	}
+
+	if (idx == -1 && !pop_free(sender, &idx)) {
+		os_atomic_inc_long(&sender->dropped);
+		return NULL;
+	}
+
+	struct frame_buffer *buf = &sender->buffers[idx];
+	if (buf->capacity < size) {
+		bfree(buf->data);
+		buf->data = bmalloc(size);
+		buf->capacity = size;
+	}
+
+	sender->acquired = idx;
+	return buf->data;
+}
+
+void frame_sender_commit(struct frame_sender *sender, size_t size)
+{
+	long idx = sender->acquired;
+	if (idx == -1)
+		return;
+
+	sender->buffers[idx].size = size;
+	sender->acquired = -1;
+	push_frame(sender, idx);
+
+	long depth = queue_depth(sender->queue_head,
+				 os_atomic_load_long(&sender->queue_tail));
+	if (depth > os_atomic_load_long(&sender->max_depth))
+		os_atomic_set_long(&sender->max_depth, depth);
+
+	os_sem_post(sender->ready);
+}
+
+void frame_sender_get_stats(struct frame_sender *sender,
+			    struct frame_sender_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (!sender)
+		return;
+
+	pthread_mutex_lock(&sender->stats_mutex);
+	update_window(sender, os_gettime_ns());
+	*stats = sender->window;
+	stats->total_sent = sender->sent;
+	stats->total_bytes = sender->bytes;
+	stats->write_errors = sender->write_errors;
+	pthread_mutex_unlock(&sender->stats_mutex);
+
+	stats->total_dropped =
+		(uint64_t)(unsigned long)os_atomic_load_long(&sender->dropped);
+	stats->queue_depth =
+		queue_depth(os_atomic_load_long(&sender->queue_head),
+			    os_atomic_load_long(&sender->queue_tail));
+	stats->queue_size = sender->queue_size;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hands render frames off from the video thread to a dedicated sender thread.
+ *
+ * The video thread (the only producer) acquires a pooled buffer, fills it and
+ * commits it into a bounded lock-free queue; the sender thread pops frames
+ * and passes them to the write callback.  When the queue is full the overflow
+ * policy decides whether the oldest queued frame is replaced, the new frame
+ * is dropped, or the video thread waits for the sender.
+ */
+
+enum frame_sender_policy {
+	FRAME_SENDER_DROP_OLDEST,
+	FRAME_SENDER_DROP_NEWEST,
+	FRAME_SENDER_BLOCK,
+};
+
+/* Called on the sender thread, returns false if the frame could not be
+ * written completely. */
+typedef bool (*frame_sender_write_cb)(void *param, const uint8_t *data,
+				      size_t size);
+
+struct frame_sender_stats {
+	/* last complete one-second window */
+	uint64_t sent_per_sec;
+	uint64_t dropped_per_sec;
+	uint64_t bytes_per_sec;
+	long max_queue_depth;
+
+	uint64_t total_sent;
+	uint64_t total_dropped;
+	uint64_t total_bytes;
+	uint64_t write_errors;
+	long queue_depth;
+	long queue_size;
+};
+
+struct frame_sender;
+
+extern struct frame_sender *
+frame_sender_create(long queue_size, enum frame_sender_policy policy,
+		    frame_sender_write_cb write, void *param);
+extern void frame_sender_destroy(struct frame_sender *sender);
+
+extern bool frame_sender_parse_policy(const char *name,
+				      enum frame_sender_policy *policy);
+extern const char *frame_sender_policy_name(enum frame_sender_policy policy);
+
+/* Producer side, video thread only.  acquire returns NULL if the frame has to
+ * be dropped, otherwise a buffer of at least size bytes that must be handed
+ * back with commit. */
+extern uint8_t *frame_sender_acquire(struct frame_sender *sender, size_t size);
+extern void frame_sender_commit(struct frame_sender *sender, size_t size);
+
+extern void frame_sender_get_stats(struct frame_sender *sender,
+				   struct frame_sender_stats *stats);
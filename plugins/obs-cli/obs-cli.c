@@ -9,6 +9,7 @@
 
 #endif
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,6 +17,13 @@
 #include <jansson.h>
 #include "util/threading.h"
 #include "obs-scene.h"
+#include "shm-ring.h"
+#include "frame-sender.h"
+#include "frame-regions.h"
+#include "frame-delta.h"
+#include "command-protocol.h"
+#include "command-executor.h"
+#include "encoder-spec.h"
 
 #ifndef _WIN32
 #include <unistd.h>
@@ -25,22 +33,43 @@
 #include <netdb.h>
 #include <sys/errno.h>
 static int sockfd = -1;
-static bool socket_ready = false;
 #else
 #define ssize_t long
 static SOCKET sock = INVALID_SOCKET;
 #endif
 
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+// Cleared by the frame sender thread when a write fails
+static volatile bool socket_ready = false;
+
 // The three primary sources: audio, desktop, and webcam
 static obs_source_t *audioSource = NULL;
 static obs_source_t *displaySource = NULL;
 static obs_source_t *webcamSource = NULL;
 
-// Output file for recordings
+// Output file for recordings, the output and encoders are created once by
+// prepareRecording (or the first startRecording) and reused
 static obs_output_t *fileOutput = NULL;
 
 static obs_encoder_t *encoder = NULL;
 static obs_encoder_t *audioEncoder = NULL;
+
+// Encoder spec from the last command that set one, see encoder-spec.h
+static json_t *s_encoder_spec = NULL;
+
+// Frame rate used by every video reset, set by the initialize commands
+static uint32_t s_fps_num = 30000;
+static uint32_t s_fps_den = 1000;
+
+// startRecording responds once the first packet is written, the pending
+// response is taken by whichever output signal comes first
+static pthread_mutex_t s_start_mutex;
+static struct deferred_response *s_pending_start = NULL;
 static obs_scene_t *scene = NULL;
 
 static int s_output_width = 0;
@@ -49,20 +78,116 @@ static int s_output_slice_x = 0;
 static int s_output_slice_y = 0;
 static int s_output_slice_width = 0;
 static int s_output_slice_height = 0;
-static uint8_t* s_output_slice_buffer = NULL;
+static bool s_output_slice_active = false;
 static bool s_raw_output_active = false;
 
+// Shared-memory transport for render frames, NULL when using the socket
+static struct shm_ring *s_frame_ring = NULL;
+#define DEFAULT_FRAME_RING_SLOTS 4
+
+// Hands socket writes off the video thread, NULL unless the socket is used
+static struct frame_sender *s_frame_sender = NULL;
+#define DEFAULT_FRAME_QUEUE_SIZE 2
+
+// Regions of interest sent instead of the full frame, see setRenderRegions
+static struct frame_region *s_render_regions = NULL;
+static size_t s_num_render_regions = 0;
+static size_t s_render_regions_size = 0;
+
+// Sends only changed tiles of the frame when the pipe is in delta mode
+static struct frame_delta *s_frame_delta = NULL;
+static int64_t s_frame_ring_overwritten = 0;
+#define DEFAULT_DELTA_TILE_SIZE 64
+#define DEFAULT_DELTA_KEYFRAME_INTERVAL 300
+
 // Array of scenes
 static obs_scene_t **sceneList = NULL;
 static int numScenes = 0;
 
-// We write to stdout when we get certain events from
-// obs and callbacks are not threadsafe, so we coordinate writes.
-static pthread_mutex_t stdout_mutex;
+// Responses and events are sent from the lanes and from obs callbacks, so
+// stdout is owned by a single writer thread.
+static struct command_writer *s_writer = NULL;
+
+// Commands run on these lanes, serialized per resource
+enum lane {
+	LANE_RECORDING,
+	LANE_DEVICES,
+	LANE_SCENE,
+	NUM_LANES,
+	// Waits for all lanes to go idle, then runs on the reading thread
+	LANE_EXCLUSIVE = NUM_LANES,
+};
+
+static const char *const lane_names[NUM_LANES] = {
+	"obs-cli: recording",
+	"obs-cli: devices",
+	"obs-cli: scene",
+};
+
+static struct executor *s_executor = NULL;
+
+// Command transport, selected with --framed on the command line
+static enum command_protocol s_protocol = COMMAND_PROTOCOL_LINES;
+
+// Set with --debug, enables verbose command logging on stderr
+static bool s_debug = false;
 
-static void null_log_handler(int log_level, const char *format, va_list args,
-			     void *param)
+static void debug_log(const char *format, ...)
 {
+	if (!s_debug) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+// Queues a response or event for stdout, safe to call from any thread
+static void send_response(json_t *obj, enum command_encoding encoding)
+{
+	if (s_debug) {
+		char *str = json_dumps(obj, 0);
+		fprintf(stderr, "Returning: %s\n", str);
+		free(str);
+	}
+
+	command_writer_send(s_writer, encoding, obj);
+}
+
+// stdout carries the command protocol, so libobs logs go to stderr instead
+// of the default handler's stdout
+static void stderr_log_handler(int log_level, const char *format, va_list args,
+			       void *param)
+{
+	const char *prefix;
+	char out[4096];
+
+	switch (log_level) {
+	case LOG_DEBUG:
+		if (!s_debug) {
+			return;
+		}
+		prefix = "debug";
+		break;
+	case LOG_INFO:
+		prefix = "info";
+		break;
+	case LOG_WARNING:
+		prefix = "warning";
+		break;
+	default:
+		prefix = "error";
+		break;
+	}
+
+	vsnprintf(out, sizeof(out), format, args);
+	fprintf(stderr, "%s: %s\n", prefix, out);
+	fflush(stderr);
+
+	UNUSED_PARAMETER(param);
 }
 
 static void connect_to_local(int port)
@@ -89,21 +214,29 @@ static void connect_to_local(int port)
 			errno);
 		close(sockfd);
 		sockfd = -1;
+		return;
 	}
 
+#ifdef SO_NOSIGPIPE
+	// Failed writes must not kill the process, see SEND_FLAGS for linux
+	int noSigPipe = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe,
+		   sizeof(noSigPipe));
+#endif
+
 	fprintf(stderr, "Connected!\n");
 
 	socket_ready = true;
 
 #else
-	printf("Connecting to %d\n", port);
+	fprintf(stderr, "Connecting to %d\n", port);
 
 	int iResult = 0;
 
 	WSADATA wsaData = {0};
 	iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
 	if (iResult != 0) {
-		printf(L"WSAStartup failed: %d\n", iResult);
+		fprintf(stderr, "WSAStartup failed: %d\n", iResult);
 		return 1;
 	}
 
@@ -124,22 +257,28 @@ static void connect_to_local(int port)
 	iResult = connect(sock, (SOCKADDR *)&clientService,
 			  sizeof(clientService));
 	if (iResult == SOCKET_ERROR) {
-		wprintf(L"connect function failed with error: %ld\n",
-			WSAGetLastError());
+		fwprintf(stderr,
+			 L"connect function failed with error: %ld\n",
+			 WSAGetLastError());
 		iResult = closesocket(sock);
 		if (iResult == SOCKET_ERROR)
-			wprintf(L"closesocket function failed with error: %ld\n",
-				WSAGetLastError());
+			fwprintf(stderr,
+				 L"closesocket function failed with error: "
+				 L"%ld\n",
+				 WSAGetLastError());
 		WSACleanup();
 		return 1;
 	}
 
-	printf("Started socket for render frames\n");
+	fprintf(stderr, "Started socket for render frames\n");
+	socket_ready = true;
 #endif
 }
 
 static void disconnect_from_local()
 {
+	socket_ready = false;
+
 #ifndef _WIN32
 	if (sockfd != -1) {
 		fprintf(stderr, "Closing socket\n");
@@ -155,61 +294,191 @@ static void disconnect_from_local()
 #endif
 }
 
-static void receive_video(void *param, struct video_data *frame)
+// Interrupts a write that is blocked on the socket
+static void shutdown_local()
 {
-	int frame_size = s_output_width * s_output_height * 4;
-	if (frame_size == 0) {
-		return;
+#ifndef _WIN32
+	if (sockfd != -1) {
+		shutdown(sockfd, SHUT_RDWR);
 	}
-
-	// If we are only sending back a slice, copy slice into buffer
-	if (s_output_slice_buffer != NULL) {
-		for (int i=0;i < s_output_slice_height; i++) {
-			int sourceOffset = ((s_output_slice_y + i) * s_output_width + s_output_slice_x) * 4;
-			int destOffset = (i * s_output_slice_width) * 4;
-			int numBytesToCopy = s_output_slice_width * 4;
-			memcpy(s_output_slice_buffer + destOffset, frame->data[0] + sourceOffset, numBytesToCopy);
-		}
+#else
+	if (sock != INVALID_SOCKET) {
+		shutdown(sock, SD_BOTH);
 	}
+#endif
+}
 
-	int bytesToWrite = frame_size;
-	if (s_output_slice_buffer) {
-		bytesToWrite = s_output_slice_height * s_output_slice_width * 4;
+// Called on the frame sender thread
+static bool write_to_local(void *param, const uint8_t *data, size_t size)
+{
+	if (!socket_ready) {
+		return false;
 	}
 
+	while (size > 0) {
 #ifndef _WIN32
-	if (sockfd == -1 || !socket_ready) {
-		return;
+		ssize_t bytesWritten = send(sockfd, data, size, SEND_FLAGS);
+		if (bytesWritten < 0 && errno == EINTR) {
+			continue;
+		}
+#else
+		int bytesWritten = send(sock, data, (int)size, 0);
+#endif
+		if (bytesWritten <= 0) {
+			fprintf(stderr, "Render frame write failed, "
+					"dropping frames until reconnected\n");
+			socket_ready = false;
+			return false;
+		}
+
+		data += bytesWritten;
+		size -= bytesWritten;
 	}
 
-	ssize_t bytesWritten = 0;
+	return true;
+}
 
-	if (s_output_slice_buffer != NULL) {
-		bytesWritten = write(sockfd, s_output_slice_buffer, bytesToWrite);
+static void get_render_region(int *x, int *y, int *width, int *height)
+{
+	if (s_output_slice_active) {
+		*x = s_output_slice_x;
+		*y = s_output_slice_y;
+		*width = s_output_slice_width;
+		*height = s_output_slice_height;
 	} else {
-		bytesWritten = write(sockfd, frame->data[0], bytesToWrite);
+		*x = 0;
+		*y = 0;
+		*width = s_output_width;
+		*height = s_output_height;
 	}
+}
+
+static void copy_render_region(uint8_t *dst, const struct video_data *frame,
+			       int x, int y, int width, int height)
+{
+	uint32_t linesize = width * 4;
+	const uint8_t *src = frame->data[0] + y * frame->linesize[0] + x * 4;
 
-	if (bytesWritten != frame_size) {
-		disconnect_from_local;
+	if (linesize == frame->linesize[0]) {
+		memcpy(dst, src, linesize * height);
+	} else {
+		for (int i = 0; i < height; i++) {
+			memcpy(dst + i * linesize, src + i * frame->linesize[0],
+			       linesize);
+		}
 	}
-#else
-	if (sock == INVALID_SOCKET) {
+}
+
+// Maximum number of bytes sent per frame without render regions
+static size_t get_frame_payload_size()
+{
+	int x, y, width, height;
+	get_render_region(&x, &y, &width, &height);
+
+	if (s_frame_delta != NULL) {
+		return frame_delta_max_size(s_frame_delta, width, height);
+	}
+
+	return (size_t)width * height * 4;
+}
+
+// Maximum number of bytes sent per frame
+static size_t get_render_payload_size()
+{
+	if (s_num_render_regions > 0) {
+		return s_render_regions_size;
+	}
+
+	return get_frame_payload_size();
+}
+
+// Returns the number of bytes actually written
+static size_t fill_render_payload(uint8_t *dst, size_t size,
+				  const struct video_data *frame)
+{
+	if (s_num_render_regions > 0) {
+		frame_regions_extract(dst, s_render_regions,
+				      s_num_render_regions, size, frame);
+		return size;
+	}
+
+	int x, y, width, height;
+	get_render_region(&x, &y, &width, &height);
+
+	if (s_frame_delta != NULL) {
+		const uint8_t *src =
+			frame->data[0] + y * frame->linesize[0] + x * 4;
+		return frame_delta_encode(s_frame_delta, dst, src,
+					  frame->linesize[0], width, height,
+					  frame->timestamp);
+	}
+
+	copy_render_region(dst, frame, x, y, width, height);
+	return size;
+}
+
+static void send_frame_to_ring(struct video_data *frame, size_t size)
+{
+	// A delta is useless to a consumer that missed the previous message
+	if (s_frame_delta != NULL) {
+		struct shm_ring_stats stats;
+		shm_ring_get_stats(s_frame_ring, &stats);
+		if (stats.overwritten != s_frame_ring_overwritten) {
+			s_frame_ring_overwritten = stats.overwritten;
+			frame_delta_request_keyframe(s_frame_delta);
+		}
+	}
+
+	// Copy straight into the shared slot, the consumer reads it in place
+	uint8_t *dst = shm_ring_acquire(s_frame_ring, (uint32_t)size);
+	if (!dst) {
 		return;
 	}
 
-	int bytesWritten = 0;
+	size = fill_render_payload(dst, size, frame);
 
-	if (s_output_slice_buffer != NULL) {
-		bytesWritten = send(sock, s_output_slice_buffer, bytesToWrite, 0);
+	if (s_num_render_regions > 0 || s_frame_delta != NULL) {
+		// The slot holds a frame_regions or frame_delta message
+		shm_ring_commit(s_frame_ring, VIDEO_FORMAT_NONE, 0, 0, 0,
+				(uint32_t)size, frame->timestamp);
 	} else {
-		bytesWritten = send(sock, frame->data[0], bytesToWrite, 0);
+		int x, y, width, height;
+		get_render_region(&x, &y, &width, &height);
+		shm_ring_commit(s_frame_ring, VIDEO_FORMAT_RGBA, width, height,
+				width * 4, (uint32_t)size, frame->timestamp);
 	}
+}
 
-	if (bytesWritten != bytesToWrite) {
-		disconnect_from_local();
+static void send_frame_to_sender(struct video_data *frame, size_t size)
+{
+	// Never blocks unless the pipe was started with the "block" policy
+	uint8_t *dst = frame_sender_acquire(s_frame_sender, size);
+	if (!dst) {
+		return;
+	}
+
+	size = fill_render_payload(dst, size, frame);
+
+	frame_sender_commit(s_frame_sender, size);
+}
+
+static void receive_video(void *param, struct video_data *frame)
+{
+	int frame_size = s_output_width * s_output_height * 4;
+	if (frame_size == 0) {
+		return;
+	}
+
+	size_t size = get_render_payload_size();
+	if (size == 0) {
+		return;
+	}
+
+	if (s_frame_ring != NULL) {
+		send_frame_to_ring(frame, size);
+	} else if (s_frame_sender != NULL) {
+		send_frame_to_sender(frame, size);
 	}
-#endif
 }
 
 static void stop_raw_output()
@@ -221,10 +490,25 @@ static void stop_raw_output()
 	}
 }
 
+static void layout_render_regions()
+{
+	s_render_regions_size = frame_regions_layout(
+		s_render_regions, s_num_render_regions, s_output_width,
+		s_output_height);
+
+	if (s_num_render_regions > 0 && s_render_regions_size == 0) {
+		fprintf(stderr, "error: render regions do not fit in %dx%d\n",
+			s_output_width, s_output_height);
+	}
+}
+
 static void start_raw_output()
 {
 	if (!s_raw_output_active)
 	{
+		// The output size may have changed since regions were set
+		layout_render_regions();
+
 		struct video_scale_info info = {0};
 		info.format = VIDEO_FORMAT_RGBA;
 		info.width = s_output_width;
@@ -234,161 +518,844 @@ static void start_raw_output()
 	}
 }
 
-static void output_stopped(void *my_data, calldata_t *cd)
+static void add_frame_ring_stats(json_t *returnObj)
 {
-	obs_output_t *output = calldata_ptr(cd, "output");
-	char *actionId = (char *)my_data;
+	struct shm_ring_stats stats;
+	shm_ring_get_stats(s_frame_ring, &stats);
+
+	json_object_set_new(returnObj, "framesPublished",
+			    json_integer(stats.published));
+	json_object_set_new(returnObj, "framesDropped",
+			    json_integer(stats.dropped));
+	json_object_set_new(returnObj, "framesOverwritten",
+			    json_integer(stats.overwritten));
+}
 
-	pthread_mutex_lock(&stdout_mutex);
-	fprintf(stderr, "STOPPED!!!!");
-	fprintf(stdout, "\n{ \"actionId\": \"%s\"}\n", actionId);
-	fflush(stdout);
-	pthread_mutex_unlock(&stdout_mutex);
+static void destroy_frame_ring()
+{
+	shm_ring_destroy(s_frame_ring);
+	s_frame_ring = NULL;
+}
 
-	bfree(my_data);
+static void add_frame_sender_stats(json_t *returnObj)
+{
+	struct frame_sender_stats stats;
+	frame_sender_get_stats(s_frame_sender, &stats);
+
+	json_object_set_new(returnObj, "sentPerSec",
+			    json_integer(stats.sent_per_sec));
+	json_object_set_new(returnObj, "droppedPerSec",
+			    json_integer(stats.dropped_per_sec));
+	json_object_set_new(returnObj, "bytesPerSec",
+			    json_integer(stats.bytes_per_sec));
+	json_object_set_new(returnObj, "maxQueueDepth",
+			    json_integer(stats.max_queue_depth));
+	json_object_set_new(returnObj, "queueDepth",
+			    json_integer(stats.queue_depth));
+	json_object_set_new(returnObj, "queueSize",
+			    json_integer(stats.queue_size));
+	json_object_set_new(returnObj, "framesSent",
+			    json_integer(stats.total_sent));
+	json_object_set_new(returnObj, "framesDropped",
+			    json_integer(stats.total_dropped));
+	json_object_set_new(returnObj, "bytesSent",
+			    json_integer(stats.total_bytes));
+	json_object_set_new(returnObj, "writeErrors",
+			    json_integer(stats.write_errors));
 }
 
-static int initialize(json_t *obj)
+static void close_render_pipe()
 {
-	if (pthread_mutex_init(&stdout_mutex, NULL) != 0) {
-		fprintf(stderr, "error initializing stdout mutex");
-		return 0;
-	}
+	destroy_frame_ring();
 
-	blog(LOG_INFO, "Starting OBS!");
+	frame_delta_destroy(s_frame_delta);
+	s_frame_delta = NULL;
 
-	json_t *pluginDirObj = json_object_get(obj, "pluginDir");
-	if (!json_is_string(pluginDirObj)) {
-		fprintf(stderr, "error: pluginDir is not a string\n");
-		return 0;
+	if (s_frame_sender != NULL) {
+		shutdown_local();
+		frame_sender_destroy(s_frame_sender);
+		s_frame_sender = NULL;
 	}
-	const char *pluginDir = json_string_value(pluginDirObj);
 
-	json_t *exeDirObj = json_object_get(obj, "exeDir");
-	if (!json_is_string(exeDirObj)) {
-		fprintf(stderr, "error: exeDir is not a string\n");
-		return 0;
-	}
-	const char *exeDir = json_string_value(exeDirObj);
-	obs_set_executable_path(exeDir);
+	disconnect_from_local();
+}
 
-	json_t *dataDirObj = json_object_get(obj, "dataDir");
-	if (!json_is_string(dataDirObj)) {
-		fprintf(stderr, "error: dataDir is not a string\n");
-		return 0;
-	}
-	const char *dataDir = json_string_value(dataDirObj);
-	obs_add_data_path(dataDir);
+static bool create_frame_ring(int slotCount)
+{
+	layout_render_regions();
 
-	if (!obs_startup("en", ".", NULL)) {
-		blog(LOG_ERROR, "Failed to start");
-		return 1;
-	} else {
-		blog(LOG_INFO, "Started OBS");
+	size_t size = get_render_payload_size();
+	if (size == 0 || slotCount <= 0) {
+		fprintf(stderr, "error: no render size to create frame ring\n");
+		return false;
 	}
 
-	struct obs_video_info ovi;
-	ovi.adapter = 0;
-	ovi.gpu_conversion = false;
-#ifndef _WIN32
-	ovi.graphics_module = "libobs-opengl";
-#else
-	ovi.graphics_module = "libobs-d3d11";
-#endif
-	ovi.fps_num = 30000;
-	ovi.fps_den = 1000;
-	ovi.base_width = 1280;
-	ovi.base_height = 720;
-	ovi.output_width = 1280;
-	ovi.output_height = 720;
-	ovi.output_format = VIDEO_FORMAT_RGBA;
-	ovi.scale_type = OBS_SCALE_BILINEAR;
+	s_frame_ring = shm_ring_create(slotCount, (uint32_t)size);
+	return s_frame_ring != NULL;
+}
 
-	blog(LOG_INFO, "Resetting video");
-	int rc = obs_reset_video(&ovi);
-	blog(LOG_INFO, "Result: %d", rc);
+static int startRenderFramesPipe(json_t *command, json_t *returnObj)
+{
+	const char *transport = "tcp";
+	json_t *transportObj = json_object_get(command, "transport");
+	if (json_is_string(transportObj)) {
+		transport = json_string_value(transportObj);
+	}
 
-	struct obs_audio_info ai;
-	ai.samples_per_sec = 44100;
-	ai.speakers = SPEAKERS_MONO;
-	rc = obs_reset_audio(&ai);
-	blog(LOG_INFO, "Reset audio: %d", rc);
+	// No frames may arrive while the transport is being swapped
+	stop_raw_output();
+	close_render_pipe();
+
+	json_t *deltaObj = json_object_get(command, "delta");
+	if (json_is_true(deltaObj)) {
+		int tileSize = DEFAULT_DELTA_TILE_SIZE;
+		json_t *tileSizeObj = json_object_get(command, "tileSize");
+		if (json_is_integer(tileSizeObj)) {
+			tileSize = json_integer_value(tileSizeObj);
+		}
 
-	obs_add_module_path(pluginDir, pluginDir);
-	blog(LOG_INFO, "Loading modules");
-	obs_load_all_modules();
-	obs_post_load_modules();
-	blog(LOG_INFO, "Done loading modules");
+		int keyframeInterval = DEFAULT_DELTA_KEYFRAME_INTERVAL;
+		json_t *keyframeIntervalObj =
+			json_object_get(command, "keyframeInterval");
+		if (json_is_integer(keyframeIntervalObj)) {
+			keyframeInterval =
+				json_integer_value(keyframeIntervalObj);
+		}
 
-#ifndef _WIN32
-	displaySource = obs_source_create("display_capture", "Display Capture",
-					  NULL, NULL);
-	if (!displaySource) {
-		blog(LOG_ERROR, "Unable to create source");
-		return 1;
-	} else {
-		blog(LOG_INFO, "Created display capture!");
-	}
+		if (tileSize <= 0 || keyframeInterval < 0) {
+			fprintf(stderr, "error: invalid tileSize or "
+					"keyframeInterval\n");
+			return 1;
+		}
 
-	audioSource = obs_source_create("coreaudio_input_capture", "Microphone",
-					NULL, NULL);
-	if (!audioSource) {
-		blog(LOG_ERROR, "Unable to create audio source");
-	} else {
-		blog(LOG_INFO, "Created audio source");
+		s_frame_delta = frame_delta_create(tileSize, keyframeInterval);
+		s_frame_ring_overwritten = 0;
 	}
+	json_object_set_new(returnObj, "delta",
+			    json_boolean(s_frame_delta != NULL));
 
-	webcamSource = obs_source_create("av_capture_input", "Webcam Capture",
-					 NULL, NULL);
-	if (!webcamSource) {
-		blog(LOG_ERROR, "Unable to create webcam source");
-	} else {
-		blog(LOG_INFO, "created av capture!");
-	}
-#else
-	displaySource = obs_source_create("monitor_capture", "Display Capture",
-					  NULL, NULL);
-	if (!displaySource) {
-		blog(LOG_ERROR, "Unable to create source");
-		return 1;
-	} else {
-		blog(LOG_INFO, "Created display capture!");
-	}
+	if (strcmp(transport, "shm") == 0) {
+		int slotCount = DEFAULT_FRAME_RING_SLOTS;
+		json_t *slotCountObj = json_object_get(command, "slotCount");
+		if (json_is_integer(slotCountObj)) {
+			slotCount = json_integer_value(slotCountObj);
+		}
 
-	audioSource = obs_source_create("wasapi_input_capture", "Microphone",
-					NULL, NULL);
-	if (!audioSource) {
-		blog(LOG_ERROR, "Unable to create audio source");
-	} else {
-		blog(LOG_INFO, "Created audio source");
+		if (!create_frame_ring(slotCount)) {
+			fprintf(stderr, "Failed to create frame ring, "
+					"falling back to socket\n");
+		}
 	}
 
-	webcamSource =
-		obs_source_create("dshow_input", "Webcam Capture", NULL, NULL);
-	if (!webcamSource) {
-		blog(LOG_ERROR, "Unable to create webcam source");
+	if (s_frame_ring != NULL) {
+		json_object_set_new(returnObj, "transport", json_string("shm"));
+		json_object_set_new(returnObj, "shmName",
+				    json_string(shm_ring_name(s_frame_ring)));
+		json_object_set_new(
+			returnObj, "signalName",
+			json_string(shm_ring_signal_name(s_frame_ring)));
+		json_object_set_new(
+			returnObj, "mapSize",
+			json_integer(shm_ring_map_size(s_frame_ring)));
+		json_object_set_new(
+			returnObj, "slotCount",
+			json_integer(shm_ring_slot_count(s_frame_ring)));
+		json_object_set_new(
+			returnObj, "slotSize",
+			json_integer(shm_ring_slot_size(s_frame_ring)));
 	} else {
-		blog(LOG_INFO, "created av capture!");
+		int queueSize = DEFAULT_FRAME_QUEUE_SIZE;
+		json_t *queueSizeObj = json_object_get(command, "queueSize");
+		if (json_is_integer(queueSizeObj)) {
+			queueSize = json_integer_value(queueSizeObj);
+		}
+
+		enum frame_sender_policy policy = FRAME_SENDER_DROP_OLDEST;
+		json_t *policyObj = json_object_get(command, "dropPolicy");
+		if (json_is_string(policyObj) &&
+		    !frame_sender_parse_policy(json_string_value(policyObj),
+					       &policy)) {
+			fprintf(stderr, "error: unknown dropPolicy %s\n",
+				json_string_value(policyObj));
+			return 1;
+		}
+
+		// Dropping a queued delta would desync the consumer, so frames
+		// are only ever dropped before they are encoded
+		if (s_frame_delta != NULL &&
+		    policy == FRAME_SENDER_DROP_OLDEST) {
+			policy = FRAME_SENDER_DROP_NEWEST;
+		}
+
+		json_t *portObj = json_object_get(command, "port");
+		if (portObj) {
+			int port = json_integer_value(portObj);
+			connect_to_local(port);
+		}
+
+		s_frame_sender = frame_sender_create(queueSize, policy,
+						     write_to_local, NULL);
+		if (!s_frame_sender) {
+			fprintf(stderr, "error: could not create frame sender\n");
+			disconnect_from_local();
+			return 1;
+		}
+
+		json_object_set_new(returnObj, "transport", json_string("tcp"));
+		json_object_set_new(returnObj, "queueSize",
+				    json_integer(queueSize));
+		json_object_set_new(
+			returnObj, "dropPolicy",
+			json_string(frame_sender_policy_name(policy)));
 	}
-#endif
+
+	start_raw_output();
 
 	return 0;
 }
 
-// Set up video for recording a single source to the output
-static int initializeSingleVideoRecording(json_t *obj)
+static int setRenderRegions(json_t *command, json_t *returnObj)
 {
-	blog(LOG_INFO, "In initializeSingleVideoRecording");
-
-	json_t *inputWidthObj = json_object_get(obj, "inputWidth");
-	if (!json_is_integer(inputWidthObj)) {
-		fprintf(stderr, "error: inputWidth is not an integer\n");
+	json_t *regionsObj = json_object_get(command, "regions");
+	if (!json_is_array(regionsObj)) {
+		fprintf(stderr, "error: regions is not an array\n");
 		return 1;
 	}
-	int inputWidth = json_integer_value(inputWidthObj);
 
-	json_t *inputHeightObj = json_object_get(obj, "inputHeight");
-	if (!json_is_integer(inputHeightObj)) {
+	size_t numRegions = json_array_size(regionsObj);
+	struct frame_region *regions = NULL;
+	if (numRegions > 0) {
+		regions = bzalloc(sizeof(struct frame_region) * numRegions);
+	}
+
+	for (size_t i = 0; i < numRegions; i++) {
+		json_t *regionObj = json_array_get(regionsObj, i);
+		struct frame_region *region = &regions[i];
+
+		json_t *xObj = json_object_get(regionObj, "x");
+		json_t *yObj = json_object_get(regionObj, "y");
+		json_t *widthObj = json_object_get(regionObj, "width");
+		json_t *heightObj = json_object_get(regionObj, "height");
+		if (!json_is_integer(xObj) || !json_is_integer(yObj) ||
+		    !json_is_integer(widthObj) || !json_is_integer(heightObj)) {
+			fprintf(stderr, "error: region %d needs integer "
+					"x, y, width and height\n",
+				(int)i);
+			bfree(regions);
+			return 1;
+		}
+
+		region->x = (uint32_t)json_integer_value(xObj);
+		region->y = (uint32_t)json_integer_value(yObj);
+		region->width = (uint32_t)json_integer_value(widthObj);
+		region->height = (uint32_t)json_integer_value(heightObj);
+
+		region->scale = 1;
+		json_t *scaleObj = json_object_get(regionObj, "scale");
+		if (json_is_integer(scaleObj)) {
+			region->scale = (uint32_t)json_integer_value(scaleObj);
+		}
+
+		region->format = VIDEO_FORMAT_RGBA;
+		json_t *formatObj = json_object_get(regionObj, "format");
+		if (json_is_string(formatObj) &&
+		    !frame_region_parse_format(json_string_value(formatObj),
+					       &region->format)) {
+			fprintf(stderr, "error: unknown region format %s\n",
+				json_string_value(formatObj));
+			bfree(regions);
+			return 1;
+		}
+	}
+
+	// A running shm ring keeps its slot size, and the consumer has it
+	// mapped, so a message that no longer fits needs a new pipe
+	size_t newSize = numRegions > 0
+				 ? frame_regions_layout(regions, numRegions,
+							s_output_width,
+							s_output_height)
+				 : get_frame_payload_size();
+	if (s_frame_ring != NULL &&
+	    newSize > shm_ring_slot_size(s_frame_ring)) {
+		fprintf(stderr,
+			"error: messages of %zu bytes do not fit the %u byte "
+			"frame ring slots, restart the render pipe\n",
+			newSize, shm_ring_slot_size(s_frame_ring));
+		bfree(regions);
+		return 1;
+	}
+
+	// Regions are read on the video thread
+	bool wasActive = s_raw_output_active;
+	stop_raw_output();
+
+	bfree(s_render_regions);
+	s_render_regions = regions;
+	s_num_render_regions = numRegions;
+	layout_render_regions();
+
+	if (wasActive) {
+		start_raw_output();
+	}
+
+	json_t *layoutArray = json_array();
+	for (size_t i = 0; i < s_num_render_regions; i++) {
+		struct frame_region *region = &s_render_regions[i];
+		json_t *layoutObj = json_object();
+		json_object_set_new(layoutObj, "width",
+				    json_integer(region->out_width));
+		json_object_set_new(layoutObj, "height",
+				    json_integer(region->out_height));
+		json_object_set_new(
+			layoutObj, "format",
+			json_string(frame_region_format_name(region->format)));
+		json_object_set_new(layoutObj, "size",
+				    json_integer(region->size));
+		json_array_append_new(layoutArray, layoutObj);
+	}
+	json_object_set_new(returnObj, "regions", layoutArray);
+	json_object_set_new(returnObj, "messageSize",
+			    json_integer(s_render_regions_size));
+
+	if (s_num_render_regions > 0 && s_render_regions_size == 0) {
+		return 1;
+	}
+
+	return 0;
+}
+
+static void add_frame_delta_stats(json_t *returnObj)
+{
+	struct frame_delta_stats stats;
+	frame_delta_get_stats(s_frame_delta, &stats);
+
+	json_object_set_new(returnObj, "deltaFrames",
+			    json_integer(stats.frames));
+	json_object_set_new(returnObj, "deltaKeyframes",
+			    json_integer(stats.keyframes));
+	json_object_set_new(returnObj, "deltaChangedTiles",
+			    json_integer(stats.changed_tiles));
+	json_object_set_new(returnObj, "deltaTotalTiles",
+			    json_integer(stats.total_tiles));
+}
+
+static void getRenderPipeStats(json_t *returnObj)
+{
+	if (s_frame_delta != NULL) {
+		add_frame_delta_stats(returnObj);
+	}
+
+	if (s_frame_ring != NULL) {
+		json_object_set_new(returnObj, "transport", json_string("shm"));
+		add_frame_ring_stats(returnObj);
+	} else if (s_frame_sender != NULL) {
+		json_object_set_new(returnObj, "transport", json_string("tcp"));
+		add_frame_sender_stats(returnObj);
+	} else {
+		json_object_set_new(returnObj, "transport", json_null());
+	}
+}
+
+static void stopRenderFramesPipe(json_t *returnObj)
+{
+	stop_raw_output();
+	getRenderPipeStats(returnObj);
+	close_render_pipe();
+}
+
+// Response to a command that completes after its handler returns
+struct deferred_response {
+	char *actionId;
+	enum command_encoding encoding;
+	uint64_t received_ns;
+};
+
+// Sends returnObj (or an empty response if NULL) and frees deferred
+static void send_deferred_response(struct deferred_response *deferred,
+				   json_t *returnObj)
+{
+	returnObj = returnObj ? json_incref(returnObj) : json_object();
+	json_object_set_new(returnObj, "actionId",
+			    json_string(deferred->actionId));
+	send_response(returnObj, deferred->encoding);
+	json_decref(returnObj);
+
+	bfree(deferred->actionId);
+	bfree(deferred);
+}
+
+static void output_stopped(void *my_data, calldata_t *cd)
+{
+	debug_log("Recording stopped");
+
+	send_deferred_response(my_data, NULL);
+
+	// one shot, the next stopRecording connects again
+	signal_handler_remove_current();
+}
+
+static struct deferred_response *take_pending_start()
+{
+	pthread_mutex_lock(&s_start_mutex);
+	struct deferred_response *start = s_pending_start;
+	s_pending_start = NULL;
+	pthread_mutex_unlock(&s_start_mutex);
+
+	return start;
+}
+
+static void recording_first_packet(void *data, calldata_t *cd)
+{
+	struct deferred_response *start = take_pending_start();
+	if (!start) {
+		return;
+	}
+
+	double latencyMs = (os_gettime_ns() - start->received_ns) / 1000000.0;
+	blog(LOG_INFO, "Recording start latency: %.1f ms", latencyMs);
+
+	json_t *returnObj = json_object();
+	json_object_set_new(returnObj, "startLatencyMs", json_real(latencyMs));
+	send_deferred_response(start, returnObj);
+	json_decref(returnObj);
+}
+
+static void recording_stopped(void *data, calldata_t *cd)
+{
+	// The recording failed before writing anything
+	struct deferred_response *start = take_pending_start();
+	if (!start) {
+		return;
+	}
+
+	json_t *returnObj = json_object();
+	json_object_set_new(returnObj, "error",
+			    json_string("recording stopped before writing data"));
+	json_object_set_new(returnObj, "code",
+			    json_integer(calldata_int(cd, "code")));
+	send_deferred_response(start, returnObj);
+	json_decref(returnObj);
+}
+
+// Must only be called while the output is stopped (the init commands check
+// with refuse_while_recording), video resets invalidate the encoders so they
+// are rebuilt on the next prepare
+static void release_recording()
+{
+	obs_output_release(fileOutput);
+	obs_encoder_release(encoder);
+	obs_encoder_release(audioEncoder);
+	fileOutput = NULL;
+	encoder = NULL;
+	audioEncoder = NULL;
+
+	struct deferred_response *start = take_pending_start();
+	if (start) {
+		json_t *returnObj = json_object();
+		json_object_set_new(returnObj, "error",
+				    json_string("recording was released"));
+		send_deferred_response(start, returnObj);
+		json_decref(returnObj);
+	}
+}
+
+static obs_encoder_t *create_video_encoder(const char *id, bool strict)
+{
+	struct dstr error = {0};
+	obs_data_t *settings =
+		encoder_spec_video_settings(s_encoder_spec, id, strict, &error);
+	if (!settings) {
+		blog(LOG_WARNING, "Video encoder: %s", error.array);
+		dstr_free(&error);
+		return NULL;
+	}
+
+	obs_encoder_t *videoEncoder = obs_video_encoder_create(
+		id, "simple_h264_recording", settings, NULL);
+	obs_data_release(settings);
+
+	if (videoEncoder) {
+		obs_encoder_set_video(videoEncoder, obs_get_video());
+	}
+	return videoEncoder;
+}
+
+static bool can_fall_back()
+{
+	return encoder_spec_fallback(s_encoder_spec) &&
+	       strcmp(obs_encoder_get_id(encoder), DEFAULT_VIDEO_ENCODER) != 0;
+}
+
+// Replaces a hardware encoder that could not be used with x264
+static bool fall_back_to_x264()
+{
+	blog(LOG_WARNING, "Video encoder %s unusable, falling back to %s",
+	     obs_encoder_get_id(encoder), DEFAULT_VIDEO_ENCODER);
+
+	obs_encoder_t *fallback =
+		create_video_encoder(DEFAULT_VIDEO_ENCODER, false);
+	if (!fallback) {
+		return false;
+	}
+
+	obs_encoder_release(encoder);
+	encoder = fallback;
+	obs_output_set_video_encoder(fileOutput, encoder);
+	return true;
+}
+
+static int create_recording()
+{
+	const char *videoEncoderId = encoder_spec_video_id(s_encoder_spec);
+	struct dstr error = {0};
+
+	fileOutput = obs_output_create("ffmpeg_muxer", "simple_file_output",
+				       NULL, NULL);
+	if (!fileOutput) {
+		blog(LOG_ERROR, "Failed to create output");
+		return 1;
+	}
+
+	signal_handler_t *handler = obs_output_get_signal_handler(fileOutput);
+	signal_handler_connect(handler, "first_packet", recording_first_packet,
+			       NULL);
+	signal_handler_connect(handler, "stop", recording_stopped, NULL);
+
+	encoder = create_video_encoder(videoEncoderId, true);
+	if (!encoder && encoder_spec_fallback(s_encoder_spec) &&
+	    strcmp(videoEncoderId, DEFAULT_VIDEO_ENCODER) != 0) {
+		blog(LOG_WARNING, "Video encoder %s unavailable, using %s",
+		     videoEncoderId, DEFAULT_VIDEO_ENCODER);
+		encoder = create_video_encoder(DEFAULT_VIDEO_ENCODER, false);
+	}
+	if (!encoder) {
+		blog(LOG_ERROR, "Failed to create video encoder");
+		release_recording();
+		return 1;
+	}
+
+	obs_data_t *audioSettings =
+		encoder_spec_audio_settings(s_encoder_spec, &error);
+	if (!audioSettings) {
+		blog(LOG_ERROR, "Audio encoder: %s", error.array);
+		dstr_free(&error);
+		release_recording();
+		return 1;
+	}
+
+	audioEncoder = obs_audio_encoder_create(DEFAULT_AUDIO_ENCODER,
+						"simple_aac_recording",
+						audioSettings, 0, NULL);
+	obs_data_release(audioSettings);
+	if (!audioEncoder) {
+		blog(LOG_ERROR, "Failed to create audio encoder");
+		release_recording();
+		return 1;
+	}
+
+	obs_encoder_set_audio(audioEncoder, obs_get_audio());
+	obs_output_set_video_encoder(fileOutput, encoder);
+	obs_output_set_audio_encoder(fileOutput, audioEncoder, 0);
+
+	blog(LOG_INFO, "Created recording output and encoders");
+	return 0;
+}
+
+// Creates the output and encoders if needed and initializes the encoders,
+// leaving only the muxer process to be spawned at start.  Encoders are shut
+// down when a recording stops, so call again after each stopRecording.  Used
+// by the prepareRecording action and by startRecording.
+static int prepare_recording(json_t *returnObj)
+{
+	if (!fileOutput && create_recording() != 0) {
+		return 1;
+	}
+
+	if (!obs_output_active(fileOutput)) {
+		obs_set_output_source(1, audioSource);
+
+		uint64_t start = os_gettime_ns();
+		bool initialized = obs_output_initialize_encoders(fileOutput, 0);
+
+		// Hardware encoders can be registered but fail on this machine
+		if (!initialized && can_fall_back() && fall_back_to_x264()) {
+			initialized =
+				obs_output_initialize_encoders(fileOutput, 0);
+		}
+		if (!initialized) {
+			blog(LOG_ERROR, "Failed to initialize encoders: %s",
+			     obs_output_get_last_error(fileOutput));
+			return 1;
+		}
+
+		blog(LOG_INFO, "Prepared recording in %.1f ms",
+		     (os_gettime_ns() - start) / 1000000.0);
+	}
+
+	if (returnObj) {
+		json_object_set_new(returnObj, "videoEncoder",
+				    json_string(obs_encoder_get_id(encoder)));
+	}
+	return 0;
+}
+
+// Applies the optional encoder spec of a command.  A new spec releases the
+// recording pipeline so the next prepare builds it with the new encoders.
+static int set_encoder_spec(json_t *command, json_t *returnObj)
+{
+	json_t *spec = json_object_get(command, "encoder");
+	if (!spec || json_equal(spec, s_encoder_spec)) {
+		return 0;
+	}
+
+	struct dstr error = {0};
+	if (!encoder_spec_validate(spec, &error)) {
+		fprintf(stderr, "error: %s\n", error.array);
+		json_object_set_new(returnObj, "error",
+				    json_string(error.array));
+		dstr_free(&error);
+		return 1;
+	}
+
+	if (fileOutput && obs_output_active(fileOutput)) {
+		fprintf(stderr, "error: cannot change encoder while recording\n");
+		json_object_set_new(
+			returnObj, "error",
+			json_string("cannot change encoder while recording"));
+		return 1;
+	}
+
+	release_recording();
+	json_decref(s_encoder_spec);
+	s_encoder_spec = json_deep_copy(spec);
+	return 0;
+}
+
+// Reads the optional fps (a number) or fpsNum/fpsDen from a command
+static int parse_video_rate(json_t *command)
+{
+	json_t *fpsObj = json_object_get(command, "fps");
+	json_t *fpsNumObj = json_object_get(command, "fpsNum");
+	json_t *fpsDenObj = json_object_get(command, "fpsDen");
+
+	if (fpsNumObj || fpsDenObj) {
+		if (!json_is_integer(fpsNumObj) || !json_is_integer(fpsDenObj) ||
+		    json_integer_value(fpsNumObj) <= 0 ||
+		    json_integer_value(fpsDenObj) <= 0) {
+			fprintf(stderr, "error: fpsNum and fpsDen must be "
+					"positive integers\n");
+			return 1;
+		}
+		s_fps_num = (uint32_t)json_integer_value(fpsNumObj);
+		s_fps_den = (uint32_t)json_integer_value(fpsDenObj);
+
+	} else if (fpsObj) {
+		if (!json_is_number(fpsObj) || json_number_value(fpsObj) <= 0.0 ||
+		    json_number_value(fpsObj) > 240.0) {
+			fprintf(stderr, "error: fps is not a valid frame rate\n");
+			return 1;
+		}
+		// 1/1000 precision covers 29.97 and friends
+		s_fps_num = (uint32_t)(json_number_value(fpsObj) * 1000.0 + 0.5);
+		s_fps_den = 1000;
+	}
+
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	enum speaker_layout speakers;
+} channel_layouts[] = {
+	{"mono", SPEAKERS_MONO},   {"stereo", SPEAKERS_STEREO},
+	{"2.1", SPEAKERS_2POINT1}, {"4.0", SPEAKERS_4POINT0},
+	{"4.1", SPEAKERS_4POINT1}, {"5.1", SPEAKERS_5POINT1},
+	{"7.1", SPEAKERS_7POINT1},
+};
+
+#define NUM_CHANNEL_LAYOUTS (sizeof(channel_layouts) / sizeof(channel_layouts[0]))
+
+// Reads the optional sampleRate and channelLayout from a command
+static int parse_audio_info(json_t *command, struct obs_audio_info *ai)
+{
+	json_t *sampleRateObj = json_object_get(command, "sampleRate");
+	if (sampleRateObj) {
+		json_int_t rate = json_integer_value(sampleRateObj);
+		if (rate != 44100 && rate != 48000) {
+			fprintf(stderr,
+				"error: sampleRate must be 44100 or 48000\n");
+			return 1;
+		}
+		ai->samples_per_sec = (uint32_t)rate;
+	}
+
+	json_t *layoutObj = json_object_get(command, "channelLayout");
+	if (layoutObj) {
+		const char *layout = json_string_value(layoutObj);
+		size_t i = 0;
+
+		while (layout && i < NUM_CHANNEL_LAYOUTS &&
+		       strcmp(layout, channel_layouts[i].name) != 0) {
+			i++;
+		}
+
+		if (!layout || i == NUM_CHANNEL_LAYOUTS) {
+			fprintf(stderr, "error: channelLayout is not valid\n");
+			return 1;
+		}
+		ai->speakers = channel_layouts[i].speakers;
+	}
+
+	return 0;
+}
+
+static int initialize(json_t *obj)
+{
+	blog(LOG_INFO, "Starting OBS!");
+
+	json_t *pluginDirObj = json_object_get(obj, "pluginDir");
+	if (!json_is_string(pluginDirObj)) {
+		fprintf(stderr, "error: pluginDir is not a string\n");
+		return 0;
+	}
+	const char *pluginDir = json_string_value(pluginDirObj);
+
+	json_t *exeDirObj = json_object_get(obj, "exeDir");
+	if (!json_is_string(exeDirObj)) {
+		fprintf(stderr, "error: exeDir is not a string\n");
+		return 0;
+	}
+	const char *exeDir = json_string_value(exeDirObj);
+	obs_set_executable_path(exeDir);
+
+	json_t *dataDirObj = json_object_get(obj, "dataDir");
+	if (!json_is_string(dataDirObj)) {
+		fprintf(stderr, "error: dataDir is not a string\n");
+		return 0;
+	}
+	const char *dataDir = json_string_value(dataDirObj);
+	obs_add_data_path(dataDir);
+
+	struct obs_audio_info ai;
+	ai.samples_per_sec = 44100;
+	ai.speakers = SPEAKERS_MONO;
+	if (parse_video_rate(obj) != 0 || parse_audio_info(obj, &ai) != 0) {
+		return 1;
+	}
+
+	if (!obs_startup("en", ".", NULL)) {
+		blog(LOG_ERROR, "Failed to start");
+		return 1;
+	} else {
+		blog(LOG_INFO, "Started OBS");
+	}
+
+	struct obs_video_info ovi;
+	ovi.adapter = 0;
+	ovi.gpu_conversion = false;
+#ifndef _WIN32
+	ovi.graphics_module = "libobs-opengl";
+#else
+	ovi.graphics_module = "libobs-d3d11";
+#endif
+	ovi.fps_num = s_fps_num;
+	ovi.fps_den = s_fps_den;
+	ovi.base_width = 1280;
+	ovi.base_height = 720;
+	ovi.output_width = 1280;
+	ovi.output_height = 720;
+	ovi.output_format = VIDEO_FORMAT_RGBA;
+	ovi.scale_type = OBS_SCALE_BILINEAR;
+
+	// Encoders are bound to the old video output
+	release_recording();
+
+	blog(LOG_INFO, "Resetting video");
+	int rc = obs_reset_video(&ovi);
+	blog(LOG_INFO, "Result: %d", rc);
+
+	rc = obs_reset_audio(&ai);
+	blog(LOG_INFO, "Reset audio: %d", rc);
+
+	obs_add_module_path(pluginDir, pluginDir);
+	blog(LOG_INFO, "Loading modules");
+	obs_load_all_modules();
+	obs_post_load_modules();
+	blog(LOG_INFO, "Done loading modules");
+
+#ifndef _WIN32
+	displaySource = obs_source_create("display_capture", "Display Capture",
+					  NULL, NULL);
+	if (!displaySource) {
+		blog(LOG_ERROR, "Unable to create source");
+		return 1;
+	} else {
+		blog(LOG_INFO, "Created display capture!");
+	}
+
+	audioSource = obs_source_create("coreaudio_input_capture", "Microphone",
+					NULL, NULL);
+	if (!audioSource) {
+		blog(LOG_ERROR, "Unable to create audio source");
+	} else {
+		blog(LOG_INFO, "Created audio source");
+	}
+
+	webcamSource = obs_source_create("av_capture_input", "Webcam Capture",
+					 NULL, NULL);
+	if (!webcamSource) {
+		blog(LOG_ERROR, "Unable to create webcam source");
+	} else {
+		blog(LOG_INFO, "created av capture!");
+	}
+#else
+	displaySource = obs_source_create("monitor_capture", "Display Capture",
+					  NULL, NULL);
+	if (!displaySource) {
+		blog(LOG_ERROR, "Unable to create source");
+		return 1;
+	} else {
+		blog(LOG_INFO, "Created display capture!");
+	}
+
+	audioSource = obs_source_create("wasapi_input_capture", "Microphone",
+					NULL, NULL);
+	if (!audioSource) {
+		blog(LOG_ERROR, "Unable to create audio source");
+	} else {
+		blog(LOG_INFO, "Created audio source");
+	}
+
+	webcamSource =
+		obs_source_create("dshow_input", "Webcam Capture", NULL, NULL);
+	if (!webcamSource) {
+		blog(LOG_ERROR, "Unable to create webcam source");
+	} else {
+		blog(LOG_INFO, "created av capture!");
+	}
+#endif
+
+	return 0;
+}
+
+// Set up video for recording a single source to the output
+static int initializeSingleVideoRecording(json_t *obj)
+{
+	blog(LOG_INFO, "In initializeSingleVideoRecording");
+
+	if (parse_video_rate(obj) != 0) {
+		return 1;
+	}
+
+	json_t *inputWidthObj = json_object_get(obj, "inputWidth");
+	if (!json_is_integer(inputWidthObj)) {
+		fprintf(stderr, "error: inputWidth is not an integer\n");
+		return 1;
+	}
+	int inputWidth = json_integer_value(inputWidthObj);
+
+	json_t *inputHeightObj = json_object_get(obj, "inputHeight");
+	if (!json_is_integer(inputHeightObj)) {
 		fprintf(stderr, "error: inputHeight is not an integer\n");
 		return 1;
 	}
@@ -413,14 +1380,14 @@ static int initializeSingleVideoRecording(json_t *obj)
 		fprintf(stderr, "error: scaledWidth is not an integer\n");
 		return 1;
 	}
-	s_output_width = json_integer_value(scaledWidthObj);
+	int scaledWidth = json_integer_value(scaledWidthObj);
 
 	json_t *scaledHeightObj = json_object_get(obj, "scaledHeight");
 	if (!json_is_integer(scaledHeightObj)) {
 		fprintf(stderr, "error: scaledHeight is not an integer\n");
 		return 1;
 	}
-	s_output_height = json_integer_value(scaledHeightObj);
+	int scaledHeight = json_integer_value(scaledHeightObj);
 
 	json_t *deviceTypeObj = json_object_get(obj, "deviceType");
 	if (!json_is_string(deviceTypeObj)) {
@@ -578,8 +1545,8 @@ static int initializeSingleVideoRecording(json_t *obj)
 #else
 	ovi.graphics_module = "libobs-d3d11";
 #endif
-	ovi.fps_num = 30000;
-	ovi.fps_den = 1000;
+	ovi.fps_num = s_fps_num;
+	ovi.fps_den = s_fps_den;
 	ovi.base_width = inputWidth;
 	ovi.base_height = inputHeight;
 	ovi.output_width = outputWidth;
@@ -590,6 +1557,13 @@ static int initializeSingleVideoRecording(json_t *obj)
 	// Make sure to remove listener so that video is not considered active
 	stop_raw_output();
 
+	// The video thread reads the output size until the listener is gone
+	s_output_width = scaledWidth;
+	s_output_height = scaledHeight;
+
+	// Encoders are bound to the old video output
+	release_recording();
+
 	blog(LOG_INFO, "Resetting video");
 	int rc = obs_reset_video(&ovi);
 	blog(LOG_INFO, "Result: %d", rc);
@@ -732,6 +1706,10 @@ static int initializeRecording(json_t *obj)
 {
 	blog(LOG_INFO, "In initializeRecording");
 
+	if (parse_video_rate(obj) != 0) {
+		return 1;
+	}
+
 	json_t *inputWidthObj = json_object_get(obj, "inputWidth");
 	if (!json_is_integer(inputWidthObj)) {
 		fprintf(stderr, "error: inputWidth is not an integer\n");
@@ -765,48 +1743,36 @@ static int initializeRecording(json_t *obj)
 		fprintf(stderr, "error: scaledWidth is not an integer\n");
 		return 1;
 	}
-	s_output_width = json_integer_value(scaledWidthObj);
+	int scaledWidth = json_integer_value(scaledWidthObj);
 
 	json_t *scaledHeightObj = json_object_get(obj, "scaledHeight");
 	if (!json_is_integer(scaledHeightObj)) {
 		fprintf(stderr, "error: scaledHeight is not an integer\n");
 		return 1;
 	}
-	s_output_height = json_integer_value(scaledHeightObj);
+	int scaledHeight = json_integer_value(scaledHeightObj);
 
 	// Optional params to return only a slice of the scaled output
 	// Used when returning just the webcam portion of the scene
-	s_output_slice_width = -1;
-	s_output_slice_height = -1;
-	s_output_slice_x = -1;
-	s_output_slice_y = -1;
-	if (s_output_slice_buffer) {
-		free(s_output_slice_buffer);
-		s_output_slice_buffer = NULL;
-	}
+	int sliceWidth = -1;
+	int sliceHeight = -1;
+	int sliceX = -1;
+	int sliceY = -1;
 	json_t *scaledSliceWidth = json_object_get(obj, "scaledSliceWidth");
 	if (json_is_integer(scaledSliceWidth)) {
-		s_output_slice_width = json_integer_value(scaledSliceWidth);
+		sliceWidth = json_integer_value(scaledSliceWidth);
 	}
 	json_t *scaledSliceHeight = json_object_get(obj, "scaledSliceHeight");
 	if (json_is_integer(scaledSliceHeight)) {
-		s_output_slice_height = json_integer_value(scaledSliceHeight);
+		sliceHeight = json_integer_value(scaledSliceHeight);
 	}
 	json_t *scaledSliceX = json_object_get(obj, "scaledSliceX");
 	if (json_is_integer(scaledSliceX)) {
-		s_output_slice_x = json_integer_value(scaledSliceX);
+		sliceX = json_integer_value(scaledSliceX);
 	}
 	json_t *scaledSliceY = json_object_get(obj, "scaledSliceY");
 	if (json_is_integer(scaledSliceY)) {
-		s_output_slice_y = json_integer_value(scaledSliceY);
-	}
-
-	// If we are going to output just a slice, allocate buffer now
-	if (s_output_slice_width > 0) {
-		fprintf(stderr, "USING SLICE BUFFER\n");
-		s_output_slice_buffer = malloc(sizeof(uint8_t) * 4 * s_output_slice_width * s_output_slice_height);
-	} else {
-		s_output_slice_buffer = NULL;
+		sliceY = json_integer_value(scaledSliceY);
 	}
 
 	struct obs_video_info ovi;
@@ -817,8 +1783,8 @@ static int initializeRecording(json_t *obj)
 #else
 	ovi.graphics_module = "libobs-d3d11";
 #endif
-	ovi.fps_num = 30000;
-	ovi.fps_den = 1000;
+	ovi.fps_num = s_fps_num;
+	ovi.fps_den = s_fps_den;
 	ovi.base_width = inputWidth;
 	ovi.base_height = inputHeight;
 	ovi.output_width = outputWidth;
@@ -827,22 +1793,31 @@ static int initializeRecording(json_t *obj)
 	ovi.scale_type = OBS_SCALE_BILINEAR;
 
 	// Make sure to remove listener so that video is not considered active
-	if (s_raw_output_active) {
-		obs_remove_raw_video_callback(receive_video, NULL);
-		s_raw_output_active = false;
+	stop_raw_output();
+
+	// The video thread reads the output size and slice until the listener
+	// is gone, frames are copied into the pipe buffers so no slice buffer
+	// is needed
+	s_output_width = scaledWidth;
+	s_output_height = scaledHeight;
+	s_output_slice_width = sliceWidth;
+	s_output_slice_height = sliceHeight;
+	s_output_slice_x = sliceX;
+	s_output_slice_y = sliceY;
+	s_output_slice_active = sliceWidth > 0;
+	if (s_output_slice_active) {
+		fprintf(stderr, "USING SLICE\n");
 	}
 
+	// Encoders are bound to the old video output
+	release_recording();
+
 	blog(LOG_INFO, "Resetting video");
 	int rc = obs_reset_video(&ovi);
 	blog(LOG_INFO, "Result: %d", rc);
 
 	// Now add raw video callback
-	struct video_scale_info info = {0};
-	info.format = VIDEO_FORMAT_RGBA;
-	info.width = s_output_width;
-	info.height = s_output_height;
-	obs_add_raw_video_callback(&info, receive_video, NULL);
-	s_raw_output_active = true;
+	start_raw_output();
 
 	return 0;
 }
@@ -861,458 +1836,968 @@ static const int initializeAudio(json_t *command)
 		fprintf(stderr, "error: syncOffsetMs is not an int\n");
 		return 0;
 	}
-	int syncOffSetMs = json_integer_value(syncOffsetMsObj);
+	int syncOffSetMs = json_integer_value(syncOffsetMsObj);
+
+	obs_data_t *settings = obs_data_create();
+	obs_data_set_string(settings, "device_id", deviceId);
+	obs_source_update(audioSource, settings);
+
+	obs_source_set_sync_offset(audioSource,
+				   (int64_t)syncOffSetMs * (int64_t)1000000);
+
+	blog(LOG_INFO, "Set audio to %s", deviceId);
+
+	return 0;
+}
+
+static const int setAudioDelay(json_t *command)
+{
+	json_t *syncOffsetMsObj = json_object_get(command, "audioDelayMs");
+	if (!json_is_integer(syncOffsetMsObj)) {
+		fprintf(stderr, "error: audioDelayMs is not an int\n");
+		return 0;
+	}
+	int audioDelayMs = json_integer_value(syncOffsetMsObj);
+
+	obs_source_set_sync_offset(audioSource,
+				   (int64_t)audioDelayMs * (int64_t)1000000);
+
+	blog(LOG_INFO, "Set audio delay to %d ms", audioDelayMs);
+
+	return 0;
+}
+
+// Takes ownership of start, which is answered once data is written
+static const int startRecording(json_t *command,
+				struct deferred_response *start)
+{
+	json_t *outputFileObj = json_object_get(command, "outputFile");
+	if (!json_is_string(outputFileObj)) {
+		fprintf(stderr, "error: outputFileObj is not a string\n");
+		goto fail;
+	}
+	const char *outputFilePath = json_string_value(outputFileObj);
+
+	if (prepare_recording(NULL) != 0) {
+		goto fail;
+	}
+
+	if (obs_output_active(fileOutput)) {
+		fprintf(stderr, "error: already recording\n");
+		goto fail;
+	}
+
+	obs_data_t *settings = obs_data_create();
+	obs_data_set_string(settings, "path", outputFilePath);
+	obs_output_update(fileOutput, settings);
+	obs_data_release(settings);
+
+	pthread_mutex_lock(&s_start_mutex);
+	s_pending_start = start;
+	pthread_mutex_unlock(&s_start_mutex);
+
+	blog(LOG_INFO, "Starting to record");
+	if (!obs_output_start(fileOutput)) {
+		blog(LOG_ERROR, "Failed to start recording");
+		// Only free it if no output signal has answered it already
+		start = take_pending_start();
+		goto fail;
+	}
+
+	blog(LOG_INFO, "Recording started");
+	return 0;
+
+fail:
+	if (start) {
+		bfree(start->actionId);
+		bfree(start);
+	}
+	return 1;
+}
+
+static void list_audio_devices(json_t *returnObj)
+{
+	json_t *array = json_array();
+	json_object_set_new(returnObj, "devices", array);
+
+	obs_properties_t *audioProps = obs_source_properties(audioSource);
+	obs_property_t *property = obs_properties_first(audioProps);
+	while (property != NULL) {
+		const char *name = obs_property_name(property);
+		enum obs_property_type type = obs_property_get_type(property);
+		if (s_debug) {
+			blog(LOG_INFO, "Property: %s, %d", name, type);
+		}
+
+		if (strcmp(name, "device_id") == 0) {
+			int numItems = obs_property_list_item_count(property);
+			if (s_debug) {
+				blog(LOG_INFO, "%d items", numItems);
+			}
+			for (int i = 0; i < numItems; i++) {
+				json_t *deviceObj = json_object();
+				json_object_set_new(
+					deviceObj, "deviceName",
+					json_string(obs_property_list_item_name(
+						property, i)));
+				json_object_set_new(
+					deviceObj, "deviceId",
+					json_string(
+						obs_property_list_item_string(
+							property, i)));
+				json_array_append_new(array, deviceObj);
+
+				if (!s_debug) {
+					continue;
+				}
+				blog(LOG_INFO, "List item name: %s",
+				     obs_property_list_item_name(property, i));
+				blog(LOG_INFO, "List item string value: %s",
+				     obs_property_list_item_string(property,
+								   i));
+				blog(LOG_INFO, "List item int value: %lld",
+				     obs_property_list_item_int(property, i));
+				blog(LOG_INFO, "List item float value: %f",
+				     obs_property_list_item_float(property, i));
+			}
+		}
+
+		obs_property_next(&property);
+	}
+
+	obs_properties_destroy(audioProps);
+}
+
+static void list_webcam_devices(json_t *returnObj)
+{
+	json_t *deviceList = obs_source_device_list(webcamSource);
+
+	if (s_debug) {
+		char *str = json_dumps(deviceList, 0);
+		fprintf(stderr, "Devices: %s\n", str);
+		free(str);
+	}
+
+	json_object_set_new(returnObj, "devices", deviceList);
+}
+
+static void list_display_devices(json_t *returnObj)
+{
+	json_t *deviceList = obs_source_device_list(displaySource);
+
+	if (s_debug) {
+		char *str = json_dumps(deviceList, 0);
+		fprintf(stderr, "Devices: %s\n", str);
+		free(str);
+	}
+
+	json_object_set_new(returnObj, "devices", deviceList);
+}
+
+// Items are added with these source types
+static obs_source_t *get_item_source(const char *type, bool *isVideo)
+{
+	*isVideo = true;
+
+	if (strncmp(type, "webcam", 6) == 0) {
+		return webcamSource;
+	} else if (strncmp(type, "display", 7) == 0) {
+		return displaySource;
+	} else if (strncmp(type, "microphone", 10) == 0) {
+		*isVideo = false;
+		return audioSource;
+	}
+
+	return NULL;
+}
+
+static bool get_item_number(json_t *info, const char *key, float *val)
+{
+	json_t *obj = json_object_get(info, key);
+	if (!json_is_number(obj)) {
+		return false;
+	}
+
+	*val = (float)json_number_value(obj);
+	return true;
+}
+
+static bool get_item_crop(json_t *info, const char *key, int *val)
+{
+	json_t *obj = json_object_get(info, key);
+	if (!json_is_integer(obj)) {
+		return false;
+	}
+
+	*val = (int)json_integer_value(obj);
+	return true;
+}
+
+// Applies the transform, crop and visibility fields present in info, fields
+// that are missing keep their current value
+static void apply_item_props(obs_sceneitem_t *item, json_t *info)
+{
+	json_t *visibleObj = json_object_get(info, "visible");
+	if (json_is_boolean(visibleObj)) {
+		obs_sceneitem_set_visible(item, json_is_true(visibleObj));
+	}
+
+	// Audio only items have no transform
+	if (!(obs_source_get_output_flags(obs_sceneitem_get_source(item)) &
+	      OBS_SOURCE_VIDEO)) {
+		return;
+	}
+
+	struct obs_sceneitem_crop crop;
+	obs_sceneitem_get_crop(item, &crop);
+	bool cropChanged = get_item_crop(info, "cropLeft", &crop.left);
+	cropChanged |= get_item_crop(info, "cropRight", &crop.right);
+	cropChanged |= get_item_crop(info, "cropTop", &crop.top);
+	cropChanged |= get_item_crop(info, "cropBottom", &crop.bottom);
+	if (cropChanged) {
+		obs_sceneitem_set_crop(item, &crop);
+	}
+
+	struct vec2 pos;
+	obs_sceneitem_get_pos(item, &pos);
+	bool posChanged = get_item_number(info, "x", &pos.x);
+	posChanged |= get_item_number(info, "y", &pos.y);
+	if (posChanged) {
+		obs_sceneitem_set_pos(item, &pos);
+	}
+
+	struct vec2 scale;
+	obs_sceneitem_get_scale(item, &scale);
+	bool scaleChanged = get_item_number(info, "scaleX", &scale.x);
+	scaleChanged |= get_item_number(info, "scaleY", &scale.y);
+	if (scaleChanged) {
+		obs_sceneitem_set_scale(item, &scale);
+	}
+}
+
+// Returns the new item's id, or -1 if it could not be added
+static int64_t add_scene_item(obs_scene_t *scene, json_t *info)
+{
+	const char *type = json_string_value(json_object_get(info, "type"));
+	bool isVideo;
+
+	obs_source_t *source = type ? get_item_source(type, &isVideo) : NULL;
+	if (!source) {
+		blog(LOG_ERROR, "Unknown type: %s", type ? type : "(none)");
+		return -1;
+	}
+
+	obs_sceneitem_t *item = obs_scene_add(scene, source);
+	if (item == NULL) {
+		blog(LOG_ERROR, "Could not add %s item", type);
+		return -1;
+	}
+
+	apply_item_props(item, info);
+	return obs_sceneitem_get_id(item);
+}
+
+static void release_scenes()
+{
+	for (int i = 0; i < numScenes; i++) {
+		obs_scene_release(sceneList[i]);
+	}
+	bfree(sceneList);
+	sceneList = NULL;
+	numScenes = 0;
+}
+
+// Responds with the ids of the created items, which updateScenes uses to
+// address them.  Items that could not be added have a null id.
+static int initializeScenes(json_t *obj, json_t *returnObj)
+{
+	blog(LOG_INFO, "In initializeScenes");
+
+	json_t *scenes = json_object_get(obj, "scenes");
+	if (!json_is_array(scenes) || json_array_size(scenes) == 0) {
+		fprintf(stderr, "error: scenes is not a non-empty array\n");
+		return 1;
+	}
+
+	// Delete any existing scenes
+	release_scenes();
+
+	numScenes = (int)json_array_size(scenes);
+	sceneList = bmalloc(sizeof(obs_scene_t *) * numScenes);
+
+	json_t *sceneIds = json_array();
+	json_object_set_new(returnObj, "scenes", sceneIds);
+
+	for (int i = 0; i < numScenes; i++) {
+		char sceneName[32];
+		snprintf(sceneName, sizeof(sceneName), "Scene_%d", i);
+		obs_scene_t *scene = obs_scene_create(sceneName);
+
+		sceneList[i] = scene;
+
+		json_t *sceneInfo = json_array_get(scenes, i);
+		json_t *sources = json_object_get(sceneInfo, "itemSources");
+		size_t numSources = json_array_size(sources);
+
+		json_t *itemIds = json_array();
+		json_array_append_new(sceneIds, itemIds);
+
+		for (size_t j = 0; j < numSources; j++) {
+			int64_t id = add_scene_item(
+				scene, json_array_get(sources, j));
+			json_array_append_new(itemIds, id >= 0 ? json_integer(id)
+							       : json_null());
+		}
+
+		blog(LOG_INFO, "Created scene %d with %d sources", i,
+		     (int)numSources);
+	}
+
+	obs_set_output_source(0, obs_scene_get_source(sceneList[0]));
+	blog(LOG_INFO, "Set output 0 to scene 0");
+
+	return 0;
+}
+
+/*
+ * updateScenes applies a patch to the existing scenes:
+ *
+ *   "scenes": [{"sceneNum": 0,
+ *               "remove": [itemId, ...],
+ *               "modify": [{"id": itemId, "cropLeft": 10, "visible": false,
+ *                           ...}, ...],
+ *               "add": [{"type": "webcam", "x": 0, ...}, ...]}, ...]
+ *
+ * Every patched scene is locked for the whole update, so the graphics thread
+ * renders either the old or the new state.  The patch is validated under the
+ * lock before anything is changed.
+ */
+struct scene_update {
+	json_t *patches;
+	size_t locked;
+	json_t *returnObj;
+	struct dstr error;
+	uint64_t apply_ns;
+};
+
+static bool validate_scene_patch(obs_scene_t *scene, json_t *patch,
+				 struct dstr *error)
+{
+	json_t *val;
+	size_t idx;
+	bool isVideo;
+
+	json_array_foreach (json_object_get(patch, "remove"), idx, val) {
+		if (!obs_scene_find_sceneitem_by_id(scene,
+						    json_integer_value(val))) {
+			dstr_printf(error, "no item %lld to remove",
+				    (long long)json_integer_value(val));
+			return false;
+		}
+	}
+
+	json_array_foreach (json_object_get(patch, "modify"), idx, val) {
+		json_int_t id = json_integer_value(json_object_get(val, "id"));
+		if (!obs_scene_find_sceneitem_by_id(scene, id)) {
+			dstr_printf(error, "no item %lld to modify",
+				    (long long)id);
+			return false;
+		}
+	}
+
+	json_array_foreach (json_object_get(patch, "add"), idx, val) {
+		const char *type =
+			json_string_value(json_object_get(val, "type"));
+		if (!type || !get_item_source(type, &isVideo)) {
+			dstr_printf(error, "cannot add item of type %s",
+				    type ? type : "(none)");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void apply_scene_patch(obs_scene_t *scene, json_t *patch,
+			      json_t *added)
+{
+	json_t *val;
+	size_t idx;
+
+	json_array_foreach (json_object_get(patch, "remove"), idx, val) {
+		obs_sceneitem_remove(obs_scene_find_sceneitem_by_id(
+			scene, json_integer_value(val)));
+	}
+
+	json_array_foreach (json_object_get(patch, "modify"), idx, val) {
+		json_int_t id = json_integer_value(json_object_get(val, "id"));
+		apply_item_props(obs_scene_find_sceneitem_by_id(scene, id),
+				 val);
+	}
+
+	json_array_foreach (json_object_get(patch, "add"), idx, val) {
+		int64_t id = add_scene_item(scene, val);
+		json_array_append_new(added, id >= 0 ? json_integer(id)
+						     : json_null());
+	}
+}
+
+static obs_scene_t *get_patch_scene(json_t *patch)
+{
+	return sceneList[json_integer_value(json_object_get(patch, "sceneNum"))];
+}
+
+// Called with every patched scene locked
+static void apply_scene_update(struct scene_update *update)
+{
+	json_t *patch;
+	size_t idx;
+
+	json_array_foreach (update->patches, idx, patch) {
+		if (!validate_scene_patch(get_patch_scene(patch), patch,
+					  &update->error)) {
+			return;
+		}
+	}
+
+	uint64_t start = os_gettime_ns();
+
+	json_t *scenes = json_array();
+	json_object_set_new(update->returnObj, "scenes", scenes);
+
+	json_array_foreach (update->patches, idx, patch) {
+		json_t *added = json_array();
+		apply_scene_patch(get_patch_scene(patch), patch, added);
+
+		json_t *result = json_object();
+		json_object_set(result, "sceneNum",
+				json_object_get(patch, "sceneNum"));
+		json_object_set_new(result, "added", added);
+		json_array_append_new(scenes, result);
+	}
+
+	update->apply_ns = os_gettime_ns() - start;
+}
+
+// Locks the patched scenes one inside the other, then applies the update
+static void lock_next_scene(void *data, obs_scene_t *scene)
+{
+	struct scene_update *update = data;
+
+	if (update->locked == json_array_size(update->patches)) {
+		apply_scene_update(update);
+		return;
+	}
+
+	json_t *patch = json_array_get(update->patches, update->locked++);
+	obs_scene_atomic_update(get_patch_scene(patch), lock_next_scene,
+				update);
+}
+
+static int updateScenes(json_t *command, json_t *returnObj)
+{
+	struct scene_update update = {0};
+	json_t *patch;
+	size_t idx;
+
+	update.patches = json_object_get(command, "scenes");
+	update.returnObj = returnObj;
+
+	if (!json_is_array(update.patches)) {
+		fprintf(stderr, "error: scenes is not an array\n");
+		return 1;
+	}
 
-	obs_data_t *settings = obs_data_create();
-	obs_data_set_string(settings, "device_id", deviceId);
-	obs_source_update(audioSource, settings);
+	json_array_foreach (update.patches, idx, patch) {
+		json_t *sceneNumObj = json_object_get(patch, "sceneNum");
+		if (!json_is_integer(sceneNumObj) ||
+		    json_integer_value(sceneNumObj) < 0 ||
+		    json_integer_value(sceneNumObj) >= numScenes) {
+			fprintf(stderr, "error: invalid sceneNum in patch %d\n",
+				(int)idx);
+			return 1;
+		}
+	}
 
-	obs_source_set_sync_offset(audioSource,
-				   (int64_t)syncOffSetMs * (int64_t)1000000);
+	uint64_t start = os_gettime_ns();
+	lock_next_scene(&update, NULL);
+	double totalMs = (os_gettime_ns() - start) / 1000000.0;
 
-	blog(LOG_INFO, "Set audio to %s", deviceId);
+	if (update.error.len) {
+		fprintf(stderr, "error: %s\n", update.error.array);
+		json_object_set_new(returnObj, "error",
+				    json_string(update.error.array));
+		dstr_free(&update.error);
+		return 1;
+	}
 
+	// applyMs is the time the scenes were locked and being changed,
+	// totalMs includes waiting for the locks and validation
+	json_object_set_new(returnObj, "applyMs",
+			    json_real(update.apply_ns / 1000000.0));
+	json_object_set_new(returnObj, "totalMs", json_real(totalMs));
 	return 0;
 }
 
-static const int setAudioDelay(json_t *command)
+static int switchToScene(json_t *command)
 {
-	json_t *syncOffsetMsObj = json_object_get(command, "audioDelayMs");
-	if (!json_is_integer(syncOffsetMsObj)) {
-		fprintf(stderr, "error: audioDelayMs is not an int\n");
-		return 0;
-	}
-	int audioDelayMs = json_integer_value(syncOffsetMsObj);
+	int sceneNum = 0;
 
-	obs_source_set_sync_offset(audioSource,
-				   (int64_t)audioDelayMs * (int64_t)1000000);
+	json_t *sceneNumObj = json_object_get(command, "sceneNum");
+	if (sceneNumObj) {
+		sceneNum = (int)json_integer_value(sceneNumObj);
+	}
 
-	blog(LOG_INFO, "Set audio delay to %d ms", audioDelayMs);
+	if (sceneNum < 0 || sceneNum >= numScenes) {
+		fprintf(stderr, "error: no scene %d\n", sceneNum);
+		return 1;
+	}
 
+	obs_set_output_source(0, obs_scene_get_source(sceneList[sceneNum]));
 	return 0;
 }
 
-static const int startRecording(json_t *command)
+enum action_result {
+	ACTION_OK,
+	ACTION_FAILED,
+	// The handler sends the response itself later, keyed by actionId
+	ACTION_DEFERRED,
+};
+
+struct request;
+
+typedef enum action_result (*action_handler_t)(json_t *command,
+					       json_t *returnObj,
+					       const struct request *req);
+
+struct action {
+	const char *name;
+	action_handler_t handler;
+	enum lane lane;
+};
+
+struct request {
+	json_t *command;
+	const struct action *action;
+	const char *actionId;
+	enum command_encoding encoding;
+	uint64_t received_ns;
+};
+
+static inline enum action_result action_result(int rc)
 {
-    blog(LOG_INFO, "In startRecording");
-    
-	json_t *outputFileObj = json_object_get(command, "outputFile");
-	if (!json_is_string(outputFileObj)) {
-		fprintf(stderr, "error: outputFileObj is not a string\n");
-		return 1;
-	}
-	const char *outputFilePath = json_string_value(outputFileObj);
+	return rc == 0 ? ACTION_OK : ACTION_FAILED;
+}
 
-	obs_data_t *settings = obs_data_create();
-	obs_data_set_string(settings, "path", outputFilePath);
-	fileOutput = obs_output_create("ffmpeg_muxer", "simple_file_output",
-				       settings, NULL);
-	if (!fileOutput) {
-		blog(LOG_ERROR, "ERROR\n");
-		return 1;
+// The init commands reset video and release the recording, which would tear
+// down a recording in progress, so they are refused until it has stopped
+static bool refuse_while_recording(json_t *returnObj)
+{
+	if (!fileOutput || !obs_output_active(fileOutput)) {
+		return false;
 	}
 
-	obs_set_output_source(1, audioSource);
+	fprintf(stderr, "error: cannot initialize while recording\n");
+	json_object_set_new(returnObj, "error",
+			    json_string("cannot initialize while recording"));
+	return true;
+}
 
-	// TODO - make this configurable
-	// obs_data_t *encoderSettings= obs_data_create();
-	// obs_data_set_string(encoderSettings, "rate_control", "CBR");
+static enum action_result action_initialize(json_t *command,
+					    json_t *returnObj,
+					    const struct request *req)
+{
+	if (refuse_while_recording(returnObj)) {
+		return ACTION_FAILED;
+	}
+	return action_result(initialize(command));
+}
 
-	encoder = obs_video_encoder_create("obs_x264", "simple_h264_recording", NULL, NULL);
-	if (!encoder) {
-		blog(LOG_ERROR, "ERROR MAKING ENCODER");
-		return 1;
+static enum action_result
+action_initialize_single_video_recording(json_t *command, json_t *returnObj,
+					 const struct request *req)
+{
+	if (refuse_while_recording(returnObj)) {
+		return ACTION_FAILED;
 	}
-	blog(LOG_INFO, "Created encoder\n");
+	return action_result(initializeSingleVideoRecording(command));
+}
 
-	audioEncoder = obs_audio_encoder_create(
-		"ffmpeg_aac", "simple_aac_recording", NULL, 0, NULL);
-	if (!audioEncoder) {
-		blog(LOG_ERROR, "ERROR MAKING ENCODER");
+static enum action_result action_initialize_audio(json_t *command,
+						  json_t *returnObj,
+						  const struct request *req)
+{
+	return action_result(initializeAudio(command));
+}
+
+static enum action_result action_set_audio_delay(json_t *command,
+						 json_t *returnObj,
+						 const struct request *req)
+{
+	return action_result(setAudioDelay(command));
+}
+
+static enum action_result action_prepare_recording(json_t *command,
+						   json_t *returnObj,
+						   const struct request *req)
+{
+	if (set_encoder_spec(command, returnObj) != 0) {
+		return ACTION_FAILED;
 	}
-	blog(LOG_INFO, "Created audio encoder");
+	return action_result(prepare_recording(returnObj));
+}
 
-	obs_encoder_set_video(encoder, obs_get_video());
-	obs_encoder_set_audio(audioEncoder, obs_get_audio());
-	obs_output_set_video_encoder(fileOutput, encoder);
-	obs_output_set_audio_encoder(fileOutput, audioEncoder, 0);
+static struct deferred_response *defer_response(const struct request *req)
+{
+	struct deferred_response *deferred =
+		bzalloc(sizeof(struct deferred_response));
+	deferred->actionId = bstrdup(req->actionId);
+	deferred->encoding = req->encoding;
+	deferred->received_ns = req->received_ns;
+	return deferred;
+}
 
-	blog(LOG_INFO, "Starting to record");
-	if (!obs_output_start(fileOutput)) {
-		blog(LOG_ERROR, "Failed to start recording");
-		return 1;
+static enum action_result action_start_recording(json_t *command,
+						 json_t *returnObj,
+						 const struct request *req)
+{
+	if (set_encoder_spec(command, returnObj) != 0) {
+		return ACTION_FAILED;
+	}
+	if (startRecording(command, defer_response(req)) != 0) {
+		return ACTION_FAILED;
 	}
 
-    blog(LOG_INFO, "Recording started");
+	// answered with the start latency once the first packet is written
+	return ACTION_DEFERRED;
+}
 
-	return 0;
+static enum action_result action_pause_recording(json_t *command,
+						 json_t *returnObj,
+						 const struct request *req)
+{
+	return obs_output_pause(fileOutput, true) ? ACTION_OK : ACTION_FAILED;
 }
 
-static const list_audio_devices(json_t *returnObj)
+static enum action_result action_resume_recording(json_t *command,
+						  json_t *returnObj,
+						  const struct request *req)
 {
-	json_t *array = json_array();
-	json_object_set_new(returnObj, "devices", array);
+	return obs_output_pause(fileOutput, false) ? ACTION_OK : ACTION_FAILED;
+}
 
-	obs_properties_t *audioProps = obs_source_properties(audioSource);
-	obs_property_t *property = obs_properties_first(audioProps);
-	while (property != NULL) {
-		const char *name = obs_property_name(property);
-		enum obs_property_type type = obs_property_get_type(property);
-		blog(LOG_INFO, "Property: %s, %d", name, type);
+static enum action_result action_stop_recording(json_t *command,
+						json_t *returnObj,
+						const struct request *req)
+{
+	// Without an active output no stop signal would ever answer
+	if (!fileOutput || !obs_output_active(fileOutput)) {
+		fprintf(stderr, "error: not recording\n");
+		json_object_set_new(returnObj, "error",
+				    json_string("not recording"));
+		return ACTION_FAILED;
+	}
 
-		if (strcmp(name, "device_id") == 0) {
-			int numItems = obs_property_list_item_count(property);
-			blog(LOG_INFO, "%d items", numItems);
-			for (int i = 0; i < numItems; i++) {
-				json_t *deviceObj = json_object();
-				json_object_set_new(
-					deviceObj, "deviceName",
-					json_string(obs_property_list_item_name(
-						property, i)));
-				json_object_set_new(
-					deviceObj, "deviceId",
-					json_string(
-						obs_property_list_item_string(
-							property, i)));
-				json_array_append(array, deviceObj);
+	signal_handler_t *handler = obs_output_get_signal_handler(fileOutput);
+	signal_handler_connect(handler, "stop", output_stopped,
+			       defer_response(req));
 
-				blog(LOG_INFO, "List item name: %s",
-				     obs_property_list_item_name(property, i));
-				blog(LOG_INFO, "List item string value: %s",
-				     obs_property_list_item_string(property,
-								   i));
-				blog(LOG_INFO, "List item int value: %d",
-				     obs_property_list_item_int(property, i));
-				blog(LOG_INFO, "List item float value: %f",
-				     obs_property_list_item_float(property, i));
-			}
-		}
+	obs_output_stop(fileOutput);
 
-		obs_property_next(&property);
-	}
+	// let the stop callback actually return the output
+	return ACTION_DEFERRED;
 }
 
-static void list_webcam_devices(json_t *returnObj)
+static enum action_result action_shutdown(json_t *command, json_t *returnObj,
+					  const struct request *req)
 {
-	json_t *deviceList = obs_source_device_list(webcamSource);
+	obs_set_output_source(0, NULL);
+	if (fileOutput && obs_output_active(fileOutput)) {
+		obs_output_force_stop(fileOutput);
+	}
+	release_recording();
+	release_scenes();
+	obs_shutdown();
+	return ACTION_OK;
+}
 
-	fprintf(stderr, "Got devicelist");
-	fprintf(stderr, "Devices: %s", json_dumps(deviceList, 0));
+static enum action_result action_list_audio_devices(json_t *command,
+						    json_t *returnObj,
+						    const struct request *req)
+{
+	list_audio_devices(returnObj);
+	return ACTION_OK;
+}
 
-	json_object_set_new(returnObj, "devices", deviceList);
+static enum action_result action_list_webcam_devices(json_t *command,
+						     json_t *returnObj,
+						     const struct request *req)
+{
+	list_webcam_devices(returnObj);
+	return ACTION_OK;
 }
 
-static void list_display_devices(json_t *returnObj)
+static enum action_result action_list_displays(json_t *command,
+					       json_t *returnObj,
+					       const struct request *req)
 {
-	json_t *deviceList = obs_source_device_list(displaySource);
+	list_display_devices(returnObj);
+	return ACTION_OK;
+}
 
-	fprintf(stderr, "Got devicelist");
-	fprintf(stderr, "Devices: %s", json_dumps(deviceList, 0));
+static enum action_result action_start_render_frames_pipe(json_t *command,
+							  json_t *returnObj,
+							  const struct request *req)
+{
+	return action_result(startRenderFramesPipe(command, returnObj));
+}
 
-	json_object_set_new(returnObj, "devices", deviceList);
+static enum action_result action_stop_render_frames_pipe(json_t *command,
+							 json_t *returnObj,
+							 const struct request *req)
+{
+	stopRenderFramesPipe(returnObj);
+	return ACTION_OK;
 }
 
-static int initializeScenes(json_t *obj)
+static enum action_result action_get_render_pipe_stats(json_t *command,
+						       json_t *returnObj,
+						       const struct request *req)
 {
-	blog(LOG_INFO, "In initializeScenes");
+	getRenderPipeStats(returnObj);
+	return ACTION_OK;
+}
 
-	// Delete any existing scenes
-	for (int i = 0; i < numScenes; i++) {
-		obs_scene_release(sceneList[i]);
+static enum action_result action_request_render_keyframe(json_t *command,
+							 json_t *returnObj,
+							 const struct request *req)
+{
+	if (s_frame_delta != NULL) {
+		frame_delta_request_keyframe(s_frame_delta);
 	}
-	bfree(sceneList);
-	sceneList = NULL;
+	return ACTION_OK;
+}
 
-	json_t *scenes = json_object_get(obj, "scenes");
-	numScenes = json_array_size(scenes);
+static enum action_result action_set_render_regions(json_t *command,
+						    json_t *returnObj,
+						    const struct request *req)
+{
+	return action_result(setRenderRegions(command, returnObj));
+}
 
-	blog(LOG_INFO, "Creating scenes");
+static enum action_result action_initialize_scenes(json_t *command,
+						   json_t *returnObj,
+						   const struct request *req)
+{
+	return action_result(initializeScenes(command, returnObj));
+}
 
-	sceneList = bmalloc(sizeof(obs_scene_t *) * numScenes);
-	for (int i = 0; i < numScenes; i++) {
-		char *sceneName = malloc(sizeof(char) * 10);
-		sprintf(sceneName, "Scene_%d", i);
-		obs_scene_t *scene = obs_scene_create(sceneName);
+static enum action_result action_update_scenes(json_t *command,
+					       json_t *returnObj,
+					       const struct request *req)
+{
+	return action_result(updateScenes(command, returnObj));
+}
 
-		sceneList[i] = scene;
+static enum action_result action_initialize_recording(json_t *command,
+						      json_t *returnObj,
+						      const struct request *req)
+{
+	if (refuse_while_recording(returnObj)) {
+		return ACTION_FAILED;
+	}
+	if (set_encoder_spec(command, returnObj) != 0) {
+		return ACTION_FAILED;
+	}
+	return action_result(initializeRecording(command));
+}
 
-		json_t *sceneInfo = json_array_get(scenes, i);
+static enum action_result action_switch_to_scene(json_t *command,
+						 json_t *returnObj,
+						 const struct request *req)
+{
+	return action_result(switchToScene(command));
+}
 
-		json_t *sources = json_object_get(sceneInfo, "itemSources");
-		int numSources = json_array_size(sources);
-
-		blog(LOG_INFO, "Found %d sources", numSources);
-
-		for (int j = 0; j < numSources; j++) {
-			json_t *itemSourceInfo = json_array_get(sources, j);
-
-			json_t *sourceTypeObj =
-				json_object_get(itemSourceInfo, "type");
-			const char *sourceType =
-				json_string_value(sourceTypeObj);
-
-			int cropLeft = 0;
-			int cropRight = 0;
-			int cropTop = 0;
-			int cropBottom = 0;
-			int x = 0;
-			int y = 0;
-			float scaleX = 1.0;
-			float scaleY = 1.0;
-
-			json_t *cropLeftObj =
-				json_object_get(itemSourceInfo, "cropLeft");
-			if (cropLeftObj) {
-				cropLeft = json_integer_value(cropLeftObj);
-			}
-			json_t *cropRightObj =
-				json_object_get(itemSourceInfo, "cropRight");
-			if (cropRightObj) {
-				cropRight = json_integer_value(cropRightObj);
-			}
-			json_t *cropTopObj =
-				json_object_get(itemSourceInfo, "cropTop");
-			if (cropTopObj) {
-				cropTop = json_integer_value(cropTopObj);
-			}
-			json_t *cropBottomObj =
-				json_object_get(itemSourceInfo, "cropBottom");
-			if (cropBottomObj) {
-				cropBottom = json_integer_value(cropBottomObj);
-			}
-			json_t *posXObj =
-				json_object_get(itemSourceInfo, "x");
-			if (posXObj) {
-				x = json_integer_value(posXObj);
-			}
-			json_t *posYObj = json_object_get(itemSourceInfo, "y");
-			if (posYObj) {
-				y = json_integer_value(posYObj);
-			}
-			json_t *scaleXObj = json_object_get(itemSourceInfo, "scaleX");
-			if (scaleXObj) {
-				scaleX = json_real_value(scaleXObj);
+static enum action_result action_initialize_webcam(json_t *command,
+						   json_t *returnObj,
+						   const struct request *req)
+{
+	return action_result(initializeWebcam(command));
+}
 
-				if (scaleX == 0) {
-					scaleX = (float) json_integer_value(scaleXObj);
-				}
-			}
-			json_t *scaleYObj =
-				json_object_get(itemSourceInfo, "scaleY");
-			if (scaleYObj) {
-				scaleY = json_real_value(scaleYObj);
+static enum action_result action_initialize_display(json_t *command,
+						    json_t *returnObj,
+						    const struct request *req)
+{
+	return action_result(initializeDisplay(command));
+}
 
-				if (scaleY == 0) {
-					scaleY = (float) json_integer_value(scaleYObj);
-				}
-			}
+static const struct action actions[] = {
+	{"initialize", action_initialize, LANE_EXCLUSIVE},
+	{"initializeSingleVideoRecording",
+	 action_initialize_single_video_recording, LANE_EXCLUSIVE},
+	{"initializeRecording", action_initialize_recording, LANE_EXCLUSIVE},
+	{"shutdown", action_shutdown, LANE_EXCLUSIVE},
+	{"setAudioDelay", action_set_audio_delay, LANE_RECORDING},
+	{"prepareRecording", action_prepare_recording, LANE_RECORDING},
+	{"startRecording", action_start_recording, LANE_RECORDING},
+	{"pauseRecording", action_pause_recording, LANE_RECORDING},
+	{"resumeRecording", action_resume_recording, LANE_RECORDING},
+	{"stopRecording", action_stop_recording, LANE_RECORDING},
+	{"startRenderFramesPipe",
+	 action_start_render_frames_pipe, LANE_RECORDING},
+	{"stopRenderFramesPipe",
+	 action_stop_render_frames_pipe, LANE_RECORDING},
+	{"getRenderPipeStats", action_get_render_pipe_stats, LANE_RECORDING},
+	{"requestRenderKeyframe",
+	 action_request_render_keyframe, LANE_RECORDING},
+	{"setRenderRegions", action_set_render_regions, LANE_RECORDING},
+	{"listAudioInputDevices", action_list_audio_devices, LANE_DEVICES},
+	{"listWebcamDevices", action_list_webcam_devices, LANE_DEVICES},
+	{"listDisplays", action_list_displays, LANE_DEVICES},
+	{"initializeAudio", action_initialize_audio, LANE_DEVICES},
+	{"initializeWebcam", action_initialize_webcam, LANE_DEVICES},
+	{"initializeDisplay", action_initialize_display, LANE_DEVICES},
+	{"initializeScenes", action_initialize_scenes, LANE_SCENE},
+	{"updateScenes", action_update_scenes, LANE_SCENE},
+	{"switchToScene", action_switch_to_scene, LANE_SCENE},
+};
+
+#define NUM_ACTIONS (sizeof(actions) / sizeof(actions[0]))
+
+// Open addressing hash table over actions, at most half full
+#define ACTION_TABLE_SIZE 128
+static const struct action *action_table[ACTION_TABLE_SIZE];
+
+static uint32_t hash_action(const char *name)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	while (*name) {
+		hash ^= (uint8_t)*(name++);
+		hash *= 16777619u;
+	}
+	return hash;
+}
 
-			struct obs_scene_item *item = NULL;
+static void init_action_table()
+{
+	for (size_t i = 0; i < NUM_ACTIONS; i++) {
+		uint32_t idx = hash_action(actions[i].name) &
+			       (ACTION_TABLE_SIZE - 1);
+		while (action_table[idx] != NULL) {
+			idx = (idx + 1) & (ACTION_TABLE_SIZE - 1);
+		}
+		action_table[idx] = &actions[i];
+	}
+}
 
-			bool needsTransform = true;
+static const struct action *find_action(const char *name)
+{
+	uint32_t idx = hash_action(name) & (ACTION_TABLE_SIZE - 1);
+	while (action_table[idx] != NULL) {
+		if (strcmp(action_table[idx]->name, name) == 0) {
+			return action_table[idx];
+		}
+		idx = (idx + 1) & (ACTION_TABLE_SIZE - 1);
+	}
+	return NULL;
+}
 
-			if (strncmp(sourceType, "webcam", 6) == 0) {
-				item = obs_scene_add(scene, webcamSource);
-				if (item == NULL) {
-					blog(LOG_ERROR,
-					     "Could not add scene item");
-					continue;
-				} else {
-					blog(LOG_INFO, "Added webcam to scene");
-				}
-			} else if (strncmp(sourceType, "display", 7) == 0) {
-				item = obs_scene_add(scene, displaySource);
-				if (item == NULL) {
-					blog(LOG_ERROR,
-					     "Could not add monitor item");
-					continue;
-				} else {
-					blog(LOG_INFO,
-					     "Added monitor to scene");
-				}
-			} else if (strncmp(sourceType, "microphone", 10) == 0) {
-				item = obs_scene_add(scene, audioSource);
-				needsTransform = false;
-				if (item == NULL) {
-					blog(LOG_ERROR,
-					     "Could not add microphone item");
-					continue;
-				} else {
-					blog(LOG_INFO,
-					     "Added microphone to scene");
-				}
-			} else {
-					blog(LOG_ERROR, "Unknown type: %s", sourceType);
-					continue;
-			}
+static void run_request(const struct request *req)
+{
+	json_t *returnObj = json_object();
+	json_object_set_new(returnObj, "actionId", json_string(req->actionId));
 
-			blog(LOG_INFO, "Checking for transform\n");
-
-			if (needsTransform)
-			{
-				blog(LOG_INFO, "ScaleX: %f\n", scaleX);
-				blog(LOG_INFO, "ScaleY: %f\n", scaleY);
-
-			    item->crop.left = cropLeft;
-			    item->crop.top = cropTop;
-			    item->crop.right = cropRight;
-			    item->crop.bottom = cropBottom;
-			    item->pos.x = x;
-			    item->pos.y = y;
-			    item->scale.x = scaleX;
-			    item->scale.y = scaleY;
-			    obs_sceneitem_force_update_transform(item);
-			}
-			else
-			{
-				blog(LOG_INFO, "No transform needed\n");
-			}
+	debug_log("Action %s (actionId %s)", req->action->name, req->actionId);
 
-		}
+	switch (req->action->handler(req->command, returnObj, req)) {
+	case ACTION_OK:
+		send_response(returnObj, req->encoding);
+		break;
+	case ACTION_FAILED:
+		fprintf(stderr, "Failed action %s (actionId %s)\n",
+			req->action->name, req->actionId);
+		send_response(returnObj, req->encoding);
+		break;
+	case ACTION_DEFERRED:
+		break;
 	}
 
-	blog(LOG_INFO, "Setting output 0 to scene 0");
-	obs_set_output_source(0, obs_scene_get_source(sceneList[0]));
-	blog(LOG_INFO, "Set output 0 to scene 0");
-
-	return 0;
+	json_decref(returnObj);
 }
 
-static int switchToScene(json_t *command)
+static void free_request(struct request *req)
 {
-	int sceneNum = 0;
+	json_decref(req->command);
+	bfree(req);
+}
 
-	json_t *sceneNumObj = json_object_get(command, "sceneNum");
-	if (sceneNumObj) {
-		sceneNum = json_integer_value(sceneNum);
-	}
+static void run_lane_request(void *param)
+{
+	struct request *req = param;
 
-	obs_set_output_source(0, obs_scene_get_source(sceneList[sceneNum]));
+	run_request(req);
+	free_request(req);
 }
 
-static const json_t *parse_command(json_t *command)
+static void send_error(json_t *command, enum command_encoding encoding,
+		       const char *error)
 {
 	json_t *returnObj = json_object();
 
+	json_t *actionIdObj = json_object_get(command, "actionId");
+	if (json_is_string(actionIdObj)) {
+		json_object_set(returnObj, "actionId", actionIdObj);
+	}
+	json_object_set_new(returnObj, "error", json_string(error));
+
+	send_response(returnObj, encoding);
+	json_decref(returnObj);
+}
+
+// Queues the command on its lane, takes a reference to the command
+static void dispatch_command(json_t *command, enum command_encoding encoding)
+{
 	json_t *actionObj = json_object_get(command, "action");
 	if (!json_is_string(actionObj)) {
-		fprintf(stderr, "action is not a string");
-		json_object_set(returnObj, "error", "action is required");
-		return returnObj;
+		fprintf(stderr, "action is not a string\n");
+		send_error(command, encoding, "action is required");
+		return;
 	}
 	const char *action = json_string_value(actionObj);
 
 	json_t *actionIdObj = json_object_get(command, "actionId");
 
 	if (!json_is_string(actionIdObj)) {
-		fprintf(stderr, "actionId is not a string");
-		json_object_set(returnObj, "error", "actionId is required");
-		return returnObj;
+		fprintf(stderr, "actionId is not a string\n");
+		send_error(command, encoding, "actionId is required");
+		return;
 	}
-	const char *actionId = json_string_value(actionIdObj);
-
-	fprintf(stderr, "actionId: %s", actionId);
-
-	json_object_set_new(returnObj, "actionId", json_string(actionId));
-
-	if (strcmp(action, "initialize") == 0) {
-		fprintf(stderr, "Initializing");
-		if (initialize(command) != 0) {
-			fprintf(stderr, "Failed to initialize");
-		}
-	} else if (strcmp(action, "initializeSingleVideoRecording") == 0) {
-		fprintf(stderr, "initSingleVideoRecording");
-		if (initializeSingleVideoRecording(command) != 0) {
-			fprintf(stderr, "Failed to initialize video");
-		}
-	} else if (strcmp(action, "initializeAudio") == 0) {
-		fprintf(stderr, "initAudio");
-		if (initializeAudio(command) != 0) {
-			fprintf(stderr, "Failed to initialize audio");
-		}
-	} else if (strcmp(action, "setAudioDelay") == 0) {
-		if (setAudioDelay(command) != 0) {
-			fprintf(stderr, "Failed to set audio delay");
-		}
-	} else if (strcmp(action, "startRecording") == 0) {
-		fprintf(stderr, "Starting recording");
-		startRecording(command);
-	} else if (strcmp(action, "pauseRecording") == 0) {
-		fprintf(stderr, "Pausing recording");
-		if (!obs_output_pause(fileOutput, true)) {
-			fprintf(stderr, "Failed to pause recording");
-		}
-	} else if (strcmp(action, "resumeRecording") == 0) {
-		fprintf(stderr, "Resume recording");
-		if (!obs_output_pause(fileOutput, false)) {
-			fprintf(stderr, "Failed to resume recording");
-		}
-	} else if (strcmp(action, "stopRecording") == 0) {
-		fprintf(stderr, "Stopping recording");
 
-		signal_handler_t *handler =
-			obs_output_get_signal_handler(fileOutput);
-		signal_handler_connect(handler, "stop", output_stopped,
-				       bstrdup(actionId));
+	const struct action *entry = find_action(action);
+	if (entry == NULL) {
+		fprintf(stderr, "Unrecognized action: %s\n", action);
+		send_error(command, encoding, "unrecognized action");
+		return;
+	}
 
-		obs_output_stop(fileOutput);
+	struct request *req = bzalloc(sizeof(struct request));
+	req->command = json_incref(command);
+	req->action = entry;
+	req->actionId = json_string_value(actionIdObj);
+	// Reply in whatever encoding the client used
+	req->encoding = encoding;
+	req->received_ns = os_gettime_ns();
 
-		// let the stop callback actually return the output
-		return NULL;
-	} else if (strcmp(action, "shutdown") == 0) {
-		fprintf(stderr, "Shutting down");
-		obs_set_output_source(0, NULL);
-		obs_shutdown();
-	} else if (strcmp(action, "listAudioInputDevices") == 0) {
-		fprintf(stderr, "Listing Audio Input Devices");
-		list_audio_devices(returnObj);
-	} else if (strcmp(action, "listWebcamDevices") == 0) {
-		fprintf(stderr, "Listing Webcam Devices");
-		list_webcam_devices(returnObj);
-	} else if (strcmp(action, "listDisplays") == 0) {
-		fprintf(stderr, "Listing Display Devices");
-		list_display_devices(returnObj);
-	} else if (strcmp(action, "startRenderFramesPipe") == 0) {
-		json_t *portObj = json_object_get(command, "port");
-		if (portObj) {
-			int port = json_integer_value(portObj);
-			connect_to_local(port);
-		}
-		start_raw_output();
-	} else if (strcmp(action, "stopRenderFramesPipe") == 0) {
-		stop_raw_output();
-		disconnect_from_local();
-	} else if (strcmp(action, "initializeScenes") == 0) {
-		fprintf(stderr, "initializeScenes");
-		if (initializeScenes(command) != 0) {
-			fprintf(stderr, "Failed to initialize scenes");
-		}
-	} else if (strcmp(action, "initializeRecording") == 0) {
-		fprintf(stderr, "initializeRecording");
-		if (initializeRecording(command) != 0) {
-			fprintf(stderr, "Failed to initialize recording");
-		}
-	} else if (strcmp(action, "switchToScene") == 0) {
-		fprintf(stderr, "switchToScene");
-		if (switchToScene(command) != 0) {
-			fprintf(stderr, "Failed to switch scenes");
-		}
-	} else if (strcmp(action, "initializeWebcam") == 0) {
-		fprintf(stderr, "initializeWebcam");
-		if (initializeWebcam(command) != 0) {
-			fprintf(stderr, "Failed to initialize webcam");
-		}
-	} else if (strcmp(action, "initializeDisplay") == 0) {
-		fprintf(stderr, "initializeDisplay");
-		if (initializeDisplay(command) != 0) {
-			fprintf(stderr, "Failed to initialize display");
-		}
+	if (entry->lane == LANE_EXCLUSIVE) {
+		// Resets video or tears down obs, nothing else may run
+		executor_wait_idle(s_executor);
+		run_lane_request(req);
 	} else {
-		fprintf(stderr, "Unrecognized action: %s", action);
+		executor_submit(s_executor, entry->lane, run_lane_request, req);
 	}
-	char *str = json_dumps(returnObj, JSON_INDENT(2));
-
-	return returnObj;
 }
 
 #ifdef _WIN32
@@ -1320,59 +2805,82 @@ int wmain(int argc, wchar_t *argv_w[])
 {
 	// Must be per monitor DPI aware
 	SetProcessDpiAwareness(PROCESS_PER_MONITOR_DPI_AWARE);
+
+	for (int i = 1; i < argc; i++) {
+		if (wcscmp(argv_w[i], L"--framed") == 0) {
+			s_protocol = COMMAND_PROTOCOL_FRAMED;
+		} else if (wcscmp(argv_w[i], L"--debug") == 0) {
+			s_debug = true;
+		}
+	}
+
+	if (s_protocol == COMMAND_PROTOCOL_FRAMED) {
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+	}
 #else
 int main(int argc, char *argv[])
 {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--framed") == 0) {
+			s_protocol = COMMAND_PROTOCOL_FRAMED;
+		} else if (strcmp(argv[i], "--debug") == 0) {
+			s_debug = true;
+		}
+	}
 #endif
-	// TODO - set up a log file properly
-	//base_set_log_handler(&null_log_handler, NULL);
+	// Must be installed before anything logs, the writer owns stdout
+	base_set_log_handler(&stderr_log_handler, NULL);
 
-	// Loop forever reading one line at a time
-	char line[2048];
-	ssize_t read;
+	if (pthread_mutex_init(&s_start_mutex, NULL) != 0) {
+		fprintf(stderr, "error initializing start mutex");
+		return 1;
+	}
 
-	while (fgets(line, 2048, stdin)) {
-		fprintf(stderr, "Read line %s\n", line);
-		if (!line) {
-			fprintf(stderr, "Bad line\n");
-			continue;
-		}
+	s_writer = command_writer_create(stdout, s_protocol);
+	if (!s_writer) {
+		fprintf(stderr, "error creating stdout writer");
+		return 1;
+	}
+
+	s_executor = executor_create(NUM_LANES, lane_names);
+	if (!s_executor) {
+		fprintf(stderr, "error creating command executor");
+		return 1;
+	}
 
-		json_t *root;
-		json_error_t error;
+	init_action_table();
 
-		root = json_loads(line, 0, &error);
+	// Loop forever reading one command at a time.  Commands run on their
+	// lane and responses carry the actionId, so they complete out of order
+	// across lanes (pauseRecording does not wait behind device listing).
+	for (;;) {
+		enum command_encoding encoding;
+		bool eof;
 
-		if (!root) {
-			fprintf(stderr, "error: on line %d: %s\n", error.line,
-				error.text);
+		json_t *command = command_read(stdin, s_protocol, &encoding,
+					       &eof);
+		if (!command) {
+			if (eof) {
+				break;
+			}
 			continue;
 		}
 
-		char *str = json_dumps(root, JSON_INDENT(2));
-		if (str) {
-			fprintf(stderr, "Read in JSON: %s", str);
-			const json_t *returnObj = parse_command(root);
-
-			if (returnObj != NULL) {
-				char *returnStr = json_dumps(returnObj, 0);
-
-				// Write newline at the beginning in case someone printed some garbage to stdout
-				pthread_mutex_lock(&stdout_mutex);
-				fprintf(stderr, "Returning: %s\n", returnStr);
-				fprintf(stdout, "\n%s\n", returnStr);
-				fflush(stdout);
-				pthread_mutex_unlock(&stdout_mutex);
-
-				// Free up all
-				free(returnStr);
-				free(str);
-				free(returnObj);
-			}
+		if (s_debug) {
+			char *str = json_dumps(command, JSON_INDENT(2));
+			fprintf(stderr, "Read in JSON: %s\n", str);
+			free(str);
 		}
+
+		dispatch_command(command, encoding);
+		json_decref(command);
 	}
 
-	printf("Exiting\n");
+	debug_log("Exiting");
+
+	executor_destroy(s_executor);
+	command_writer_destroy(s_writer);
 
 	return 0;
 }
@@ -0,0 +1,364 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/bmem.h"
+#include "util/base.h"
+#include "shm-ring.h"
+
+#define SHM_RING_ALIGN 64
+
+struct shm_ring {
+	char name[64];
+	char signal_name[64];
+	size_t map_size;
+
+	struct shm_ring_header *header;
+	uint8_t *slots;
+
+	/* sequence number of the frame currently acquired by the writer */
+	int64_t pending_seq;
+
+#ifdef _WIN32
+	HANDLE mapping;
+	HANDLE signal;
+#else
+	int fd;
+	sem_t *signal;
+#endif
+};
+
+/* the shared layout is fixed width, so the long based os_atomic_* functions
+ * cannot be used on it */
+#ifdef _MSC_VER
+static inline int64_t ring_load(volatile int64_t *ptr)
+{
+	return InterlockedCompareExchange64(ptr, 0, 0);
+}
+
+static inline void ring_store(volatile int64_t *ptr, int64_t val)
+{
+	InterlockedExchange64(ptr, val);
+}
+
+static inline void ring_inc(volatile int64_t *ptr)
+{
+	InterlockedIncrement64(ptr);
+}
+
+static inline void ring_fence(void)
+{
+	MemoryBarrier();
+}
+#else
+static inline int64_t ring_load(volatile int64_t *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void ring_store(volatile int64_t *ptr, int64_t val)
+{
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+static inline void ring_inc(volatile int64_t *ptr)
+{
+	__atomic_add_fetch(ptr, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void ring_fence(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+#endif
+
+static inline uint32_t align_up(uint32_t val)
+{
+	return (val + SHM_RING_ALIGN - 1) & ~(SHM_RING_ALIGN - 1);
+}
+
+static inline struct shm_ring_slot *get_slot(struct shm_ring *ring,
+					     int64_t seq)
+{
+	uint32_t idx = (uint32_t)((seq - 1) % ring->header->slot_count);
+	return (struct shm_ring_slot *)(ring->slots +
+					(size_t)idx * ring->header->slot_stride);
+}
+
+static inline uint8_t *get_slot_data(struct shm_ring *ring,
+				     struct shm_ring_slot *slot)
+{
+	return (uint8_t *)slot + ring->header->slot_header_size;
+}
+
+#ifdef _WIN32
+static bool map_ring(struct shm_ring *ring)
+{
+	DWORD pid = GetCurrentProcessId();
+	uint64_t size = ring->map_size;
+
+	snprintf(ring->name, sizeof(ring->name), "Local\\obs-cli-frames-%lu",
+		 (unsigned long)pid);
+	snprintf(ring->signal_name, sizeof(ring->signal_name),
+		 "Local\\obs-cli-signal-%lu", (unsigned long)pid);
+
+	ring->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL,
+					   PAGE_READWRITE, (DWORD)(size >> 32),
+					   (DWORD)size, ring->name);
+	if (!ring->mapping) {
+		blog(LOG_ERROR, "shm-ring: CreateFileMapping failed: %lu",
+		     GetLastError());
+		return false;
+	}
+
+	ring->header = MapViewOfFile(ring->mapping, FILE_MAP_ALL_ACCESS, 0, 0,
+				     ring->map_size);
+	if (!ring->header) {
+		blog(LOG_ERROR, "shm-ring: MapViewOfFile failed: %lu",
+		     GetLastError());
+		return false;
+	}
+
+	ring->signal = CreateSemaphoreA(NULL, 0, LONG_MAX, ring->signal_name);
+	if (!ring->signal) {
+		blog(LOG_ERROR, "shm-ring: CreateSemaphore failed: %lu",
+		     GetLastError());
+		return false;
+	}
+
+	return true;
+}
+
+static void unmap_ring(struct shm_ring *ring)
+{
+	if (ring->header)
+		UnmapViewOfFile(ring->header);
+	if (ring->mapping)
+		CloseHandle(ring->mapping);
+	if (ring->signal)
+		CloseHandle(ring->signal);
+}
+
+static inline void post_signal(struct shm_ring *ring)
+{
+	ReleaseSemaphore(ring->signal, 1, NULL);
+}
+
+#else
+static bool map_ring(struct shm_ring *ring)
+{
+	pid_t pid = getpid();
+
+	/* names are kept short, macOS limits them to 31 characters */
+	snprintf(ring->name, sizeof(ring->name), "/obs-cli-frames-%d",
+		 (int)pid);
+	snprintf(ring->signal_name, sizeof(ring->signal_name),
+		 "/obs-cli-signal-%d", (int)pid);
+
+	/* remove leftovers from a previous ring of this process */
+	shm_unlink(ring->name);
+	sem_unlink(ring->signal_name);
+
+	ring->fd = shm_open(ring->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (ring->fd == -1) {
+		blog(LOG_ERROR, "shm-ring: shm_open failed: %d", errno);
+		return false;
+	}
+
+	if (ftruncate(ring->fd, (off_t)ring->map_size) != 0) {
+		blog(LOG_ERROR, "shm-ring: ftruncate failed: %d", errno);
+		return false;
+	}
+
+	void *ptr = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, ring->fd, 0);
+	if (ptr == MAP_FAILED) {
+		blog(LOG_ERROR, "shm-ring: mmap failed: %d", errno);
+		return false;
+	}
+	ring->header = ptr;
+
+	ring->signal =
+		sem_open(ring->signal_name, O_CREAT | O_EXCL, 0600, 0);
+	if (ring->signal == SEM_FAILED) {
+		blog(LOG_ERROR, "shm-ring: sem_open failed: %d", errno);
+		ring->signal = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static void unmap_ring(struct shm_ring *ring)
+{
+	if (ring->header)
+		munmap(ring->header, ring->map_size);
+	if (ring->fd != -1) {
+		close(ring->fd);
+		shm_unlink(ring->name);
+	}
+	if (ring->signal) {
+		sem_close(ring->signal);
+		sem_unlink(ring->signal_name);
+	}
+}
+
+static inline void post_signal(struct shm_ring *ring)
+{
+	sem_post(ring->signal);
+}
+#endif
+
+struct shm_ring *shm_ring_create(uint32_t slot_count, uint32_t slot_size)
+{
+	struct shm_ring *ring;
+	uint32_t header_size = align_up(sizeof(struct shm_ring_header));
+	uint32_t slot_header_size = align_up(sizeof(struct shm_ring_slot));
+	uint32_t slot_stride = slot_header_size + align_up(slot_size);
+
+	if (!slot_count || !slot_size)
+		return NULL;
+
+	ring = bzalloc(sizeof(struct shm_ring));
+	ring->map_size = header_size + (size_t)slot_stride * slot_count;
+#ifndef _WIN32
+	ring->fd = -1;
+#endif
+
+	if (!map_ring(ring)) {
+		shm_ring_destroy(ring);
+		return NULL;
+	}
+
+	memset(ring->header, 0, header_size);
+	ring->header->header_size = header_size;
+	ring->header->slot_header_size = slot_header_size;
+	ring->header->slot_count = slot_count;
+	ring->header->slot_stride = slot_stride;
+	ring->header->slot_size = slot_size;
+	ring->header->version = SHM_RING_VERSION;
+	ring->slots = (uint8_t *)ring->header + header_size;
+
+	for (uint32_t i = 0; i < slot_count; i++) {
+		struct shm_ring_slot *slot = get_slot(ring, i + 1);
+		memset(slot, 0, sizeof(*slot));
+	}
+
+	ring->header->magic = SHM_RING_MAGIC;
+
+	blog(LOG_INFO, "shm-ring: created %s (%u slots of %u bytes, %zu bytes)",
+	     ring->name, slot_count, slot_size, ring->map_size);
+	return ring;
+}
+
+void shm_ring_destroy(struct shm_ring *ring)
+{
+	if (!ring)
+		return;
+
+	unmap_ring(ring);
+	bfree(ring);
+}
+
+const char *shm_ring_name(const struct shm_ring *ring)
+{
+	return ring ? ring->name : NULL;
+}
+
+const char *shm_ring_signal_name(const struct shm_ring *ring)
+{
+	return ring ? ring->signal_name : NULL;
+}
+
+size_t shm_ring_map_size(const struct shm_ring *ring)
+{
+	return ring ? ring->map_size : 0;
+}
+
+uint32_t shm_ring_slot_count(const struct shm_ring *ring)
+{
+	return ring ? ring->header->slot_count : 0;
+}
+
+uint32_t shm_ring_slot_size(const struct shm_ring *ring)
+{
+	return ring ? ring->header->slot_size : 0;
+}
+
+uint8_t *shm_ring_acquire(struct shm_ring *ring, uint32_t size)
+{
+	struct shm_ring_header *header = ring->header;
+	struct shm_ring_slot *slot;
+	int64_t read_seq;
+	int64_t seq;
+
+	if (size > header->slot_size) {
+		shm_ring_drop(ring);
+		return NULL;
+	}
+
+	seq = ring_load(&header->write_seq) + 1;
+
+	/* the consumer has not caught up with the frame in this slot yet,
+	 * only known for consumers that report what they read */
+	read_seq = ring_load(&header->read_seq);
+	if (read_seq && seq - read_seq > (int64_t)header->slot_count)
+		ring_inc(&header->overwritten);
+
+	slot = get_slot(ring, seq);
+	ring_store(&slot->seq, 0);
+
+	/* a reader must not see new frame data with the old sequence */
+	ring_fence();
+
+	ring->pending_seq = seq;
+	return get_slot_data(ring, slot);
+}
+
+void shm_ring_commit(struct shm_ring *ring, uint32_t format, uint32_t width,
+		     uint32_t height, uint32_t linesize, uint32_t size,
+		     uint64_t timestamp)
+{
+	int64_t seq = ring->pending_seq;
+	struct shm_ring_slot *slot = get_slot(ring, seq);
+
+	slot->format = format;
+	slot->width = width;
+	slot->height = height;
+	slot->linesize = linesize;
+	slot->size = size;
+	slot->timestamp = timestamp;
+
+	/* release, the frame data must be visible before the sequence */
+	ring_store(&slot->seq, seq);
+	ring_inc(&ring->header->write_seq);
+	post_signal(ring);
+}
+
+void shm_ring_drop(struct shm_ring *ring)
+{
+	ring_inc(&ring->header->dropped);
+}
+
+void shm_ring_get_stats(const struct shm_ring *ring,
+			struct shm_ring_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (!ring)
+		return;
+
+	stats->published = ring_load(&ring->header->write_seq);
+	stats->dropped = ring_load(&ring->header->dropped);
+	stats->overwritten = ring_load(&ring->header->overwritten);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Shared-memory frame ring used by startRenderFramesPipe.
+ *
+ * The mapping is laid out as a shm_ring_header followed by slot_count slots,
+ * each slot being a shm_ring_slot header followed by slot_size bytes of frame
+ * data (slot_stride bytes apart).  The consumer maps it once and reads frames
+ * in place.
+ *
+ * All fields are fixed width and little-endian, 64-bit fields are 8 byte
+ * aligned, so the layout is the same for 32 and 64-bit processes on every
+ * platform.
+ *
+ * Every slot is guarded by its sequence number: the writer sets it to 0 (and
+ * issues a full fence) before the frame is copied in, then to the frame's
+ * (1-based) sequence number with release semantics once published.  A reader
+ * should load the slot sequence with acquire semantics before and after
+ * reading a frame; if it changed, or is 0, the frame was overwritten
+ * mid-read.
+ *
+ * After publishing, the writer bumps write_seq and posts the signal object
+ * (a named POSIX semaphore, or a named semaphore on Windows).
+ *
+ * read_seq is optional.  A consumer that stores the last sequence it
+ * consumed there gets overwrite accounting: frames overwritten before it
+ * read them are counted in overwritten, and in delta mode the next frame is
+ * sent as a keyframe.  While read_seq is 0 nothing is counted, and a delta
+ * consumer that skips frames must ask for a keyframe with
+ * requestRenderKeyframe.
+ */
+
+#define SHM_RING_MAGIC 0x46534F43 /* "COSF" */
+#define SHM_RING_VERSION 2
+
+struct shm_ring_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t slot_header_size;
+	uint32_t slot_count;
+	uint32_t slot_stride;
+	uint32_t slot_size;
+	uint32_t reserved;
+
+	volatile int64_t write_seq;
+	volatile int64_t read_seq;
+	volatile int64_t dropped;
+	volatile int64_t overwritten;
+};
+
+struct shm_ring_slot {
+	volatile int64_t seq;
+	uint32_t format; /* enum video_format */
+	uint32_t width;
+	uint32_t height;
+	uint32_t linesize;
+	uint32_t size;
+	uint32_t reserved;
+	uint64_t timestamp;
+};
+
+struct shm_ring_stats {
+	int64_t published;
+	int64_t dropped;
+	int64_t overwritten;
+};
+
+struct shm_ring;
+
+extern struct shm_ring *shm_ring_create(uint32_t slot_count,
+					uint32_t slot_size);
+extern void shm_ring_destroy(struct shm_ring *ring);
+
+extern const char *shm_ring_name(const struct shm_ring *ring);
+extern const char *shm_ring_signal_name(const struct shm_ring *ring);
+extern size_t shm_ring_map_size(const struct shm_ring *ring);
+extern uint32_t shm_ring_slot_count(const struct shm_ring *ring);
+extern uint32_t shm_ring_slot_size(const struct shm_ring *ring);
+
+/* Returns the data pointer of the next slot, or NULL (and counts a dropped
+ * frame) if size does not fit in a slot.  Must be followed by
+ * shm_ring_commit. */
+extern uint8_t *shm_ring_acquire(struct shm_ring *ring, uint32_t size);
+extern void shm_ring_commit(struct shm_ring *ring, uint32_t format,
+			    uint32_t width, uint32_t height, uint32_t linesize,
+			    uint32_t size, uint64_t timestamp);
+extern void shm_ring_drop(struct shm_ring *ring);
+
+extern void shm_ring_get_stats(const struct shm_ring *ring,
+			       struct shm_ring_stats *stats);
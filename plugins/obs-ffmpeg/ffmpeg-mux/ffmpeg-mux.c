@@ -20,11 +20,16 @@
 #include <windows.h>
 #define inline __inline
 
+#else
+#include <errno.h>
+#include <unistd.h>
 #endif
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "ffmpeg-mux.h"
 
 #include <libavformat/avformat.h>
@@ -37,33 +42,83 @@
 
 /* ------------------------------------------------------------------------- */
 
-struct resize_buf {
+/* stdin is read in large chunks, so a single read picks up everything the
+ * parent has written since the last one rather than doing a read for every
+ * packet header and payload.  packets are parsed straight out of the
+ * buffer. */
+
+#define READ_CHUNK_SIZE (1024 * 1024)
+
+struct read_buf {
 	uint8_t *buf;
+	size_t pos;
 	size_t size;
 	size_t capacity;
 };
 
-static inline void resize_buf_resize(struct resize_buf *rb, size_t size)
+static struct read_buf input = {0};
+
+static size_t read_input(uint8_t *data, size_t size)
 {
-	if (!rb->buf) {
-		rb->buf = malloc(size);
-		rb->size = size;
-		rb->capacity = size;
-	} else {
-		if (rb->capacity < size) {
-			size_t capx2 = rb->capacity * 2;
-			size_t new_cap = capx2 > size ? capx2 : size;
-			rb->buf = realloc(rb->buf, new_cap);
-			rb->capacity = new_cap;
-		}
+#ifdef _WIN32
+	int ret = _read(_fileno(stdin), data,
+			(unsigned int)(size < INT_MAX ? size : INT_MAX));
+#else
+	ssize_t ret;
+	do {
+		ret = read(STDIN_FILENO, data, size);
+	} while (ret < 0 && errno == EINTR);
+#endif
+	return ret > 0 ? (size_t)ret : 0;
+}
+
+/* makes sure at least size bytes are buffered, false at the end of input */
+static bool fill_input(size_t size)
+{
+	size_t left = input.size - input.pos;
+
+	if (left >= size)
+		return true;
+
+	if (input.pos) {
+		memmove(input.buf, input.buf + input.pos, left);
+		input.size = left;
+		input.pos = 0;
+	}
 
-		rb->size = size;
+	if (input.capacity < size || input.capacity < READ_CHUNK_SIZE) {
+		size_t capx2 = input.capacity * 2;
+		size_t new_cap = capx2 > size ? capx2 : size;
+		if (new_cap < READ_CHUNK_SIZE)
+			new_cap = READ_CHUNK_SIZE;
+
+		input.buf = realloc(input.buf, new_cap);
+		input.capacity = new_cap;
+	}
+
+	while (input.size < size) {
+		size_t in_size = read_input(input.buf + input.size,
+					    input.capacity - input.size);
+		if (in_size == 0)
+			return false;
+
+		input.size += in_size;
 	}
+
+	return true;
 }
 
-static inline void resize_buf_free(struct resize_buf *rb)
+/* the returned data stays valid until the next read */
+static uint8_t *read_data(size_t size)
 {
-	free(rb->buf);
+	uint8_t *data;
+
+	if (!fill_input(size))
+		return NULL;
+
+	data = input.buf + input.pos;
+	input.pos += size;
+	return data;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -406,19 +461,12 @@ static void ffmpeg_mux_header(struct ffmpeg_mux *ffm, uint8_t *data,
 
 static size_t safe_read(void *vdata, size_t size)
 {
-	uint8_t *data = vdata;
-	size_t total = size;
-
-	while (size > 0) {
-		size_t in_size = fread(data, 1, size, stdin);
-		if (in_size == 0)
-			return 0;
-
-		size -= in_size;
-		data += in_size;
-	}
+	uint8_t *data = read_data(size);
+	if (!data)
+		return 0;
 
-	return total;
+	memcpy(vdata, data, size);
+	return size;
 }
 
 static bool ffmpeg_mux_get_header(struct ffmpeg_mux *ffm)
@@ -427,15 +475,13 @@ static bool ffmpeg_mux_get_header(struct ffmpeg_mux *ffm)
 
 	bool success = safe_read(&info, sizeof(info)) == sizeof(info);
 	if (success) {
-		uint8_t *data = malloc(info.size);
+		uint8_t *data = read_data(info.size);
 
-		if (safe_read(data, info.size) == info.size) {
+		if (data) {
 			ffmpeg_mux_header(ffm, data, &info);
 		} else {
 			success = false;
 		}
-
-		free(data);
 	}
 
 	return success;
@@ -655,7 +701,6 @@ int main(int argc, char *argv[])
 {
 	struct ffm_packet_info info = {0};
 	struct ffmpeg_mux ffm = {0};
-	struct resize_buf rb = {0};
 	bool fail = false;
 	int ret;
 
@@ -688,17 +733,17 @@ int main(int argc, char *argv[])
 	}
 
 	while (!fail && safe_read(&info, sizeof(info)) == sizeof(info)) {
-		resize_buf_resize(&rb, info.size);
+		uint8_t *data = read_data(info.size);
 
-		if (safe_read(rb.buf, info.size) == info.size) {
-			ffmpeg_mux_packet(&ffm, rb.buf, &info);
+		if (data) {
+			ffmpeg_mux_packet(&ffm, data, &info);
 		} else {
 			fail = true;
 		}
 	}
 
 	ffmpeg_mux_free(&ffm);
-	resize_buf_free(&rb);
+	free(input.buf);
 
 #ifdef _WIN32
 	for (int i = 0; i < argc; i++)
@@ -46,6 +46,7 @@ struct ffmpeg_muxer {
 	uint64_t total_bytes;
 	struct dstr path;
 	bool sent_headers;
+	bool sent_first_packet;
 	volatile bool active;
 	volatile bool stopping;
 	volatile bool capturing;
@@ -64,8 +65,31 @@ struct ffmpeg_muxer {
 	pthread_t mux_thread;
 	bool mux_thread_joinable;
 	volatile bool muxing;
+
+	/* packets waiting for the write thread, queued_* count them until
+	 * they have been written to the pipe */
+	DARRAY(struct encoder_packet) write_queue;
+	pthread_mutex_t write_mutex;
+	os_sem_t *write_sem;
+	os_event_t *write_space;
+	pthread_t write_thread;
+	bool write_thread_active;
+	volatile bool write_stopping;
+	volatile bool write_failed;
+	size_t queued_packets;
+	uint64_t queued_bytes;
+	size_t peak_queued_packets;
+	uint64_t peak_queued_bytes;
+	bool write_queue_full;
 };
 
+/* most packets the write thread sends to the pipe in a single write */
+#define MAX_WRITE_BATCH 64
+
+/* past this the encoder thread waits for the write thread, several seconds
+ * of video at recording bitrates */
+#define MAX_QUEUED_BYTES (64 * 1024 * 1024)
+
 static const char *ffmpeg_mux_getname(void *type)
 {
 	UNUSED_PARAMETER(type);
@@ -89,6 +113,8 @@ static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
 	stream->keyframes = 0;
 }
 
+static bool stop_write_thread(struct ffmpeg_muxer *stream);
+
 static void ffmpeg_mux_destroy(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -98,16 +124,57 @@ static void ffmpeg_mux_destroy(void *data)
 		pthread_join(stream->mux_thread, NULL);
 	da_free(stream->mux_packets);
 
+	stop_write_thread(stream);
+	da_free(stream->write_queue);
+	pthread_mutex_destroy(&stream->write_mutex);
+
 	os_process_pipe_destroy(stream->pipe);
 	dstr_free(&stream->path);
 	bfree(stream);
 }
 
-static void *ffmpeg_mux_create(obs_data_t *settings, obs_output_t *output)
+static struct ffmpeg_muxer *create_muxer(obs_output_t *output)
 {
 	struct ffmpeg_muxer *stream = bzalloc(sizeof(*stream));
 	stream->output = output;
 
+	pthread_mutex_init_value(&stream->write_mutex);
+	if (pthread_mutex_init(&stream->write_mutex, NULL) != 0) {
+		bfree(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+static void get_write_queue_proc(void *data, calldata_t *cd)
+{
+	struct ffmpeg_muxer *stream = data;
+
+	pthread_mutex_lock(&stream->write_mutex);
+	calldata_set_int(cd, "packets", (long long)stream->queued_packets);
+	calldata_set_int(cd, "bytes", (long long)stream->queued_bytes);
+	calldata_set_int(cd, "peak_packets",
+			 (long long)stream->peak_queued_packets);
+	calldata_set_int(cd, "peak_bytes", (long long)stream->peak_queued_bytes);
+	pthread_mutex_unlock(&stream->write_mutex);
+}
+
+static void *ffmpeg_mux_create(obs_data_t *settings, obs_output_t *output)
+{
+	struct ffmpeg_muxer *stream = create_muxer(output);
+	if (!stream)
+		return NULL;
+
+	signal_handler_t *sh = obs_output_get_signal_handler(output);
+	signal_handler_add(sh, "void first_packet(ptr output)");
+
+	proc_handler_t *ph = obs_output_get_proc_handler(output);
+	proc_handler_add(ph,
+			 "void get_write_queue(out int packets, out int bytes, "
+			 "out int peak_packets, out int peak_bytes)",
+			 get_write_queue_proc, stream);
+
 	UNUSED_PARAMETER(settings);
 	return stream;
 }
@@ -274,6 +341,214 @@ static inline void start_pipe(struct ffmpeg_muxer *stream, const char *path)
 	dstr_free(&cmd);
 }
 
+static inline void set_packet_info(struct ffm_packet_info *info,
+				   const struct encoder_packet *packet)
+{
+	bool is_video = packet->type == OBS_ENCODER_VIDEO;
+
+	info->pts = packet->pts;
+	info->dts = packet->dts;
+	info->size = (uint32_t)packet->size;
+	info->index = (int)packet->track_idx;
+	info->type = is_video ? FFM_PACKET_VIDEO : FFM_PACKET_AUDIO;
+	info->keyframe = packet->keyframe;
+}
+
+/* writes the info structure and data of each packet, batched into as few
+ * pipe writes as possible */
+static bool write_packets(struct ffmpeg_muxer *stream,
+			  const struct encoder_packet *packets, size_t count)
+{
+	struct ffm_packet_info info[MAX_WRITE_BATCH] = {0};
+	struct os_process_pipe_vec vecs[MAX_WRITE_BATCH * 2];
+
+	while (count) {
+		size_t batch = count < MAX_WRITE_BATCH ? count : MAX_WRITE_BATCH;
+		uint64_t data_size = 0;
+		size_t total = 0;
+		size_t ret;
+
+		for (size_t i = 0; i < batch; i++) {
+			set_packet_info(&info[i], &packets[i]);
+
+			vecs[i * 2].data = (const uint8_t *)&info[i];
+			vecs[i * 2].len = sizeof(info[i]);
+			vecs[i * 2 + 1].data = packets[i].data;
+			vecs[i * 2 + 1].len = packets[i].size;
+
+			total += sizeof(info[i]) + packets[i].size;
+			data_size += packets[i].size;
+		}
+
+		ret = os_process_pipe_writev(stream->pipe, vecs, batch * 2);
+		if (ret != total) {
+			warn("os_process_pipe_writev for %d packets failed",
+			     (int)batch);
+			return false;
+		}
+
+		stream->total_bytes += data_size;
+		packets += batch;
+		count -= batch;
+	}
+
+	return true;
+}
+
+/* lets callers measure how long the output took to produce data, sent once
+ * the first packet has been written to the pipe */
+static void signal_first_packet(struct ffmpeg_muxer *stream)
+{
+	struct calldata params;
+	uint8_t stack[128];
+
+	calldata_init_fixed(&params, stack, sizeof(stack));
+	calldata_set_ptr(&params, "output", stream->output);
+	signal_handler_signal(obs_output_get_signal_handler(stream->output),
+			      "first_packet", &params);
+}
+
+/* packets are written to the pipe by a separate thread so that a slow muxer
+ * does not hold up the encoder thread */
+
+static void *write_thread(void *data)
+{
+	struct ffmpeg_muxer *stream = data;
+	DARRAY(struct encoder_packet) batch = {0};
+
+	os_set_thread_name("ffmpeg-mux: write_thread");
+
+	while (os_sem_wait(stream->write_sem) == 0) {
+		bool stop = os_atomic_load_bool(&stream->write_stopping);
+		uint64_t bytes = 0;
+
+		/* take everything queued so far, the queue gets the
+		 * (empty) array of the previous batch */
+		pthread_mutex_lock(&stream->write_mutex);
+		struct darray swap = batch.da;
+		batch.da = stream->write_queue.da;
+		stream->write_queue.da = swap;
+		pthread_mutex_unlock(&stream->write_mutex);
+
+		if (batch.num && !os_atomic_load_bool(&stream->write_failed)) {
+			if (!write_packets(stream, batch.array, batch.num)) {
+				os_atomic_set_bool(&stream->write_failed, true);
+			} else if (!stream->sent_first_packet) {
+				stream->sent_first_packet = true;
+				signal_first_packet(stream);
+			}
+		}
+
+		for (size_t i = 0; i < batch.num; i++) {
+			bytes += batch.array[i].size;
+			obs_encoder_packet_release(&batch.array[i]);
+		}
+
+		pthread_mutex_lock(&stream->write_mutex);
+		stream->queued_packets -= batch.num;
+		stream->queued_bytes -= bytes;
+		pthread_mutex_unlock(&stream->write_mutex);
+		os_event_signal(stream->write_space);
+
+		da_resize(batch, 0);
+
+		if (stop)
+			break;
+	}
+
+	da_free(batch);
+	return NULL;
+}
+
+static bool start_write_thread(struct ffmpeg_muxer *stream)
+{
+	os_atomic_set_bool(&stream->write_stopping, false);
+	os_atomic_set_bool(&stream->write_failed, false);
+	stream->queued_packets = 0;
+	stream->queued_bytes = 0;
+	stream->peak_queued_packets = 0;
+	stream->peak_queued_bytes = 0;
+	stream->write_queue_full = false;
+	stream->sent_first_packet = false;
+
+	if (os_sem_init(&stream->write_sem, 0) != 0)
+		return false;
+	if (os_event_init(&stream->write_space, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+	if (pthread_create(&stream->write_thread, NULL, write_thread,
+			   stream) != 0)
+		goto fail;
+
+	stream->write_thread_active = true;
+	return true;
+
+fail:
+	os_event_destroy(stream->write_space);
+	os_sem_destroy(stream->write_sem);
+	stream->write_space = NULL;
+	stream->write_sem = NULL;
+	return false;
+}
+
+/* writes out whatever is still queued before the thread exits, returns
+ * false if any of it could not be written */
+static bool stop_write_thread(struct ffmpeg_muxer *stream)
+{
+	if (!stream->write_thread_active)
+		return true;
+
+	os_atomic_set_bool(&stream->write_stopping, true);
+	os_sem_post(stream->write_sem);
+	pthread_join(stream->write_thread, NULL);
+
+	os_event_destroy(stream->write_space);
+	os_sem_destroy(stream->write_sem);
+	stream->write_space = NULL;
+	stream->write_sem = NULL;
+	stream->write_thread_active = false;
+
+	info("Write queue peaked at %d packets (%d KiB)",
+	     (int)stream->peak_queued_packets,
+	     (int)(stream->peak_queued_bytes / 1024));
+
+	return !os_atomic_load_bool(&stream->write_failed);
+}
+
+static void queue_packet(struct ffmpeg_muxer *stream,
+			 struct encoder_packet *packet)
+{
+	struct encoder_packet pkt;
+	obs_encoder_packet_ref(&pkt, packet);
+
+	pthread_mutex_lock(&stream->write_mutex);
+
+	/* back pressure, the queue must not grow without bound when the
+	 * muxer cannot keep up */
+	while (stream->queued_bytes >= MAX_QUEUED_BYTES &&
+	       !os_atomic_load_bool(&stream->write_failed)) {
+		if (!stream->write_queue_full) {
+			stream->write_queue_full = true;
+			warn("Write queue is full, waiting for the muxer");
+		}
+
+		pthread_mutex_unlock(&stream->write_mutex);
+		os_event_wait(stream->write_space);
+		pthread_mutex_lock(&stream->write_mutex);
+	}
+
+	da_push_back(stream->write_queue, &pkt);
+
+	stream->queued_packets++;
+	stream->queued_bytes += pkt.size;
+	if (stream->queued_packets > stream->peak_queued_packets)
+		stream->peak_queued_packets = stream->queued_packets;
+	if (stream->queued_bytes > stream->peak_queued_bytes)
+		stream->peak_queued_bytes = stream->queued_bytes;
+	pthread_mutex_unlock(&stream->write_mutex);
+
+	os_sem_post(stream->write_sem);
+}
+
 static bool ffmpeg_mux_start(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -325,6 +600,13 @@ static bool ffmpeg_mux_start(void *data)
 		return false;
 	}
 
+	if (!start_write_thread(stream)) {
+		os_process_pipe_destroy(stream->pipe);
+		stream->pipe = NULL;
+		warn("Failed to create write thread");
+		return false;
+	}
+
 	/* write headers and start capture */
 	os_atomic_set_bool(&stream->active, true);
 	os_atomic_set_bool(&stream->capturing, true);
@@ -337,9 +619,11 @@ static bool ffmpeg_mux_start(void *data)
 
 static int deactivate(struct ffmpeg_muxer *stream, int code)
 {
+	bool flushed = true;
 	int ret = -1;
 
 	if (active(stream)) {
+		flushed = stop_write_thread(stream);
 		ret = os_process_pipe_destroy(stream->pipe);
 		stream->pipe = NULL;
 
@@ -351,6 +635,9 @@ static int deactivate(struct ffmpeg_muxer *stream, int code)
 
 	if (code) {
 		obs_output_signal_stop(stream->output, code);
+	} else if (stopping(stream) && !flushed) {
+		warn("Failed to write the last packets to the pipe");
+		obs_output_signal_stop(stream->output, OBS_OUTPUT_ERROR);
 	} else if (stopping(stream)) {
 		obs_output_end_data_capture(stream->output);
 	}
@@ -387,6 +674,8 @@ static void signal_failure(struct ffmpeg_muxer *stream)
 		obs_output_set_last_error(stream->output, error);
 	}
 
+	/* the stop is signaled below */
+	os_atomic_set_bool(&stream->stopping, false);
 	ret = deactivate(stream, 0);
 
 	switch (ret) {
@@ -404,33 +693,11 @@ static void signal_failure(struct ffmpeg_muxer *stream)
 static bool write_packet(struct ffmpeg_muxer *stream,
 			 struct encoder_packet *packet)
 {
-	bool is_video = packet->type == OBS_ENCODER_VIDEO;
-	size_t ret;
-
-	struct ffm_packet_info info = {.pts = packet->pts,
-				       .dts = packet->dts,
-				       .size = (uint32_t)packet->size,
-				       .index = (int)packet->track_idx,
-				       .type = is_video ? FFM_PACKET_VIDEO
-							: FFM_PACKET_AUDIO,
-				       .keyframe = packet->keyframe};
-
-	ret = os_process_pipe_write(stream->pipe, (const uint8_t *)&info,
-				    sizeof(info));
-	if (ret != sizeof(info)) {
-		warn("os_process_pipe_write for info structure failed");
+	if (!write_packets(stream, packet, 1)) {
 		signal_failure(stream);
 		return false;
 	}
 
-	ret = os_process_pipe_write(stream->pipe, packet->data, packet->size);
-	if (ret != packet->size) {
-		warn("os_process_pipe_write for packet data failed");
-		signal_failure(stream);
-		return false;
-	}
-
-	stream->total_bytes += packet->size;
 	return true;
 }
 
@@ -489,6 +756,12 @@ static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
 		return;
 	}
 
+	/* the write thread failed to write to the pipe */
+	if (os_atomic_load_bool(&stream->write_failed)) {
+		signal_failure(stream);
+		return;
+	}
+
 	if (!stream->sent_headers) {
 		if (!send_headers(stream))
 			return;
@@ -503,7 +776,7 @@ static void ffmpeg_mux_data(void *data, struct encoder_packet *packet)
 		}
 	}
 
-	write_packet(stream, packet);
+	queue_packet(stream, packet);
 }
 
 static obs_properties_t *ffmpeg_mux_properties(void *unused)
@@ -585,8 +858,9 @@ static void get_last_replay(void *data, calldata_t *cd)
 static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
 {
 	UNUSED_PARAMETER(settings);
-	struct ffmpeg_muxer *stream = bzalloc(sizeof(*stream));
-	stream->output = output;
+	struct ffmpeg_muxer *stream = create_muxer(output);
+	if (!stream)
+		return NULL;
 
 	stream->hotkey =
 		obs_hotkey_register_output(output, "ReplayBuffer.Save",
@@ -740,13 +1014,15 @@ static void *replay_buffer_mux_thread(void *data)
 		goto error;
 	}
 
-	for (size_t i = 0; i < stream->mux_packets.num; i++) {
-		struct encoder_packet *pkt = &stream->mux_packets.array[i];
-		write_packet(stream, pkt);
-		obs_encoder_packet_release(pkt);
-	}
+	/* this is already off the encoder thread, so write directly */
+	if (write_packets(stream, stream->mux_packets.array,
+			  stream->mux_packets.num))
+		info("Wrote replay buffer to '%s'", stream->path.array);
+	else
+		signal_failure(stream);
 
-	info("Wrote replay buffer to '%s'", stream->path.array);
+	for (size_t i = 0; i < stream->mux_packets.num; i++)
+		obs_encoder_packet_release(&stream->mux_packets.array[i]);
 
 error:
 	os_process_pipe_destroy(stream->pipe);
@@ -237,6 +237,13 @@ static void get_frame(void *opaque, struct obs_source_frame *f)
 	obs_source_output_video(s->source, f);
 }
 
+static void get_frame_external(void *opaque, struct obs_source_frame *f,
+			       void (*release)(void *param), void *param)
+{
+	struct ffmpeg_source *s = opaque;
+	obs_source_output_video_external(s->source, f, release, param);
+}
+
 static void preload_frame(void *opaque, struct obs_source_frame *f)
 {
 	struct ffmpeg_source *s = opaque;
@@ -273,6 +280,7 @@ static void ffmpeg_source_open(struct ffmpeg_source *s)
 		struct mp_media_info info = {
 			.opaque = s,
 			.v_cb = get_frame,
+			.v_external_cb = get_frame_external,
 			.v_preload_cb = preload_frame,
 			.a_cb = get_audio,
 			.stop_cb = media_stopped,
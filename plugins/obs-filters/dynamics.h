@@ -0,0 +1,276 @@
+#pragma once
+
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+#include <util/c99defs.h>
+#include <util/sse-intrin.h>
+#include <media-io/audio-io.h>
+
+/* Block kernels shared by the compressor, expander, limiter and noise gate.
+ *
+ * Decibels are converted with polynomial log2/exp2 approximations instead of
+ * log10f/powf per sample.  dyn_mul_to_db is within 0.0001 dB of
+ * 20 * log10f(x), dyn_db_to_mul within 0.00001 dB of powf(10, x / 20), and
+ * 0 dB converts to a gain of exactly 1.0, so audio below a threshold passes
+ * through unchanged.  Zero converts to about -758 dB instead of -INFINITY.
+ *
+ * The vector and scalar paths evaluate the same polynomials in the same
+ * order, so results do not depend on how a block is split. */
+
+#define DYN_DB_PER_LOG2 6.02059991f /* 20 * log10(2) */
+#define DYN_LOG2_PER_DB 0.166096404f /* log2(10) / 20 */
+
+/* log2(1 + t) / t on [0, 1) */
+#define DYN_LOG2_C0 1.442681468f
+#define DYN_LOG2_C1 -7.203587727e-01f
+#define DYN_LOG2_C2 4.686588791e-01f
+#define DYN_LOG2_C3 -3.016380097e-01f
+#define DYN_LOG2_C4 1.444710957e-01f
+#define DYN_LOG2_C5 -3.382204597e-02f
+
+/* (2^f - 1) / f on [0, 1) */
+#define DYN_EXP2_C0 6.931475676e-01f
+#define DYN_EXP2_C1 2.402071942e-01f
+#define DYN_EXP2_C2 5.565705439e-02f
+#define DYN_EXP2_C3 9.199387600e-03f
+#define DYN_EXP2_C4 1.788368742e-03f
+
+union dyn_float_bits {
+	float f;
+	uint32_t i;
+};
+
+static inline float dyn_log2(float x)
+{
+	union dyn_float_bits v = {x > FLT_MIN ? x : FLT_MIN};
+	float e = (float)((int32_t)(v.i >> 23) - 127);
+	float t, q;
+
+	v.i = (v.i & 0x007FFFFF) | 0x3F800000;
+	t = v.f - 1.0f;
+
+	q = DYN_LOG2_C5;
+	q = q * t + DYN_LOG2_C4;
+	q = q * t + DYN_LOG2_C3;
+	q = q * t + DYN_LOG2_C2;
+	q = q * t + DYN_LOG2_C1;
+	q = q * t + DYN_LOG2_C0;
+	return e + t * q;
+}
+
+static inline float dyn_exp2(float x)
+{
+	union dyn_float_bits scale;
+	float fl, f, q;
+
+	x = fmaxf(fminf(x, 127.0f), -126.0f);
+	fl = (float)(int32_t)x;
+	if (fl > x)
+		fl -= 1.0f;
+	f = x - fl;
+
+	q = DYN_EXP2_C4;
+	q = q * f + DYN_EXP2_C3;
+	q = q * f + DYN_EXP2_C2;
+	q = q * f + DYN_EXP2_C1;
+	q = q * f + DYN_EXP2_C0;
+
+	scale.i = (uint32_t)((int32_t)fl + 127) << 23;
+	return (1.0f + f * q) * scale.f;
+}
+
+static inline __m128 dyn_log2_ps(__m128 x)
+{
+	const __m128i mantissa = _mm_set1_epi32(0x007FFFFF);
+	const __m128i one_bits = _mm_set1_epi32(0x3F800000);
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128i bits = _mm_castps_si128(_mm_max_ps(x, _mm_set1_ps(FLT_MIN)));
+	__m128 e, t, q;
+
+	e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23),
+					  _mm_set1_epi32(127)));
+	bits = _mm_or_si128(_mm_and_si128(bits, mantissa), one_bits);
+	t = _mm_sub_ps(_mm_castsi128_ps(bits), one);
+
+	q = _mm_set1_ps(DYN_LOG2_C5);
+	q = _mm_add_ps(_mm_mul_ps(q, t), _mm_set1_ps(DYN_LOG2_C4));
+	q = _mm_add_ps(_mm_mul_ps(q, t), _mm_set1_ps(DYN_LOG2_C3));
+	q = _mm_add_ps(_mm_mul_ps(q, t), _mm_set1_ps(DYN_LOG2_C2));
+	q = _mm_add_ps(_mm_mul_ps(q, t), _mm_set1_ps(DYN_LOG2_C1));
+	q = _mm_add_ps(_mm_mul_ps(q, t), _mm_set1_ps(DYN_LOG2_C0));
+	return _mm_add_ps(e, _mm_mul_ps(t, q));
+}
+
+static inline __m128 dyn_exp2_ps(__m128 x)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128 fl, f, q, scale;
+
+	x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(127.0f)),
+		       _mm_set1_ps(-126.0f));
+	fl = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	fl = _mm_sub_ps(fl, _mm_and_ps(_mm_cmpgt_ps(fl, x), one));
+	f = _mm_sub_ps(x, fl);
+
+	q = _mm_set1_ps(DYN_EXP2_C4);
+	q = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(DYN_EXP2_C3));
+	q = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(DYN_EXP2_C2));
+	q = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(DYN_EXP2_C1));
+	q = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(DYN_EXP2_C0));
+
+	scale = _mm_castsi128_ps(_mm_slli_epi32(
+		_mm_add_epi32(_mm_cvttps_epi32(fl), _mm_set1_epi32(127)), 23));
+	return _mm_mul_ps(_mm_add_ps(one, _mm_mul_ps(f, q)), scale);
+}
+
+/* dst[i] = 20 * log10(src[i]), src may be dst */
+static inline void dyn_mul_to_db(float *dst, const float *src, size_t count)
+{
+	const __m128 db_per_log2 = _mm_set1_ps(DYN_DB_PER_LOG2);
+	size_t i = 0;
+
+	for (; i < (count & ~(size_t)3); i += 4) {
+		__m128 v = dyn_log2_ps(_mm_loadu_ps(src + i));
+		_mm_storeu_ps(dst + i, _mm_mul_ps(v, db_per_log2));
+	}
+
+	for (; i < count; i++)
+		dst[i] = dyn_log2(src[i]) * DYN_DB_PER_LOG2;
+}
+
+/* dst[i] = 10^(src[i] / 20) * scale, src may be dst */
+static inline void dyn_db_to_mul(float *dst, const float *src, size_t count,
+				 float scale)
+{
+	const __m128 log2_per_db = _mm_set1_ps(DYN_LOG2_PER_DB);
+	const __m128 scale_v = _mm_set1_ps(scale);
+	size_t i = 0;
+
+	for (; i < (count & ~(size_t)3); i += 4) {
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), log2_per_db);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(dyn_exp2_ps(v), scale_v));
+	}
+
+	for (; i < count; i++)
+		dst[i] = dyn_exp2(src[i] * DYN_LOG2_PER_DB) * scale;
+}
+
+/* Turns an envelope into the gain of a downward compressor, in place:
+ * 10^(min(0, slope * (threshold - env_db)) / 20) * output_gain */
+static inline void dyn_compress_gain(float *buf, size_t count, float threshold,
+				     float slope, float output_gain)
+{
+	const __m128 db_per_log2 = _mm_set1_ps(DYN_DB_PER_LOG2);
+	const __m128 log2_per_db = _mm_set1_ps(DYN_LOG2_PER_DB);
+	const __m128 threshold_v = _mm_set1_ps(threshold);
+	const __m128 slope_v = _mm_set1_ps(slope);
+	const __m128 output_gain_v = _mm_set1_ps(output_gain);
+	const __m128 zero = _mm_setzero_ps();
+	size_t i = 0;
+
+	for (; i < (count & ~(size_t)3); i += 4) {
+		__m128 db = _mm_mul_ps(dyn_log2_ps(_mm_loadu_ps(buf + i)),
+				       db_per_log2);
+		__m128 gain = _mm_mul_ps(slope_v, _mm_sub_ps(threshold_v, db));
+
+		gain = _mm_mul_ps(_mm_min_ps(gain, zero), log2_per_db);
+		_mm_storeu_ps(buf + i,
+			      _mm_mul_ps(dyn_exp2_ps(gain), output_gain_v));
+	}
+
+	for (; i < count; i++) {
+		float db = dyn_log2(buf[i]) * DYN_DB_PER_LOG2;
+		float gain = fminf(slope * (threshold - db), 0.0f);
+
+		buf[i] = dyn_exp2(gain * DYN_LOG2_PER_DB) * output_gain;
+	}
+}
+
+/* Peak envelope follower run over all channels in one pass.  Every channel
+ * starts from *envelope, env_buf gets the highest channel envelope of each
+ * frame and *envelope is left at the last one.  NULL channels are skipped. */
+static inline void dyn_peak_envelope(float *env_buf, float *const *samples,
+				     size_t channels, size_t frames,
+				     float *envelope, float attack_gain,
+				     float release_gain)
+{
+	const float *planes[MAX_AUDIO_CHANNELS];
+	float env[MAX_AUDIO_CHANNELS];
+	size_t num_planes = 0;
+
+	for (size_t c = 0; c < channels && c < MAX_AUDIO_CHANNELS; c++) {
+		if (samples[c]) {
+			planes[num_planes] = samples[c];
+			env[num_planes++] = *envelope;
+		}
+	}
+
+	for (size_t i = 0; i < frames; i++) {
+		float peak = 0.0f;
+
+		for (size_t c = 0; c < num_planes; c++) {
+			const float env_in = fabsf(planes[c][i]);
+			const float gain = env[c] < env_in ? attack_gain
+							   : release_gain;
+
+			env[c] = env_in + gain * (env[c] - env_in);
+			peak = fmaxf(peak, env[c]);
+		}
+
+		env_buf[i] = peak;
+	}
+
+	if (frames)
+		*envelope = env_buf[frames - 1];
+}
+
+/* dst[i] = highest absolute sample of frame i over all channels */
+static inline void dyn_peak_level(float *dst, float *const *samples,
+				  size_t channels, size_t frames)
+{
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	size_t i = 0;
+
+	for (; i < (frames & ~(size_t)3); i += 4) {
+		__m128 peak = _mm_setzero_ps();
+
+		for (size_t c = 0; c < channels; c++) {
+			__m128 v = _mm_loadu_ps(samples[c] + i);
+			peak = _mm_max_ps(peak, _mm_andnot_ps(sign, v));
+		}
+
+		_mm_storeu_ps(dst + i, peak);
+	}
+
+	for (; i < frames; i++) {
+		float peak = 0.0f;
+
+		for (size_t c = 0; c < channels; c++)
+			peak = fmaxf(peak, fabsf(samples[c][i]));
+
+		dst[i] = peak;
+	}
+}
+
+/* samples[c][i] *= gain[i] for every channel, NULL channels are skipped */
+static inline void dyn_apply_gain(float *const *samples, size_t channels,
+				  const float *gain, size_t frames)
+{
+	for (size_t c = 0; c < channels; c++) {
+		float *data = samples[c];
+		size_t i = 0;
+
+		if (!data)
+			continue;
+
+		for (; i < (frames & ~(size_t)3); i += 4) {
+			__m128 v = _mm_loadu_ps(data + i);
+			v = _mm_mul_ps(v, _mm_loadu_ps(gain + i));
+			_mm_storeu_ps(data + i, v);
+		}
+
+		for (; i < frames; i++)
+			data[i] *= gain[i];
+	}
+}
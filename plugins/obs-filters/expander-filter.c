@@ -8,6 +8,8 @@
 #include <util/circlebuf.h>
 #include <util/threading.h>
 
+#include "dynamics.h"
+
 /* -------------------------------------------------------- */
 
 #define do_log(level, format, ...)              \
@@ -87,8 +89,6 @@ struct expander_data {
 	bool is_gate;
 	float *runaverage[MAX_AUDIO_CHANNELS];
 	size_t runaverage_len;
-	float *gaindB[MAX_AUDIO_CHANNELS];
-	size_t gaindB_len;
 	float gaindB_buf[MAX_AUDIO_CHANNELS];
 	float *env_in;
 	size_t env_in_len;
@@ -124,14 +124,6 @@ static void resize_env_in_buffer(struct expander_data *cd, size_t len)
 	cd->env_in = brealloc(cd->env_in, cd->env_in_len * sizeof(float));
 }
 
-static void resize_gaindB_buffer(struct expander_data *cd, size_t len)
-{
-	cd->gaindB_len = len;
-	for (int i = 0; i < MAX_AUDIO_CHANNELS; i++)
-		cd->gaindB[i] =
-			brealloc(cd->gaindB[i], cd->gaindB_len * sizeof(float));
-}
-
 static inline float gain_coefficient(uint32_t sample_rate, float time)
 {
 	return expf(-1.0f / (sample_rate * time));
@@ -212,8 +204,6 @@ static void expander_update(void *data, obs_data_t *s)
 		resize_runaverage_buffer(cd, sample_len);
 	if (cd->env_in_len == 0)
 		resize_env_in_buffer(cd, sample_len);
-	if (cd->gaindB_len == 0)
-		resize_gaindB_buffer(cd, sample_len);
 }
 
 static void *expander_create(obs_data_t *settings, obs_source_t *filter)
@@ -241,7 +231,6 @@ static void expander_destroy(void *data)
 	for (int i = 0; i < MAX_AUDIO_CHANNELS; i++) {
 		bfree(cd->envelope_buf[i]);
 		bfree(cd->runaverage[i]);
-		bfree(cd->gaindB[i]);
 	}
 	bfree(cd->env_in);
 	bfree(cd);
@@ -280,18 +269,18 @@ static void analyze_envelope(struct expander_data *cd, float **samples,
 		if (cd->detector == RMS_DETECT) {
 			runave[0] =
 				rmscoef * cd->runave[chan] +
-				(1 - rmscoef) * powf(samples[chan][0], 2.0f);
+				(1 - rmscoef) * samples[chan][0] *
+					samples[chan][0];
 			env_in[0] = sqrtf(fmaxf(runave[0], 0));
 			for (uint32_t i = 1; i < num_samples; ++i) {
-				runave[i] =
-					rmscoef * runave[i - 1] +
-					(1 - rmscoef) *
-						powf(samples[chan][i], 2.0f);
+				runave[i] = rmscoef * runave[i - 1] +
+					    (1 - rmscoef) * samples[chan][i] *
+						    samples[chan][i];
 				env_in[i] = sqrtf(runave[i]);
 			}
 		} else if (cd->detector == PEAK_DETECT) {
 			for (uint32_t i = 0; i < num_samples; ++i) {
-				runave[i] = powf(samples[chan][i], 2);
+				runave[i] = samples[chan][i] * samples[chan][i];
 				env_in[i] = fabsf(samples[chan][i]);
 			}
 		}
@@ -310,52 +299,38 @@ static inline void process_expansion(struct expander_data *cd, float **samples,
 	const float attack_gain = cd->attack_gain;
 	const float release_gain = cd->release_gain;
 
-	if (cd->gaindB_len < num_samples)
-		resize_gaindB_buffer(cd, num_samples);
-	for (int i = 0; i < MAX_AUDIO_CHANNELS; i++)
-		memset(cd->gaindB[i], 0,
-		       num_samples * sizeof(cd->gaindB[i][0]));
-
 	for (size_t chan = 0; chan < cd->num_channels; chan++) {
+		/* env_in is free after detection, it holds the envelope in dB
+		 * and then the gain of each sample */
+		float *buf = cd->env_in;
+		float prev = cd->gaindB_buf[chan];
+
+		dyn_mul_to_db(buf, cd->envelope_buf[chan], num_samples);
+
 		for (size_t i = 0; i < num_samples; ++i) {
 			// gain stage of expansion
-			float env_db = mul_to_db(cd->envelope_buf[chan][i]);
-			float gain =
-				cd->threshold - env_db > 0.0f
-					? fmaxf(cd->slope * (cd->threshold -
-							     env_db),
-						-60.0f)
-					: 0.0f;
+			const float env_db = buf[i];
+			float gain = cd->threshold - env_db > 0.0f
+					     ? fmaxf(cd->slope * (cd->threshold -
+								  env_db),
+						     -60.0f)
+					     : 0.0f;
 			// ballistics (attack/release)
-			if (i > 0) {
-				if (gain > cd->gaindB[chan][i - 1])
-					cd->gaindB[chan][i] =
-						attack_gain *
-							cd->gaindB[chan][i - 1] +
-						(1.0f - attack_gain) * gain;
-				else
-					cd->gaindB[chan][i] =
-						release_gain *
-							cd->gaindB[chan][i - 1] +
-						(1.0f - release_gain) * gain;
-			} else {
-				if (gain > cd->gaindB_buf[chan])
-					cd->gaindB[chan][i] =
-						attack_gain *
-							cd->gaindB_buf[chan] +
-						(1.0f - attack_gain) * gain;
-				else
-					cd->gaindB[chan][i] =
-						release_gain *
-							cd->gaindB_buf[chan] +
-						(1.0f - release_gain) * gain;
-			}
+			if (gain > prev)
+				prev = attack_gain * prev +
+				       (1.0f - attack_gain) * gain;
+			else
+				prev = release_gain * prev +
+				       (1.0f - release_gain) * gain;
+
+			buf[i] = fminf(0, prev);
+		}
+		cd->gaindB_buf[chan] = prev;
 
-			gain = db_to_mul(fminf(0, cd->gaindB[chan][i]));
-			if (samples[chan])
-				samples[chan][i] *= gain * cd->output_gain;
+		if (samples[chan]) {
+			dyn_db_to_mul(buf, buf, num_samples, cd->output_gain);
+			dyn_apply_gain(&samples[chan], 1, buf, num_samples);
 		}
-		cd->gaindB_buf[chan] = cd->gaindB[chan][num_samples - 1];
 	}
 }
 
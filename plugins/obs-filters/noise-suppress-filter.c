@@ -2,6 +2,7 @@
 #include <inttypes.h>
 
 #include <util/circlebuf.h>
+#include <util/threading.h>
 #include <obs-module.h>
 #include <speex/speex_preprocess.h>
 
@@ -31,25 +32,61 @@
 
 /* -------------------------------------------------------- */
 
+/* A suppression backend processes fixed size frames of one channel of float
+ * audio in place, it keeps one state per channel.  Backends that work on
+ * another sample format convert internally. */
+struct noise_suppress_backend {
+	const char *name;
+	size_t (*frame_size)(uint32_t sample_rate);
+	void *(*create)(uint32_t sample_rate, size_t frames);
+	void (*destroy)(void *state);
+	void (*set_level)(void *state, int level_db);
+	void (*process)(void *state, float *samples);
+};
+
+/* With two or more channels, the upper half of the channels of each batch is
+ * handed to a worker thread while the filtering thread processes the lower
+ * half.  Filters of async sources run on the thread that outputs the audio,
+ * so this shortens the time a capture thread spends in the filter. */
+struct channel_worker {
+	pthread_t thread;
+	bool active;
+	os_sem_t *start_sem;
+	os_event_t *done_event;
+	volatile bool stop;
+
+	/* current batch, set before start_sem is posted */
+	float **planes;
+	size_t frames;
+	size_t first_channel;
+};
+
 struct noise_suppress_data {
 	obs_source_t *context;
 	int suppress_level;
+	int applied_level;
 
 	uint64_t last_timestamp;
 
 	size_t frames;
 	size_t channels;
+	uint32_t sample_rate;
+
+	/* frames held back from the output by buffering */
+	volatile long latency_frames;
+
+	const struct noise_suppress_backend *backend;
+	void *states[MAX_PREPROC_CHANNELS];
 
 	struct circlebuf info_buffer;
 	struct circlebuf input_buffers[MAX_PREPROC_CHANNELS];
 	struct circlebuf output_buffers[MAX_PREPROC_CHANNELS];
 
-	/* Speex preprocessor state */
-	SpeexPreprocessState *states[MAX_PREPROC_CHANNELS];
-
-	/* 16 bit PCM buffers */
+	/* segments being processed */
 	float *copy_buffers[MAX_PREPROC_CHANNELS];
-	spx_int16_t *segment_buffers[MAX_PREPROC_CHANNELS];
+	size_t copy_frames;
+
+	struct channel_worker worker;
 
 	/* output data */
 	struct obs_audio_data output_audio;
@@ -61,9 +98,80 @@ struct noise_suppress_data {
 #define SUP_MIN -60
 #define SUP_MAX 0
 
+/* -------------------------------------------------------- */
+/* Speex backend, speex only takes 16 bit PCM */
+
 static const float c_32_to_16 = (float)INT16_MAX;
 static const float c_16_to_32 = ((float)INT16_MAX + 1.0f);
 
+struct speex_state {
+	SpeexPreprocessState *st;
+	spx_int16_t *segment;
+	size_t frames;
+};
+
+static size_t speex_frame_size(uint32_t sample_rate)
+{
+	/* Process 10 millisecond segments to keep latency low */
+	return (size_t)sample_rate / 100;
+}
+
+static void *speex_create(uint32_t sample_rate, size_t frames)
+{
+	struct speex_state *state = bzalloc(sizeof(*state));
+
+	state->st = speex_preprocess_state_init((int)frames, sample_rate);
+	state->segment = bmalloc(frames * sizeof(spx_int16_t));
+	state->frames = frames;
+	return state;
+}
+
+static void speex_destroy(void *data)
+{
+	struct speex_state *state = data;
+
+	speex_preprocess_state_destroy(state->st);
+	bfree(state->segment);
+	bfree(state);
+}
+
+static void speex_set_level(void *data, int level_db)
+{
+	struct speex_state *state = data;
+
+	speex_preprocess_ctl(state->st, SPEEX_PREPROCESS_SET_NOISE_SUPPRESS,
+			     &level_db);
+}
+
+static void speex_process(void *data, float *samples)
+{
+	struct speex_state *state = data;
+	spx_int16_t *segment = state->segment;
+
+	for (size_t i = 0; i < state->frames; i++) {
+		float s = samples[i];
+		if (s > 1.0f)
+			s = 1.0f;
+		else if (s < -1.0f)
+			s = -1.0f;
+		segment[i] = (spx_int16_t)(s * c_32_to_16);
+	}
+
+	speex_preprocess_run(state->st, segment);
+
+	for (size_t i = 0; i < state->frames; i++)
+		samples[i] = (float)segment[i] / c_16_to_32;
+}
+
+static const struct noise_suppress_backend speex_backend = {
+	.name = "speex",
+	.frame_size = speex_frame_size,
+	.create = speex_create,
+	.destroy = speex_destroy,
+	.set_level = speex_set_level,
+	.process = speex_process,
+};
+
 /* -------------------------------------------------------- */
 
 static const char *noise_suppress_name(void *unused)
@@ -72,29 +180,135 @@ static const char *noise_suppress_name(void *unused)
 	return obs_module_text("NoiseSuppress");
 }
 
+/* processes whole segments of channels first to last - 1 */
+static void process_channel_range(struct noise_suppress_data *ng,
+				  float **planes, size_t frames, size_t first,
+				  size_t last)
+{
+	for (size_t i = first; i < last; i++) {
+		for (size_t j = 0; j < frames; j += ng->frames)
+			ng->backend->process(ng->states[i], planes[i] + j);
+	}
+}
+
+static void *channel_worker_thread(void *data)
+{
+	struct noise_suppress_data *ng = data;
+	struct channel_worker *worker = &ng->worker;
+
+	os_set_thread_name("noise suppress: channel worker");
+
+	while (os_sem_wait(worker->start_sem) == 0) {
+		if (os_atomic_load_bool(&worker->stop))
+			break;
+
+		process_channel_range(ng, worker->planes, worker->frames,
+				      worker->first_channel, ng->channels);
+		os_event_signal(worker->done_event);
+	}
+
+	return NULL;
+}
+
+static void start_channel_worker(struct noise_suppress_data *ng)
+{
+	struct channel_worker *worker = &ng->worker;
+
+	if (ng->channels < 2)
+		return;
+
+	if (os_sem_init(&worker->start_sem, 0) != 0)
+		goto fail;
+	if (os_event_init(&worker->done_event, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+	if (pthread_create(&worker->thread, NULL, channel_worker_thread,
+			   ng) != 0)
+		goto fail;
+
+	worker->active = true;
+	return;
+
+fail:
+	warn("Failed to start channel worker, processing channels serially");
+	os_event_destroy(worker->done_event);
+	os_sem_destroy(worker->start_sem);
+	worker->done_event = NULL;
+	worker->start_sem = NULL;
+}
+
+static void stop_channel_worker(struct noise_suppress_data *ng)
+{
+	struct channel_worker *worker = &ng->worker;
+
+	if (!worker->active)
+		return;
+
+	os_atomic_set_bool(&worker->stop, true);
+	os_sem_post(worker->start_sem);
+	pthread_join(worker->thread, NULL);
+
+	os_event_destroy(worker->done_event);
+	os_sem_destroy(worker->start_sem);
+	worker->active = false;
+}
+
+/* processes frames (whole segments) of every channel, one batch per call so
+ * the worker is woken at most once per packet */
+static void process_channels(struct noise_suppress_data *ng, float **planes,
+			     size_t frames)
+{
+	struct channel_worker *worker = &ng->worker;
+	size_t split = ng->channels / 2;
+
+	if (!worker->active) {
+		process_channel_range(ng, planes, frames, 0, ng->channels);
+		return;
+	}
+
+	worker->planes = planes;
+	worker->frames = frames;
+	worker->first_channel = split;
+	os_sem_post(worker->start_sem);
+
+	process_channel_range(ng, planes, frames, 0, split);
+	os_event_wait(worker->done_event);
+}
+
 static void noise_suppress_destroy(void *data)
 {
 	struct noise_suppress_data *ng = data;
 
+	stop_channel_worker(ng);
+
 	for (size_t i = 0; i < ng->channels; i++) {
-		speex_preprocess_state_destroy(ng->states[i]);
+		if (ng->states[i])
+			ng->backend->destroy(ng->states[i]);
 		circlebuf_free(&ng->input_buffers[i]);
 		circlebuf_free(&ng->output_buffers[i]);
+		bfree(ng->copy_buffers[i]);
 	}
 
-	bfree(ng->segment_buffers[0]);
-	bfree(ng->copy_buffers[0]);
 	circlebuf_free(&ng->info_buffer);
 	da_free(ng->output_data);
 	bfree(ng);
 }
 
+static void reserve_copy_frames(struct noise_suppress_data *ng, size_t frames)
+{
+	if (ng->copy_frames >= frames)
+		return;
+
+	for (size_t i = 0; i < ng->channels; i++)
+		ng->copy_buffers[i] =
+			brealloc(ng->copy_buffers[i], frames * sizeof(float));
+	ng->copy_frames = frames;
+}
+
 static inline void alloc_channel(struct noise_suppress_data *ng,
 				 uint32_t sample_rate, size_t channel,
 				 size_t frames)
 {
-	ng->states[channel] =
-		speex_preprocess_state_init((int)frames, sample_rate);
+	ng->states[channel] = ng->backend->create(sample_rate, frames);
 
 	circlebuf_reserve(&ng->input_buffers[channel], frames * sizeof(float));
 	circlebuf_reserve(&ng->output_buffers[channel], frames * sizeof(float));
@@ -106,29 +320,36 @@ static void noise_suppress_update(void *data, obs_data_t *s)
 
 	uint32_t sample_rate = audio_output_get_sample_rate(obs_get_audio());
 	size_t channels = audio_output_get_channels(obs_get_audio());
-	size_t frames = (size_t)sample_rate / 100;
+	size_t frames = ng->backend->frame_size(sample_rate);
 
 	ng->suppress_level = (int)obs_data_get_int(s, S_SUPPRESS_LEVEL);
 
-	/* Process 10 millisecond segments to keep latency low */
-	ng->frames = frames;
-	ng->channels = channels;
-
 	/* Ignore if already allocated */
 	if (ng->states[0])
 		return;
 
-	/* One speex state for each channel (limit 2) */
-	ng->copy_buffers[0] = bmalloc(frames * channels * sizeof(float));
-	ng->segment_buffers[0] =
-		bmalloc(frames * channels * sizeof(spx_int16_t));
-	for (size_t c = 1; c < channels; ++c) {
-		ng->copy_buffers[c] = ng->copy_buffers[c - 1] + frames;
-		ng->segment_buffers[c] = ng->segment_buffers[c - 1] + frames;
-	}
+	ng->frames = frames;
+	ng->channels = channels;
+	ng->sample_rate = sample_rate;
+
+	reserve_copy_frames(ng, frames);
 
+	/* One backend state for each channel */
 	for (size_t i = 0; i < channels; i++)
 		alloc_channel(ng, sample_rate, i, frames);
+
+	start_channel_worker(ng);
+}
+
+static void get_latency_proc(void *data, calldata_t *cd)
+{
+	struct noise_suppress_data *ng = data;
+	long frames = os_atomic_load_long(&ng->latency_frames);
+	uint64_t ns = ng->sample_rate ? (uint64_t)frames * 1000000000ULL /
+						ng->sample_rate
+				      : 0;
+
+	calldata_set_int(cd, "latency_ns", (long long)ns);
 }
 
 static void *noise_suppress_create(obs_data_t *settings, obs_source_t *filter)
@@ -137,49 +358,64 @@ static void *noise_suppress_create(obs_data_t *settings, obs_source_t *filter)
 		bzalloc(sizeof(struct noise_suppress_data));
 
 	ng->context = filter;
+	ng->backend = &speex_backend;
+	ng->applied_level = SUP_MAX + 1; /* nothing applied yet */
 	noise_suppress_update(ng, settings);
+
+	proc_handler_t *ph = obs_source_get_proc_handler(filter);
+	proc_handler_add(ph, "void get_latency(out int latency_ns)",
+			 get_latency_proc, ng);
 	return ng;
 }
 
-static inline void process(struct noise_suppress_data *ng)
+static inline void apply_level(struct noise_suppress_data *ng)
 {
-	/* Pop from input circlebuf */
-	for (size_t i = 0; i < ng->channels; i++)
-		circlebuf_pop_front(&ng->input_buffers[i], ng->copy_buffers[i],
-				    ng->frames * sizeof(float));
+	int level = ng->suppress_level;
 
-	/* Set args */
-	for (size_t i = 0; i < ng->channels; i++)
-		speex_preprocess_ctl(ng->states[i],
-				     SPEEX_PREPROCESS_SET_NOISE_SUPPRESS,
-				     &ng->suppress_level);
+	if (level == ng->applied_level)
+		return;
 
-	/* Convert to 16bit */
 	for (size_t i = 0; i < ng->channels; i++)
-		for (size_t j = 0; j < ng->frames; j++) {
-			float s = ng->copy_buffers[i][j];
-			if (s > 1.0f)
-				s = 1.0f;
-			else if (s < -1.0f)
-				s = -1.0f;
-			ng->segment_buffers[i][j] =
-				(spx_int16_t)(s * c_32_to_16);
-		}
+		ng->backend->set_level(ng->states[i], level);
+	ng->applied_level = level;
+}
 
-	/* Execute */
-	for (size_t i = 0; i < ng->channels; i++)
-		speex_preprocess_run(ng->states[i], ng->segment_buffers[i]);
+static inline void process(struct noise_suppress_data *ng)
+{
+	size_t segment_size = ng->frames * sizeof(float);
+	size_t frames = ng->input_buffers[0].size / segment_size * ng->frames;
+	size_t size = frames * sizeof(float);
+
+	if (!frames)
+		return;
+
+	reserve_copy_frames(ng, frames);
 
-	/* Convert back to 32bit */
+	/* Pop every whole segment from the input circlebufs */
 	for (size_t i = 0; i < ng->channels; i++)
-		for (size_t j = 0; j < ng->frames; j++)
-			ng->copy_buffers[i][j] =
-				(float)ng->segment_buffers[i][j] / c_16_to_32;
+		circlebuf_pop_front(&ng->input_buffers[i], ng->copy_buffers[i],
+				    size);
+
+	/* Execute */
+	process_channels(ng, ng->copy_buffers, frames);
 
 	/* Push to output circlebuf */
 	for (size_t i = 0; i < ng->channels; i++)
 		circlebuf_push_back(&ng->output_buffers[i], ng->copy_buffers[i],
-				    ng->frames * sizeof(float));
+				    size);
+}
+
+/* With nothing buffered and a packet made of whole segments, the packet is
+ * processed in place and passed on without any copies or delay */
+static inline bool process_in_place(struct noise_suppress_data *ng,
+				    struct obs_audio_data *audio)
+{
+	if (ng->info_buffer.size || ng->input_buffers[0].size ||
+	    ng->output_buffers[0].size || audio->frames % ng->frames != 0)
+		return false;
+
+	process_channels(ng, (float **)audio->data, audio->frames);
+	return true;
 }
 
 struct ng_audio_info {
@@ -202,12 +438,17 @@ static void reset_data(struct noise_suppress_data *ng)
 	clear_circlebuf(&ng->info_buffer);
 }
 
+static inline void update_latency(struct noise_suppress_data *ng)
+{
+	size_t size = ng->input_buffers[0].size + ng->output_buffers[0].size;
+	os_atomic_set_long(&ng->latency_frames, (long)(size / sizeof(float)));
+}
+
 static struct obs_audio_data *
 noise_suppress_filter_audio(void *data, struct obs_audio_data *audio)
 {
 	struct noise_suppress_data *ng = data;
 	struct ng_audio_info info;
-	size_t segment_size = ng->frames * sizeof(float);
 	size_t out_size;
 
 	if (!ng->states[0])
@@ -227,6 +468,13 @@ noise_suppress_filter_audio(void *data, struct obs_audio_data *audio)
 
 	ng->last_timestamp = audio->timestamp;
 
+	apply_level(ng);
+
+	if (process_in_place(ng, audio)) {
+		os_atomic_set_long(&ng->latency_frames, 0);
+		return audio;
+	}
+
 	/* -----------------------------------------------
 	 * push audio packet info (timestamp/frame count) to info circlebuf */
 	info.frames = audio->frames;
@@ -240,9 +488,8 @@ noise_suppress_filter_audio(void *data, struct obs_audio_data *audio)
 				    audio->frames * sizeof(float));
 
 	/* -----------------------------------------------
-	 * pop/process each 10ms segments, push back to output circlebuf */
-	while (ng->input_buffers[0].size >= segment_size)
-		process(ng);
+	 * pop/process all whole 10ms segments, push back to output circlebuf */
+	process(ng);
 
 	/* -----------------------------------------------
 	 * peek front of info circlebuf, check to see if we have enough to
@@ -251,8 +498,10 @@ noise_suppress_filter_audio(void *data, struct obs_audio_data *audio)
 	circlebuf_peek_front(&ng->info_buffer, &info, sizeof(info));
 	out_size = info.frames * sizeof(float);
 
-	if (ng->output_buffers[0].size < out_size)
+	if (ng->output_buffers[0].size < out_size) {
+		update_latency(ng);
 		return NULL;
+	}
 
 	/* -----------------------------------------------
 	 * if there's enough audio data buffered in the output circlebuf,
@@ -270,6 +519,8 @@ noise_suppress_filter_audio(void *data, struct obs_audio_data *audio)
 
 	ng->output_audio.frames = info.frames;
 	ng->output_audio.timestamp = info.timestamp;
+
+	update_latency(ng);
 	return &ng->output_audio;
 }
 
@@ -0,0 +1,224 @@
+/* Checks that audio buffering is reduced while an output is connected to the
+ * audio output, without a gap in the audio it receives.
+ *
+ * A test source outputs a tone in real time, stalls once, and then catches
+ * up by outputting the audio it missed, which makes libobs add buffering.
+ * From then on the source is early by the amount that was added, so after
+ * the headroom window (~10 seconds) the buffering has to come down again
+ * while the raw audio callback below stays connected, and the timestamps it
+ * receives have to stay contiguous throughout. */
+
+#include <stdio.h>
+#include <math.h>
+#include <obs.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+#define SAMPLE_RATE 48000
+#define SOURCE_FRAMES 480
+#define STALL_START_MS 1000
+#define STALL_MS 300
+#define TIMEOUT_MS 30000
+
+struct test_source {
+	obs_source_t *source;
+	pthread_t thread;
+	os_event_t *stop_event;
+};
+
+static volatile long ticks_received = 0;
+static volatile long timestamp_gaps = 0;
+static uint64_t last_timestamp = 0;
+static uint32_t last_frames = 0;
+
+static int failures = 0;
+
+static void check(bool success, const char *what)
+{
+	if (!success) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void output_block(obs_source_t *source, uint64_t start_ts,
+			 uint64_t frame)
+{
+	float samples[SOURCE_FRAMES];
+	struct obs_source_audio audio = {0};
+
+	for (size_t i = 0; i < SOURCE_FRAMES; i++)
+		samples[i] = 0.25f * sinf((float)(frame + i) * 440.0f * 2.0f *
+					  3.14159265f / SAMPLE_RATE);
+
+	audio.data[0] = (const uint8_t *)samples;
+	audio.frames = SOURCE_FRAMES;
+	audio.speakers = SPEAKERS_MONO;
+	audio.format = AUDIO_FORMAT_FLOAT;
+	audio.samples_per_sec = SAMPLE_RATE;
+	audio.timestamp = start_ts + audio_frames_to_ns(SAMPLE_RATE, frame);
+	obs_source_output_audio(source, &audio);
+}
+
+static void *source_thread(void *data)
+{
+	struct test_source *ts = data;
+	uint64_t start_ts = os_gettime_ns();
+	uint64_t frame = 0;
+	bool stalled = false;
+
+	while (os_event_try(ts->stop_event) == EAGAIN) {
+		uint64_t now = os_gettime_ns();
+
+		if (!stalled && now - start_ts >= STALL_START_MS * 1000000ULL) {
+			os_sleep_ms(STALL_MS);
+			stalled = true;
+			continue;
+		}
+
+		/* each block is output once all of it is in the past */
+		while (start_ts + audio_frames_to_ns(SAMPLE_RATE,
+						     frame + SOURCE_FRAMES) <=
+		       now) {
+			output_block(ts->source, start_ts, frame);
+			frame += SOURCE_FRAMES;
+		}
+
+		os_sleep_ms(2);
+	}
+
+	return NULL;
+}
+
+static const char *test_source_get_name(void *type_data)
+{
+	UNUSED_PARAMETER(type_data);
+	return "Audio buffering test source";
+}
+
+static void *test_source_create(obs_data_t *settings, obs_source_t *source)
+{
+	struct test_source *ts = bzalloc(sizeof(*ts));
+	ts->source = source;
+
+	if (os_event_init(&ts->stop_event, OS_EVENT_TYPE_MANUAL) != 0 ||
+	    pthread_create(&ts->thread, NULL, source_thread, ts) != 0) {
+		os_event_destroy(ts->stop_event);
+		bfree(ts);
+		return NULL;
+	}
+
+	UNUSED_PARAMETER(settings);
+	return ts;
+}
+
+static void test_source_destroy(void *data)
+{
+	struct test_source *ts = data;
+
+	os_event_signal(ts->stop_event);
+	pthread_join(ts->thread, NULL);
+	os_event_destroy(ts->stop_event);
+	bfree(ts);
+}
+
+static struct obs_source_info test_source_info = {
+	.id = "test_audio_buffering_source",
+	.type = OBS_SOURCE_TYPE_INPUT,
+	.output_flags = OBS_SOURCE_AUDIO,
+	.get_name = test_source_get_name,
+	.create = test_source_create,
+	.destroy = test_source_destroy,
+};
+
+/* runs on the audio thread */
+static void receive_audio(void *param, size_t mix_idx, struct audio_data *data)
+{
+	if (last_frames) {
+		uint64_t expected = last_timestamp +
+				    audio_frames_to_ns(SAMPLE_RATE, last_frames);
+		uint64_t diff = data->timestamp > expected
+					? data->timestamp - expected
+					: expected - data->timestamp;
+
+		/* tick timestamps are rounded to the nanosecond */
+		if (diff > 1000)
+			os_atomic_inc_long(&timestamp_gaps);
+	}
+
+	last_timestamp = data->timestamp;
+	last_frames = data->frames;
+	os_atomic_inc_long(&ticks_received);
+
+	UNUSED_PARAMETER(param);
+	UNUSED_PARAMETER(mix_idx);
+}
+
+int main(void)
+{
+	struct obs_audio_info oai = {SAMPLE_RATE, SPEAKERS_STEREO};
+	struct obs_audio_buffering_info info = {0};
+	obs_source_t *source;
+	uint64_t start;
+	bool reduced = false;
+
+	if (!obs_startup("en-US", NULL, NULL)) {
+		printf("FAIL: obs_startup\n");
+		return 1;
+	}
+
+	if (!obs_reset_audio(&oai)) {
+		printf("FAIL: obs_reset_audio\n");
+		obs_shutdown();
+		return 1;
+	}
+
+	obs_register_source(&test_source_info);
+
+	check(audio_output_connect(obs_get_audio(), 0, NULL, receive_audio,
+				   NULL),
+	      "audio_output_connect");
+	check(audio_output_active(obs_get_audio()), "audio output active");
+
+	source = obs_source_create(test_source_info.id, "test", NULL, NULL);
+	check(source != NULL, "obs_source_create");
+	obs_set_output_source(0, source);
+
+	start = os_gettime_ns();
+	while (source && os_gettime_ns() - start < TIMEOUT_MS * 1000000ULL) {
+		os_sleep_ms(100);
+		obs_get_audio_buffering_info(&info);
+		if (info.increases && info.decreases) {
+			reduced = true;
+			break;
+		}
+	}
+
+	printf("buffering: %u ms now, %u ms peak, %u increases, "
+	       "%u decreases\n",
+	       info.ms, info.max_ms, info.increases, info.decreases);
+	printf("ticks received: %ld, timestamp gaps: %ld\n",
+	       os_atomic_load_long(&ticks_received),
+	       os_atomic_load_long(&timestamp_gaps));
+
+	check(info.increases > 0, "the stall added buffering");
+	check(reduced, "buffering was reduced with an output connected");
+	check(info.ms < info.max_ms, "buffering is below its peak");
+	check(audio_output_active(obs_get_audio()),
+	      "audio output still active");
+	check(os_atomic_load_long(&ticks_received) > 0, "audio was received");
+	check(os_atomic_load_long(&timestamp_gaps) == 0,
+	      "output timestamps are contiguous");
+
+	audio_output_disconnect(obs_get_audio(), 0, receive_audio, NULL);
+	obs_set_output_source(0, NULL);
+	obs_source_release(source);
+	obs_shutdown();
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	else
+		printf("all checks passed\n");
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,279 @@
+/* Checks the block kernels of the audio dynamics filters (dynamics.h) against
+ * the per sample code they replaced, and times both.
+ *
+ * Fails if a kernel strays from log10f/powf by more than the error documented
+ * in dynamics.h, or if the vector and scalar paths of a kernel disagree. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/platform.h>
+
+#include "dynamics.h"
+
+#define BLOCK_FRAMES 1024
+#define BENCH_BLOCKS 20000
+#define SWEEP_COUNT 100000
+
+#define MAX_MUL_TO_DB_ERROR 0.0001
+#define MAX_DB_TO_MUL_ERROR 0.00001
+
+static int failures = 0;
+
+static void check(bool success, const char *what, double value)
+{
+	printf("%-44s %-4s (%g)\n", what, success ? "ok" : "FAIL", value);
+	if (!success)
+		failures++;
+}
+
+/* ------------------------------------------------------------------------- */
+/* the code the kernels replaced */
+
+static inline float ref_mul_to_db(float mul)
+{
+	return (mul == 0.0f) ? -INFINITY : (20.0f * log10f(mul));
+}
+
+static inline float ref_db_to_mul(float db)
+{
+	return isfinite((double)db) ? powf(10.0f, db / 20.0f) : 0.0f;
+}
+
+static void ref_compress(float *buf, size_t count, float threshold,
+			 float slope, float output_gain)
+{
+	for (size_t i = 0; i < count; i++) {
+		const float env_db = ref_mul_to_db(buf[i]);
+		float gain = slope * (threshold - env_db);
+		buf[i] = ref_db_to_mul(fminf(0, gain)) * output_gain;
+	}
+}
+
+static void ref_peak_envelope(float *env_buf, float *const *samples,
+			      size_t channels, size_t frames, float *envelope,
+			      float attack_gain, float release_gain)
+{
+	memset(env_buf, 0, frames * sizeof(float));
+
+	for (size_t c = 0; c < channels; c++) {
+		float env = *envelope;
+
+		for (size_t i = 0; i < frames; i++) {
+			const float env_in = fabsf(samples[c][i]);
+
+			if (env < env_in)
+				env = env_in + attack_gain * (env - env_in);
+			else
+				env = env_in + release_gain * (env - env_in);
+
+			env_buf[i] = fmaxf(env_buf[i], env);
+		}
+	}
+
+	*envelope = env_buf[frames - 1];
+}
+
+/* ------------------------------------------------------------------------- */
+
+static float sweep_in[SWEEP_COUNT];
+static float sweep_out[SWEEP_COUNT];
+
+static void test_mul_to_db(void)
+{
+	double max_error = 0.0;
+	bool same = true;
+
+	/* -200 dB to +40 dB */
+	for (size_t i = 0; i < SWEEP_COUNT; i++)
+		sweep_in[i] = powf(10.0f, (float)i / SWEEP_COUNT * 12.0f - 10.0f);
+
+	dyn_mul_to_db(sweep_out, sweep_in, SWEEP_COUNT);
+
+	for (size_t i = 0; i < SWEEP_COUNT; i++) {
+		double error = fabs(sweep_out[i] - 20.0 * log10(sweep_in[i]));
+		float scalar = dyn_log2(sweep_in[i]) * DYN_DB_PER_LOG2;
+
+		if (error > max_error)
+			max_error = error;
+		if (scalar != sweep_out[i])
+			same = false;
+	}
+
+	check(max_error <= MAX_MUL_TO_DB_ERROR, "dyn_mul_to_db error (dB)",
+	      max_error);
+	check(same, "dyn_mul_to_db vector == scalar", 0.0);
+}
+
+static void test_db_to_mul(void)
+{
+	double max_error = 0.0;
+	bool same = true;
+	float unity;
+
+	/* -130 dB to +30 dB */
+	for (size_t i = 0; i < SWEEP_COUNT; i++)
+		sweep_in[i] = -130.0f + (float)i * (160.0f / SWEEP_COUNT);
+
+	dyn_db_to_mul(sweep_out, sweep_in, SWEEP_COUNT, 1.0f);
+
+	for (size_t i = 0; i < SWEEP_COUNT; i++) {
+		double exact = pow(10.0, sweep_in[i] / 20.0);
+		double error = fabs(20.0 * log10(sweep_out[i] / exact));
+		float scalar = dyn_exp2(sweep_in[i] * DYN_LOG2_PER_DB);
+
+		if (error > max_error)
+			max_error = error;
+		if (scalar != sweep_out[i])
+			same = false;
+	}
+
+	unity = dyn_exp2(0.0f);
+
+	check(max_error <= MAX_DB_TO_MUL_ERROR, "dyn_db_to_mul error (dB)",
+	      max_error);
+	check(same, "dyn_db_to_mul vector == scalar", 0.0);
+	check(unity == 1.0f, "dyn_db_to_mul 0 dB == 1.0", unity);
+}
+
+static void fill_block(float *buf, size_t count, unsigned seed)
+{
+	srand(seed);
+	for (size_t i = 0; i < count; i++)
+		buf[i] = ((float)rand() / RAND_MAX * 2.0f - 1.0f) *
+			 ((i / 256) % 2 ? 1.0f : 0.01f);
+}
+
+static void test_compress_gain(void)
+{
+	float env[BLOCK_FRAMES];
+	float ref[BLOCK_FRAMES];
+	float out[BLOCK_FRAMES];
+	double max_error = 0.0;
+	bool same = true;
+
+	fill_block(env, BLOCK_FRAMES, 1);
+	for (size_t i = 0; i < BLOCK_FRAMES; i++)
+		env[i] = fabsf(env[i]);
+
+	memcpy(ref, env, sizeof(env));
+	memcpy(out, env, sizeof(env));
+	ref_compress(ref, BLOCK_FRAMES, -18.0f, 0.75f, 1.5f);
+	dyn_compress_gain(out, BLOCK_FRAMES, -18.0f, 0.75f, 1.5f);
+
+	for (size_t i = 0; i < BLOCK_FRAMES; i++) {
+		double error = fabs(20.0 * log10((double)out[i] / ref[i]));
+		float db = dyn_log2(env[i]) * DYN_DB_PER_LOG2;
+		float gain = fminf(0.75f * (-18.0f - db), 0.0f);
+		float scalar = dyn_exp2(gain * DYN_LOG2_PER_DB) * 1.5f;
+
+		if (error > max_error)
+			max_error = error;
+		if (scalar != out[i])
+			same = false;
+	}
+
+	check(max_error <= MAX_MUL_TO_DB_ERROR + MAX_DB_TO_MUL_ERROR,
+	      "dyn_compress_gain vs old gain (dB)", max_error);
+	check(same, "dyn_compress_gain vector == scalar", 0.0);
+}
+
+static void test_peak_envelope(void)
+{
+	float left[BLOCK_FRAMES];
+	float right[BLOCK_FRAMES];
+	float *samples[2] = {left, right};
+	float ref[BLOCK_FRAMES];
+	float out[BLOCK_FRAMES];
+	float ref_env = 0.25f;
+	float env = 0.25f;
+	double max_error = 0.0;
+
+	fill_block(left, BLOCK_FRAMES, 2);
+	fill_block(right, BLOCK_FRAMES, 3);
+
+	ref_peak_envelope(ref, samples, 2, BLOCK_FRAMES, &ref_env, 0.9f,
+			  0.999f);
+	dyn_peak_envelope(out, samples, 2, BLOCK_FRAMES, &env, 0.9f, 0.999f);
+
+	for (size_t i = 0; i < BLOCK_FRAMES; i++) {
+		double error = fabs((double)out[i] - ref[i]);
+		if (error > max_error)
+			max_error = error;
+	}
+
+	check(max_error <= 1e-6 && env == out[BLOCK_FRAMES - 1],
+	      "dyn_peak_envelope vs old envelope", max_error);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static float bench_buf[BLOCK_FRAMES];
+static volatile float bench_sink;
+
+static double bench_ns_per_block(void (*run)(float *buf))
+{
+	uint64_t start = os_gettime_ns();
+
+	for (int i = 0; i < BENCH_BLOCKS; i++) {
+		run(bench_buf);
+		bench_sink = bench_buf[i % BLOCK_FRAMES];
+	}
+
+	return (double)(os_gettime_ns() - start) / BENCH_BLOCKS;
+}
+
+static void run_ref_compress(float *buf)
+{
+	fill_block(buf, 16, 4);
+	ref_compress(buf, BLOCK_FRAMES, -18.0f, 0.75f, 1.0f);
+}
+
+static void run_compress(float *buf)
+{
+	fill_block(buf, 16, 4);
+	dyn_compress_gain(buf, BLOCK_FRAMES, -18.0f, 0.75f, 1.0f);
+}
+
+static void run_ref_mul_to_db(float *buf)
+{
+	for (size_t i = 0; i < BLOCK_FRAMES; i++)
+		buf[i] = ref_mul_to_db(fabsf(buf[i]) + 0.001f);
+}
+
+static void run_mul_to_db(float *buf)
+{
+	for (size_t i = 0; i < BLOCK_FRAMES; i++)
+		buf[i] = fabsf(buf[i]) + 0.001f;
+	dyn_mul_to_db(buf, buf, BLOCK_FRAMES);
+}
+
+static void benchmark(void)
+{
+	double before, after;
+
+	fill_block(bench_buf, BLOCK_FRAMES, 5);
+	before = bench_ns_per_block(run_ref_compress);
+	after = bench_ns_per_block(run_compress);
+	printf("compressor gain, %d frames: %.0f ns -> %.0f ns (%.1fx)\n",
+	       BLOCK_FRAMES, before, after, before / after);
+
+	fill_block(bench_buf, BLOCK_FRAMES, 6);
+	before = bench_ns_per_block(run_ref_mul_to_db);
+	after = bench_ns_per_block(run_mul_to_db);
+	printf("mul to dB, %d frames:       %.0f ns -> %.0f ns (%.1fx)\n",
+	       BLOCK_FRAMES, before, after, before / after);
+}
+
+int main(void)
+{
+	test_mul_to_db();
+	test_db_to_mul();
+	test_compress_gain();
+	test_peak_envelope();
+	benchmark();
+
+	if (failures)
+		printf("%d check(s) failed\n", failures);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
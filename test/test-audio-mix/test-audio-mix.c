@@ -0,0 +1,298 @@
+/* Checks the audio mixing kernels (media-io/audio-mix.h) against the scalar
+ * loops they replaced, and times both.
+ *
+ * Sources are set up the way obs-source.c leaves them after a tick: mixes a
+ * source is not assigned to, or that are inactive, are cleared, a muted
+ * source is cleared entirely, and audio_output_mixes is what is left.  The
+ * old code added all six mixes of every source, the new one only the
+ * active mixes in audio_output_mixes.  Every active mix has to come out bit
+ * identical. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <media-io/audio-mix.h>
+
+#define NUM_SOURCES 4
+#define BENCH_SOURCES 10
+#define BENCH_TICKS 2000
+
+struct test_source {
+	float *planes[MAX_AUDIO_MIXES][MAX_AUDIO_CHANNELS];
+	uint32_t output_mixes;
+};
+
+static int failures = 0;
+
+static void check(bool success, const char *what)
+{
+	if (!success) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static inline float random_sample(void)
+{
+	return (float)rand() / RAND_MAX * 2.0f - 1.0f;
+}
+
+static float *alloc_plane(void)
+{
+	return bzalloc(AUDIO_OUTPUT_FRAMES * sizeof(float));
+}
+
+static void init_source(struct test_source *source)
+{
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++)
+			source->planes[mix][ch] = alloc_plane();
+}
+
+static void free_source(struct test_source *source)
+{
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++)
+			bfree(source->planes[mix][ch]);
+}
+
+/* what a tick of obs-source.c leaves in the output buffer of a source */
+static void render_source(struct test_source *source, uint32_t audio_mixers,
+			  uint32_t active_mixers, bool muted)
+{
+	source->output_mixes = muted ? 0 : audio_mixers & active_mixers;
+
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		bool audible = (source->output_mixes & (1 << mix)) != 0;
+
+		for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++) {
+			float *plane = source->planes[mix][ch];
+
+			for (size_t i = 0; i < AUDIO_OUTPUT_FRAMES; i++)
+				plane[i] = audible ? random_sample() : 0.0f;
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* the loops mix_audio and the audio output thread used before */
+
+static void scalar_mix(struct audio_output_data *mixes,
+		       struct test_source *source, size_t channels,
+		       size_t start_point)
+{
+	size_t total_floats = AUDIO_OUTPUT_FRAMES - start_point;
+
+	for (size_t mix_idx = 0; mix_idx < MAX_AUDIO_MIXES; mix_idx++) {
+		for (size_t ch = 0; ch < channels; ch++) {
+			register float *mix = mixes[mix_idx].data[ch];
+			register float *aud = source->planes[mix_idx][ch];
+			register float *end;
+
+			mix += start_point;
+			end = aud + total_floats;
+
+			while (aud < end)
+				*(mix++) += *(aud++);
+		}
+	}
+}
+
+static void scalar_clamp(float *data, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		float val = data[i];
+		val = (val > 1.0f) ? 1.0f : val;
+		val = (val < -1.0f) ? -1.0f : val;
+		data[i] = val;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static struct audio_output_data expected[MAX_AUDIO_MIXES];
+static struct audio_output_data actual[MAX_AUDIO_MIXES];
+
+static void init_mixes(struct audio_output_data *mixes)
+{
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++)
+			mixes[mix].data[ch] = alloc_plane();
+}
+
+static void free_mixes(struct audio_output_data *mixes)
+{
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++)
+		for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++)
+			bfree(mixes[mix].data[ch]);
+}
+
+static void clear_mixes(void)
+{
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		for (size_t ch = 0; ch < MAX_AUDIO_CHANNELS; ch++) {
+			memset(expected[mix].data[ch], 0,
+			       AUDIO_OUTPUT_FRAMES * sizeof(float));
+			memset(actual[mix].data[ch], 0,
+			       AUDIO_OUTPUT_FRAMES * sizeof(float));
+		}
+	}
+}
+
+static bool active_mixes_equal(uint32_t active_mixers, size_t channels)
+{
+	for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
+		if ((active_mixers & (1 << mix)) == 0)
+			continue;
+
+		for (size_t ch = 0; ch < channels; ch++) {
+			if (memcmp(expected[mix].data[ch], actual[mix].data[ch],
+				   AUDIO_OUTPUT_FRAMES * sizeof(float)) != 0)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static void test_mix(void)
+{
+	static const uint32_t assigned[] = {0x3F, 0x01, 0x05, 0x22, 0x00};
+	static const uint32_t active[] = {0x3F, 0x01, 0x03, 0x21};
+	static const size_t channel_counts[] = {1, 2, 6, 8};
+	static const size_t start_points[] = {0, 1, 333, 1023};
+	struct test_source sources[NUM_SOURCES];
+	size_t cases = 0;
+
+	for (size_t i = 0; i < NUM_SOURCES; i++)
+		init_source(&sources[i]);
+
+	for (size_t a = 0; a < sizeof(active) / sizeof(active[0]); a++) {
+		for (size_t c = 0; c < 4; c++) {
+			size_t channels = channel_counts[c];
+
+			clear_mixes();
+
+			for (size_t i = 0; i < NUM_SOURCES; i++) {
+				struct test_source *source = &sources[i];
+				uint32_t mixers = active[a];
+				size_t start = start_points[(i + c) % 4];
+
+				render_source(source,
+					      assigned[(i + a) % 5], mixers,
+					      i == 2);
+
+				scalar_mix(expected, source, channels, start);
+				audio_mix_add_mixes(
+					actual, source->planes,
+					mixers & source->output_mixes,
+					channels, start,
+					AUDIO_OUTPUT_FRAMES - start);
+			}
+
+			check(active_mixes_equal(active[a], channels),
+			      "mix differs from the scalar mix");
+			cases++;
+		}
+	}
+
+	for (size_t i = 0; i < NUM_SOURCES; i++)
+		free_source(&sources[i]);
+
+	printf("mixing: %d cases\n", (int)cases);
+}
+
+static void test_clamp(void)
+{
+	float expected_buf[64];
+	float actual_buf[64];
+
+	for (size_t count = 0; count <= 64; count++) {
+		for (size_t i = 0; i < count; i++)
+			expected_buf[i] = random_sample() * 3.0f;
+		memcpy(actual_buf, expected_buf, count * sizeof(float));
+
+		scalar_clamp(expected_buf, count);
+		audio_mix_clamp(actual_buf, count);
+
+		check(memcmp(expected_buf, actual_buf,
+			     count * sizeof(float)) == 0,
+		      "clamp differs from the scalar clamp");
+	}
+
+	printf("clamping: 65 lengths\n");
+}
+
+/* ------------------------------------------------------------------------- */
+
+static double bench_ticks(struct test_source *sources, uint32_t active_mixers,
+			  bool vector)
+{
+	uint64_t start = os_gettime_ns();
+
+	for (int tick = 0; tick < BENCH_TICKS; tick++) {
+		for (size_t i = 0; i < BENCH_SOURCES; i++) {
+			struct test_source *source = &sources[i];
+
+			if (vector)
+				audio_mix_add_mixes(
+					actual, source->planes,
+					active_mixers & source->output_mixes,
+					2, 0, AUDIO_OUTPUT_FRAMES);
+			else
+				scalar_mix(expected, source, 2, 0);
+		}
+	}
+
+	return (double)(os_gettime_ns() - start) / BENCH_TICKS / 1000.0;
+}
+
+/* ten stereo sources assigned to every track, first with every mix active
+ * (only the kernel differs) and then with one active mix (a single track
+ * stream or recording, where the silent mixes are skipped) */
+static void benchmark(void)
+{
+	struct test_source sources[BENCH_SOURCES];
+	double before, after;
+
+	for (size_t i = 0; i < BENCH_SOURCES; i++) {
+		init_source(&sources[i]);
+		render_source(&sources[i], 0x3F, 0x3F, false);
+	}
+
+	before = bench_ticks(sources, 0x3F, false);
+	after = bench_ticks(sources, 0x3F, true);
+	printf("6 active mixes: %.1f us -> %.1f us per tick (%.1fx)\n", before,
+	       after, before / after);
+
+	for (size_t i = 0; i < BENCH_SOURCES; i++)
+		render_source(&sources[i], 0x3F, 0x01, false);
+
+	before = bench_ticks(sources, 0x01, false);
+	after = bench_ticks(sources, 0x01, true);
+	printf("1 active mix:   %.1f us -> %.1f us per tick (%.1fx)\n", before,
+	       after, before / after);
+
+	for (size_t i = 0; i < BENCH_SOURCES; i++)
+		free_source(&sources[i]);
+}
+
+int main(void)
+{
+	srand(1);
+	init_mixes(expected);
+	init_mixes(actual);
+
+	test_mix();
+	test_clamp();
+	benchmark();
+
+	free_mixes(expected);
+	free_mixes(actual);
+
+	if (failures)
+		printf("%d check(s) failed\n", failures);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
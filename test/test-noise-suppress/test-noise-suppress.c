@@ -0,0 +1,189 @@
+/* Runs the noise suppression filter against a stub speex preprocessor that
+ * halves every sample, so the expected output is known exactly.
+ *
+ * Packets of mixed sizes are fed through the filter, taking both the in
+ * place path (whole 10 ms segments with nothing buffered) and the buffered
+ * path.  With two or more channels the channel worker processes half of the
+ * channels.  Fails if any channel comes out wrong, out of order, or if the
+ * reported latency does not account for every buffered frame. */
+
+#include "noise-suppress-filter.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SAMPLE_RATE 48000
+#define NUM_PACKETS 400
+
+/* ------------------------------------------------------------------------- */
+/* stub speex preprocessor */
+
+struct SpeexPreprocessState_ {
+	int frame_size;
+	int level;
+};
+
+SpeexPreprocessState *speex_preprocess_state_init(int frame_size,
+						  int sampling_rate)
+{
+	SpeexPreprocessState *st = bzalloc(sizeof(*st));
+	st->frame_size = frame_size;
+	UNUSED_PARAMETER(sampling_rate);
+	return st;
+}
+
+void speex_preprocess_state_destroy(SpeexPreprocessState *st)
+{
+	bfree(st);
+}
+
+int speex_preprocess_run(SpeexPreprocessState *st, spx_int16_t *x)
+{
+	for (int i = 0; i < st->frame_size; i++)
+		x[i] = (spx_int16_t)(x[i] / 2);
+	return 0;
+}
+
+int speex_preprocess_ctl(SpeexPreprocessState *st, int request, void *ptr)
+{
+	if (request == SPEEX_PREPROCESS_SET_NOISE_SUPPRESS)
+		st->level = *(int *)ptr;
+	return 0;
+}
+
+const char *obs_module_text(const char *val)
+{
+	return val;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline float input_sample(size_t channel, size_t frame)
+{
+	return (float)((int)((frame * 7 + channel * 1000) % 20000) - 10000) /
+	       32768.0f;
+}
+
+static inline float expected_sample(size_t channel, size_t frame)
+{
+	float s = input_sample(channel, frame);
+	spx_int16_t v = (spx_int16_t)(s * c_32_to_16);
+	return (float)(v / 2) / c_16_to_32;
+}
+
+/* the parts of noise_suppress_update that need a running audio output */
+static struct noise_suppress_data *create_filter(size_t channels)
+{
+	struct noise_suppress_data *ng = bzalloc(sizeof(*ng));
+
+	ng->backend = &speex_backend;
+	ng->applied_level = SUP_MAX + 1;
+	ng->suppress_level = -30;
+	ng->frames = ng->backend->frame_size(SAMPLE_RATE);
+	ng->channels = channels;
+	ng->sample_rate = SAMPLE_RATE;
+
+	reserve_copy_frames(ng, ng->frames);
+	for (size_t i = 0; i < channels; i++)
+		alloc_channel(ng, SAMPLE_RATE, i, ng->frames);
+
+	start_channel_worker(ng);
+	return ng;
+}
+
+static bool run(size_t channels)
+{
+	static const uint32_t sizes[] = {960, 480, 1024, 1024, 300,
+					 480, 960, 1024, 2400, 7};
+	struct noise_suppress_data *ng = create_filter(channels);
+	float *planes[MAX_PREPROC_CHANNELS];
+	size_t in_frames = 0;
+	size_t out_frames = 0;
+	size_t in_place = 0;
+	size_t buffered = 0;
+	uint64_t timestamp = 1000;
+	uint64_t last_out_ts = 0;
+	bool success = true;
+
+	for (size_t c = 0; c < channels; c++)
+		planes[c] = bmalloc(2400 * sizeof(float));
+
+	for (size_t p = 0; p < NUM_PACKETS && success; p++) {
+		struct obs_audio_data audio = {0};
+		struct obs_audio_data *out;
+		uint32_t frames = sizes[p % (sizeof(sizes) / sizeof(sizes[0]))];
+
+		for (size_t c = 0; c < channels; c++) {
+			for (size_t i = 0; i < frames; i++)
+				planes[c][i] = input_sample(c, in_frames + i);
+			audio.data[c] = (uint8_t *)planes[c];
+		}
+
+		audio.frames = frames;
+		audio.timestamp = timestamp;
+		timestamp += 1000000;
+		in_frames += frames;
+
+		out = noise_suppress_filter_audio(ng, &audio);
+		if (out == &audio)
+			in_place++;
+		else
+			buffered++;
+
+		if (out) {
+			if (out->timestamp <= last_out_ts)
+				success = false;
+			last_out_ts = out->timestamp;
+
+			for (size_t c = 0; c < channels; c++) {
+				const float *data = (const float *)out->data[c];
+
+				for (size_t i = 0; i < out->frames; i++) {
+					float expect = expected_sample(
+						c, out_frames + i);
+					if (data[i] != expect)
+						success = false;
+				}
+			}
+
+			out_frames += out->frames;
+		}
+
+		if (out_frames + (size_t)ng->latency_frames != in_frames)
+			success = false;
+	}
+
+	for (size_t c = 0; c < channels; c++) {
+		struct speex_state *state = ng->states[c];
+		if (state->st->level != -30)
+			success = false;
+	}
+
+	/* both paths have to be covered */
+	if (!in_place || !buffered)
+		success = false;
+
+	printf("%d channel(s), worker %s: %d frames in, %d out, %d packets "
+	       "in place, %d buffered: %s\n",
+	       (int)channels, ng->worker.active ? "on" : "off",
+	       (int)in_frames, (int)out_frames, (int)in_place, (int)buffered,
+	       success ? "ok" : "FAIL");
+
+	for (size_t c = 0; c < channels; c++)
+		bfree(planes[c]);
+	noise_suppress_destroy(ng);
+	return success;
+}
+
+int main(void)
+{
+	static const size_t channel_counts[] = {1, 2, 6};
+	int failures = 0;
+
+	for (size_t i = 0; i < 3; i++) {
+		if (!run(channel_counts[i]))
+			failures++;
+	}
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
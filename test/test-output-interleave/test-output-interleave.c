@@ -0,0 +1,231 @@
+/* Benchmarks the per-track interleave queues of obs-output.c against the
+ * single sorted array they replaced.
+ *
+ * Both get the same stream: one video track and two audio tracks, each in
+ * dts order but arriving with a per-track delay and jitter, and release the
+ * earliest packet whenever more than a given number are buffered.  Fails if
+ * the two ever release packets in a different order. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <util/platform.h>
+#include <obs-interleave.h>
+
+#define NUM_PACKETS 200000
+#define NUM_AUDIO_TRACKS 2
+#define VIDEO_INTERVAL 16667
+#define AUDIO_INTERVAL 21333
+
+struct arrival {
+	int64_t arrive_usec;
+	struct encoder_packet packet;
+};
+
+static struct arrival *stream;
+static size_t stream_size;
+
+static int compare_arrival(const void *a, const void *b)
+{
+	const struct arrival *x = a;
+	const struct arrival *y = b;
+
+	if (x->arrive_usec != y->arrive_usec)
+		return x->arrive_usec < y->arrive_usec ? -1 : 1;
+	return x->packet.dts_usec < y->packet.dts_usec ? -1 : 1;
+}
+
+/* tracks arrive in order, but a track can be up to 50ms behind the others */
+static void add_track(enum obs_encoder_type type, size_t track_idx,
+		      int64_t interval, int64_t delay, size_t count)
+{
+	int64_t last_arrival = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		struct arrival *arrival = &stream[stream_size++];
+		int64_t dts = (int64_t)i * interval;
+		int64_t arrive = dts + delay + rand() % 30000;
+
+		if (arrive <= last_arrival)
+			arrive = last_arrival + 1;
+		last_arrival = arrive;
+
+		memset(arrival, 0, sizeof(*arrival));
+		arrival->arrive_usec = arrive;
+		arrival->packet.type = type;
+		arrival->packet.track_idx = track_idx;
+		arrival->packet.dts_usec = dts;
+	}
+}
+
+static void build_stream(void)
+{
+	size_t video = NUM_PACKETS * 4 / 10;
+	size_t audio = (NUM_PACKETS - video) / NUM_AUDIO_TRACKS;
+
+	srand(1);
+	stream = bzalloc(sizeof(*stream) * NUM_PACKETS);
+
+	add_track(OBS_ENCODER_VIDEO, 0, VIDEO_INTERVAL, 20000, video);
+	for (size_t i = 0; i < NUM_AUDIO_TRACKS; i++)
+		add_track(OBS_ENCODER_AUDIO, i, AUDIO_INTERVAL, i * 10000,
+			  audio);
+
+	qsort(stream, stream_size, sizeof(*stream), compare_arrival);
+}
+
+/* ------------------------------------------------------------------------- */
+/* the sorted array interleave_packets used before */
+
+static DARRAY(struct encoder_packet) sorted;
+
+static void sorted_insert(struct encoder_packet *out)
+{
+	size_t idx;
+	for (idx = 0; idx < sorted.num; idx++) {
+		struct encoder_packet *cur_packet = sorted.array + idx;
+
+		if (out->dts_usec == cur_packet->dts_usec &&
+		    out->type == OBS_ENCODER_VIDEO) {
+			break;
+		} else if (out->dts_usec < cur_packet->dts_usec) {
+			break;
+		}
+	}
+
+	da_insert(sorted, idx, out);
+}
+
+static size_t sorted_size(void)
+{
+	return sorted.num;
+}
+
+static void sorted_pop(struct encoder_packet *out)
+{
+	*out = sorted.array[0];
+	da_erase(sorted, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+/* the per-track queues */
+
+static struct interleave_queue video_queue;
+static struct interleave_queue audio_queues[MAX_AUDIO_MIXES];
+static uint64_t seq;
+static size_t queued;
+
+static void queues_insert(struct encoder_packet *out)
+{
+	struct interleave_queue *queue = &video_queue;
+	struct interleaved_packet packet = {*out, seq++};
+
+	if (out->type == OBS_ENCODER_AUDIO)
+		queue = &audio_queues[out->track_idx];
+
+	interleave_queue_insert(queue, &packet);
+	queued++;
+}
+
+static size_t queues_size(void)
+{
+	return queued;
+}
+
+static void queues_pop(struct encoder_packet *out)
+{
+	struct interleave_queue *queue =
+		interleave_next_queue(&video_queue, audio_queues);
+
+	*out = interleave_queue_first(queue)->packet;
+	interleave_queue_pop(queue);
+	queued--;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct method {
+	const char *name;
+	void (*insert)(struct encoder_packet *out);
+	size_t (*size)(void);
+	void (*pop)(struct encoder_packet *out);
+};
+
+static const struct method methods[] = {
+	{"sorted array", sorted_insert, sorted_size, sorted_pop},
+	{"track queues", queues_insert, queues_size, queues_pop},
+};
+
+static struct encoder_packet *released[2];
+
+static double run(const struct method *method, size_t depth,
+		  struct encoder_packet *out)
+{
+	uint64_t start = os_gettime_ns();
+	size_t count = 0;
+
+	for (size_t i = 0; i < stream_size; i++) {
+		method->insert(&stream[i].packet);
+		while (method->size() > depth)
+			method->pop(&out[count++]);
+	}
+
+	while (method->size())
+		method->pop(&out[count++]);
+
+	return (double)(os_gettime_ns() - start) / stream_size;
+}
+
+static bool same_packet(const struct encoder_packet *a,
+			const struct encoder_packet *b)
+{
+	return a->type == b->type && a->track_idx == b->track_idx &&
+	       a->dts_usec == b->dts_usec;
+}
+
+int main(void)
+{
+	static const size_t depths[] = {16, 128, 1024};
+	int failures = 0;
+
+	build_stream();
+
+	for (size_t i = 0; i < 2; i++)
+		released[i] = bzalloc(sizeof(struct encoder_packet) *
+				      stream_size);
+
+	for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+		double ns[2];
+		size_t mismatch = stream_size;
+
+		for (size_t m = 0; m < 2; m++)
+			ns[m] = run(&methods[m], depths[d], released[m]);
+
+		for (size_t i = 0; i < stream_size; i++) {
+			if (!same_packet(&released[0][i], &released[1][i])) {
+				mismatch = i;
+				break;
+			}
+		}
+
+		printf("depth %4d: %s %.0f ns/packet, %s %.0f ns/packet (%.1fx)"
+		       " %s\n",
+		       (int)depths[d], methods[0].name, ns[0], methods[1].name,
+		       ns[1], ns[0] / ns[1],
+		       mismatch == stream_size ? "ok" : "FAIL");
+
+		if (mismatch != stream_size) {
+			printf("order differs at packet %d\n", (int)mismatch);
+			failures++;
+		}
+	}
+
+	da_free(sorted);
+	interleave_queue_free(&video_queue);
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++)
+		interleave_queue_free(&audio_queues[i]);
+	for (size_t i = 0; i < 2; i++)
+		bfree(released[i]);
+	bfree(stream);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}